@@ -0,0 +1,333 @@
+#include "analysis_codec.h"
+#include "content_analyzer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define VARINT_MAX_BYTES 10
+
+// Growable output buffer
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} encoder_t;
+
+static int reserve(encoder_t *enc, size_t extra) {
+    if (enc->len + extra <= enc->cap) {
+        return 0;
+    }
+    size_t cap = enc->cap ? enc->cap : 256;
+    while (cap < enc->len + extra) cap *= 2;
+    uint8_t *grown = realloc(enc->data, cap);
+    if (!grown) {
+        return -1;
+    }
+    enc->data = grown;
+    enc->cap = cap;
+    return 0;
+}
+
+static int put_varint(encoder_t *enc, uint64_t value) {
+    if (reserve(enc, VARINT_MAX_BYTES) != 0) {
+        return -1;
+    }
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        enc->data[enc->len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return 0;
+}
+
+static int put_bytes(encoder_t *enc, const void *data, size_t len) {
+    if (reserve(enc, len) != 0) {
+        return -1;
+    }
+    memcpy(enc->data + enc->len, data, len);
+    enc->len += len;
+    return 0;
+}
+
+static int put_string(encoder_t *enc, const char *str) {
+    size_t len = strlen(str);
+    return put_varint(enc, len) == 0 && put_bytes(enc, str, len) == 0 ? 0 : -1;
+}
+
+static int get_varint(const uint8_t **pos, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        uint8_t byte = *(*pos)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_slice(const uint8_t **pos, const uint8_t *end, analysis_str_t *out) {
+    uint64_t len;
+    if (get_varint(pos, end, &len) != 0 || len > (uint64_t)(end - *pos)) {
+        return -1;
+    }
+    out->ptr = (const char *)*pos;
+    out->len = len;
+    *pos += len;
+    return 0;
+}
+
+// Index of str in the table, adding it if new; lists are short, so a
+// linear scan is cheaper than hashing
+static int intern_string(const char ***table, size_t *count, size_t *cap, const char *str) {
+    for (size_t i = 0; i < *count; i++) {
+        if (strcmp((*table)[i], str) == 0) {
+            return (int)i;
+        }
+    }
+    if (*count == *cap) {
+        size_t grown_cap = *cap ? *cap * 2 : 16;
+        const char **grown = realloc(*table, grown_cap * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        *table = grown;
+        *cap = grown_cap;
+    }
+    (*table)[*count] = str;
+    return (int)(*count)++;
+}
+
+// Encode an analysis
+int analysis_encode(const content_analysis_t *analysis, time_t timestamp,
+                    char **out, size_t *out_len) {
+    if (!analysis || !out || !out_len) {
+        return -1;
+    }
+
+    const char *fields[ANALYSIS_STRING_FIELDS] = {
+        analysis->title, analysis->description, analysis->keywords, analysis->author,
+        analysis->publish_date, analysis->main_content, analysis->language
+    };
+    char **lists[ANALYSIS_LISTS] = {analysis->topics, analysis->entities, analysis->categories};
+    int counts[ANALYSIS_LISTS] = {analysis->topic_count, analysis->entity_count,
+                                  analysis->category_count};
+
+    // Build the shared string table and the per-list indexes
+    const char **table = NULL;
+    size_t table_count = 0, table_cap = 0;
+    int total = counts[0] + counts[1] + counts[2];
+    int *indexes = total > 0 ? malloc(total * sizeof(int)) : NULL;
+    if (total > 0 && !indexes) {
+        return -1;
+    }
+    int n = 0;
+    for (int l = 0; l < ANALYSIS_LISTS; l++) {
+        for (int i = 0; i < counts[l]; i++) {
+            int idx = intern_string(&table, &table_count, &table_cap,
+                                    lists[l][i] ? lists[l][i] : "");
+            if (idx < 0) {
+                free(indexes);
+                free(table);
+                return -1;
+            }
+            indexes[n++] = idx;
+        }
+    }
+
+    encoder_t enc = {0};
+    uint64_t mask = 0;
+    for (int f = 0; f < ANALYSIS_STRING_FIELDS; f++) {
+        if (fields[f]) mask |= 1u << f;
+    }
+
+    // Sentiment is stored bit-exact rather than through text
+    uint32_t bits;
+    memcpy(&bits, &analysis->sentiment_score, sizeof(bits));
+    uint8_t sentiment[4] = {bits & 0xFF, (bits >> 8) & 0xFF, (bits >> 16) & 0xFF, bits >> 24};
+    uint8_t header[2] = {ANALYSIS_CODEC_MAGIC, ANALYSIS_CODEC_VERSION};
+
+    int failed = put_bytes(&enc, header, sizeof(header)) != 0 ||
+                 put_varint(&enc, mask) != 0 ||
+                 put_bytes(&enc, sentiment, sizeof(sentiment)) != 0 ||
+                 put_varint(&enc, timestamp > 0 ? (uint64_t)timestamp : 0) != 0;
+    for (int f = 0; f < ANALYSIS_STRING_FIELDS && !failed; f++) {
+        if (fields[f]) failed = put_string(&enc, fields[f]) != 0;
+    }
+    failed = failed || put_varint(&enc, table_count) != 0;
+    for (size_t i = 0; i < table_count && !failed; i++) {
+        failed = put_string(&enc, table[i]) != 0;
+    }
+    n = 0;
+    for (int l = 0; l < ANALYSIS_LISTS && !failed; l++) {
+        failed = put_varint(&enc, counts[l] > 0 ? counts[l] : 0) != 0;
+        for (int i = 0; i < counts[l] && !failed; i++) {
+            failed = put_varint(&enc, indexes[n++]) != 0;
+        }
+    }
+
+    free(indexes);
+    free(table);
+    if (failed) {
+        free(enc.data);
+        return -1;
+    }
+    *out = (char *)enc.data;
+    *out_len = enc.len;
+    return 0;
+}
+
+// Whether a stored value looks like an encoded analysis
+int analysis_is_encoded(const char *buf, size_t len) {
+    return buf && len >= 2 && (uint8_t)buf[0] == ANALYSIS_CODEC_MAGIC;
+}
+
+// Parse an encoded analysis without copying its strings
+int analysis_view_init(analysis_view_t *view, const char *buf, size_t len) {
+    memset(view, 0, sizeof(*view));
+    if (!analysis_is_encoded(buf, len) || (uint8_t)buf[1] != ANALYSIS_CODEC_VERSION) {
+        return -1;
+    }
+
+    const uint8_t *pos = (const uint8_t *)buf + 2;
+    const uint8_t *end = (const uint8_t *)buf + len;
+    view->version = (uint8_t)buf[1];
+    view->end = end;
+
+    uint64_t mask, timestamp, count;
+    if (get_varint(&pos, end, &mask) != 0 || end - pos < 4) {
+        return -1;
+    }
+    uint32_t bits = (uint32_t)pos[0] | (uint32_t)pos[1] << 8 | (uint32_t)pos[2] << 16 |
+                    (uint32_t)pos[3] << 24;
+    memcpy(&view->sentiment_score, &bits, sizeof(bits));
+    pos += 4;
+    if (get_varint(&pos, end, &timestamp) != 0) {
+        return -1;
+    }
+    view->timestamp = (time_t)timestamp;
+
+    for (int f = 0; f < ANALYSIS_STRING_FIELDS; f++) {
+        if ((mask & (1u << f)) && get_slice(&pos, end, &view->fields[f]) != 0) {
+            return -1;
+        }
+    }
+
+    // Each table entry takes at least one byte, which bounds the count
+    if (get_varint(&pos, end, &count) != 0 || count > (uint64_t)(end - pos)) {
+        return -1;
+    }
+    view->table = view->inline_table;
+    if (count > ANALYSIS_VIEW_INLINE_TABLE) {
+        view->table = malloc(count * sizeof(analysis_str_t));
+        if (!view->table) {
+            return -1;
+        }
+    }
+    view->table_count = count;
+    for (size_t i = 0; i < count; i++) {
+        if (get_slice(&pos, end, &view->table[i]) != 0) {
+            analysis_view_release(view);
+            return -1;
+        }
+    }
+
+    // Record where each index list starts, validating indexes on the way
+    for (int l = 0; l < ANALYSIS_LISTS; l++) {
+        if (get_varint(&pos, end, &count) != 0 || count > (uint64_t)(end - pos)) {
+            analysis_view_release(view);
+            return -1;
+        }
+        view->lists[l] = pos;
+        view->list_counts[l] = count;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t idx;
+            if (get_varint(&pos, end, &idx) != 0 || idx >= view->table_count) {
+                analysis_view_release(view);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Release anything analysis_view_init() had to allocate
+void analysis_view_release(analysis_view_t *view) {
+    if (view->table && view->table != view->inline_table) {
+        free(view->table);
+    }
+    view->table = NULL;
+    view->table_count = 0;
+}
+
+// Start iterating over a list of the view
+void analysis_view_list(const analysis_view_t *view, analysis_list_t list,
+                        analysis_list_iter_t *it) {
+    it->pos = view->lists[list];
+    it->remaining = view->list_counts[list];
+}
+
+// Fetch the next item of a list
+int analysis_list_next(const analysis_view_t *view, analysis_list_iter_t *it,
+                       analysis_str_t *item) {
+    uint64_t idx;
+    if (it->remaining == 0 || get_varint(&it->pos, view->end, &idx) != 0 ||
+        idx >= view->table_count) {
+        return 0;
+    }
+    it->remaining--;
+    *item = view->table[idx];
+    return 1;
+}
+
+static char *copy_slice(analysis_str_t str) {
+    return str.ptr ? strndup(str.ptr, str.len) : NULL;
+}
+
+// Decode into a newly allocated content_analysis_t
+content_analysis_t *analysis_decode(const char *buf, size_t len) {
+    analysis_view_t view;
+    if (analysis_view_init(&view, buf, len) != 0) {
+        return NULL;
+    }
+
+    content_analysis_t *analysis = calloc(1, sizeof(content_analysis_t));
+    if (!analysis) {
+        analysis_view_release(&view);
+        return NULL;
+    }
+
+    analysis->title = copy_slice(view.fields[ANALYSIS_FIELD_TITLE]);
+    analysis->description = copy_slice(view.fields[ANALYSIS_FIELD_DESCRIPTION]);
+    analysis->keywords = copy_slice(view.fields[ANALYSIS_FIELD_KEYWORDS]);
+    analysis->author = copy_slice(view.fields[ANALYSIS_FIELD_AUTHOR]);
+    analysis->publish_date = copy_slice(view.fields[ANALYSIS_FIELD_PUBLISH_DATE]);
+    analysis->main_content = copy_slice(view.fields[ANALYSIS_FIELD_MAIN_CONTENT]);
+    analysis->language = copy_slice(view.fields[ANALYSIS_FIELD_LANGUAGE]);
+    analysis->sentiment_score = view.sentiment_score;
+
+    char ***lists[ANALYSIS_LISTS] = {&analysis->topics, &analysis->entities,
+                                     &analysis->categories};
+    int *counts[ANALYSIS_LISTS] = {&analysis->topic_count, &analysis->entity_count,
+                                   &analysis->category_count};
+    for (int l = 0; l < ANALYSIS_LISTS; l++) {
+        if (view.list_counts[l] == 0) {
+            continue;
+        }
+        *lists[l] = calloc(view.list_counts[l], sizeof(char *));
+        if (!*lists[l]) {
+            break;
+        }
+        analysis_list_iter_t it;
+        analysis_str_t item;
+        analysis_view_list(&view, l, &it);
+        while (analysis_list_next(&view, &it, &item)) {
+            char *copy = copy_slice(item);
+            if (!copy) break;
+            (*lists[l])[(*counts[l])++] = copy;
+        }
+    }
+
+    analysis_view_release(&view);
+    return analysis;
+}
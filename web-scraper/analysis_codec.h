@@ -0,0 +1,99 @@
+#ifndef ANALYSIS_CODEC_H
+#define ANALYSIS_CODEC_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Binary encoding of content_analysis_t, stored as a single Redis value
+//
+// Layout (version 1), integers are unsigned LEB128 varints:
+//   magic byte, version byte, varint field mask, sentiment (4-byte IEEE
+//   float, little endian), varint timestamp,
+//   for each string field in the mask: varint length + bytes,
+//   string table: varint count, then varint length + bytes per entry,
+//   topics, entities, categories: varint count + varint table index each.
+// Topics, entities and categories share the string table, so a value that
+// appears in several lists is stored once.
+
+#define ANALYSIS_CODEC_MAGIC 0xA7
+#define ANALYSIS_CODEC_VERSION 1
+#define ANALYSIS_VIEW_INLINE_TABLE 64  // Table entries held without allocating
+
+// String fields, in encoding order
+typedef enum {
+    ANALYSIS_FIELD_TITLE,
+    ANALYSIS_FIELD_DESCRIPTION,
+    ANALYSIS_FIELD_KEYWORDS,
+    ANALYSIS_FIELD_AUTHOR,
+    ANALYSIS_FIELD_PUBLISH_DATE,
+    ANALYSIS_FIELD_MAIN_CONTENT,
+    ANALYSIS_FIELD_LANGUAGE,
+    ANALYSIS_STRING_FIELDS
+} analysis_field_t;
+
+typedef enum {
+    ANALYSIS_LIST_TOPICS,
+    ANALYSIS_LIST_ENTITIES,
+    ANALYSIS_LIST_CATEGORIES,
+    ANALYSIS_LISTS
+} analysis_list_t;
+
+// Slice of an encoded buffer; not NUL-terminated
+typedef struct {
+    const char *ptr;
+    size_t len;
+} analysis_str_t;
+
+// Zero-copy view of an encoded analysis
+// Strings point into the buffer passed to analysis_view_init(), which must
+// outlive the view
+typedef struct {
+    uint8_t version;
+    float sentiment_score;
+    time_t timestamp;
+    analysis_str_t fields[ANALYSIS_STRING_FIELDS];  // ptr is NULL when absent
+    analysis_str_t *table;
+    size_t table_count;
+    analysis_str_t inline_table[ANALYSIS_VIEW_INLINE_TABLE];
+    const uint8_t *lists[ANALYSIS_LISTS];           // Start of each index list
+    size_t list_counts[ANALYSIS_LISTS];
+    const uint8_t *end;
+} analysis_view_t;
+
+// Iterator over one list of a view
+typedef struct {
+    const uint8_t *pos;
+    size_t remaining;
+} analysis_list_iter_t;
+
+// Encode an analysis; *out is malloc'd and must be freed by the caller
+// Returns 0 on success, -1 on failure
+int analysis_encode(const content_analysis_t *analysis, time_t timestamp,
+                    char **out, size_t *out_len);
+
+// Whether a stored value looks like an encoded analysis
+int analysis_is_encoded(const char *buf, size_t len);
+
+// Parse an encoded analysis without copying its strings
+// Returns 0 on success, -1 if the buffer is malformed or of an unknown version
+int analysis_view_init(analysis_view_t *view, const char *buf, size_t len);
+
+// Release anything analysis_view_init() had to allocate
+void analysis_view_release(analysis_view_t *view);
+
+// Start iterating over a list of the view
+void analysis_view_list(const analysis_view_t *view, analysis_list_t list,
+                        analysis_list_iter_t *it);
+
+// Fetch the next item of a list
+// Returns 1 and fills *item while items remain, 0 at the end
+int analysis_list_next(const analysis_view_t *view, analysis_list_iter_t *it,
+                       analysis_str_t *item);
+
+// Decode into a newly allocated content_analysis_t
+// Caller frees it with free_content_analysis()
+content_analysis_t *analysis_decode(const char *buf, size_t len);
+
+#endif // ANALYSIS_CODEC_H
@@ -0,0 +1,585 @@
+#include "async_redis.h"
+#include "cache.h"
+#include "frontier.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include "shard_router.h"
+#include "visited_store.h"
+#include <errno.h>
+#include <hiredis/async.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 16
+
+// Queued command, owned by the loop once submitted
+typedef struct async_request {
+    struct async_request *next;
+    char *cmd;
+    size_t len;
+    async_redis_callback_fn cb;
+    void *privdata;
+} async_request_t;
+
+struct redis_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    redisReply *reply;
+};
+
+// Submission queue
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static async_request_t *queue_head = NULL;
+static async_request_t *queue_tail = NULL;
+static int running = 0;
+static int stopping = 0;
+
+// Owned by the loop thread
+static pthread_t loop_thread;
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static redisAsyncContext *async_ctx = NULL;
+static int redis_fd = -1;
+static uint32_t redis_events = 0;
+static int disconnect_sent = 0;
+static int reconnect_delay_ms = 0;
+static long long reconnect_at_ms = 0;   // No connect attempt before this time
+static char *loop_host = NULL;
+static int loop_port = 0;
+
+// Deep-copy a reply so it can outlive the hiredis callback
+static redisReply *clone_reply(const redisReply *reply) {
+    redisReply *copy = calloc(1, sizeof(redisReply));
+    if (!copy) {
+        return NULL;
+    }
+    *copy = *reply;
+    copy->str = NULL;
+    copy->element = NULL;
+    copy->elements = 0;
+
+    if (reply->str) {
+        copy->str = malloc(reply->len + 1);
+        if (!copy->str) {
+            free(copy);
+            return NULL;
+        }
+        memcpy(copy->str, reply->str, reply->len);
+        copy->str[reply->len] = '\0';
+    }
+    if (reply->element && reply->elements > 0) {
+        copy->element = calloc(reply->elements, sizeof(redisReply *));
+        if (!copy->element) {
+            freeReplyObject(copy);
+            return NULL;
+        }
+        copy->elements = reply->elements;
+        for (size_t i = 0; i < reply->elements; i++) {
+            copy->element[i] = reply->element[i] ? clone_reply(reply->element[i]) : NULL;
+            if (reply->element[i] && !copy->element[i]) {
+                freeReplyObject(copy);
+                return NULL;
+            }
+        }
+    }
+    return copy;
+}
+
+// epoll adapter for hiredis
+static void update_events(uint32_t events) {
+    if (redis_fd < 0 || events == redis_events) {
+        return;
+    }
+    struct epoll_event ev = {.events = events, .data.fd = redis_fd};
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, redis_fd, &ev);
+    redis_events = events;
+}
+
+static void add_read(void *privdata) {
+    (void)privdata;
+    update_events(redis_events | EPOLLIN);
+}
+
+static void del_read(void *privdata) {
+    (void)privdata;
+    update_events(redis_events & ~EPOLLIN);
+}
+
+static void add_write(void *privdata) {
+    (void)privdata;
+    update_events(redis_events | EPOLLOUT);
+}
+
+static void del_write(void *privdata) {
+    (void)privdata;
+    update_events(redis_events & ~EPOLLOUT);
+}
+
+static void cleanup_events(void *privdata) {
+    (void)privdata;
+    if (redis_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, redis_fd, NULL);
+    }
+    redis_fd = -1;
+    redis_events = 0;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Double the reconnect delay, within bounds, and schedule the next attempt
+static void back_off(void) {
+    reconnect_delay_ms = reconnect_delay_ms ? reconnect_delay_ms * 2 : ASYNC_REDIS_RECONNECT_MIN_MS;
+    if (reconnect_delay_ms > ASYNC_REDIS_RECONNECT_MAX_MS) {
+        reconnect_delay_ms = ASYNC_REDIS_RECONNECT_MAX_MS;
+    }
+    reconnect_at_ms = now_ms() + reconnect_delay_ms;
+}
+
+static void on_connect(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK) {
+        // hiredis frees the context after this returns without calling
+        // on_disconnect, so forget it here and retry after the backoff
+        LOG_WARNING("Async Redis connection failed: %s", ac->errstr ? ac->errstr : "unknown");
+        async_ctx = NULL;
+        disconnect_sent = 0;
+        back_off();
+        return;
+    }
+    reconnect_delay_ms = 0;
+    reconnect_at_ms = 0;
+    LOG_INFO("Async Redis connection established");
+}
+
+static void on_disconnect(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK) {
+        LOG_WARNING("Async Redis connection lost: %s", ac->errstr ? ac->errstr : "unknown");
+        back_off();
+    }
+    async_ctx = NULL;
+    disconnect_sent = 0;
+}
+
+static int connect_async(void) {
+    redisAsyncContext *ac = redisAsyncConnect(loop_host, loop_port);
+    if (!ac || ac->err) {
+        LOG_WARNING("Async Redis connect failed: %s", ac ? ac->errstr : "out of memory");
+        if (ac) redisAsyncFree(ac);
+        back_off();
+        return -1;
+    }
+
+    redis_fd = ac->c.fd;
+    redis_events = 0;
+    struct epoll_event ev = {.events = 0, .data.fd = redis_fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, redis_fd, &ev) != 0) {
+        redis_fd = -1;
+        redisAsyncFree(ac);
+        back_off();
+        return -1;
+    }
+
+    ac->ev.data = NULL;
+    ac->ev.addRead = add_read;
+    ac->ev.delRead = del_read;
+    ac->ev.addWrite = add_write;
+    ac->ev.delWrite = del_write;
+    ac->ev.cleanup = cleanup_events;
+    ac->ev.scheduleTimer = NULL;
+    redisAsyncSetConnectCallback(ac, on_connect);
+    redisAsyncSetDisconnectCallback(ac, on_disconnect);
+    async_ctx = ac;
+    return 0;
+}
+
+static void free_request(async_request_t *req) {
+    redisFreeCommand(req->cmd);
+    free(req);
+}
+
+static void on_reply(redisAsyncContext *ac, void *reply, void *privdata) {
+    (void)ac;
+    async_request_t *req = privdata;
+    req->cb((redisReply *)reply, req->privdata);
+    free_request(req);
+}
+
+// Issue everything in the submission queue; hiredis coalesces the writes
+static void issue_queued(void) {
+    pthread_mutex_lock(&queue_mutex);
+    async_request_t *req = queue_head;
+    queue_head = queue_tail = NULL;
+    pthread_mutex_unlock(&queue_mutex);
+
+    while (req) {
+        async_request_t *next = req->next;
+        if (!async_ctx ||
+            redisAsyncFormattedCommand(async_ctx, on_reply, req, req->cmd, req->len) != REDIS_OK) {
+            req->cb(NULL, req->privdata);
+            free_request(req);
+        }
+        req = next;
+    }
+}
+
+static void *loop_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    for (;;) {
+        pthread_mutex_lock(&queue_mutex);
+        int stop = stopping;
+        int queued = queue_head != NULL;
+        pthread_mutex_unlock(&queue_mutex);
+
+        if (!async_ctx && !stop && queued && now_ms() >= reconnect_at_ms) {
+            connect_async();
+        }
+        if (queued) {
+            issue_queued();
+        }
+        if (stop) {
+            // Let outstanding replies arrive, then close
+            if (!async_ctx) {
+                break;
+            }
+            if (!disconnect_sent) {
+                disconnect_sent = 1;
+                redisAsyncDisconnect(async_ctx);
+                continue;
+            }
+        }
+
+        // Wait indefinitely when connected; otherwise until the next attempt is due
+        int timeout = -1;
+        if (!async_ctx && reconnect_delay_ms) {
+            long long wait = reconnect_at_ms - now_ms();
+            timeout = wait > 0 ? (int)wait : 0;
+        }
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            LOG_ERROR("Async Redis epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == wake_fd) {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    LOG_WARNING("Async Redis wakeup read failed: %s", strerror(errno));
+                }
+                continue;
+            }
+            if (!async_ctx || events[i].data.fd != redis_fd) {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                redisAsyncHandleRead(async_ctx);
+            }
+            // The read may have torn the connection down
+            if (async_ctx && (events[i].events & EPOLLOUT)) {
+                redisAsyncHandleWrite(async_ctx);
+            }
+        }
+        if (!async_ctx && !stop && reconnect_delay_ms && now_ms() >= reconnect_at_ms) {
+            connect_async();
+        }
+    }
+
+    // Anything still queued fails
+    issue_queued();
+    return NULL;
+}
+
+// Run a command on a node's shared blocking connection and hand over the reply
+static int execute_sync(int node, const char *cmd, size_t len, async_redis_callback_fn cb,
+                        void *privdata) {
+    redisContext *ctx = shard_acquire(node);
+    redisReply *reply = NULL;
+    if (ctx) {
+        if (redisAppendFormattedCommand(ctx, cmd, len) != REDIS_OK ||
+            redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            reply = NULL;
+        }
+        shard_release(node);
+    }
+    cb(reply, privdata);
+    freeReplyObject(reply);
+    return 0;
+}
+
+// The loop only owns a connection to node 0; other nodes are served
+// synchronously on their shared connections
+static int submit(int node, char *cmd, size_t len, async_redis_callback_fn cb, void *privdata) {
+    pthread_mutex_lock(&queue_mutex);
+    if (!running || stopping || node != 0) {
+        pthread_mutex_unlock(&queue_mutex);
+        int result = execute_sync(node, cmd, len, cb, privdata);
+        redisFreeCommand(cmd);
+        return result;
+    }
+
+    async_request_t *req = malloc(sizeof(async_request_t));
+    if (!req) {
+        pthread_mutex_unlock(&queue_mutex);
+        redisFreeCommand(cmd);
+        return -1;
+    }
+    req->next = NULL;
+    req->cmd = cmd;
+    req->len = len;
+    req->cb = cb;
+    req->privdata = privdata;
+
+    // Only the first request of a batch needs to wake the loop
+    int wake = queue_head == NULL;
+    if (queue_tail) {
+        queue_tail->next = req;
+    } else {
+        queue_head = req;
+    }
+    queue_tail = req;
+    pthread_mutex_unlock(&queue_mutex);
+
+    if (wake) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            LOG_WARNING("Async Redis wakeup failed: %s", strerror(errno));
+        }
+    }
+    return 0;
+}
+
+static int submitv(int node, async_redis_callback_fn cb, void *privdata, const char *format,
+                   va_list args) {
+    char *cmd = NULL;
+    int len = redisvFormatCommand(&cmd, format, args);
+    if (len < 0) {
+        LOG_ERROR("Failed to format Redis command");
+        return -1;
+    }
+    return submit(node, cmd, len, cb, privdata);
+}
+
+// Submit a command whose result is handed to cb
+int async_redis_command_cb(async_redis_callback_fn cb, void *privdata, const char *format, ...) {
+    if (!cb) {
+        return -1;
+    }
+    va_list args;
+    va_start(args, format);
+    int result = submitv(0, cb, privdata, format, args);
+    va_end(args);
+    return result;
+}
+
+static void complete_future(redisReply *reply, void *privdata) {
+    redis_future_t *future = privdata;
+    pthread_mutex_lock(&future->lock);
+    future->reply = reply ? clone_reply(reply) : NULL;
+    future->done = 1;
+    pthread_cond_signal(&future->cond);
+    pthread_mutex_unlock(&future->lock);
+}
+
+static redis_future_t *future_commandv(int node, const char *format, va_list args) {
+    redis_future_t *future = calloc(1, sizeof(redis_future_t));
+    if (!future) {
+        return NULL;
+    }
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    if (submitv(node, complete_future, future, format, args) != 0) {
+        pthread_mutex_destroy(&future->lock);
+        pthread_cond_destroy(&future->cond);
+        free(future);
+        return NULL;
+    }
+    return future;
+}
+
+// Submit a command and return a future for its reply
+redis_future_t *async_redis_command(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    redis_future_t *future = future_commandv(0, format, args);
+    va_end(args);
+    return future;
+}
+
+// Submit a command to the node that owns key
+static redis_future_t *routed_command(const char *key, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    redis_future_t *future = future_commandv(shard_for_key(key), format, args);
+    va_end(args);
+    return future;
+}
+
+// Wait for a future, free it and return its reply
+redisReply *redis_future_get(redis_future_t *future) {
+    if (!future) {
+        return NULL;
+    }
+    pthread_mutex_lock(&future->lock);
+    while (!future->done) {
+        pthread_cond_wait(&future->cond, &future->lock);
+    }
+    redisReply *reply = future->reply;
+    pthread_mutex_unlock(&future->lock);
+
+    pthread_mutex_destroy(&future->lock);
+    pthread_cond_destroy(&future->cond);
+    free(future);
+    return reply;
+}
+
+// Resolve a future into a 0/1 integer reply
+int redis_future_get_bool(redis_future_t *future) {
+    redisReply *reply = redis_future_get(future);
+    int result = reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    return result;
+}
+
+redis_future_t *async_is_visited(const char *url) {
+    visited_ref_t ref;
+    if (!url || visited_ref(url, &ref) != 0) {
+        return NULL;
+    }
+    return routed_command(ref.key, "%s %s %b", visited_check_command(), ref.key, ref.member,
+                          ref.member_len);
+}
+
+redis_future_t *async_mark_visited(const char *url) {
+    visited_ref_t ref;
+    if (!url || visited_ref(url, &ref) != 0) {
+        return NULL;
+    }
+    if (visited_get_mode() == VISITED_MODE_URLS) {
+        return routed_command(ref.key, "SADD %s %s", ref.key, url);
+    }
+    return routed_command(ref.key, "HSET %s %b 1", ref.key, ref.member, ref.member_len);
+}
+
+redis_future_t *async_push_url(const char *url, int priority) {
+    char tag[SHARD_TAG_MAX], key[SHARD_KEY_MAX];
+    if (!url) {
+        return NULL;
+    }
+    if (shard_url_tag(url, tag, sizeof(tag)) != 0) {
+        strcpy(tag, "_");
+    }
+    if (shard_tag_key(key, sizeof(key), URL_QUEUE_PREFIX, tag, NULL) != 0) {
+        return NULL;
+    }
+    size_t buf_size = strlen(url) + 2;
+    char *buf = malloc(buf_size);
+    const char *member = frontier_member(url, tag, buf, buf ? buf_size : 0);
+    redis_future_t *future = routed_command(key, "ZADD %s %d %s", key, priority, member);
+    free(buf);
+    return future;
+}
+
+redis_future_t *async_pop_url(const char *host) {
+    char key[SHARD_KEY_MAX];
+    if (!host || shard_tag_key(key, sizeof(key), URL_QUEUE_PREFIX, host, NULL) != 0) {
+        return NULL;
+    }
+    return routed_command(key, "ZPOPMIN %s", key);
+}
+
+redis_future_t *async_cache_lookup(const char *url) {
+    return url ? async_redis_command("HMGET %s%s hash type status", CACHE_PREFIX, url) : NULL;
+}
+
+redis_future_t *async_robots_cached(const char *domain) {
+    char key[SHARD_KEY_MAX];
+    if (!domain || shard_tag_key(key, sizeof(key), ROBOTS_KEY_PREFIX, domain, ":allow") != 0) {
+        return NULL;
+    }
+    return routed_command(key, "EXISTS %s", key);
+}
+
+// Start the event loop with its own connection
+int async_redis_start(const char *host, int port) {
+    if (running) {
+        return 0;
+    }
+    free(loop_host);
+    loop_host = strdup(host);
+    loop_port = port;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!loop_host || epoll_fd < 0 || wake_fd < 0) {
+        LOG_ERROR("Failed to set up async Redis event loop: %s", strerror(errno));
+        async_redis_stop();
+        return -1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = wake_fd};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    if (connect_async() != 0) {
+        LOG_ERROR("Failed to connect async Redis client");
+        async_redis_stop();
+        return -1;
+    }
+
+    stopping = 0;
+    running = 1;
+    if (pthread_create(&loop_thread, NULL, loop_main, NULL) != 0) {
+        LOG_ERROR("Failed to start async Redis loop: %s", strerror(errno));
+        running = 0;
+        async_redis_stop();
+        return -1;
+    }
+    LOG_INFO("Async Redis event loop started");
+    return 0;
+}
+
+// Send what is queued, wait for outstanding replies and stop the loop
+void async_redis_stop(void) {
+    pthread_mutex_lock(&queue_mutex);
+    int was_running = running;
+    stopping = 1;
+    pthread_mutex_unlock(&queue_mutex);
+
+    if (was_running) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            LOG_WARNING("Async Redis wakeup failed: %s", strerror(errno));
+        }
+        pthread_join(loop_thread, NULL);
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    running = 0;
+    pthread_mutex_unlock(&queue_mutex);
+
+    if (async_ctx) {
+        redisAsyncFree(async_ctx);
+        async_ctx = NULL;
+    }
+    if (wake_fd >= 0) close(wake_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+    wake_fd = epoll_fd = -1;
+}
+
+// Whether the event loop is running
+int async_redis_is_running(void) {
+    pthread_mutex_lock(&queue_mutex);
+    int result = running && !stopping;
+    pthread_mutex_unlock(&queue_mutex);
+    return result;
+}
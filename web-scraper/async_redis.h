@@ -0,0 +1,75 @@
+#ifndef ASYNC_REDIS_H
+#define ASYNC_REDIS_H
+
+#include <hiredis/hiredis.h>
+
+// Non-blocking Redis access on a redisAsyncContext
+//
+// A single event-loop thread owns the async connection and drives it with
+// epoll. Other threads submit commands through a queue and are woken via
+// an eventfd. The loop issues every queued command before going back to
+// epoll_wait, so commands submitted concurrently share one write
+// (automatic pipelining).
+//
+// Results come back either through a callback, run on the loop thread, or
+// through a future that any thread can wait on. Until async_redis_start()
+// is called (and after async_redis_stop()), commands run synchronously on
+// the shared connection and complete before the call returns.
+//
+// The loop connects to shard node 0. Commands for keys that live on other
+// nodes (see shard_router.h) run synchronously on that node's connection.
+
+#define ASYNC_REDIS_RECONNECT_MIN_MS 10    // First reconnect delay
+#define ASYNC_REDIS_RECONNECT_MAX_MS 1000  // Reconnect backoff ceiling
+
+// Callback for a completed command
+// reply is NULL if the command could not be sent or the connection dropped;
+// it is owned by the caller of the callback and freed when it returns
+typedef void (*async_redis_callback_fn)(redisReply *reply, void *privdata);
+
+// Result of a command that has not completed yet
+typedef struct redis_future redis_future_t;
+
+// Start the event loop with its own connection
+// Returns 0 on success, -1 on failure
+int async_redis_start(const char *host, int port);
+
+// Send what is queued, wait for outstanding replies and stop the loop
+void async_redis_stop(void);
+
+// Whether the event loop is running
+int async_redis_is_running(void);
+
+// Submit a command whose result is handed to cb
+// Returns 0 if submitted, -1 on failure (cb is not called)
+int async_redis_command_cb(async_redis_callback_fn cb, void *privdata, const char *format, ...);
+
+// Submit a command and return a future for its reply
+// Returns NULL if the command could not be submitted
+redis_future_t *async_redis_command(const char *format, ...);
+
+// Wait for a future, free it and return its reply
+// Caller frees the reply with freeReplyObject(); NULL on failure
+redisReply *redis_future_get(redis_future_t *future);
+
+// Visited set of the URL's host: SISMEMBER / SADD, or HEXISTS / HSET
+// in fingerprint mode (see visited_store.h)
+redis_future_t *async_is_visited(const char *url);
+redis_future_t *async_mark_visited(const char *url);
+
+// Frontier: ZADD to the URL's host queue / ZPOPMIN from a host's queue.
+// Popped members are host-relative; turn them into URLs with frontier_url()
+redis_future_t *async_push_url(const char *url, int priority);
+redis_future_t *async_pop_url(const char *host);
+
+// Cache pointer for a URL: HMGET cache:<url> hash type status
+redis_future_t *async_cache_lookup(const char *url);
+
+// Whether robots rules are cached for a domain: EXISTS robots:{domain}:allow
+redis_future_t *async_robots_cached(const char *domain);
+
+// Resolve a future into a 0/1 integer reply
+// Returns 1 for a true integer reply, 0 otherwise (including failures)
+int redis_future_get_bool(redis_future_t *future);
+
+#endif // ASYNC_REDIS_H
@@ -0,0 +1,177 @@
+#include "content_store.h"
+#include "logger.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Write and read throughput of the local content store
+//
+// Usage: bench_content_store [records] [record bytes] [threads]
+// Records are written to a temporary directory by several threads, read
+// back in random order, and the directory is removed afterwards.
+
+#define DEFAULT_RECORDS 20000
+#define DEFAULT_RECORD_BYTES 16384
+#define DEFAULT_THREADS 8
+
+typedef struct {
+    int id;
+    int threads;
+    int records;
+    size_t record_bytes;
+    int failures;
+    unsigned long long checksum;
+} worker_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Deterministic record body, so reads can be checked
+static void fill_record(char *buf, size_t len, uint64_t key) {
+    uint64_t x = key * 0x9e3779b97f4a7c15ULL + 1;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = "<div class=\"item\">text</div>\n"[x % 29];
+    }
+}
+
+static void *write_worker(void *arg) {
+    worker_t *w = arg;
+    char *buf = malloc(w->record_bytes);
+    for (int i = w->id; buf && i < w->records; i += w->threads) {
+        fill_record(buf, w->record_bytes, i + 1);
+        if (content_store_put(i + 1, buf, w->record_bytes) != 0) {
+            w->failures++;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static void *read_worker(void *arg) {
+    worker_t *w = arg;
+    char *expected = malloc(w->record_bytes);
+    unsigned int seed = w->id + 1;
+    for (int i = 0; expected && i < w->records / w->threads; i++) {
+        uint64_t key = rand_r(&seed) % w->records + 1;
+        const char *data;
+        size_t len;
+        if (content_store_get(key, &data, &len) != 0) {
+            w->failures++;
+            continue;
+        }
+        // Check every 64th record in full; sum the rest so the read is not skipped
+        if (i % 64 == 0) {
+            fill_record(expected, w->record_bytes, key);
+            if (len != w->record_bytes || memcmp(data, expected, len) != 0) {
+                w->failures++;
+            }
+        }
+        for (size_t off = 0; off < len; off += 64) {
+            w->checksum += (unsigned char)data[off];
+        }
+        content_store_release();
+    }
+    free(expected);
+    return NULL;
+}
+
+// Run one phase on all threads; returns the failures
+static int run_phase(void *(*fn)(void *), worker_t *workers, int threads) {
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    int failures = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&ids[i], NULL, fn, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        failures += workers[i].failures;
+        workers[i].failures = 0;
+    }
+    free(ids);
+    return failures;
+}
+
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *entry;
+        char path[1100];
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+    int records = argc > 1 ? atoi(argv[1]) : DEFAULT_RECORDS;
+    size_t record_bytes = argc > 2 ? (size_t)atol(argv[2]) : DEFAULT_RECORD_BYTES;
+    int threads = argc > 3 ? atoi(argv[3]) : DEFAULT_THREADS;
+    if (records <= 0 || record_bytes == 0 || threads <= 0) {
+        fprintf(stderr, "Usage: %s [records] [record bytes] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/bench_content_store.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    logger_init("/dev/null");
+    if (content_store_open(dir) != 0) {
+        fprintf(stderr, "Failed to open content store in %s\n", dir);
+        remove_dir(dir);
+        return 1;
+    }
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    for (int i = 0; i < threads; i++) {
+        workers[i].id = i;
+        workers[i].threads = threads;
+        workers[i].records = records;
+        workers[i].record_bytes = record_bytes;
+    }
+    double mb = (double)records * record_bytes / (1024.0 * 1024.0);
+
+    double start = now_seconds();
+    int write_failures = run_phase(write_worker, workers, threads);
+    int sync_failed = content_store_sync() != 0;
+    double write_time = now_seconds() - start;
+    printf("write: %d records of %zu bytes on %d threads in %.3f s: %.0f records/s, %.1f MB/s%s\n",
+           records, record_bytes, threads, write_time, records / write_time, mb / write_time,
+           sync_failed ? " (sync failed)" : "");
+
+    start = now_seconds();
+    int read_failures = run_phase(read_worker, workers, threads);
+    double read_time = now_seconds() - start;
+    int reads = records / threads * threads;
+    printf("read:  %d random records on %d threads in %.3f s: %.0f records/s, %.1f MB/s\n",
+           reads, threads, read_time, reads / read_time,
+           (double)reads * record_bytes / (1024.0 * 1024.0) / read_time);
+
+    content_store_close();
+    logger_close();
+    remove_dir(dir);
+    free(workers);
+
+    if (write_failures || read_failures) {
+        fprintf(stderr, "%d writes and %d reads failed\n", write_failures, read_failures);
+        return 1;
+    }
+    return 0;
+}
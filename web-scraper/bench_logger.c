@@ -0,0 +1,164 @@
+#include "logger.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Logging throughput under contention
+//
+// Usage: bench_logger [threads] [lines per thread]
+// Every thread logs the same number of lines, first through a copy of the
+// previous logger (one mutex, localtime and fflush per line), then through
+// logger.c. The logger.c output is then checked: every line present and
+// the lines of each thread in order.
+
+#define DEFAULT_THREADS 16
+#define DEFAULT_LINES 100000
+
+typedef struct {
+    int id;
+    int lines;
+} worker_t;
+
+static FILE *mutex_file = NULL;
+static pthread_mutex_t mutex_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The previous logger_log(), kept as the baseline
+static void mutex_log(log_level_t level, const char *format, ...) {
+    static const char *names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+    pthread_mutex_lock(&mutex_log_lock);
+    time_t now = time(NULL);
+    struct tm *tm_info = localtime(&now);
+    char time_str[20];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
+    fprintf(mutex_file, "[%s] [%s] ", time_str, names[level]);
+    va_list args;
+    va_start(args, format);
+    vfprintf(mutex_file, format, args);
+    va_end(args);
+    fprintf(mutex_file, "\n");
+    fflush(mutex_file);
+    pthread_mutex_unlock(&mutex_log_lock);
+}
+
+static void *mutex_worker(void *arg) {
+    worker_t *w = arg;
+    for (int i = 0; i < w->lines; i++) {
+        mutex_log(LOG_INFO, "worker %d line %d url https://example.com/page/%d", w->id, i, i);
+    }
+    return NULL;
+}
+
+static void *ring_worker(void *arg) {
+    worker_t *w = arg;
+    for (int i = 0; i < w->lines; i++) {
+        LOG_INFO("worker %d line %d url https://example.com/page/%d", w->id, i, i);
+    }
+    return NULL;
+}
+
+// Run fn on every worker; returns the elapsed seconds
+static double run(void *(*fn)(void *), worker_t *workers, int threads) {
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&ids[i], NULL, fn, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    return now_seconds() - start;
+}
+
+// Check that every line of every worker is in the log, in order per worker
+// Returns the number of problems found
+static long check_log(const char *path, int threads, int lines) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 1;
+    }
+    int *next = calloc(threads, sizeof(int));
+    long problems = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        int id, n;
+        const char *body = strstr(line, "] worker ");
+        if (!body || sscanf(body, "] worker %d line %d", &id, &n) != 2) {
+            continue;
+        }
+        if (id < 0 || id >= threads || n != next[id]) {
+            problems++;
+        } else {
+            next[id]++;
+        }
+    }
+    fclose(file);
+    for (int i = 0; i < threads; i++) {
+        if (next[i] != lines) {
+            problems++;
+        }
+    }
+    free(next);
+    return problems;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    int lines = argc > 2 ? atoi(argv[2]) : DEFAULT_LINES;
+    if (threads <= 0 || lines <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [lines per thread]\n", argv[0]);
+        return 1;
+    }
+
+    char mutex_path[] = "/tmp/bench_logger_mutex.XXXXXX";
+    char ring_path[] = "/tmp/bench_logger_ring.XXXXXX";
+    int mutex_fd = mkstemp(mutex_path);
+    int ring_fd = mkstemp(ring_path);
+    if (mutex_fd < 0 || ring_fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(ring_fd);
+    mutex_file = fdopen(mutex_fd, "w");
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    for (int i = 0; i < threads; i++) {
+        workers[i].id = i;
+        workers[i].lines = lines;
+    }
+    double total = (double)threads * lines;
+
+    double mutex_time = run(mutex_worker, workers, threads);
+    fclose(mutex_file);
+    printf("mutex logger: %d threads x %d lines in %.3f s: %.0f lines/s\n",
+           threads, lines, mutex_time, total / mutex_time);
+
+    logger_init(ring_path);
+    double log_time = run(ring_worker, workers, threads);
+    double start = now_seconds();
+    logger_close();
+    double drain_time = now_seconds() - start;
+    printf("ring logger:  %d threads x %d lines in %.3f s: %.0f lines/s "
+           "(%.0f lines/s including the final drain)\n",
+           threads, lines, log_time, total / log_time, total / (log_time + drain_time));
+    printf("speedup: %.1fx\n", mutex_time / log_time);
+
+    long problems = check_log(ring_path, threads, lines);
+    unlink(mutex_path);
+    unlink(ring_path);
+    free(workers);
+    if (problems) {
+        fprintf(stderr, "ring logger output has %ld missing or out-of-order lines\n", problems);
+        return 1;
+    }
+    return 0;
+}
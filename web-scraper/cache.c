@@ -1,6 +1,12 @@
 #include "cache.h"
 #include "logger.h"
 #include "redis_helper.h"
+#include "content_hash.h"
+#include "compression.h"
+#include "cache_policy.h"
+#include "stats.h"
+#include "content_store.h"
+#include "write_behind.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -10,11 +16,24 @@
 #include <hiredis/hiredis.h>
 
 #define CACHE_PREFIX "cache:"
-#define MAX_CACHE_SIZE 1000000  // 1MB
 #define MAX_RETRIES 3
-#define RETRY_DELAY 1  // seconds
+#define RETRY_DELAY_MS 10  // first retry delay, doubled per attempt
 #define REDIS_HOST "127.0.0.1"
 #define REDIS_PORT 6379
+#define TRAIN_SAMPLE_COUNT 200  // Cached bodies sampled to train a dictionary
+#define STORE_DISK "disk"        // Blob marker: body lives in the local content store
+
+// Local content store directory; NULL keeps bodies in Redis
+static char *content_dir = NULL;
+
+// Thread CPU time in microseconds, for compression accounting
+static unsigned long thread_cpu_us(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
 
 // Helper function to create cache key
 static char *create_cache_key(const char *prefix, const char *url) {
@@ -25,6 +44,93 @@ static char *create_cache_key(const char *prefix, const char *url) {
     return key;
 }
 
+// Keep cached bodies in a local segment store
+void cache_set_content_dir(const char *dir) {
+    free(content_dir);
+    content_dir = dir ? strdup(dir) : NULL;
+}
+
+// Directory of the local content store
+const char *cache_get_content_dir(void) {
+    return content_dir;
+}
+
+// Decode a blob (HMGET codec size data store) into a NUL-terminated body
+static int decode_blob(const char *hash_hex, redisReply *blob, char **out, size_t *out_len) {
+    if (!blob || blob->type != REDIS_REPLY_ARRAY || blob->elements != 4) {
+        return -1;
+    }
+    const char *codec = blob->element[0]->type == REDIS_REPLY_STRING
+                            ? blob->element[0]->str : CODEC_RAW;
+    size_t raw_size = blob->element[1]->type == REDIS_REPLY_STRING
+                          ? strtoul(blob->element[1]->str, NULL, 10) : 0;
+    int on_disk = blob->element[3]->type == REDIS_REPLY_STRING &&
+                  strcmp(blob->element[3]->str, STORE_DISK) == 0;
+
+    const char *data;
+    size_t data_len;
+    if (on_disk) {
+        // Decompress straight out of the mapped segment
+        if (content_store_get(strtoull(hash_hex, NULL, 16), &data, &data_len) != 0) {
+            return -1;
+        }
+    } else if (blob->element[2]->type == REDIS_REPLY_STRING) {
+        data = blob->element[2]->str;
+        data_len = blob->element[2]->len;
+    } else {
+        return -1;
+    }
+
+    int result = decompress_content(codec, data, data_len, raw_size ? raw_size : data_len,
+                                    out, out_len);
+    if (on_disk) {
+        content_store_release();
+    }
+    return result;
+}
+
+// Whether a blob lookup (HMGET codec size data store) found nothing
+static int blob_missing(const redisReply *blob) {
+    if (!blob || blob->type != REDIS_REPLY_ARRAY) {
+        return 0;
+    }
+    for (size_t i = 0; i < blob->elements; i++) {
+        if (blob->element[i]->type != REDIS_REPLY_NIL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Which local store records still have a blob:<hash> entry; bodies whose
+// blob expired or was evicted are dropped by the store's compactor
+static int content_blobs_live(const uint64_t *keys, int count, int *live) {
+    redisContext *ctx = get_redis_context();
+    if (!ctx) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&redis_mutex);
+    for (int i = 0; i < count; i++) {
+        char hash_hex[CONTENT_HASH_HEX_LEN];
+        content_hash_hex(keys[i], hash_hex);
+        redisAppendCommand(ctx, "EXISTS %s%s", CACHE_BLOB_PREFIX, hash_hex);
+    }
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            result = -1;
+            break;
+        }
+        // Anything but a definite 0 keeps the record
+        live[i] = !(reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 0);
+        freeReplyObject(reply);
+    }
+    pthread_mutex_unlock(&redis_mutex);
+    return result;
+}
+
 // Initialize cache
 int cache_init(redisContext *ctx) {
     if (!ctx) {
@@ -49,7 +155,7 @@ int cache_init(redisContext *ctx) {
         }
         LOG_WARNING("Cache write test failed, retrying (%d/%d)...", 
                    retry_count + 1, MAX_RETRIES);
-        sleep(RETRY_DELAY);
+        usleep((RETRY_DELAY_MS << retry_count) * 1000);
         retry_count++;
     }
 
@@ -80,32 +186,164 @@ int cache_init(redisContext *ctx) {
     freeReplyObject(reply);
 
     pthread_mutex_unlock(&redis_mutex);
+
+    if (content_dir && content_store_open(content_dir) != 0) {
+        LOG_ERROR("Failed to open content store at %s", content_dir);
+        return 0;
+    }
+    content_store_set_liveness(content_blobs_live);
+
+    // Use the dictionary trained on our corpus if one has been built
+    if (compression_load_dictionary(COMPRESSION_DICT_FILE) != 0) {
+        LOG_INFO("No trained compression dictionary, using built-in HTML dictionary");
+    }
+
     LOG_INFO("Cache initialized successfully");
     return 1;
 }
 
+// Write a new blob and its TTL on the shared connection, in one round trip
+// Returns 0 once Redis has acknowledged both, -1 otherwise
+static int store_blob_now(redisContext *ctx, const char *blob_key, const char *codec,
+                          size_t content_size, int on_disk, const char *data, size_t data_len,
+                          int ttl) {
+    pthread_mutex_lock(&redis_mutex);
+    if (on_disk) {
+        redisAppendCommand(ctx, "HSET %s codec %s size %zu store %s", blob_key, codec,
+                           content_size, STORE_DISK);
+    } else {
+        redisAppendCommand(ctx, "HSET %s codec %s size %zu data %b", blob_key, codec,
+                           content_size, data, data_len);
+    }
+    redisAppendCommand(ctx, "EXPIRE %s %d", blob_key, ttl);
+    int ok = 1;
+    for (int i = 0; i < 2; i++) {
+        redisReply *reply = NULL;
+        ok = redisGetReply(ctx, (void **)&reply) == REDIS_OK && ok &&
+             reply->type == REDIS_REPLY_INTEGER;
+        freeReplyObject(reply);
+    }
+    pthread_mutex_unlock(&redis_mutex);
+    return ok ? 0 : -1;
+}
+
 // Store content in cache
 int cache_store_content(redisContext *ctx, const char *url, const char *content, size_t content_size,
                        const char *content_type, int status_code) {
+    if (!content) {
+        return 0;
+    }
+    return cache_store_content_hashed(ctx, url, content_hash64(content, content_size, 0),
+                                      content, content_size, content_type, status_code);
+}
+
+// Store content whose body hash is already known
+int cache_store_content_hashed(redisContext *ctx, const char *url, uint64_t content_hash,
+                               const char *content, size_t content_size,
+                               const char *content_type, int status_code) {
     if (!ctx || !url || !content) {
         return 0;
     }
 
-    char key[256];
-    snprintf(key, sizeof(key), "%s%s", CACHE_PREFIX, url);
+    // Enforce the per-entry size ceiling
+    if (!cache_policy_admit(content_size)) {
+        LOG_INFO("Not caching %s: %zu bytes exceeds the per-entry limit", url, content_size);
+        return 0;
+    }
 
-    pthread_mutex_lock(&redis_mutex);
-    redisReply *reply = redisCommand(ctx, "HMSET %s content %b type %s status %d",
-                                   key, content, content_size,
-                                   content_type, status_code);
-    pthread_mutex_unlock(&redis_mutex);
+    char hash_hex[CONTENT_HASH_HEX_LEN];
+    content_hash_hex(content_hash, hash_hex);
 
-    if (!reply) {
+    char *key = create_cache_key(CACHE_PREFIX, url);
+    char *blob_key = create_cache_key(CACHE_BLOB_PREFIX, hash_hex);
+    if (!key || !blob_key) {
+        LOG_ERROR("Failed to create cache key");
+        free(key);
+        free(blob_key);
         return 0;
     }
 
-    int result = reply->type == REDIS_REPLY_STATUS;
+    // Only send the body if no other URL has stored the same bytes. A blob
+    // written as a plain string by an earlier version is dropped and
+    // rewritten as a hash; the DEL is synchronous so it cannot land after
+    // the rewrite
+    pthread_mutex_lock(&redis_mutex);
+    redisReply *reply = redisCommand(ctx, "TYPE %s", blob_key);
+    int blob_exists = reply && reply->type == REDIS_REPLY_STATUS &&
+                      strcmp(reply->str, "hash") == 0;
+    if (reply && reply->type == REDIS_REPLY_STATUS && !blob_exists &&
+        strcmp(reply->str, "none") != 0) {
+        freeReplyObject(reply);
+        reply = redisCommand(ctx, "DEL %s", blob_key);
+        LOG_DEBUG("Replacing old-format blob for URL: %s", url);
+    }
+    pthread_mutex_unlock(&redis_mutex);
     freeReplyObject(reply);
+
+    // Compress new bodies outside the Redis lock
+    char *compressed = NULL;
+    size_t compressed_size = 0;
+    const char *codec = CODEC_RAW;
+    if (!blob_exists) {
+        unsigned long start_us = thread_cpu_us();
+        if (compress_content(content, content_size, &compressed, &compressed_size, &codec) != 0) {
+            LOG_WARNING("Compression failed, storing raw content for URL: %s", url);
+            codec = CODEC_RAW;
+        }
+        update_compression_stats(content_size, compressed ? compressed_size : content_size,
+                                 thread_cpu_us() - start_us);
+    }
+    size_t stored_bytes = blob_exists ? 0 : (compressed ? compressed_size : content_size);
+
+    // With a local store Redis only keeps a pointer to the body
+    int on_disk = 0;
+    if (!blob_exists && content_store_is_open()) {
+        on_disk = content_store_put(content_hash, compressed ? compressed : content,
+                                    stored_bytes) == 0;
+        if (!on_disk) {
+            LOG_WARNING("Content store write failed, keeping body in Redis for URL: %s", url);
+        }
+    }
+
+    // Both the pointer and the blob expire; the blob lives as long as its
+    // most recent reference
+    int ttl = cache_policy_ttl_for(content_type);
+    int failed = 0;
+    if (!blob_exists && cache_policy_tracks_bytes()) {
+        // The byte budget indexes the blob, so it has to exist first: an
+        // eviction must never be overtaken by a write still queued
+        failed |= store_blob_now(ctx, blob_key, codec, content_size, on_disk,
+                                 compressed ? compressed : content, stored_bytes, ttl);
+    } else if (on_disk) {
+        failed |= write_behind_command("HSET %s codec %s size %zu store %s", blob_key, codec,
+                                       content_size, STORE_DISK);
+    } else if (!blob_exists) {
+        failed |= write_behind_command("HSET %s codec %s size %zu data %b", blob_key, codec,
+                                       content_size, compressed ? compressed : content,
+                                       stored_bytes);
+    }
+
+    // The other writes are queued; workers do not wait for the acknowledgements
+    failed |= write_behind_command("HSET %s hash %s size %zu type %s status %d",
+                                   key, hash_hex, content_size,
+                                   content_type ? content_type : "", status_code);
+    // Drop the inline body of entries written before blobs existed
+    failed |= write_behind_command("HDEL %s content", key);
+    failed |= write_behind_command("EXPIRE %s %d", key, ttl);
+    failed |= write_behind_command("EXPIRE %s %d", blob_key, ttl);
+    free(compressed);
+    int result = !failed;
+
+    // Track the blob against the byte budget, evicting if needed
+    if (result) {
+        cache_policy_on_store(ctx, hash_hex, stored_bytes);
+    }
+
+    if (!result) {
+        LOG_ERROR("Failed to store content in cache for URL: %s", url);
+    }
+    free(key);
+    free(blob_key);
     return result;
 }
 
@@ -159,34 +397,73 @@ int cache_get_content(redisContext *ctx, const char *url, char **content, size_t
         return 0;
     }
 
-    char key[256];
-    snprintf(key, sizeof(key), "%s%s", CACHE_PREFIX, url);
+    char *key = create_cache_key(CACHE_PREFIX, url);
+    if (!key) {
+        LOG_ERROR("Failed to create cache key");
+        return 0;
+    }
 
     pthread_mutex_lock(&redis_mutex);
-    redisReply *reply = redisCommand(ctx, "HMGET %s content type status", key);
-    pthread_mutex_unlock(&redis_mutex);
+    redisReply *reply = redisCommand(ctx, "HMGET %s hash type status content", key);
+    free(key);
 
-    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 3) {
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 4) {
+        pthread_mutex_unlock(&redis_mutex);
         if (reply) {
             freeReplyObject(reply);
         }
         return 0;
     }
 
+    // Entries written before blobs existed keep the body inline
+    redisReply *blob_reply = NULL;
+    int has_blob = reply->element[0] && reply->element[0]->type == REDIS_REPLY_STRING;
+    if (has_blob) {
+        blob_reply = redisCommand(ctx, "HMGET %s%s codec size data store", CACHE_BLOB_PREFIX,
+                                  reply->element[0]->str);
+    }
+    pthread_mutex_unlock(&redis_mutex);
+
     // Initialize output parameters
     *content = NULL;
     *content_size = 0;
     *content_type = NULL;
     *status_code = 0;
 
-    // Get content
-    if (reply->element[0] && reply->element[0]->type == REDIS_REPLY_STRING) {
-        *content_size = reply->element[0]->len;
-        *content = malloc(*content_size + 1);
-        if (*content) {
-            memcpy(*content, reply->element[0]->str, *content_size);
-            (*content)[*content_size] = '\0';
+    // Get content, decompressing as recorded in the blob
+    unsigned long start_us = thread_cpu_us();
+    int decoded;
+    if (has_blob) {
+        decoded = decode_blob(reply->element[0]->str, blob_reply, content, content_size);
+    } else {
+        redisReply *body = reply->element[3];
+        decoded = body && body->type == REDIS_REPLY_STRING
+                      ? decompress_content(CODEC_RAW, body->str, body->len, body->len,
+                                           content, content_size)
+                      : -1;
+    }
+    if (decoded != 0) {
+        if (has_blob && blob_reply && blob_reply->type == REDIS_REPLY_ERROR) {
+            // An old-format blob; the next store of this URL replaces it
+            LOG_DEBUG("Cached content for URL %s has an unreadable blob: %s", url,
+                      blob_reply->str);
+        } else if (has_blob && blob_missing(blob_reply)) {
+            // The pointer outlived its blob; release the blob's accounting
+            LOG_DEBUG("Cached content for URL %s has expired", url);
+            cache_policy_on_missing(ctx, reply->element[0]->str);
+        } else if (has_blob) {
+            LOG_ERROR("Failed to decode cached content for URL: %s", url);
+        }
+        freeReplyObject(blob_reply);
+        freeReplyObject(reply);
+        return 0;
+    }
+    if (has_blob) {
+        if (blob_reply->element[0]->type == REDIS_REPLY_STRING &&
+            strcmp(blob_reply->element[0]->str, CODEC_RAW) != 0) {
+            update_decompression_stats(thread_cpu_us() - start_us);
         }
+        cache_policy_on_access(ctx, reply->element[0]->str);
     }
 
     // Get content type
@@ -199,6 +476,7 @@ int cache_get_content(redisContext *ctx, const char *url, char **content, size_t
         *status_code = atoi(reply->element[2]->str);
     }
 
+    freeReplyObject(blob_reply);
     freeReplyObject(reply);
     return 1;
 }
@@ -319,7 +597,77 @@ int cache_clear_url(redisContext *ctx, const char *url) {
     return 0;
 }
 
+// Train a compression dictionary from cached bodies
+int cache_train_dictionary(redisContext *ctx, const char *path) {
+    if (!ctx || !path) {
+        LOG_ERROR("Invalid parameters for cache_train_dictionary");
+        return -1;
+    }
+
+    const char *samples[TRAIN_SAMPLE_COUNT];
+    size_t sizes[TRAIN_SAMPLE_COUNT];
+    char *decoded[TRAIN_SAMPLE_COUNT];
+    int count = 0;
+    char cursor[32] = "0";
+
+    // Sample cached bodies with SCAN
+    do {
+        pthread_mutex_lock(&redis_mutex);
+        redisReply *reply = redisCommand(ctx, "SCAN %s MATCH %s* COUNT 100", cursor, CACHE_BLOB_PREFIX);
+        pthread_mutex_unlock(&redis_mutex);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            freeReplyObject(reply);
+            break;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+        redisReply *keys = reply->element[1];
+        for (size_t i = 0; i < keys->elements && count < TRAIN_SAMPLE_COUNT; i++) {
+            pthread_mutex_lock(&redis_mutex);
+            redisReply *blob = redisCommand(ctx, "HMGET %s codec size data store",
+                                            keys->element[i]->str);
+            pthread_mutex_unlock(&redis_mutex);
+            const char *hash_hex = keys->element[i]->str + strlen(CACHE_BLOB_PREFIX);
+            if (decode_blob(hash_hex, blob, &decoded[count], &sizes[count]) == 0) {
+                samples[count] = decoded[count];
+                count++;
+            }
+            freeReplyObject(blob);
+        }
+        freeReplyObject(reply);
+    } while (strcmp(cursor, "0") != 0 && count < TRAIN_SAMPLE_COUNT);
+
+    if (count == 0) {
+        LOG_ERROR("No cached content available to train a dictionary");
+        return -1;
+    }
+
+    char *dict = NULL;
+    size_t dict_len = 0;
+    int result = compression_train_dictionary(samples, sizes, count, &dict, &dict_len);
+    for (int i = 0; i < count; i++) {
+        free(decoded[i]);
+    }
+    if (result != 0) {
+        LOG_ERROR("Failed to train compression dictionary");
+        return -1;
+    }
+
+    result = compression_save_dictionary(path, dict, dict_len);
+    free(dict);
+    if (result != 0) {
+        LOG_ERROR("Failed to save compression dictionary");
+        return -1;
+    }
+
+    LOG_INFO("Trained compression dictionary from %d cached pages (%zu bytes)", count, dict_len);
+    return 0;
+}
+
 // Cleanup cache
 void cache_cleanup(void) {
-    // No cleanup needed as Redis handles cleanup automatically
+    // Redis expires its own keys; only the local store needs closing
+    if (content_store_is_open()) {
+        content_store_close();
+    }
 } 
\ No newline at end of file
@@ -3,11 +3,14 @@
 
 #include <hiredis/hiredis.h>
 #include <pthread.h>
+#include <stdint.h>
 
 // Cache configuration
 #define CACHE_TTL 86400  // 24 hours in seconds
+#define MAX_CACHE_SIZE 1000000  // Default per-entry size ceiling (1MB)
 #define CACHE_PREFIX "cache:"
 #define CACHE_META_PREFIX "meta:"
+#define CACHE_BLOB_PREFIX "blob:"  // Content-addressed bodies, keyed by body hash
 
 // Structure for cached content
 typedef struct {
@@ -27,6 +30,14 @@ typedef struct {
     time_t last_modified; // Last modified time
 } cached_metadata_t;
 
+// Keep cached bodies in a local segment store under dir instead of Redis
+// Redis then holds only the blob metadata; NULL switches back to Redis
+// Must be called before cache_init()
+void cache_set_content_dir(const char *dir);
+
+// Directory of the local content store, or NULL when bodies live in Redis
+const char *cache_get_content_dir(void);
+
 // Initialize cache
 int cache_init(redisContext *ctx);
 
@@ -34,6 +45,12 @@ int cache_init(redisContext *ctx);
 int cache_store_content(redisContext *ctx, const char *url, const char *content, size_t content_size, 
                        const char *content_type, int status_code);
 
+// Store content whose body hash is already known
+// The body is written once under blob:<hash>; cache:<url> only points to it
+int cache_store_content_hashed(redisContext *ctx, const char *url, uint64_t content_hash,
+                               const char *content, size_t content_size,
+                               const char *content_type, int status_code);
+
 // Store metadata in cache
 int cache_store_metadata(redisContext *ctx, const char *url, const cached_metadata_t *metadata);
 
@@ -50,6 +67,12 @@ int cache_has_url(redisContext *ctx, const char *url);
 // Clear cache for a URL
 int cache_clear_url(redisContext *ctx, const char *url);
 
+// Train the shared compression dictionary from a sample of cached bodies,
+// write it to path and start using it for new entries; earlier dictionaries
+// stay on disk under their ids so older entries remain readable
+// Returns 0 on success, -1 on failure
+int cache_train_dictionary(redisContext *ctx, const char *path);
+
 // Cleanup cache
 void cache_cleanup(void);
 
@@ -0,0 +1,278 @@
+#include "cache_policy.h"
+#include "cache.h"
+#include "content_store.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Active policy
+static cache_policy_t active_policy = {
+    .policy = CACHE_EVICT_LRU,
+    .max_entry_bytes = MAX_CACHE_SIZE,
+    .max_total_bytes = CACHE_DEFAULT_BUDGET,
+    .sample_size = CACHE_DEFAULT_SAMPLE
+};
+
+// TTLs per content type prefix
+typedef struct {
+    const char *prefix;
+    int ttl;
+} content_ttl_t;
+
+static const content_ttl_t content_ttls[] = {
+    {"text/html", CACHE_TTL},
+    {"application/xhtml", CACHE_TTL},
+    {"application/json", 3600},
+    {"application/xml", 6 * 3600},
+    {"text/xml", 6 * 3600},
+    {"text/css", 7 * 86400},
+    {"application/javascript", 7 * 86400},
+    {"text/javascript", 7 * 86400},
+    {"image/", 30 * 86400},
+    {"text/plain", CACHE_TTL},
+    {NULL, 0}
+};
+
+static long long now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// Replace the active policy
+void cache_set_policy(const cache_policy_t *policy) {
+    if (!policy) {
+        return;
+    }
+    active_policy = *policy;
+    if (active_policy.sample_size <= 0) {
+        active_policy.sample_size = CACHE_DEFAULT_SAMPLE;
+    }
+}
+
+// Get the active policy
+const cache_policy_t *cache_get_policy(void) {
+    return &active_policy;
+}
+
+// Parse a policy name
+int cache_policy_parse(const char *name, cache_evict_policy_t *policy) {
+    if (!name || !policy) {
+        return -1;
+    }
+    if (strcmp(name, "ttl") == 0) {
+        *policy = CACHE_EVICT_TTL;
+    } else if (strcmp(name, "lru") == 0) {
+        *policy = CACHE_EVICT_LRU;
+    } else if (strcmp(name, "cost") == 0) {
+        *policy = CACHE_EVICT_COST;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// TTL in seconds for a content type
+int cache_policy_ttl_for(const char *content_type) {
+    if (content_type) {
+        for (const content_ttl_t *entry = content_ttls; entry->prefix; entry++) {
+            if (strncmp(content_type, entry->prefix, strlen(entry->prefix)) == 0) {
+                return entry->ttl;
+            }
+        }
+    }
+    return CACHE_TTL;
+}
+
+// Whether an entry of this size may be cached
+int cache_policy_admit(size_t content_size) {
+    return active_policy.max_entry_bytes == 0 || content_size <= active_policy.max_entry_bytes;
+}
+
+// Remove one blob and its accounting; the ZREM guard makes sure only one
+// thread subtracts its size
+static long long evict_blob(redisContext *ctx, const char *blob_hash) {
+    pthread_mutex_lock(&redis_mutex);
+    redisReply *reply = redisCommand(ctx, "ZREM %s %s", CACHE_POLICY_ATIME_KEY, blob_hash);
+    int owned = reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+    if (!owned) {
+        pthread_mutex_unlock(&redis_mutex);
+        return 0;
+    }
+
+    reply = redisCommand(ctx, "HGET %s %s", CACHE_POLICY_SIZES_KEY, blob_hash);
+    long long size = reply && reply->type == REDIS_REPLY_STRING ? atoll(reply->str) : 0;
+    freeReplyObject(reply);
+
+    redisAppendCommand(ctx, "DEL %s%s", CACHE_BLOB_PREFIX, blob_hash);
+    redisAppendCommand(ctx, "HDEL %s %s", CACHE_POLICY_SIZES_KEY, blob_hash);
+    redisAppendCommand(ctx, "HDEL %s %s", CACHE_POLICY_HITS_KEY, blob_hash);
+    redisAppendCommand(ctx, "DECRBY %s %lld", CACHE_POLICY_BYTES_KEY, size);
+    for (int i = 0; i < 4; i++) {
+        reply = NULL;
+        redisGetReply(ctx, (void **)&reply);
+        freeReplyObject(reply);
+    }
+    pthread_mutex_unlock(&redis_mutex);
+
+    // Bodies kept in the local store are dropped there as well
+    if (content_store_is_open()) {
+        content_store_delete(strtoull(blob_hash, NULL, 16));
+    }
+
+    LOG_DEBUG("Evicted cache blob %s (%lld bytes)", blob_hash, size);
+    return size;
+}
+
+// Pick and evict one round of candidates; returns bytes freed
+static long long evict_round(redisContext *ctx, long long bytes_over) {
+    int sample = active_policy.sample_size;
+
+    // Oldest blobs first; expired blobs are still listed and get cleaned up here
+    pthread_mutex_lock(&redis_mutex);
+    redisReply *candidates = redisCommand(ctx, "ZRANGE %s 0 %d", CACHE_POLICY_ATIME_KEY, sample - 1);
+    pthread_mutex_unlock(&redis_mutex);
+    if (!candidates || candidates->type != REDIS_REPLY_ARRAY || candidates->elements == 0) {
+        freeReplyObject(candidates);
+        return 0;
+    }
+
+    long long freed = 0;
+    if (active_policy.policy == CACHE_EVICT_COST) {
+        // Among the old candidates, drop the one with the fewest hits per byte
+        const char **argv = malloc((candidates->elements + 2) * sizeof(char *));
+        if (!argv) {
+            freeReplyObject(candidates);
+            return 0;
+        }
+        argv[0] = "HMGET";
+        argv[1] = CACHE_POLICY_HITS_KEY;
+        for (size_t i = 0; i < candidates->elements; i++) {
+            argv[i + 2] = candidates->element[i]->str;
+        }
+        pthread_mutex_lock(&redis_mutex);
+        redisReply *hits = redisCommandArgv(ctx, candidates->elements + 2, argv, NULL);
+        argv[1] = CACHE_POLICY_SIZES_KEY;
+        redisReply *sizes = redisCommandArgv(ctx, candidates->elements + 2, argv, NULL);
+        pthread_mutex_unlock(&redis_mutex);
+        free(argv);
+
+        size_t victim = 0;
+        double worst = -1.0;
+        if (hits && sizes && hits->type == REDIS_REPLY_ARRAY && sizes->type == REDIS_REPLY_ARRAY) {
+            for (size_t i = 0; i < candidates->elements && i < hits->elements && i < sizes->elements; i++) {
+                double h = hits->element[i]->type == REDIS_REPLY_STRING ? atof(hits->element[i]->str) : 0.0;
+                double sz = sizes->element[i]->type == REDIS_REPLY_STRING ? atof(sizes->element[i]->str) : 1.0;
+                double value = (h + 1.0) / (sz > 0 ? sz : 1.0);
+                if (worst < 0 || value < worst) {
+                    worst = value;
+                    victim = i;
+                }
+            }
+        }
+        freeReplyObject(hits);
+        freeReplyObject(sizes);
+        freed = evict_blob(ctx, candidates->element[victim]->str);
+    } else {
+        for (size_t i = 0; i < candidates->elements && freed < bytes_over; i++) {
+            freed += evict_blob(ctx, candidates->element[i]->str);
+        }
+    }
+
+    freeReplyObject(candidates);
+    return freed;
+}
+
+// Whether blobs are indexed against the byte budget
+int cache_policy_tracks_bytes(void) {
+    return active_policy.policy != CACHE_EVICT_TTL;
+}
+
+// Account for a blob being stored or referenced again
+int cache_policy_on_store(redisContext *ctx, const char *blob_hash, size_t stored_bytes) {
+    if (!ctx || !blob_hash) {
+        return -1;
+    }
+
+    // TTLs alone bound the cache; the access index and byte counter are
+    // never pruned by expiry, so they are not kept at all
+    if (active_policy.policy == CACHE_EVICT_TTL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&redis_mutex);
+    redisAppendCommand(ctx, "ZADD %s %lld %s", CACHE_POLICY_ATIME_KEY, now_ms(), blob_hash);
+    redisAppendCommand(ctx, "HSETNX %s %s %zu", CACHE_POLICY_SIZES_KEY, blob_hash, stored_bytes);
+
+    redisReply *reply = NULL;
+    redisGetReply(ctx, (void **)&reply);
+    freeReplyObject(reply);
+    reply = NULL;
+    redisGetReply(ctx, (void **)&reply);
+    int is_new = reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+
+    // Only the first writer of a blob adds its size to the total
+    long long total = 0;
+    if (is_new) {
+        reply = redisCommand(ctx, "INCRBY %s %zu", CACHE_POLICY_BYTES_KEY, stored_bytes);
+        if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+            LOG_ERROR("Failed to update cache byte budget");
+            freeReplyObject(reply);
+            pthread_mutex_unlock(&redis_mutex);
+            return -1;
+        }
+        total = reply->integer;
+        freeReplyObject(reply);
+    }
+    pthread_mutex_unlock(&redis_mutex);
+
+    if (active_policy.max_total_bytes == 0 || total <= (long long)active_policy.max_total_bytes) {
+        return 0;
+    }
+
+    // Over budget: evict down to the low watermark
+    long long target = (long long)(active_policy.max_total_bytes * CACHE_EVICT_LOW_WATERMARK);
+    long long freed = 0;
+    while (total - freed > target) {
+        long long round = evict_round(ctx, total - freed - target);
+        if (round <= 0) {
+            break;
+        }
+        freed += round;
+    }
+    LOG_INFO("Cache over budget (%lld bytes), evicted %lld bytes", total, freed);
+    return 0;
+}
+
+// Drop the accounting of a blob that has expired
+void cache_policy_on_missing(redisContext *ctx, const char *blob_hash) {
+    if (!ctx || !blob_hash || active_policy.policy == CACHE_EVICT_TTL) {
+        return;
+    }
+    long long size = evict_blob(ctx, blob_hash);
+    if (size > 0) {
+        LOG_DEBUG("Cache blob %s expired, released %lld bytes", blob_hash, size);
+    }
+}
+
+// Record a read of a blob
+void cache_policy_on_access(redisContext *ctx, const char *blob_hash) {
+    if (!ctx || !blob_hash || active_policy.policy == CACHE_EVICT_TTL) {
+        return;
+    }
+
+    pthread_mutex_lock(&redis_mutex);
+    redisAppendCommand(ctx, "ZADD %s XX %lld %s", CACHE_POLICY_ATIME_KEY, now_ms(), blob_hash);
+    redisAppendCommand(ctx, "HINCRBY %s %s 1", CACHE_POLICY_HITS_KEY, blob_hash);
+    for (int i = 0; i < 2; i++) {
+        redisReply *reply = NULL;
+        redisGetReply(ctx, (void **)&reply);
+        freeReplyObject(reply);
+    }
+    pthread_mutex_unlock(&redis_mutex);
+}
@@ -0,0 +1,64 @@
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+#include <hiredis/hiredis.h>
+#include <stddef.h>
+
+// Redis keys used for cache accounting
+#define CACHE_POLICY_PREFIX "cache_policy:"
+#define CACHE_POLICY_BYTES_KEY CACHE_POLICY_PREFIX "bytes"  // Total stored blob bytes
+#define CACHE_POLICY_ATIME_KEY CACHE_POLICY_PREFIX "atime"  // Blob hash -> last access (ms)
+#define CACHE_POLICY_SIZES_KEY CACHE_POLICY_PREFIX "sizes"  // Blob hash -> stored bytes
+#define CACHE_POLICY_HITS_KEY CACHE_POLICY_PREFIX "hits"    // Blob hash -> read count
+
+// Defaults
+#define CACHE_DEFAULT_BUDGET (512UL * 1024 * 1024)  // 512MB for all blobs
+#define CACHE_DEFAULT_SAMPLE 16                     // Eviction candidates per round
+#define CACHE_EVICT_LOW_WATERMARK 0.9               // Evict down to 90% of budget
+
+// How entries are chosen once the byte budget is exceeded
+typedef enum {
+    CACHE_EVICT_TTL,   // Only per-content-type TTLs bound the cache
+    CACHE_EVICT_LRU,   // Evict least recently used blobs first
+    CACHE_EVICT_COST   // Evict the blob with the fewest hits per byte among old candidates
+} cache_evict_policy_t;
+
+typedef struct {
+    cache_evict_policy_t policy;
+    size_t max_entry_bytes;   // Larger bodies are not cached
+    size_t max_total_bytes;   // Byte budget across all blobs
+    int sample_size;          // Oldest blobs considered per eviction round
+} cache_policy_t;
+
+// Replace the active policy (call before the crawl starts)
+void cache_set_policy(const cache_policy_t *policy);
+
+// Get the active policy
+const cache_policy_t *cache_get_policy(void);
+
+// Parse a policy name ("ttl", "lru", "cost"); returns -1 if unknown
+int cache_policy_parse(const char *name, cache_evict_policy_t *policy);
+
+// TTL in seconds for a content type
+int cache_policy_ttl_for(const char *content_type);
+
+// Whether an entry of this size may be cached
+int cache_policy_admit(size_t content_size);
+
+// Whether blobs are indexed against the byte budget; if so a new blob
+// must be written before cache_policy_on_store() records it
+int cache_policy_tracks_bytes(void);
+
+// Account for a blob being stored or referenced again, evicting if the
+// budget is exceeded. Call once the blob's write has been acknowledged.
+// Returns 0 on success, -1 on failure
+int cache_policy_on_store(redisContext *ctx, const char *blob_hash, size_t stored_bytes);
+
+// Drop the accounting of a blob found missing (expired by its TTL) so it
+// no longer counts against the byte budget
+void cache_policy_on_missing(redisContext *ctx, const char *blob_hash);
+
+// Record a read of a blob for LRU and cost-aware eviction
+void cache_policy_on_access(redisContext *ctx, const char *blob_hash);
+
+#endif // CACHE_POLICY_H
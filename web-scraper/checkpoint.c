@@ -0,0 +1,729 @@
+#include "checkpoint.h"
+#include "content_hash.h"
+#include "frontier_runs.h"
+#include "logger.h"
+#include "rate_limiter.h"
+#include "redis_scripts.h"
+#include "shard_router.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "types.h"
+#include "url_processor.h"
+#include "write_behind.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <hiredis/hiredis.h>
+
+#define CHECKPOINT_HEADER_LEN 13    // Magic, version and write time
+#define ROBOTS_DEFAULT_TTL 86400    // Lifetime of rules that had none
+
+extern thread_pool_t *scraper_pool;  // Defined in scraper.c
+extern rate_limiter_t *rate_limiter; // Defined in url_processor.c
+
+// Growable output buffer; failed is set once an allocation fails
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} cp_buf_t;
+
+// Bounds-checked reader over a loaded checkpoint
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    int failed;
+} cp_reader_t;
+
+// Counter slot patched in once the entries after it are written
+typedef struct {
+    cp_buf_t *buf;
+    size_t count_at;
+    uint32_t count;
+} cp_section_t;
+
+// A saved domain's robots rules, located for the restore
+typedef struct {
+    char key[SHARD_KEY_MAX];
+    int node;
+    long long ttl;
+    size_t rules_at;    // Reader position of the allow count
+    int missing;        // Redis no longer has the rules
+} robots_entry_t;
+
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;   // One writer at a time
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t checkpoint_thread;
+static int running = 0;
+static char *checkpoint_path = NULL;
+static int checkpoint_interval = CHECKPOINT_INTERVAL;
+
+static void put_bytes(cp_buf_t *buf, const void *data, size_t len) {
+    if (buf->failed) {
+        return;
+    }
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) {
+            cap *= 2;
+        }
+        unsigned char *grown = realloc(buf->data, cap);
+        if (!grown) {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void put_u32(cp_buf_t *buf, uint32_t value) {
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+    put_bytes(buf, bytes, 4);
+}
+
+static void put_u64(cp_buf_t *buf, uint64_t value) {
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+    put_bytes(buf, bytes, 8);
+}
+
+static void put_f64(cp_buf_t *buf, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u64(buf, bits);
+}
+
+static void put_str(cp_buf_t *buf, const char *str, size_t len) {
+    put_u32(buf, (uint32_t)len);
+    put_bytes(buf, str, len);
+}
+
+// Start a section whose entry count is filled in by section_end()
+static void section_begin(cp_section_t *section, cp_buf_t *buf) {
+    section->buf = buf;
+    section->count_at = buf->len;
+    section->count = 0;
+    put_u32(buf, 0);
+}
+
+static void section_end(cp_section_t *section) {
+    if (section->buf->failed) {
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        section->buf->data[section->count_at + i] = (section->count >> (8 * i)) & 0xFF;
+    }
+}
+
+static const unsigned char *get_bytes(cp_reader_t *reader, size_t len) {
+    if (reader->failed || len > reader->len - reader->pos) {
+        reader->failed = 1;
+        return NULL;
+    }
+    const unsigned char *bytes = reader->data + reader->pos;
+    reader->pos += len;
+    return bytes;
+}
+
+static uint32_t get_u32(cp_reader_t *reader) {
+    const unsigned char *bytes = get_bytes(reader, 4);
+    uint32_t value = 0;
+    for (int i = 0; bytes && i < 4; i++) {
+        value |= (uint32_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t get_u64(cp_reader_t *reader) {
+    const unsigned char *bytes = get_bytes(reader, 8);
+    uint64_t value = 0;
+    for (int i = 0; bytes && i < 8; i++) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static double get_f64(cp_reader_t *reader) {
+    uint64_t bits = get_u64(reader);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// A string in place; not NUL-terminated
+static const char *get_str(cp_reader_t *reader, uint32_t *len) {
+    *len = get_u32(reader);
+    return (const char *)get_bytes(reader, *len);
+}
+
+// A string copied out and NUL-terminated, or NULL
+static char *get_str_copy(cp_reader_t *reader) {
+    uint32_t len;
+    const char *str = get_str(reader, &len);
+    return str ? strndup(str, len) : NULL;
+}
+
+// Copy the rate limiter's domains so no Redis I/O happens under its lock
+static domain_rate_t *snapshot_domains(int *count) {
+    *count = 0;
+    if (!rate_limiter) {
+        return NULL;
+    }
+    pthread_mutex_lock(&rate_limiter->mutex);
+    domain_rate_t *domains = rate_limiter->domain_count > 0 ?
+        malloc(rate_limiter->domain_count * sizeof(domain_rate_t)) : NULL;
+    for (int i = 0; domains && i < rate_limiter->domain_count; i++) {
+        domains[*count] = rate_limiter->domains[i];
+        if ((domains[*count].domain = strdup(rate_limiter->domains[i].domain)) != NULL) {
+            (*count)++;
+        }
+    }
+    pthread_mutex_unlock(&rate_limiter->mutex);
+    return domains;
+}
+
+static void put_counters(cp_buf_t *buf) {
+    ScraperStats saved;
+    stats_snapshot(&saved, NULL, NULL);
+
+    time_t now = time(NULL);
+    put_u64(buf, saved.urls_processed);
+    put_u64(buf, saved.urls_skipped);
+    put_u64(buf, saved.urls_disallowed);
+    put_u64(buf, saved.bytes_downloaded);
+    put_u64(buf, now > saved.start_time ? (uint64_t)(now - saved.start_time) : 0);
+}
+
+static void put_domains(cp_buf_t *buf, const domain_rate_t *domains, int count) {
+    put_u32(buf, (uint32_t)count);
+    for (int i = 0; i < count; i++) {
+        put_str(buf, domains[i].domain, strlen(domains[i].domain));
+        put_f64(buf, domains[i].min_delay);
+        put_f64(buf, domains[i].current_delay);
+        put_u64(buf, (uint64_t)domains[i].last_request);
+        put_u32(buf, (uint32_t)domains[i].consecutive_errors);
+    }
+}
+
+static void put_rule_list(cp_buf_t *buf, const redisReply *reply) {
+    int usable = reply && reply->type == REDIS_REPLY_ARRAY;
+    put_u32(buf, usable ? (uint32_t)reply->elements : 0);
+    for (size_t i = 0; usable && i < reply->elements; i++) {
+        const redisReply *rule = reply->element[i];
+        if (rule->type == REDIS_REPLY_STRING) {
+            put_str(buf, rule->str, rule->len);
+        } else {
+            put_str(buf, "", 0);
+        }
+    }
+}
+
+// Read every domain's robots rules, one pipeline per node
+static void put_robots(cp_buf_t *buf, const domain_rate_t *domains, int count) {
+    cp_section_t section;
+    section_begin(&section, buf);
+    char (*keys)[SHARD_KEY_MAX] = count > 0 ? malloc(count * sizeof(*keys)) : NULL;
+    int *nodes = count > 0 ? malloc(count * sizeof(int)) : NULL;
+    redisReply **replies = count > 0 ? calloc(count * 3, sizeof(redisReply *)) : NULL;
+    if (!keys || !nodes || !replies) {
+        free(keys);
+        free(nodes);
+        free(replies);
+        section_end(&section);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        nodes[i] = shard_tag_key(keys[i], SHARD_KEY_MAX, ROBOTS_KEY_PREFIX,
+                                 domains[i].domain, NULL) == 0 ? shard_for_key(keys[i]) : -1;
+    }
+
+    for (int node = 0; node < shard_count(); node++) {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (nodes[i] == node) {
+                redisAppendCommand(ctx, "LRANGE %s:allow 0 -1", keys[i]);
+                redisAppendCommand(ctx, "LRANGE %s:disallow 0 -1", keys[i]);
+                redisAppendCommand(ctx, "TTL %s:allow", keys[i]);
+            }
+        }
+        int ok = 1;
+        for (int i = 0; i < count; i++) {
+            for (int j = 0; nodes[i] == node && j < 3; j++) {
+                redisReply *reply = NULL;
+                if (ok && redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+                    ok = 0;
+                }
+                replies[i * 3 + j] = ok ? reply : NULL;
+            }
+        }
+        shard_release(node);
+        if (!ok) {
+            LOG_WARNING("Failed to read robots rules from Redis node %d", node);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        redisReply *allow = replies[i * 3], *disallow = replies[i * 3 + 1];
+        redisReply *ttl = replies[i * 3 + 2];
+        int has_rules = (allow && allow->type == REDIS_REPLY_ARRAY && allow->elements > 0) ||
+                        (disallow && disallow->type == REDIS_REPLY_ARRAY && disallow->elements > 0);
+        if (has_rules) {
+            put_str(buf, domains[i].domain, strlen(domains[i].domain));
+            put_u64(buf, ttl && ttl->type == REDIS_REPLY_INTEGER && ttl->integer > 0 ?
+                         (uint64_t)ttl->integer : ROBOTS_DEFAULT_TTL);
+            put_rule_list(buf, allow);
+            put_rule_list(buf, disallow);
+            section.count++;
+        }
+        for (int j = 0; j < 3; j++) {
+            if (replies[i * 3 + j]) {
+                freeReplyObject(replies[i * 3 + j]);
+            }
+        }
+    }
+    free(keys);
+    free(nodes);
+    free(replies);
+    section_end(&section);
+}
+
+static void put_run(const char *path, long offset, int skip, void *ctx) {
+    cp_section_t *section = ctx;
+    put_str(section->buf, path, strlen(path));
+    put_u64(section->buf, (uint64_t)offset);
+    put_u32(section->buf, (uint32_t)skip);
+    section->count++;
+}
+
+static void put_task(cp_section_t *section, const url_task_t *task) {
+    put_str(section->buf, task->url, strlen(task->url));
+    put_u32(section->buf, (uint32_t)task->priority);
+    put_u32(section->buf, (uint32_t)task->depth);
+    section->count++;
+}
+
+static void put_queued_task(void *(*function)(void *), void *arg, void *ctx) {
+    const url_task_t *task = arg;
+    if (function == process_url_thread && task && task->url) {
+        put_task(ctx, task);
+    }
+}
+
+static void put_inflight_task(const url_task_t *task, void *ctx) {
+    put_task(ctx, task);
+}
+
+// Write a checkpoint of the current crawl state
+int checkpoint_write(const char *path) {
+    if (!path) {
+        return -1;
+    }
+    pthread_mutex_lock(&write_mutex);
+    cp_buf_t buf = {0};
+    cp_section_t section;
+
+    put_bytes(&buf, CHECKPOINT_MAGIC, 4);
+    unsigned char version = CHECKPOINT_VERSION;
+    put_bytes(&buf, &version, 1);
+    put_u64(&buf, (uint64_t)time(NULL));
+    put_counters(&buf);
+
+    int domain_count;
+    domain_rate_t *domains = snapshot_domains(&domain_count);
+    put_domains(&buf, domains, domain_count);
+    put_robots(&buf, domains, domain_count);
+    for (int i = 0; i < domain_count; i++) {
+        free(domains[i].domain);
+    }
+    free(domains);
+
+    section_begin(&section, &buf);
+    frontier_runs_for_each(put_run, &section);
+    section_end(&section);
+
+    // In-flight tasks first; a task picked up between the two walks is
+    // saved twice, and the claim check drops the second copy
+    section_begin(&section, &buf);
+    url_processor_for_each_inflight(put_inflight_task, &section);
+    if (scraper_pool) {
+        thread_pool_for_each_queued(scraper_pool, put_queued_task, &section);
+    }
+    section_end(&section);
+    uint32_t task_count = section.count;
+
+    put_u64(&buf, content_hash64(buf.data, buf.len, 0));
+    if (buf.failed) {
+        LOG_ERROR("Failed to allocate memory for checkpoint");
+        free(buf.data);
+        pthread_mutex_unlock(&write_mutex);
+        return -1;
+    }
+
+    // Replace the previous checkpoint only once the new one is on disk
+    size_t tmp_size = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_size);
+    FILE *fp = NULL;
+    int ok = tmp_path != NULL;
+    if (ok) {
+        snprintf(tmp_path, tmp_size, "%s.tmp", path);
+        fp = fopen(tmp_path, "wb");
+        ok = fp != NULL;
+    }
+    if (ok) {
+        ok = fwrite(buf.data, 1, buf.len, fp) == buf.len && fflush(fp) == 0 &&
+             fsync(fileno(fp)) == 0;
+        ok = fclose(fp) == 0 && ok;
+        ok = ok && rename(tmp_path, path) == 0;
+        if (!ok) {
+            unlink(tmp_path);
+        }
+    }
+    if (ok) {
+        LOG_DEBUG("Checkpoint written to %s (%zu bytes, %u tasks)", path, buf.len, task_count);
+    } else {
+        LOG_ERROR("Failed to write checkpoint %s: %s", path, strerror(errno));
+    }
+    free(tmp_path);
+    free(buf.data);
+    pthread_mutex_unlock(&write_mutex);
+    return ok ? 0 : -1;
+}
+
+// Load a checkpoint file and check its header and checksum
+static unsigned char *load_checkpoint(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    unsigned char *data = NULL;
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= CHECKPOINT_HEADER_LEN + 8 &&
+        fseek(fp, 0, SEEK_SET) == 0 && (data = malloc(size)) != NULL &&
+        fread(data, 1, size, fp) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    if (!data) {
+        return NULL;
+    }
+
+    cp_reader_t trailer = {data, size, size - 8, 0};
+    if (memcmp(data, CHECKPOINT_MAGIC, 4) != 0 || data[4] != CHECKPOINT_VERSION ||
+        get_u64(&trailer) != content_hash64(data, size - 8, 0)) {
+        free(data);
+        return NULL;
+    }
+    *len = size - 8;
+    return data;
+}
+
+static void restore_counters(cp_reader_t *reader) {
+    ScraperStats saved = {0};
+    saved.urls_processed = get_u64(reader);
+    saved.urls_skipped = get_u64(reader);
+    saved.urls_disallowed = get_u64(reader);
+    saved.bytes_downloaded = get_u64(reader);
+    time_t elapsed = (time_t)get_u64(reader);
+    if (reader->failed) {
+        return;
+    }
+
+    stats_restore(&saved, elapsed);
+}
+
+static void restore_domains(cp_reader_t *reader) {
+    uint32_t count = get_u32(reader);
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+        domain_rate_t saved = {0};
+        saved.domain = get_str_copy(reader);
+        saved.min_delay = get_f64(reader);
+        saved.current_delay = get_f64(reader);
+        saved.last_request = (time_t)get_u64(reader);
+        saved.consecutive_errors = (int)get_u32(reader);
+        if (!reader->failed && rate_limiter) {
+            rate_limiter_restore(&saved, rate_limiter);
+        }
+        free(saved.domain);
+    }
+}
+
+static void skip_rule_list(cp_reader_t *reader) {
+    uint32_t count = get_u32(reader), len;
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+        get_str(reader, &len);
+    }
+}
+
+// Queue the writes that put one domain's rules back
+// Returns the number of commands appended
+static int append_rule_writes(redisContext *ctx, cp_reader_t *reader, const robots_entry_t *entry) {
+    int appended = 0;
+    redisAppendCommand(ctx, "MULTI");
+    redisAppendCommand(ctx, "DEL %s:allow %s:disallow", entry->key, entry->key);
+    appended += 2;
+    const char *lists[] = {"allow", "disallow"};
+    for (int l = 0; l < 2; l++) {
+        uint32_t count = get_u32(reader), len;
+        for (uint32_t i = 0; i < count && !reader->failed; i++) {
+            const char *rule = get_str(reader, &len);
+            if (rule) {
+                redisAppendCommand(ctx, "RPUSH %s:%s %b", entry->key, lists[l], rule, (size_t)len);
+                appended++;
+            }
+        }
+    }
+    redisAppendCommand(ctx, "EXPIRE %s:allow %lld", entry->key, entry->ttl);
+    redisAppendCommand(ctx, "EXPIRE %s:disallow %lld", entry->key, entry->ttl);
+    redisAppendCommand(ctx, "EXEC");
+    return appended + 3;
+}
+
+static int drain_replies(redisContext *ctx, int count) {
+    int ok = 1;
+    for (int i = 0; i < count && ok; i++) {
+        redisReply *reply = NULL;
+        ok = redisGetReply(ctx, (void **)&reply) == REDIS_OK;
+        if (reply) {
+            freeReplyObject(reply);
+        }
+    }
+    return ok;
+}
+
+// Put back the robots rules Redis no longer has, one node at a time:
+// one pipeline to find the missing ones, one to write them
+static void restore_robots(cp_reader_t *reader, time_t age) {
+    uint32_t count = get_u32(reader);
+    robots_entry_t *entries = count > 0 && count <= reader->len ?
+        calloc(count, sizeof(robots_entry_t)) : NULL;
+    if (!entries) {
+        reader->failed = reader->failed || count > 0;
+        return;
+    }
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+        char *domain = get_str_copy(reader);
+        long long ttl = (long long)get_u64(reader) - age;
+        entries[i].rules_at = reader->pos;
+        skip_rule_list(reader);
+        skip_rule_list(reader);
+        entries[i].node = domain && ttl > 0 &&
+                          shard_tag_key(entries[i].key, SHARD_KEY_MAX, ROBOTS_KEY_PREFIX,
+                                        domain, NULL) == 0 ? shard_for_key(entries[i].key) : -1;
+        entries[i].ttl = ttl;
+        free(domain);
+    }
+    if (reader->failed) {
+        free(entries);
+        return;
+    }
+    size_t end = reader->pos;
+
+    int restored = 0;
+    for (int node = 0; node < shard_count(); node++) {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            continue;
+        }
+        int checks = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (entries[i].node == node) {
+                redisAppendCommand(ctx, "EXISTS %s:allow", entries[i].key);
+                checks++;
+            }
+        }
+        int ok = 1;
+        for (uint32_t i = 0; i < count && ok; i++) {
+            redisReply *reply = NULL;
+            if (entries[i].node != node) {
+                continue;
+            }
+            ok = redisGetReply(ctx, (void **)&reply) == REDIS_OK;
+            entries[i].missing = ok && reply->type == REDIS_REPLY_INTEGER && reply->integer == 0;
+            if (reply) {
+                freeReplyObject(reply);
+            }
+        }
+
+        int writes = 0;
+        for (uint32_t i = 0; i < count && ok; i++) {
+            if (entries[i].node == node && entries[i].missing) {
+                reader->pos = entries[i].rules_at;
+                writes += append_rule_writes(ctx, reader, &entries[i]);
+                restored++;
+            }
+        }
+        if (ok && !drain_replies(ctx, writes)) {
+            ok = 0;
+        }
+        shard_release(node);
+        if (!ok) {
+            LOG_WARNING("Failed to restore robots rules on Redis node %d (%d lookups)", node, checks);
+        }
+    }
+    reader->pos = end;
+    free(entries);
+    if (restored > 0) {
+        LOG_INFO("Restored robots rules of %d domains", restored);
+    }
+}
+
+static void restore_runs(cp_reader_t *reader) {
+    uint32_t count = get_u32(reader);
+    int missing = 0;
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+        char *path = get_str_copy(reader);
+        long offset = (long)get_u64(reader);
+        int skip = (int)get_u32(reader);
+        if (path && !reader->failed && frontier_runs_seek(path, offset, skip) != 0) {
+            missing++;
+        }
+        free(path);
+    }
+    if (missing > 0) {
+        LOG_DEBUG("%d checkpointed frontier runs are gone or were compacted", missing);
+    }
+}
+
+// Requeue the saved tasks; their claims are dropped first so the workers
+// of this process are not turned away by claims of the one that stopped
+static int restore_tasks(cp_reader_t *reader) {
+    uint32_t count = get_u32(reader);
+    url_task_t **tasks = count > 0 && count <= reader->len ?
+        calloc(count, sizeof(url_task_t *)) : NULL;
+    if (!tasks) {
+        return count > 0 ? -1 : 0;
+    }
+    uint32_t loaded = 0;
+    for (uint32_t i = 0; i < count && !reader->failed; i++) {
+        char *url = get_str_copy(reader);
+        int priority = (int32_t)get_u32(reader);
+        int depth = (int32_t)get_u32(reader);
+        url_task_t *task = url && !reader->failed ? url_task_create(url, priority, depth) : NULL;
+        free(url);
+        if (!task) {
+            continue;
+        }
+        tasks[loaded++] = task;
+        release_claim(task->url);
+    }
+    write_behind_flush();
+
+    int queued = 0;
+    for (uint32_t i = 0; i < loaded; i++) {
+        if (scraper_pool && thread_pool_add_task(scraper_pool, process_url_thread, tasks[i])) {
+            queued++;
+        } else {
+            LOG_ERROR("Failed to requeue checkpointed URL: %s", tasks[i]->url);
+            free(tasks[i]);
+        }
+    }
+    free(tasks);
+    return queued;
+}
+
+// Restore the crawl state saved in path
+int checkpoint_restore(const char *path) {
+    size_t len;
+    unsigned char *data = path ? load_checkpoint(path, &len) : NULL;
+    if (!data) {
+        LOG_ERROR("No usable checkpoint at %s", path ? path : "(null)");
+        return -1;
+    }
+    cp_reader_t reader = {data, len, 4 + 1, 0};
+    time_t written = (time_t)get_u64(&reader);
+    time_t now = time(NULL);
+    time_t age = now > written ? now - written : 0;
+
+    restore_counters(&reader);
+    restore_domains(&reader);
+    restore_robots(&reader, age);
+    restore_runs(&reader);
+    int queued = reader.failed ? -1 : restore_tasks(&reader);
+    free(data);
+    if (reader.failed || queued < 0) {
+        LOG_ERROR("Checkpoint %s is damaged; resumed partially", path);
+        return -1;
+    }
+    LOG_INFO("Resumed from checkpoint %s written %ld seconds ago, %d tasks requeued",
+             path, (long)age, queued);
+    return queued;
+}
+
+static void *checkpoint_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&thread_mutex);
+    while (running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += checkpoint_interval;
+        pthread_cond_timedwait(&thread_wake, &thread_mutex, &deadline);
+        if (!running) {
+            break;
+        }
+        pthread_mutex_unlock(&thread_mutex);
+        checkpoint_write(checkpoint_path);
+        pthread_mutex_lock(&thread_mutex);
+    }
+    pthread_mutex_unlock(&thread_mutex);
+    return NULL;
+}
+
+// Write a checkpoint to path every interval seconds
+int checkpoint_start(const char *path, int interval) {
+    pthread_mutex_lock(&thread_mutex);
+    if (running || !path) {
+        pthread_mutex_unlock(&thread_mutex);
+        return running ? 0 : -1;
+    }
+    free(checkpoint_path);
+    checkpoint_path = strdup(path);
+    checkpoint_interval = interval > 0 ? interval : CHECKPOINT_INTERVAL;
+    running = checkpoint_path != NULL;
+    if (running && pthread_create(&checkpoint_thread, NULL, checkpoint_main, NULL) != 0) {
+        LOG_ERROR("Failed to start checkpoint thread: %s", strerror(errno));
+        running = 0;
+    }
+    int started = running;
+    pthread_mutex_unlock(&thread_mutex);
+    if (started) {
+        LOG_INFO("Checkpointing to %s every %d seconds", path, checkpoint_interval);
+    }
+    return started ? 0 : -1;
+}
+
+// Stop the checkpoint thread and write a final checkpoint
+void checkpoint_stop(void) {
+    pthread_mutex_lock(&thread_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&thread_mutex);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&thread_wake);
+    pthread_mutex_unlock(&thread_mutex);
+    pthread_join(checkpoint_thread, NULL);
+
+    checkpoint_write(checkpoint_path);
+    free(checkpoint_path);
+    checkpoint_path = NULL;
+}
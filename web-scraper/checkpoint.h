@@ -0,0 +1,53 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Crawl checkpoints
+//
+// Most crawl state already outlives the process in Redis: the frontier,
+// the visited sets and robots rules. What does not is held here: tasks
+// queued in or being run by the thread pool, per-domain rate limiter
+// delays, how far each spilled frontier run has been read, and the crawl
+// counters. A checkpoint also copies the robots rules of every domain the
+// rate limiter knows, with their remaining lifetime, so a resume after the
+// rules expired or Redis lost them does not refetch every robots.txt.
+//
+// Checkpoints are written every CHECKPOINT_INTERVAL seconds by a
+// background thread and once more on shutdown. The file is built in
+// memory, written to <path>.tmp, synced and renamed over <path>, so a
+// crash mid-write leaves the previous checkpoint intact.
+//
+// File layout (version 1), integers little-endian, strings as a 4-byte
+// length and bytes:
+//   "WSCP", version byte, 8-byte write time
+//   counters: processed, skipped, disallowed, bytes, elapsed seconds (8 bytes each)
+//   4-byte domain count, per domain: name, min and current delay
+//     (IEEE doubles), 8-byte last request time, 4-byte error count
+//   4-byte robots count, per domain: name, 8-byte remaining lifetime,
+//     4-byte allow count and rules, 4-byte disallow count and rules
+//   4-byte run count, per run: path, 8-byte offset, 4-byte skip
+//   4-byte task count, per task: URL, 4-byte priority, 4-byte depth
+//   8-byte content_hash64 of everything before it
+
+#define CHECKPOINT_MAGIC "WSCP"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_FILE "crawler.checkpoint"
+#define CHECKPOINT_INTERVAL 30    // Seconds between checkpoints
+
+// Write a checkpoint of the current crawl state to path
+// Returns 0 on success, -1 on failure
+int checkpoint_write(const char *path);
+
+// Restore the crawl state saved in path and requeue its tasks. Call after
+// init_scraper(); counters are added to the current ones.
+// Returns the number of tasks requeued, or -1 if the file is missing or damaged
+int checkpoint_restore(const char *path);
+
+// Write a checkpoint to path every interval seconds
+// Returns 0 on success, -1 if the thread could not be started
+int checkpoint_start(const char *path, int interval);
+
+// Stop the checkpoint thread and write a final checkpoint. Call before
+// the thread pool is destroyed so queued tasks are still there to save.
+void checkpoint_stop(void);
+
+#endif // CHECKPOINT_H
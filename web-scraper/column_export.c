@@ -0,0 +1,1167 @@
+#include "column_export.h"
+#include "analysis_codec.h"
+#include "content_analyzer.h"
+#include "content_hash.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include "shard_router.h"
+#include <errno.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ANALYSIS_KEY_PREFIX "analysis:"
+
+enum {
+    COL_URL,
+    COL_CRAWL_TIME,
+    COL_STATUS_CODE,
+    COL_CONTENT_SIZE,
+    COL_CONTENT_TYPE,
+    COL_TITLE,
+    COL_DESCRIPTION,
+    COL_KEYWORDS,
+    COL_AUTHOR,
+    COL_PUBLISH_DATE,
+    COL_LANGUAGE,
+    COL_SENTIMENT,
+    COL_TOPIC_COUNT,
+    COL_TOPICS,
+    COL_ENTITY_COUNT,
+    COL_ENTITIES,
+    COL_CATEGORY_COUNT,
+    COL_CATEGORIES,
+    EXPORT_COLUMNS
+};
+
+static const struct {
+    const char *name;
+    int type;
+} COLUMNS[EXPORT_COLUMNS] = {
+    {"url", EXPORT_TYPE_STRING},
+    {"crawl_time", EXPORT_TYPE_INT},
+    {"status_code", EXPORT_TYPE_INT},
+    {"content_size", EXPORT_TYPE_INT},
+    {"content_type", EXPORT_TYPE_STRING},
+    {"title", EXPORT_TYPE_STRING},
+    {"description", EXPORT_TYPE_STRING},
+    {"keywords", EXPORT_TYPE_STRING},
+    {"author", EXPORT_TYPE_STRING},
+    {"publish_date", EXPORT_TYPE_STRING},
+    {"language", EXPORT_TYPE_STRING},
+    {"sentiment", EXPORT_TYPE_FLOAT},
+    {"topic_count", EXPORT_TYPE_INT},
+    {"topics", EXPORT_TYPE_STRING},
+    {"entity_count", EXPORT_TYPE_INT},
+    {"entities", EXPORT_TYPE_STRING},
+    {"category_count", EXPORT_TYPE_INT},
+    {"categories", EXPORT_TYPE_STRING}
+};
+
+// Values of one column in a row group
+typedef struct {
+    size_t count;
+    size_t capacity;
+    char **strs;      // EXPORT_TYPE_STRING; NULL entries are NULL values
+    int64_t *ints;    // EXPORT_TYPE_INT
+    float *floats;    // EXPORT_TYPE_FLOAT
+} column_t;
+
+typedef struct {
+    column_t cols[EXPORT_COLUMNS];
+    size_t rows;
+} row_group_t;
+
+// Growable output buffer
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} out_buf_t;
+
+// An export file being written
+typedef struct {
+    FILE *fp;
+    char path[1024];
+    char tmp_path[1100];
+    uint64_t pos;
+    uint64_t *offsets;
+    uint64_t *rows;
+    size_t groups;
+    size_t groups_capacity;
+} export_file_t;
+
+static char *export_dir = NULL;
+static row_group_t pending;
+static int running = 0;
+static unsigned long file_seq = 0;
+static pthread_t export_thread;
+static export_stats_t stats;
+
+static pthread_mutex_t export_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_cond = PTHREAD_COND_INITIALIZER;
+
+// Write export files under dir
+void export_set_dir(const char *dir) {
+    free(export_dir);
+    export_dir = dir ? strdup(dir) : NULL;
+}
+
+// Export directory, or NULL if exporting is disabled
+const char *export_get_dir(void) {
+    return export_dir;
+}
+
+static void buf_reserve(out_buf_t *b, size_t n) {
+    if (b->failed || b->len + n <= b->capacity) {
+        return;
+    }
+    size_t capacity = b->capacity ? b->capacity * 2 : 4096;
+    while (capacity < b->len + n) {
+        capacity *= 2;
+    }
+    unsigned char *grown = realloc(b->data, capacity);
+    if (!grown) {
+        b->failed = 1;
+        return;
+    }
+    b->data = grown;
+    b->capacity = capacity;
+}
+
+static void put_bytes(out_buf_t *b, const void *data, size_t n) {
+    buf_reserve(b, n);
+    if (!b->failed) {
+        memcpy(b->data + b->len, data, n);
+        b->len += n;
+    }
+}
+
+static void put_u8(out_buf_t *b, uint8_t v) {
+    put_bytes(b, &v, 1);
+}
+
+static void put_varint(out_buf_t *b, uint64_t v) {
+    unsigned char tmp[10];
+    size_t n = 0;
+    do {
+        tmp[n] = v & 0x7F;
+        v >>= 7;
+        if (v) {
+            tmp[n] |= 0x80;
+        }
+        n++;
+    } while (v);
+    put_bytes(b, tmp, n);
+}
+
+static void put_zigzag(out_buf_t *b, int64_t v) {
+    put_varint(b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static void put_le32(out_buf_t *b, uint32_t v) {
+    unsigned char tmp[4] = {v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, (v >> 24) & 0xFF};
+    put_bytes(b, tmp, 4);
+}
+
+static void put_le64(out_buf_t *b, uint64_t v) {
+    put_le32(b, v & 0xFFFFFFFF);
+    put_le32(b, v >> 32);
+}
+
+// Make room for n more values in a column
+static int column_reserve(column_t *c, int type, size_t n) {
+    if (c->count + n <= c->capacity) {
+        return 0;
+    }
+    size_t capacity = c->capacity ? c->capacity * 2 : 256;
+    while (capacity < c->count + n) {
+        capacity *= 2;
+    }
+    if (type == EXPORT_TYPE_STRING) {
+        char **grown = realloc(c->strs, capacity * sizeof(char *));
+        if (!grown) return -1;
+        c->strs = grown;
+    } else if (type == EXPORT_TYPE_INT) {
+        int64_t *grown = realloc(c->ints, capacity * sizeof(int64_t));
+        if (!grown) return -1;
+        c->ints = grown;
+    } else {
+        float *grown = realloc(c->floats, capacity * sizeof(float));
+        if (!grown) return -1;
+        c->floats = grown;
+    }
+    c->capacity = capacity;
+    return 0;
+}
+
+// Free a row group's values and empty it
+static void group_clear(row_group_t *g) {
+    for (int i = 0; i < EXPORT_COLUMNS; i++) {
+        column_t *c = &g->cols[i];
+        for (size_t j = 0; c->strs && j < c->count; j++) {
+            free(c->strs[j]);
+        }
+        free(c->strs);
+        free(c->ints);
+        free(c->floats);
+    }
+    memset(g, 0, sizeof(*g));
+}
+
+// Append to a column with room reserved; a string that cannot be copied is stored as NULL
+static void push_str(column_t *c, const char *s) {
+    c->strs[c->count++] = s ? strdup(s) : NULL;
+}
+
+static void push_int(column_t *c, int64_t v) {
+    c->ints[c->count++] = v;
+}
+
+// Append a page to a row group; space is reserved first so a row is
+// either added whole or not at all
+static int group_add(row_group_t *g, const export_page_t *page) {
+    const content_analysis_t *a = page->analysis;
+    int topics = a ? a->topic_count : 0;
+    int entities = a ? a->entity_count : 0;
+    int categories = a ? a->category_count : 0;
+    for (int i = 0; i < EXPORT_COLUMNS; i++) {
+        size_t n = i == COL_TOPICS ? (size_t)topics : i == COL_ENTITIES ? (size_t)entities :
+                   i == COL_CATEGORIES ? (size_t)categories : 1;
+        if (column_reserve(&g->cols[i], COLUMNS[i].type, n) != 0) {
+            return -1;
+        }
+    }
+
+    column_t *c = g->cols;
+    push_str(&c[COL_URL], page->url);
+    push_int(&c[COL_CRAWL_TIME], (int64_t)page->crawl_time);
+    push_int(&c[COL_STATUS_CODE], page->status_code);
+    push_int(&c[COL_CONTENT_SIZE], (int64_t)page->content_size);
+    push_str(&c[COL_CONTENT_TYPE], page->content_type);
+    push_str(&c[COL_TITLE], a ? a->title : NULL);
+    push_str(&c[COL_DESCRIPTION], a ? a->description : NULL);
+    push_str(&c[COL_KEYWORDS], a ? a->keywords : NULL);
+    push_str(&c[COL_AUTHOR], a ? a->author : NULL);
+    push_str(&c[COL_PUBLISH_DATE], a ? a->publish_date : NULL);
+    push_str(&c[COL_LANGUAGE], a ? a->language : NULL);
+    c[COL_SENTIMENT].floats[c[COL_SENTIMENT].count++] = a ? a->sentiment_score : 0.0f;
+    push_int(&c[COL_TOPIC_COUNT], topics);
+    for (int i = 0; i < topics; i++) {
+        push_str(&c[COL_TOPICS], a->topics[i]);
+    }
+    push_int(&c[COL_ENTITY_COUNT], entities);
+    for (int i = 0; i < entities; i++) {
+        push_str(&c[COL_ENTITIES], a->entities[i]);
+    }
+    push_int(&c[COL_CATEGORY_COUNT], categories);
+    for (int i = 0; i < categories; i++) {
+        push_str(&c[COL_CATEGORIES], a->categories[i]);
+    }
+    g->rows++;
+    return 0;
+}
+
+// Encode a string column, dictionary-encoded when it repeats enough
+// Returns the encoding used
+static int encode_strings(out_buf_t *b, const column_t *c) {
+    size_t table_size = 16;
+    while (table_size < c->count * 2) {
+        table_size *= 2;
+    }
+    uint32_t *table = calloc(table_size, sizeof(uint32_t));       // Dictionary index + 1
+    uint32_t *indexes = malloc((c->count + 1) * sizeof(uint32_t)); // 0 is NULL
+    const char **dict = malloc((c->count + 1) * sizeof(char *));
+    size_t dict_size = 0;
+    size_t runs = 0;
+
+    for (size_t i = 0; table && indexes && dict && i < c->count; i++) {
+        const char *s = c->strs[i];
+        uint32_t index = 0;
+        if (s) {
+            size_t mask = table_size - 1;
+            size_t slot = content_hash64(s, strlen(s), 0) & mask;
+            while (table[slot] && strcmp(dict[table[slot] - 1], s) != 0) {
+                slot = (slot + 1) & mask;
+            }
+            if (!table[slot]) {
+                dict[dict_size++] = s;
+                table[slot] = dict_size;
+            }
+            index = table[slot];
+        }
+        indexes[i] = index;
+        if (i == 0 || indexes[i - 1] != index) {
+            runs++;
+        }
+    }
+
+    int encoding = EXPORT_PLAIN_STRING;
+    if (table && indexes && dict && c->count > 0 && dict_size * 2 <= c->count) {
+        encoding = EXPORT_DICT_STRING;
+        put_varint(b, dict_size);
+        for (size_t i = 0; i < dict_size; i++) {
+            size_t len = strlen(dict[i]);
+            put_varint(b, len);
+            put_bytes(b, dict[i], len);
+        }
+        for (size_t i = 0; i < c->count;) {
+            size_t run = 1;
+            while (i + run < c->count && indexes[i + run] == indexes[i]) {
+                run++;
+            }
+            put_varint(b, run);
+            put_varint(b, indexes[i]);
+            i += run;
+        }
+    } else {
+        for (size_t i = 0; i < c->count; i++) {
+            const char *s = c->strs[i];
+            size_t len = s ? strlen(s) : 0;
+            put_varint(b, s ? len + 1 : 0);
+            put_bytes(b, s, len);
+        }
+    }
+    free(table);
+    free(indexes);
+    free(dict);
+    return encoding;
+}
+
+// Encode an integer column, run-length encoded when runs are long enough
+static int encode_ints(out_buf_t *b, const column_t *c) {
+    size_t runs = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        if (i == 0 || c->ints[i] != c->ints[i - 1]) {
+            runs++;
+        }
+    }
+    if (c->count == 0 || runs * 2 > c->count) {
+        for (size_t i = 0; i < c->count; i++) {
+            put_zigzag(b, c->ints[i]);
+        }
+        return EXPORT_PLAIN_INT;
+    }
+    for (size_t i = 0; i < c->count;) {
+        size_t run = 1;
+        while (i + run < c->count && c->ints[i + run] == c->ints[i]) {
+            run++;
+        }
+        put_varint(b, run);
+        put_zigzag(b, c->ints[i]);
+        i += run;
+    }
+    return EXPORT_RLE_INT;
+}
+
+static int encode_floats(out_buf_t *b, const column_t *c) {
+    for (size_t i = 0; i < c->count; i++) {
+        uint32_t bits;
+        memcpy(&bits, &c->floats[i], sizeof(bits));
+        put_le32(b, bits);
+    }
+    return EXPORT_PLAIN_FLOAT;
+}
+
+// Create dir/<prefix>-<time>-<seq>.wsc under a temporary name
+static int file_open(export_file_t *f, const char *prefix) {
+    memset(f, 0, sizeof(*f));
+    if (mkdir(export_dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create export directory %s: %s", export_dir, strerror(errno));
+        return -1;
+    }
+    unsigned long seq = __atomic_add_fetch(&file_seq, 1, __ATOMIC_RELAXED);
+    snprintf(f->path, sizeof(f->path), "%s/%s-%ld-%lu.wsc", export_dir, prefix,
+             (long)time(NULL), seq);
+    snprintf(f->tmp_path, sizeof(f->tmp_path), "%s.tmp", f->path);
+    f->fp = fopen(f->tmp_path, "wb");
+    if (!f->fp) {
+        LOG_ERROR("Failed to create export file %s: %s", f->tmp_path, strerror(errno));
+        return -1;
+    }
+    if (fwrite(EXPORT_MAGIC, 1, 4, f->fp) != 4) {
+        fclose(f->fp);
+        unlink(f->tmp_path);
+        return -1;
+    }
+    f->pos = 4;
+    return 0;
+}
+
+// Write a row group, one chunk per column
+static int file_write_group(export_file_t *f, const row_group_t *g) {
+    if (g->rows == 0) {
+        return 0;
+    }
+    if (f->groups == f->groups_capacity) {
+        size_t capacity = f->groups_capacity ? f->groups_capacity * 2 : 16;
+        uint64_t *offsets = realloc(f->offsets, capacity * sizeof(uint64_t));
+        if (!offsets) return -1;
+        f->offsets = offsets;
+        uint64_t *rows = realloc(f->rows, capacity * sizeof(uint64_t));
+        if (!rows) return -1;
+        f->rows = rows;
+        f->groups_capacity = capacity;
+    }
+
+    out_buf_t group = {0}, chunk = {0};
+    put_varint(&group, g->rows);
+    put_varint(&group, EXPORT_COLUMNS);
+    for (int i = 0; i < EXPORT_COLUMNS; i++) {
+        const column_t *c = &g->cols[i];
+        chunk.len = 0;
+        int encoding = COLUMNS[i].type == EXPORT_TYPE_STRING ? encode_strings(&chunk, c) :
+                       COLUMNS[i].type == EXPORT_TYPE_INT ? encode_ints(&chunk, c) :
+                       encode_floats(&chunk, c);
+        put_varint(&group, i);
+        put_u8(&group, encoding);
+        put_varint(&group, c->count);
+        put_varint(&group, chunk.len);
+        put_bytes(&group, chunk.data, chunk.len);
+    }
+    int ok = !group.failed && !chunk.failed &&
+             fwrite(group.data, 1, group.len, f->fp) == group.len;
+    if (ok) {
+        f->offsets[f->groups] = f->pos;
+        f->rows[f->groups] = g->rows;
+        f->groups++;
+        f->pos += group.len;
+    }
+    free(group.data);
+    free(chunk.data);
+    return ok ? 0 : -1;
+}
+
+// Write the footer and publish the file; an empty file is discarded
+// Returns the file size, 0 if discarded, or -1 on failure
+static long file_close(export_file_t *f, int ok) {
+    out_buf_t footer = {0};
+    if (ok && f->groups > 0) {
+        put_varint(&footer, EXPORT_COLUMNS);
+        for (int i = 0; i < EXPORT_COLUMNS; i++) {
+            size_t len = strlen(COLUMNS[i].name);
+            put_varint(&footer, len);
+            put_bytes(&footer, COLUMNS[i].name, len);
+            put_u8(&footer, COLUMNS[i].type);
+        }
+        put_varint(&footer, f->groups);
+        for (size_t i = 0; i < f->groups; i++) {
+            put_le64(&footer, f->offsets[i]);
+            put_varint(&footer, f->rows[i]);
+        }
+        size_t footer_len = footer.len;
+        put_le32(&footer, footer_len);
+        put_bytes(&footer, EXPORT_MAGIC, 4);
+        ok = !footer.failed && fwrite(footer.data, 1, footer.len, f->fp) == footer.len;
+        ok = ok && fflush(f->fp) == 0 && fsync(fileno(f->fp)) == 0;
+    }
+    if (fclose(f->fp) != 0) {
+        ok = 0;
+    }
+    long size = ok ? 0 : -1;
+    if (ok && f->groups > 0) {
+        if (rename(f->tmp_path, f->path) == 0) {
+            size = (long)(f->pos + footer.len);
+        } else {
+            LOG_ERROR("Failed to publish export file %s: %s", f->path, strerror(errno));
+            size = -1;
+        }
+    }
+    if (size <= 0) {
+        unlink(f->tmp_path);
+    }
+    free(footer.data);
+    free(f->offsets);
+    free(f->rows);
+    return size;
+}
+
+// Write one row group as a file of its own
+static int write_group_file(const row_group_t *g, const char *prefix) {
+    export_file_t f;
+    if (file_open(&f, prefix) != 0) {
+        return -1;
+    }
+    long size = file_close(&f, file_write_group(&f, g) == 0);
+    if (size <= 0) {
+        return size < 0 ? -1 : 0;
+    }
+    pthread_mutex_lock(&export_mutex);
+    stats.files_written++;
+    stats.bytes_written += size;
+    stats.rows_exported += g->rows;
+    pthread_mutex_unlock(&export_mutex);
+    LOG_INFO("Exported %zu rows to %s", g->rows, f.path);
+    return 0;
+}
+
+// Write the pending row group; called and returns with export_mutex held
+static void flush_pending(void) {
+    if (pending.rows == 0) {
+        return;
+    }
+    row_group_t group = pending;
+    memset(&pending, 0, sizeof(pending));
+    pthread_mutex_unlock(&export_mutex);
+    if (write_group_file(&group, "pages") != 0) {
+        LOG_ERROR("Failed to export %zu rows", group.rows);
+    }
+    group_clear(&group);
+    pthread_mutex_lock(&export_mutex);
+}
+
+// Write a row group when one fills up and every EXPORT_INTERVAL seconds
+static void *export_thread_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&export_mutex);
+    while (running) {
+        if (pending.rows < EXPORT_ROW_GROUP) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += EXPORT_INTERVAL;
+            while (running && pending.rows < EXPORT_ROW_GROUP &&
+                   pthread_cond_timedwait(&export_cond, &export_mutex, &deadline) == 0) {
+            }
+        }
+        flush_pending();
+    }
+    flush_pending();
+    pthread_mutex_unlock(&export_mutex);
+    return NULL;
+}
+
+// Start writing row groups while the crawl runs
+int export_start(void) {
+    if (!export_dir) {
+        return 0;
+    }
+    pthread_mutex_lock(&export_mutex);
+    if (running) {
+        pthread_mutex_unlock(&export_mutex);
+        return 0;
+    }
+    running = 1;
+    if (pthread_create(&export_thread, NULL, export_thread_main, NULL) != 0) {
+        running = 0;
+        pthread_mutex_unlock(&export_mutex);
+        LOG_ERROR("Failed to start export thread");
+        return -1;
+    }
+    pthread_mutex_unlock(&export_mutex);
+    LOG_INFO("Exporting pages to %s", export_dir);
+    return 0;
+}
+
+// Queue a page for the current row group
+int export_add_page(const export_page_t *page) {
+    if (!page || !page->url) {
+        return -1;
+    }
+    pthread_mutex_lock(&export_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&export_mutex);
+        return -1;
+    }
+    if (pending.rows >= EXPORT_MAX_PENDING || group_add(&pending, page) != 0) {
+        stats.rows_dropped++;
+        pthread_mutex_unlock(&export_mutex);
+        return -1;
+    }
+    if (pending.rows >= EXPORT_ROW_GROUP) {
+        pthread_cond_signal(&export_cond);
+    }
+    pthread_mutex_unlock(&export_mutex);
+    return 0;
+}
+
+// Export of one node: a SCAN thread hands key pages to its readers
+typedef struct {
+    int node;
+    long rows;
+    int failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    redisReply *pages[EXPORT_QUEUE_PAGES];   // SCAN replies not yet read
+    int head;
+    int queued;
+    int scan_done;
+} node_export_t;
+
+// One reader of a node: its own connection, row group and file
+typedef struct {
+    node_export_t *job;
+    int index;
+    redisContext *ctx;
+    export_file_t file;
+    row_group_t group;
+    long rows;
+    int failed;
+} export_reader_t;
+
+// Add the analyses of one SCAN page to a row group
+// Returns 0 on success, -1 if a value could not be read or added
+static int add_analysis_page(redisContext *ctx, redisReply *keys, row_group_t *group) {
+    for (size_t i = 0; i < keys->elements; i++) {
+        redisAppendCommand(ctx, "GET %b", keys->element[i]->str, keys->element[i]->len);
+    }
+    redisReply **values = calloc(keys->elements, sizeof(redisReply *));
+    int ok = values != NULL;
+    for (size_t i = 0; i < keys->elements; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            ok = 0;
+            break;
+        }
+        if (values) {
+            values[i] = reply;
+        } else {
+            freeReplyObject(reply);
+        }
+    }
+
+    for (size_t i = 0; ok && i < keys->elements; i++) {
+        redisReply *value = values[i];
+        const char *url = keys->element[i]->str + strlen(ANALYSIS_KEY_PREFIX);
+        content_analysis_t *analysis = NULL;
+        if (value->type == REDIS_REPLY_STRING) {
+            analysis = analysis_decode(value->str, value->len);
+        } else if (value->type == REDIS_REPLY_ERROR) {
+            // Hashes written before the binary encoding
+            analysis = get_analysis_results(get_redis_context(), url);
+        }
+        if (!analysis) {
+            continue;
+        }
+        time_t timestamp = 0;
+        analysis_view_t view;
+        if (value->type == REDIS_REPLY_STRING &&
+            analysis_view_init(&view, value->str, value->len) == 0) {
+            timestamp = view.timestamp;
+            analysis_view_release(&view);
+        }
+        export_page_t page = {.url = url, .crawl_time = timestamp, .analysis = analysis};
+        ok = group_add(group, &page) == 0;
+        free_content_analysis(analysis);
+    }
+    for (size_t i = 0; values && i < keys->elements; i++) {
+        freeReplyObject(values[i]);
+    }
+    free(values);
+    return ok ? 0 : -1;
+}
+
+// Connect a reader to its node and open its file
+static int reader_open(export_reader_t *reader) {
+    int node = reader->job->node;
+    struct timeval timeout = {1, 500000};  // 1.5 seconds
+    reader->ctx = redisConnectWithTimeout(shard_node_host(node), shard_node_port(node), timeout);
+    if (!reader->ctx || reader->ctx->err) {
+        LOG_ERROR("Export connection to Redis node %d failed: %s", node,
+                  reader->ctx ? reader->ctx->errstr : "Unknown error");
+        if (reader->ctx) {
+            redisFree(reader->ctx);
+            reader->ctx = NULL;
+        }
+        return -1;
+    }
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "analysis-node%d-%d", node, reader->index);
+    if (file_open(&reader->file, prefix) != 0) {
+        redisFree(reader->ctx);
+        reader->ctx = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Read one SCAN page, writing a row group per EXPORT_ROW_GROUP rows
+static int reader_add(export_reader_t *reader, redisReply *keys) {
+    if (add_analysis_page(reader->ctx, keys, &reader->group) != 0) {
+        return -1;
+    }
+    if (reader->group.rows >= EXPORT_ROW_GROUP) {
+        if (file_write_group(&reader->file, &reader->group) != 0) {
+            return -1;
+        }
+        reader->rows += reader->group.rows;
+        group_clear(&reader->group);
+    }
+    return 0;
+}
+
+// Write the last row group and publish the reader's file
+static void reader_close(export_reader_t *reader) {
+    int ok = !reader->failed;
+    if (ok && reader->group.rows > 0) {
+        ok = file_write_group(&reader->file, &reader->group) == 0;
+        reader->rows += reader->group.rows;
+    }
+    group_clear(&reader->group);
+    long size = file_close(&reader->file, ok);
+    redisFree(reader->ctx);
+    reader->ctx = NULL;
+    if (!ok || size < 0) {
+        reader->failed = 1;
+        return;
+    }
+    if (size > 0) {
+        pthread_mutex_lock(&export_mutex);
+        stats.files_written++;
+        stats.bytes_written += size;
+        stats.rows_exported += reader->rows;
+        pthread_mutex_unlock(&export_mutex);
+        LOG_INFO("Exported %ld analyses from Redis node %d to %s", reader->rows,
+                 reader->job->node, reader->file.path);
+    }
+}
+
+// Take SCAN pages off the node's queue until the scan is done; the file
+// is published by export_node() once every reader has finished
+static void *reader_main(void *arg) {
+    export_reader_t *reader = arg;
+    node_export_t *job = reader->job;
+    reader->failed = reader_open(reader) != 0;
+    pthread_mutex_lock(&job->mutex);
+    job->failed |= reader->failed;
+    for (;;) {
+        while (job->queued == 0 && !job->scan_done) {
+            pthread_cond_wait(&job->cond, &job->mutex);
+        }
+        if (job->queued == 0) {
+            break;
+        }
+        redisReply *keys = job->pages[job->head];
+        job->head = (job->head + 1) % EXPORT_QUEUE_PAGES;
+        job->queued--;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->mutex);
+
+        // After a failure pages are only drained, so the scan can finish
+        if (!reader->failed && reader_add(reader, keys->element[1]) != 0) {
+            reader->failed = 1;
+        }
+        freeReplyObject(keys);
+        pthread_mutex_lock(&job->mutex);
+        job->failed |= reader->failed;
+    }
+    job->failed |= reader->failed;
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+// Hand a SCAN page to the readers, waiting while the queue is full
+// Returns 0, or -1 once a reader has failed
+static int queue_page(node_export_t *job, redisReply *page) {
+    pthread_mutex_lock(&job->mutex);
+    while (job->queued == EXPORT_QUEUE_PAGES && !job->failed) {
+        pthread_cond_wait(&job->cond, &job->mutex);
+    }
+    int failed = job->failed;
+    if (!failed) {
+        job->pages[(job->head + job->queued) % EXPORT_QUEUE_PAGES] = page;
+        job->queued++;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->mutex);
+    if (failed) {
+        freeReplyObject(page);
+    }
+    return failed ? -1 : 0;
+}
+
+// SCAN a node and spread its keys over EXPORT_NODE_READERS readers. The
+// GETs and decoding dominate, so they run on the readers' own
+// connections while this thread keeps scanning
+static void *export_node(void *arg) {
+    node_export_t *job = arg;
+    export_reader_t readers[EXPORT_NODE_READERS];
+    pthread_t threads[EXPORT_NODE_READERS];
+    int started = 0;
+    memset(readers, 0, sizeof(readers));
+    pthread_mutex_init(&job->mutex, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    for (int i = 0; i < EXPORT_NODE_READERS; i++) {
+        readers[started].job = job;
+        readers[started].index = i;
+        started += pthread_create(&threads[started], NULL, reader_main, &readers[started]) == 0;
+    }
+
+    // Without reader threads this thread reads the pages itself
+    export_reader_t *inline_reader = started == 0 ? &readers[0] : NULL;
+    int ok = !inline_reader || reader_open(inline_reader) == 0;
+    char cursor[32] = "0";
+    do {
+        redisContext *ctx = ok ? shard_acquire(job->node) : NULL;
+        if (!ctx) {
+            ok = 0;
+            break;
+        }
+        redisReply *reply = redisCommand(ctx, "SCAN %s MATCH %s* COUNT %d", cursor,
+                                         ANALYSIS_KEY_PREFIX, EXPORT_SCAN_COUNT);
+        shard_release(job->node);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            freeReplyObject(reply);
+            ok = 0;
+            break;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        if (reply->element[1]->elements == 0) {
+            freeReplyObject(reply);
+        } else if (inline_reader) {
+            ok = reader_add(inline_reader, reply->element[1]) == 0;
+            freeReplyObject(reply);
+        } else {
+            ok = queue_page(job, reply) == 0;
+        }
+    } while (ok && strcmp(cursor, "0") != 0);
+
+    pthread_mutex_lock(&job->mutex);
+    job->scan_done = 1;
+    job->failed |= !ok;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->mutex);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Publish the files only if the whole node was read, as with one file
+    for (int i = 0; i < EXPORT_NODE_READERS; i++) {
+        job->failed |= readers[i].failed;
+    }
+    for (int i = 0; i < EXPORT_NODE_READERS; i++) {
+        if (readers[i].ctx) {
+            readers[i].failed |= job->failed;
+            reader_close(&readers[i]);
+        }
+        job->rows += readers[i].rows;
+        job->failed |= readers[i].failed;
+    }
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->mutex);
+    if (job->failed) {
+        LOG_ERROR("Failed to export analyses from Redis node %d", job->node);
+    }
+    return NULL;
+}
+
+// Export every analysis stored in Redis, in parallel per node
+long export_redis_analysis(void) {
+    if (!export_dir) {
+        export_set_dir(EXPORT_DEFAULT_DIR);
+    }
+    int nodes = shard_count();
+    node_export_t *jobs = calloc(nodes, sizeof(node_export_t));
+    pthread_t *threads = calloc(nodes, sizeof(pthread_t));
+    int *started = calloc(nodes, sizeof(int));
+    if (!jobs || !threads || !started) {
+        free(jobs);
+        free(threads);
+        free(started);
+        return -1;
+    }
+
+    // Nodes own disjoint key ranges, so each gets its own scan and readers
+    for (int node = 0; node < nodes; node++) {
+        jobs[node].node = node;
+        started[node] = pthread_create(&threads[node], NULL, export_node, &jobs[node]) == 0;
+        if (!started[node]) {
+            export_node(&jobs[node]);
+        }
+    }
+    long rows = 0;
+    int failed = 0;
+    for (int node = 0; node < nodes; node++) {
+        if (started[node]) {
+            pthread_join(threads[node], NULL);
+        }
+        rows += jobs[node].rows;
+        failed |= jobs[node].failed;
+    }
+    free(jobs);
+    free(threads);
+    free(started);
+    return failed ? -1 : rows;
+}
+
+// Counters since startup
+void export_get_stats(export_stats_t *out) {
+    pthread_mutex_lock(&export_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&export_mutex);
+}
+
+// Write the last row group and stop
+void export_stop(void) {
+    pthread_mutex_lock(&export_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&export_mutex);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&export_cond);
+    pthread_mutex_unlock(&export_mutex);
+    pthread_join(export_thread, NULL);
+    group_clear(&pending);
+}
+
+// Input buffer for reading an export file back
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+    int failed;
+} in_buf_t;
+
+static uint64_t get_varint(in_buf_t *b) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (b->pos >= b->end) {
+            break;
+        }
+        unsigned char byte = *b->pos++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    b->failed = 1;
+    return 0;
+}
+
+static int64_t get_zigzag(in_buf_t *b) {
+    uint64_t v = get_varint(b);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint32_t get_le32(in_buf_t *b) {
+    if (b->end - b->pos < 4) {
+        b->failed = 1;
+        return 0;
+    }
+    const unsigned char *p = b->pos;
+    b->pos += 4;
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t peek_le64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+// Bytes of a length read before them; NULL if the length overruns
+static const unsigned char *get_bytes(in_buf_t *b, uint64_t len) {
+    if (b->failed || len > (uint64_t)(b->end - b->pos)) {
+        b->failed = 1;
+        return NULL;
+    }
+    const unsigned char *p = b->pos;
+    b->pos += len;
+    return p;
+}
+
+// Append the count values of one chunk to a column
+// Returns 0 on success, -1 if the chunk does not hold exactly count values
+static int read_chunk(in_buf_t *b, export_column_t *col, int encoding, uint64_t count) {
+    static const int types[] = {
+        EXPORT_TYPE_STRING, EXPORT_TYPE_STRING, EXPORT_TYPE_INT, EXPORT_TYPE_INT, EXPORT_TYPE_FLOAT
+    };
+    // Plain values take at least a byte each, so only runs may expand
+    uint64_t bytes = (uint64_t)(b->end - b->pos);
+    if (encoding < EXPORT_PLAIN_STRING || encoding > EXPORT_PLAIN_FLOAT ||
+        types[encoding] != col->type || count > EXPORT_READ_MAX_VALUES ||
+        ((encoding == EXPORT_PLAIN_STRING || encoding == EXPORT_PLAIN_INT) && count > bytes) ||
+        (encoding == EXPORT_PLAIN_FLOAT && count * 4 != bytes)) {
+        return -1;
+    }
+    export_value_t *grown = realloc(col->values, (col->count + count + 1) * sizeof(export_value_t));
+    if (!grown) {
+        return -1;
+    }
+    col->values = grown;
+    col->encoding = encoding;
+    export_value_t *out = col->values + col->count;
+    memset(out, 0, count * sizeof(export_value_t));
+    col->count += count;   // Values filled so far stay freeable on failure
+
+    if (encoding == EXPORT_PLAIN_STRING) {
+        for (uint64_t i = 0; i < count && !b->failed; i++) {
+            uint64_t len = get_varint(b);
+            const unsigned char *s = len ? get_bytes(b, len - 1) : NULL;
+            if (s) {
+                out[i].str = strndup((const char *)s, len - 1);
+            }
+        }
+    } else if (encoding == EXPORT_DICT_STRING) {
+        uint64_t entries = get_varint(b);
+        if (entries > (uint64_t)(b->end - b->pos)) {
+            return -1;
+        }
+        const unsigned char **dict = malloc((entries + 1) * sizeof(char *));
+        uint64_t *lens = malloc((entries + 1) * sizeof(uint64_t));
+        if (!dict || !lens) {
+            b->failed = 1;
+        }
+        for (uint64_t i = 0; i < entries && !b->failed; i++) {
+            lens[i] = get_varint(b);
+            dict[i] = get_bytes(b, lens[i]);
+        }
+        for (uint64_t i = 0; i < count && !b->failed;) {
+            uint64_t run = get_varint(b);
+            uint64_t index = get_varint(b);
+            if (run == 0 || run > count - i || index > entries) {
+                b->failed = 1;
+                break;
+            }
+            for (uint64_t j = 0; j < run; j++, i++) {
+                out[i].str = index ? strndup((const char *)dict[index - 1], lens[index - 1]) : NULL;
+            }
+        }
+        free(dict);
+        free(lens);
+    } else if (encoding == EXPORT_PLAIN_INT) {
+        for (uint64_t i = 0; i < count; i++) {
+            out[i].i = get_zigzag(b);
+        }
+    } else if (encoding == EXPORT_RLE_INT) {
+        for (uint64_t i = 0; i < count && !b->failed;) {
+            uint64_t run = get_varint(b);
+            int64_t value = get_zigzag(b);
+            if (run == 0 || run > count - i) {
+                b->failed = 1;
+                break;
+            }
+            for (uint64_t j = 0; j < run; j++) {
+                out[i++].i = value;
+            }
+        }
+    } else {
+        for (uint64_t i = 0; i < count; i++) {
+            uint32_t bits = get_le32(b);
+            memcpy(&out[i].f, &bits, sizeof(bits));
+        }
+    }
+    return b->failed || b->pos != b->end ? -1 : 0;
+}
+
+// Read the row group between start and end, which must hold rows rows
+static int read_group(const unsigned char *start, const unsigned char *end, uint64_t rows,
+                      export_table_t *table) {
+    in_buf_t b = {start, end, 0};
+    uint64_t group_rows = get_varint(&b);
+    uint64_t chunks = get_varint(&b);
+    if (b.failed || group_rows != rows || chunks != (uint64_t)table->columns) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < chunks; i++) {
+        uint64_t column = get_varint(&b);
+        const unsigned char *encoding = get_bytes(&b, 1);
+        uint64_t count = get_varint(&b);
+        uint64_t len = get_varint(&b);
+        const unsigned char *data = get_bytes(&b, len);
+        if (b.failed || column != i) {
+            return -1;
+        }
+        in_buf_t chunk = {data, data + len, 0};
+        if (read_chunk(&chunk, &table->cols[column], *encoding, count) != 0) {
+            return -1;
+        }
+    }
+    return b.pos == b.end ? 0 : -1;
+}
+
+// Read a whole export file held in memory
+int export_read(const unsigned char *data, size_t len, export_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    if (len < 16 || memcmp(data, EXPORT_MAGIC, 4) != 0 ||
+        memcmp(data + len - 4, EXPORT_MAGIC, 4) != 0) {
+        return -1;
+    }
+    in_buf_t tail = {data + len - 8, data + len - 4, 0};
+    uint32_t footer_len = get_le32(&tail);
+    if (footer_len > len - 12) {
+        return -1;
+    }
+    const unsigned char *footer = data + len - 8 - footer_len;
+    uint64_t footer_offset = (uint64_t)(footer - data);
+    in_buf_t b = {footer, data + len - 8, 0};
+
+    uint64_t columns = get_varint(&b);
+    if (b.failed || columns == 0 || columns > EXPORT_READ_MAX_COLUMNS) {
+        return -1;
+    }
+    table->columns = (int)columns;
+    for (int c = 0; c < table->columns; c++) {
+        uint64_t name_len = get_varint(&b);
+        const unsigned char *name = get_bytes(&b, name_len);
+        const unsigned char *type = get_bytes(&b, 1);
+        if (b.failed || name_len >= sizeof(table->cols[c].name) || *type > EXPORT_TYPE_FLOAT) {
+            return -1;
+        }
+        memcpy(table->cols[c].name, name, name_len);
+        table->cols[c].type = *type;
+    }
+
+    // Row groups must tile the file between the magic and the footer
+    uint64_t groups = get_varint(&b);
+    uint64_t expected_offset = 4;
+    for (uint64_t g = 0; g < groups && !b.failed; g++) {
+        const unsigned char *offset_bytes = get_bytes(&b, 8);
+        uint64_t rows = get_varint(&b);
+        if (b.failed) {
+            break;
+        }
+        uint64_t offset = peek_le64(offset_bytes);
+        if (offset != expected_offset || offset >= footer_offset) {
+            b.failed = 1;
+            break;
+        }
+        // The next group starts where this one ends
+        uint64_t next = footer_offset;
+        if (g + 1 < groups && b.end - b.pos >= 8) {
+            next = peek_le64(b.pos);
+            if (next <= offset || next > footer_offset) {
+                b.failed = 1;
+                break;
+            }
+        }
+        if (read_group(data + offset, data + next, rows, table) != 0) {
+            b.failed = 1;
+            break;
+        }
+        table->rows += rows;
+        expected_offset = next;
+    }
+    if (b.failed || b.pos != b.end || groups == 0 || expected_offset != footer_offset) {
+        export_table_free(table);
+        return -1;
+    }
+    return 0;
+}
+
+// Column of a table by name
+export_column_t *export_find_column(export_table_t *table, const char *name) {
+    for (int c = 0; c < table->columns; c++) {
+        if (strcmp(table->cols[c].name, name) == 0) {
+            return &table->cols[c];
+        }
+    }
+    return NULL;
+}
+
+// Free the values of a table
+void export_table_free(export_table_t *table) {
+    for (int c = 0; c < table->columns; c++) {
+        for (size_t i = 0; i < table->cols[c].count; i++) {
+            free(table->cols[c].values[i].str);
+        }
+        free(table->cols[c].values);
+    }
+    memset(table, 0, sizeof(*table));
+}
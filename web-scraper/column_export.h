@@ -0,0 +1,152 @@
+#ifndef COLUMN_EXPORT_H
+#define COLUMN_EXPORT_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Columnar export of crawled pages and their analysis
+//
+// Rows are gathered into row groups and written column by column, so
+// analysts read only the columns they need instead of SCAN plus GET on
+// every analysis:* key. While the crawl runs, every analyzed page is
+// added to the current row group; it is written as a file of its own
+// once it holds EXPORT_ROW_GROUP rows or every EXPORT_INTERVAL seconds.
+// export_redis_analysis() exports everything already in Redis: a thread
+// per Redis node scans its keys and hands the pages to
+// EXPORT_NODE_READERS readers, each with its own connection and file, which
+// fetch and decode the analyses. Files are written under a
+// temporary name and renamed when complete, so a reader never sees a
+// partial file.
+//
+// File layout, integers unsigned LEB128 varints unless noted:
+//   "WSC1"
+//   row groups: varint row count, varint chunk count, then per chunk:
+//     varint column id, encoding byte, varint value count,
+//     varint byte length, encoded values
+//   footer: varint column count, per column varint name length, name,
+//     type byte; varint row group count, per row group 8-byte
+//     little-endian file offset and varint row count
+//   4-byte little-endian footer length, "WSC1"
+//
+// Encodings:
+//   EXPORT_PLAIN_STRING  per value varint length + 1 (0 is NULL), bytes
+//   EXPORT_DICT_STRING   varint entry count, per entry varint length and
+//                        bytes, then runs of varint run length, varint
+//                        index (0 is NULL, n is entry n - 1)
+//   EXPORT_PLAIN_INT     per value zigzag varint
+//   EXPORT_RLE_INT       runs of varint run length, zigzag varint value
+//   EXPORT_PLAIN_FLOAT   per value 4-byte little-endian IEEE float
+// Strings are dictionary-encoded when at most half their values are
+// distinct, integers run-length encoded when that halves the runs.
+// A list column such as topics holds the items of every row in order;
+// its count column says how many belong to each row.
+//
+// export_read() reads a whole file back into memory, checking it against
+// this layout: it is what downstream tools and the tests use, so a file
+// the writer produces and a file that reads back are the same thing.
+
+#define EXPORT_MAGIC "WSC1"
+#define EXPORT_ROW_GROUP 8192             // Rows per incremental file
+#define EXPORT_INTERVAL 60                // Seconds before a partial row group is written
+#define EXPORT_MAX_PENDING (4 * EXPORT_ROW_GROUP)   // Rows queued before new ones are dropped
+#define EXPORT_SCAN_COUNT 1000            // Keys per SCAN page in a Redis export
+#define EXPORT_NODE_READERS 4             // Reader threads per node in a Redis export
+#define EXPORT_QUEUE_PAGES 8              // SCAN pages a node's readers may fall behind
+#define EXPORT_DEFAULT_DIR "export"
+#define EXPORT_READ_MAX_COLUMNS 64        // Columns export_read() accepts in a footer
+#define EXPORT_READ_MAX_VALUES (1 << 24)  // Values per chunk; runs expand far past the chunk size
+
+typedef enum {
+    EXPORT_PLAIN_STRING,
+    EXPORT_DICT_STRING,
+    EXPORT_PLAIN_INT,
+    EXPORT_RLE_INT,
+    EXPORT_PLAIN_FLOAT
+} export_encoding_t;
+
+// Column type byte in the footer
+typedef enum {
+    EXPORT_TYPE_STRING,
+    EXPORT_TYPE_INT,
+    EXPORT_TYPE_FLOAT
+} export_type_t;
+
+// One exported page; analysis may be NULL
+typedef struct {
+    const char *url;
+    time_t crawl_time;
+    int status_code;
+    size_t content_size;
+    const char *content_type;
+    const content_analysis_t *analysis;
+} export_page_t;
+
+// Export counters
+typedef struct {
+    unsigned long long rows_exported;
+    unsigned long long rows_dropped;   // Queue was full
+    unsigned long files_written;
+    unsigned long long bytes_written;
+} export_stats_t;
+
+// One value read back from an export file
+typedef struct {
+    char *str;     // EXPORT_TYPE_STRING; NULL is a NULL value
+    int64_t i;     // EXPORT_TYPE_INT
+    float f;       // EXPORT_TYPE_FLOAT
+} export_value_t;
+
+// One column read back, with the values of every row group in order
+typedef struct {
+    char name[64];
+    int type;
+    int encoding;  // Encoding of the last chunk read
+    size_t count;
+    export_value_t *values;
+} export_column_t;
+
+// A whole export file read back
+typedef struct {
+    int columns;
+    export_column_t cols[EXPORT_READ_MAX_COLUMNS];
+    uint64_t rows;
+} export_table_t;
+
+// Write export files under dir; NULL disables exporting during the crawl
+void export_set_dir(const char *dir);
+
+// Export directory, or NULL if exporting is disabled
+const char *export_get_dir(void);
+
+// Start writing row groups while the crawl runs
+// Returns 0 on success or when disabled, -1 on failure
+int export_start(void);
+
+// Queue a page for the current row group
+// Returns 0 if queued, -1 if exporting is off or the queue is full
+int export_add_page(const export_page_t *page);
+
+// Export every analysis stored in Redis, in parallel per node
+// Returns the number of rows exported, or -1 on failure
+long export_redis_analysis(void);
+
+// Counters since startup
+void export_get_stats(export_stats_t *out);
+
+// Write the last row group and stop
+void export_stop(void);
+
+// Read a whole export file held in memory
+// Returns 0 on success, -1 if the file is malformed or truncated;
+// on success free the table with export_table_free()
+int export_read(const unsigned char *data, size_t len, export_table_t *table);
+
+// Column of a table read by export_read(), or NULL if it has none by that name
+export_column_t *export_find_column(export_table_t *table, const char *name);
+
+// Free the values of a table read by export_read()
+void export_table_free(export_table_t *table);
+
+#endif // COLUMN_EXPORT_H
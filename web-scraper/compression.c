@@ -0,0 +1,488 @@
+#include "compression.h"
+#include "logger.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define TRAIN_SEGMENT 32
+#define TRAIN_STEP 8
+#define TRAIN_TABLE_BITS 18
+#define DICT_PATH_LENGTH 1024
+
+// Common HTML fragments used when no trained dictionary is loaded
+static const char builtin_dictionary[] =
+    "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"utf-8\">"
+    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">"
+    "<meta name=\"description\" content=\"<meta property=\"og:title\" content=\""
+    "<meta property=\"og:description\" content=\"<meta property=\"og:image\" content=\""
+    "<link rel=\"stylesheet\" href=\"<link rel=\"canonical\" href=\"<link rel=\"icon\" href=\""
+    "<script type=\"text/javascript\" src=\"<script async src=\"https://"
+    "</script></head><body class=\"<div class=\"container\"><div class=\"row\">"
+    "<div class=\"col-<nav class=\"navbar<ul class=\"nav\"><li class=\"nav-item\">"
+    "<a class=\"nav-link\" href=\"/<span class=\"<img src=\"https://\" alt=\"\" width=\""
+    "\" height=\"<p class=\"<h1 class=\"<h2 class=\"<h3><button type=\"button\" class=\"btn"
+    "<form action=\"/\" method=\"post\"><input type=\"hidden\" name=\"<footer class=\"footer\">"
+    "</a></li></ul></nav></span></p></div></div></div></footer></body></html>";
+
+typedef struct {
+    const char *data;
+    size_t len;
+    uLong adler;
+} dictionary_t;
+
+static dictionary_t builtin_dict = {builtin_dictionary, sizeof(builtin_dictionary) - 1, 0};
+
+// Trained dictionaries; entries are only ever appended, so readers need no lock
+static dictionary_t dictionaries[COMPRESSION_MAX_DICTS];
+static int dictionary_count = 0;
+static int active_index = -1;   // Dictionary used for new entries, -1 for the built-in one
+static pthread_mutex_t dictionary_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Built-in dictionary with its id computed on first use
+static const dictionary_t *get_builtin_dictionary(void) {
+    if (!builtin_dict.adler) {
+        builtin_dict.adler = adler32(1L, (const Bytef *)builtin_dict.data, builtin_dict.len);
+    }
+    return &builtin_dict;
+}
+
+// Dictionary used for new entries
+static const dictionary_t *active_dictionary(void) {
+    int index = __atomic_load_n(&active_index, __ATOMIC_ACQUIRE);
+    return index >= 0 ? &dictionaries[index] : get_builtin_dictionary();
+}
+
+// Find the dictionary a compressed stream was written with
+static const dictionary_t *dictionary_for(uLong adler) {
+    int count = __atomic_load_n(&dictionary_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (dictionaries[i].adler == adler) {
+            return &dictionaries[i];
+        }
+    }
+    const dictionary_t *builtin = get_builtin_dictionary();
+    return builtin->adler == adler ? builtin : NULL;
+}
+
+// Add a dictionary to the table unless one with its id is already there
+// Takes ownership of data; returns the entry index or -1 if the table is full
+static int add_dictionary(char *data, size_t len) {
+    uLong adler = adler32(1L, (const Bytef *)data, len);
+    pthread_mutex_lock(&dictionary_mutex);
+    int index = -1;
+    for (int i = 0; i < dictionary_count; i++) {
+        if (dictionaries[i].adler == adler) {
+            index = i;
+            break;
+        }
+    }
+    if (index >= 0) {
+        free(data);
+    } else if (dictionary_count < COMPRESSION_MAX_DICTS) {
+        index = dictionary_count;
+        dictionaries[index].data = data;
+        dictionaries[index].len = len;
+        dictionaries[index].adler = adler;
+        __atomic_store_n(&dictionary_count, dictionary_count + 1, __ATOMIC_RELEASE);
+    } else {
+        LOG_ERROR("Compression dictionary table is full (%d dictionaries)", COMPRESSION_MAX_DICTS);
+        free(data);
+    }
+    pthread_mutex_unlock(&dictionary_mutex);
+    return index;
+}
+
+// Read a dictionary file; caller frees *data
+static int read_dictionary(const char *path, char **data, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    *data = malloc(COMPRESSION_DICT_MAX);
+    if (!*data) {
+        fclose(file);
+        return -1;
+    }
+    *len = fread(*data, 1, COMPRESSION_DICT_MAX, file);
+    fclose(file);
+    if (*len == 0) {
+        free(*data);
+        return -1;
+    }
+    return 0;
+}
+
+// Write data to path through a temporary file and rename
+static int write_dictionary(const char *path, const char *data, size_t len) {
+    char tmp[DICT_PATH_LENGTH + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *file = fopen(tmp, "wb");
+    if (!file) {
+        return -1;
+    }
+    int failed = fwrite(data, 1, len, file) != len;
+    failed |= fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Directory part of a path, "." if it has none
+static void dictionary_dir(const char *path, char *dir, size_t size) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        snprintf(dir, size, ".");
+    } else {
+        snprintf(dir, size, "%.*s", (int)(slash - path), path);
+    }
+}
+
+// Path of the file keeping a dictionary under its id
+static int id_path(const char *dir, uLong adler, char *path, size_t size) {
+    int len = snprintf(path, size, "%s/%s%08lx.bin", dir, COMPRESSION_DICT_PREFIX,
+                       (unsigned long)adler);
+    return len < 0 || (size_t)len >= size ? -1 : 0;
+}
+
+// Keep a dictionary under its id next to the active file if it is not there yet
+static int archive_dictionary(const char *dir, const dictionary_t *dict) {
+    char path[DICT_PATH_LENGTH];
+    if (id_path(dir, dict->adler, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    if (access(path, F_OK) == 0) {
+        return 0;
+    }
+    if (write_dictionary(path, dict->data, dict->len) != 0) {
+        LOG_ERROR("Failed to write compression dictionary %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Compress content with the shared dictionary
+int compress_content(const char *in, size_t in_len, char **out, size_t *out_len,
+                     const char **codec) {
+    if (!in || !out || !out_len || !codec) {
+        return -1;
+    }
+
+    *out = NULL;
+    *out_len = 0;
+    *codec = CODEC_RAW;
+    if (in_len < COMPRESSION_MIN_SIZE) {
+        return 0;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        LOG_ERROR("Failed to initialize zlib deflate");
+        return -1;
+    }
+
+    const dictionary_t *dict = active_dictionary();
+    if (deflateSetDictionary(&stream, (const Bytef *)dict->data, dict->len) != Z_OK) {
+        LOG_ERROR("Failed to set compression dictionary");
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    uLong bound = deflateBound(&stream, in_len);
+    char *buffer = malloc(bound);
+    if (!buffer) {
+        LOG_ERROR("Failed to allocate compression buffer");
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_in = (Bytef *)in;
+    stream.avail_in = in_len;
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = bound;
+    int ret = deflate(&stream, Z_FINISH);
+    size_t compressed_len = stream.total_out;
+    deflateEnd(&stream);
+
+    if (ret != Z_STREAM_END) {
+        LOG_ERROR("zlib deflate failed: %d", ret);
+        free(buffer);
+        return -1;
+    }
+
+    // Keep incompressible content raw
+    if (compressed_len >= in_len) {
+        free(buffer);
+        return 0;
+    }
+
+    *out = buffer;
+    *out_len = compressed_len;
+    *codec = CODEC_ZLIB;
+    return 0;
+}
+
+// Decompress content stored with the given codec
+int decompress_content(const char *codec, const char *in, size_t in_len, size_t raw_len,
+                       char **out, size_t *out_len) {
+    if (!in || !out || !out_len) {
+        return -1;
+    }
+
+    // Raw content (or entries without a codec) is copied through
+    if (!codec || strcmp(codec, CODEC_RAW) == 0) {
+        *out = malloc(in_len + 1);
+        if (!*out) {
+            return -1;
+        }
+        memcpy(*out, in, in_len);
+        (*out)[in_len] = '\0';
+        *out_len = in_len;
+        return 0;
+    }
+
+    if (strcmp(codec, CODEC_ZLIB) != 0) {
+        LOG_ERROR("Unknown content codec: %s", codec);
+        return -1;
+    }
+
+    char *buffer = malloc(raw_len + 1);
+    if (!buffer) {
+        LOG_ERROR("Failed to allocate decompression buffer");
+        return -1;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        LOG_ERROR("Failed to initialize zlib inflate");
+        free(buffer);
+        return -1;
+    }
+
+    stream.next_in = (Bytef *)in;
+    stream.avail_in = in_len;
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = raw_len;
+
+    int ret = inflate(&stream, Z_FINISH);
+    if (ret == Z_NEED_DICT) {
+        const dictionary_t *dict = dictionary_for(stream.adler);
+        if (!dict || inflateSetDictionary(&stream, (const Bytef *)dict->data, dict->len) != Z_OK) {
+            LOG_ERROR("Compression dictionary %08lx is not loaded", (unsigned long)stream.adler);
+            inflateEnd(&stream);
+            free(buffer);
+            return -1;
+        }
+        ret = inflate(&stream, Z_FINISH);
+    }
+    size_t decompressed_len = stream.total_out;
+    inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END) {
+        LOG_ERROR("zlib inflate failed: %d", ret);
+        free(buffer);
+        return -1;
+    }
+
+    buffer[decompressed_len] = '\0';
+    *out = buffer;
+    *out_len = decompressed_len;
+    return 0;
+}
+
+// Load every stored dictionary and make the one in path active
+int compression_load_dictionary(const char *path) {
+    if (!path) {
+        return -1;
+    }
+
+    // Dictionaries kept by id stay readable whichever one is active
+    char dir[DICT_PATH_LENGTH];
+    dictionary_dir(path, dir, sizeof(dir));
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *entry;
+        size_t prefix_len = strlen(COMPRESSION_DICT_PREFIX);
+        while ((entry = readdir(d)) != NULL) {
+            unsigned long id;
+            char tail[8];
+            if (strncmp(entry->d_name, COMPRESSION_DICT_PREFIX, prefix_len) != 0 ||
+                sscanf(entry->d_name + prefix_len, "%8lx%7s", &id, tail) != 2 ||
+                strcmp(tail, ".bin") != 0) {
+                continue;
+            }
+            char file_path[DICT_PATH_LENGTH];
+            char *data;
+            size_t len;
+            if (id_path(dir, id, file_path, sizeof(file_path)) != 0 ||
+                read_dictionary(file_path, &data, &len) != 0) {
+                continue;
+            }
+            if (adler32(1L, (const Bytef *)data, len) != id) {
+                LOG_WARNING("Compression dictionary %s does not match its id, skipping", file_path);
+                free(data);
+                continue;
+            }
+            add_dictionary(data, len);
+        }
+        closedir(d);
+    }
+
+    char *data;
+    size_t len;
+    if (read_dictionary(path, &data, &len) != 0) {
+        return -1;
+    }
+    int index = add_dictionary(data, len);
+    if (index < 0) {
+        return -1;
+    }
+
+    // A dictionary written before they were kept by id gets its own file,
+    // so training a new one cannot make its entries unreadable
+    archive_dictionary(dir, &dictionaries[index]);
+    __atomic_store_n(&active_index, index, __ATOMIC_RELEASE);
+    LOG_INFO("Loaded compression dictionary %s (%zu bytes, id %08lx, %d known)",
+             path, dictionaries[index].len, (unsigned long)dictionaries[index].adler,
+             __atomic_load_n(&dictionary_count, __ATOMIC_ACQUIRE));
+    return 0;
+}
+
+// Keep a new dictionary by id, make it the active file and use it
+int compression_save_dictionary(const char *path, const char *dict, size_t dict_len) {
+    if (!path || !dict || dict_len == 0 || dict_len > COMPRESSION_DICT_MAX) {
+        return -1;
+    }
+
+    char *data = malloc(dict_len);
+    if (!data) {
+        return -1;
+    }
+    memcpy(data, dict, dict_len);
+    int index = add_dictionary(data, dict_len);
+    if (index < 0) {
+        return -1;
+    }
+
+    char dir[DICT_PATH_LENGTH];
+    dictionary_dir(path, dir, sizeof(dir));
+    if (archive_dictionary(dir, &dictionaries[index]) != 0) {
+        return -1;
+    }
+    if (write_dictionary(path, dict, dict_len) != 0) {
+        LOG_ERROR("Failed to write compression dictionary %s: %s", path, strerror(errno));
+        return -1;
+    }
+    __atomic_store_n(&active_index, index, __ATOMIC_RELEASE);
+    LOG_INFO("Saved compression dictionary %s (%zu bytes, id %08lx)", path, dict_len,
+             (unsigned long)dictionaries[index].adler);
+    return 0;
+}
+
+// Segment counted while training a dictionary
+typedef struct {
+    uint64_t hash;
+    const char *segment;
+    unsigned int count;
+} train_entry_t;
+
+static uint64_t segment_hash(const char *p) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < TRAIN_SEGMENT; i++) {
+        hash ^= (unsigned char)p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+static int compare_train_entries(const void *a, const void *b) {
+    const train_entry_t *ea = a;
+    const train_entry_t *eb = b;
+    // Ascending count: the most frequent segments end up last
+    if (ea->count != eb->count) {
+        return ea->count < eb->count ? -1 : 1;
+    }
+    return 0;
+}
+
+// Build a dictionary from sample documents
+int compression_train_dictionary(const char **samples, const size_t *sizes, int count,
+                                 char **dict, size_t *dict_len) {
+    if (!samples || !sizes || count <= 0 || !dict || !dict_len) {
+        return -1;
+    }
+
+    size_t table_size = (size_t)1 << TRAIN_TABLE_BITS;
+    train_entry_t *table = calloc(table_size, sizeof(train_entry_t));
+    if (!table) {
+        LOG_ERROR("Failed to allocate dictionary training table");
+        return -1;
+    }
+
+    // Count segments at fixed strides; every occurrence counts, so a segment
+    // repeated within one document weighs as much as one shared across documents
+    for (int s = 0; s < count; s++) {
+        if (!samples[s] || sizes[s] < TRAIN_SEGMENT) {
+            continue;
+        }
+        for (size_t off = 0; off + TRAIN_SEGMENT <= sizes[s]; off += TRAIN_STEP) {
+            const char *segment = samples[s] + off;
+            uint64_t hash = segment_hash(segment);
+            size_t slot = hash & (table_size - 1);
+            for (size_t probe = 0; probe < table_size; probe++) {
+                train_entry_t *entry = &table[(slot + probe) & (table_size - 1)];
+                if (entry->hash == 0) {
+                    entry->hash = hash;
+                    entry->segment = segment;
+                    entry->count = 1;
+                    break;
+                }
+                if (entry->hash == hash) {
+                    entry->count++;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Compact the table to the segments seen more than once
+    size_t used = 0;
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].hash && table[i].count > 1) {
+            table[used++] = table[i];
+        }
+    }
+    qsort(table, used, sizeof(train_entry_t), compare_train_entries);
+
+    size_t max_segments = COMPRESSION_DICT_MAX / TRAIN_SEGMENT;
+    size_t first = used > max_segments ? used - max_segments : 0;
+    size_t len = (used - first) * TRAIN_SEGMENT;
+    if (len == 0) {
+        free(table);
+        return -1;
+    }
+
+    char *buffer = malloc(len);
+    if (!buffer) {
+        free(table);
+        return -1;
+    }
+    for (size_t i = first; i < used; i++) {
+        memcpy(buffer + (i - first) * TRAIN_SEGMENT, table[i].segment, TRAIN_SEGMENT);
+    }
+
+    free(table);
+    *dict = buffer;
+    *dict_len = len;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+
+// Codec names recorded alongside stored content
+#define CODEC_RAW "raw"
+#define CODEC_ZLIB "zlib"
+
+#define COMPRESSION_MIN_SIZE 256      // Smaller bodies are stored raw
+#define COMPRESSION_DICT_MAX 32768    // zlib window size bounds a useful dictionary
+#define COMPRESSION_DICT_FILE "cache_dict.bin"   // Dictionary used for new entries
+#define COMPRESSION_DICT_PREFIX "cache_dict-"     // Every dictionary: cache_dict-<adler32>.bin
+#define COMPRESSION_MAX_DICTS 64                  // Dictionaries kept readable at once
+
+// Compress content with the shared dictionary
+// Sets *codec to the codec used (CODEC_RAW if compression did not help)
+// Returns 0 on success, -1 on failure; caller frees *out
+int compress_content(const char *in, size_t in_len, char **out, size_t *out_len,
+                     const char **codec);
+
+// Decompress content stored with the given codec
+// raw_len is the original size (used to size the output buffer)
+// Returns 0 on success, -1 on failure; caller frees *out (NUL terminated)
+int decompress_content(const char *codec, const char *in, size_t in_len, size_t raw_len,
+                       char **out, size_t *out_len);
+
+// Load every cache_dict-<id>.bin next to path and make the dictionary in
+// path the one used for new entries. Entries name their dictionary by
+// adler32 id, so all loaded dictionaries and the built-in one stay readable
+// Returns 0 on success, -1 if path could not be loaded
+int compression_load_dictionary(const char *path);
+
+// Store a dictionary as cache_dict-<id>.bin next to path, replace path with
+// it and use it for new entries; earlier dictionaries are kept
+// Returns 0 on success, -1 on failure
+int compression_save_dictionary(const char *path, const char *dict, size_t dict_len);
+
+// Build a dictionary from sample documents by keeping their most frequent
+// 32-byte segments, most frequent last (closest to the data)
+// Returns 0 on success, -1 on failure; caller frees *dict
+int compression_train_dictionary(const char **samples, const size_t *sizes, int count,
+                                 char **dict, size_t *dict_len);
+
+#endif // COMPRESSION_H
@@ -1,6 +1,10 @@
 #include "content_analyzer.h"
 #include "logger.h"
 #include "redis_helper.h"
+#include "content_hash.h"
+#include "analysis_codec.h"
+#include "write_behind.h"
+#include "shard_router.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,9 +17,13 @@
 
 // Redis key prefixes
 #define ANALYSIS_KEY_PREFIX "analysis:"
+#define ANALYSIS_MEMO_PREFIX "analysis_memo:"  // Results keyed by body hash
 #define TREND_KEY_PREFIX "trend:"
 #define TREND_COUNT_KEY "trend:count"
 
+// Legacy hash layout: list fields joined by ASCII US
+#define ANALYSIS_LIST_SEPARATOR '\x1f'
+
 // Global variables
 extern redisContext *redis_ctx;
 
@@ -31,6 +39,55 @@ int init_content_analyzer(redisContext *ctx) {
     return 0;
 }
 
+// Growable buffer used while collecting text nodes
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} text_buffer_t;
+
+// Append a text node to the buffer, followed by a separating space
+static int append_text(text_buffer_t *buf, const char *text) {
+    size_t text_len = strlen(text);
+    if (buf->len + text_len + 2 > buf->capacity) {
+        size_t new_capacity = buf->capacity * 2;
+        while (buf->len + text_len + 2 > new_capacity) {
+            new_capacity *= 2;
+        }
+        char *new_data = realloc(buf->data, new_capacity);
+        if (!new_data) {
+            return -1;
+        }
+        buf->data = new_data;
+        buf->capacity = new_capacity;
+    }
+    memcpy(buf->data + buf->len, text, text_len);
+    buf->len += text_len;
+    buf->data[buf->len++] = ' ';
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+// Walk the document tree collecting text, skipping script and style elements
+static int collect_text(xmlNodePtr node, text_buffer_t *buf) {
+    for (; node; node = node->next) {
+        if (node->type == XML_TEXT_NODE && node->content) {
+            if (append_text(buf, (const char *)node->content) != 0) {
+                return -1;
+            }
+        } else if (node->type == XML_ELEMENT_NODE) {
+            if (xmlStrcmp(node->name, (const xmlChar *)"script") == 0 ||
+                xmlStrcmp(node->name, (const xmlChar *)"style") == 0) {
+                continue;
+            }
+            if (collect_text(node->children, buf) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
 // Extract text content from HTML
 char *extract_text_content(const char *html) {
     if (!html) return NULL;
@@ -47,51 +104,24 @@ char *extract_text_content(const char *html) {
     }
     
     // Create a buffer for the text content
-    char *text = malloc(1);
-    if (!text) {
+    text_buffer_t buf = {malloc(4096), 0, 4096};
+    if (!buf.data) {
         LOG_ERROR("Failed to allocate memory for text content");
         xmlFreeDoc(doc);
         return NULL;
     }
-    text[0] = '\0';
+    buf.data[0] = '\0';
     
     // Extract text from all text nodes
-    xmlNodePtr node = root;
-    while (node) {
-        if (node->type == XML_ELEMENT_NODE) {
-            // Skip script and style elements
-            if (xmlStrcmp(node->name, (const xmlChar *)"script") == 0 ||
-                xmlStrcmp(node->name, (const xmlChar *)"style") == 0) {
-                node = node->next;
-                continue;
-            }
-            
-            // Process child nodes
-            xmlNodePtr child = node->children;
-            while (child) {
-                if (child->type == XML_TEXT_NODE && child->content) {
-                    // Append text content
-                    size_t text_len = strlen(text);
-                    size_t content_len = strlen((char *)child->content);
-                    char *new_text = realloc(text, text_len + content_len + 1);
-                    if (!new_text) {
-                        LOG_ERROR("Failed to allocate memory for text content");
-                        free(text);
-                        xmlFreeDoc(doc);
-                        return NULL;
-                    }
-                    text = new_text;
-                    strcat(text, (char *)child->content);
-                    strcat(text, " ");
-                }
-                child = child->next;
-            }
-        }
-        node = node->next;
+    if (collect_text(root, &buf) != 0) {
+        LOG_ERROR("Failed to allocate memory for text content");
+        free(buf.data);
+        xmlFreeDoc(doc);
+        return NULL;
     }
     
     xmlFreeDoc(doc);
-    return text;
+    return buf.data;
 }
 
 // Extract title from HTML
@@ -341,6 +371,65 @@ void free_content_analysis(content_analysis_t *analysis) {
     free(analysis);
 }
 
+// Build a Redis key from a prefix and an arbitrarily long id
+static char *create_analysis_key(const char *prefix, const char *id) {
+    size_t key_len = strlen(prefix) + strlen(id) + 1;
+    char *key = malloc(key_len);
+    if (!key) {
+        LOG_ERROR("Failed to allocate memory for analysis key");
+        return NULL;
+    }
+    snprintf(key, key_len, "%s%s", prefix, id);
+    return key;
+}
+
+// Split a list field of a legacy hash back into an array
+static char **decode_list(const char *value, size_t len, int *count) {
+    *count = 0;
+    if (len == 0) {
+        return NULL;
+    }
+    int n = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] == ANALYSIS_LIST_SEPARATOR) n++;
+    }
+    char **items = calloc(n, sizeof(char *));
+    if (!items) {
+        return NULL;
+    }
+    const char *start = value;
+    const char *end = value + len;
+    while (*count < n) {
+        const char *stop = memchr(start, ANALYSIS_LIST_SEPARATOR, end - start);
+        if (!stop) stop = end;
+        items[*count] = strndup(start, stop - start);
+        if (!items[*count]) break;
+        (*count)++;
+        start = stop + 1;
+    }
+    return items;
+}
+
+// Write the encoded analysis to key as a single value
+static int store_analysis_key(const char *key, content_analysis_t *analysis) {
+    char *encoded = NULL;
+    size_t encoded_len = 0;
+    if (analysis_encode(analysis, time(NULL), &encoded, &encoded_len) != 0) {
+        LOG_ERROR("Failed to encode analysis");
+        return -1;
+    }
+
+    // SET replaces hashes written by older versions as well
+    int result = write_behind_command_at(shard_for_key(key), "SET %s %b", key, encoded,
+                                         encoded_len);
+    free(encoded);
+
+    if (result != 0) {
+        LOG_ERROR("Failed to store analysis in Redis");
+    }
+    return result;
+}
+
 // Store analysis results in Redis
 int store_analysis_results(redisContext *ctx, const char *url, content_analysis_t *analysis) {
     if (!ctx || !url || !analysis) {
@@ -349,145 +438,178 @@ int store_analysis_results(redisContext *ctx, const char *url, content_analysis_
     }
     
     // Create Redis key
-    char key[1024];
-    snprintf(key, sizeof(key), "%s%s", ANALYSIS_KEY_PREFIX, url);
-    
-    // Store basic metadata
-    redisReply *reply;
-    
-    // Title
-    if (analysis->title) {
-        reply = redisCommand(ctx, "HSET %s title %s", key, analysis->title);
-        if (!reply) {
-            LOG_ERROR("Failed to store title in Redis");
-            return -1;
-        }
-        freeReplyObject(reply);
+    char *key = create_analysis_key(ANALYSIS_KEY_PREFIX, url);
+    if (!key) {
+        return -1;
     }
     
-    // Description
-    if (analysis->description) {
-        reply = redisCommand(ctx, "HSET %s description %s", key, analysis->description);
-        if (!reply) {
-            LOG_ERROR("Failed to store description in Redis");
-            return -1;
-        }
-        freeReplyObject(reply);
-    }
+    int result = store_analysis_key(key, analysis);
+    free(key);
     
-    // Keywords
-    if (analysis->keywords) {
-        reply = redisCommand(ctx, "HSET %s keywords %s", key, analysis->keywords);
-        if (!reply) {
-            LOG_ERROR("Failed to store keywords in Redis");
-            return -1;
-        }
-        freeReplyObject(reply);
+    if (result == 0) {
+        LOG_INFO("Stored analysis results for URL: %s", url);
     }
-    
-    // Sentiment score
-    reply = redisCommand(ctx, "HSET %s sentiment %f", key, analysis->sentiment_score);
-    if (!reply) {
-        LOG_ERROR("Failed to store sentiment score in Redis");
+    return result;
+}
+
+// Memoize analysis results for a body hash
+int store_analysis_by_hash(redisContext *ctx, uint64_t content_hash, content_analysis_t *analysis) {
+    if (!ctx || !analysis) {
+        LOG_ERROR("Invalid parameters for storing memoized analysis");
         return -1;
     }
-    freeReplyObject(reply);
-    
-    // Language
-    if (analysis->language) {
-        reply = redisCommand(ctx, "HSET %s language %s", key, analysis->language);
-        if (!reply) {
-            LOG_ERROR("Failed to store language in Redis");
-            return -1;
-        }
-        freeReplyObject(reply);
-    }
     
-    // Store timestamp
-    time_t now = time(NULL);
-    reply = redisCommand(ctx, "HSET %s timestamp %ld", key, now);
-    if (!reply) {
-        LOG_ERROR("Failed to store timestamp in Redis");
+    char hash_hex[CONTENT_HASH_HEX_LEN];
+    content_hash_hex(content_hash, hash_hex);
+    char *key = create_analysis_key(ANALYSIS_MEMO_PREFIX, hash_hex);
+    if (!key) {
         return -1;
     }
-    freeReplyObject(reply);
     
-    LOG_INFO("Stored analysis results for URL: %s", url);
-    return 0;
+    int result = store_analysis_key(key, analysis);
+    free(key);
+    return result;
 }
 
-// Retrieve analysis results from Redis
-content_analysis_t *get_analysis_results(redisContext *ctx, const char *url) {
-    if (!ctx || !url) {
-        LOG_ERROR("Invalid parameters for retrieving analysis results");
+// Read analysis fields from a hash written before the binary encoding
+static content_analysis_t *get_legacy_analysis_key(const char *key) {
+    int node = shard_for_key(key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
         return NULL;
     }
-    
-    // Create Redis key
-    char key[1024];
-    snprintf(key, sizeof(key), "%s%s", ANALYSIS_KEY_PREFIX, url);
-    
-    // Check if analysis exists
-    redisReply *reply = redisCommand(ctx, "EXISTS %s", key);
-    if (!reply) {
-        LOG_ERROR("Failed to check if analysis exists in Redis");
+    redisReply *reply = redisCommand(ctx, "HGETALL %s", key);
+    shard_release(node);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        LOG_ERROR("Failed to read analysis from Redis");
+        freeReplyObject(reply);
         return NULL;
     }
-    
-    if (reply->integer == 0) {
+
+    // A missing key comes back as an empty array
+    if (reply->elements == 0) {
         freeReplyObject(reply);
-        LOG_INFO("No analysis results found for URL: %s", url);
         return NULL;
     }
-    
-    freeReplyObject(reply);
-    
+
     // Create analysis structure
     content_analysis_t *analysis = malloc(sizeof(content_analysis_t));
     if (!analysis) {
         LOG_ERROR("Failed to allocate memory for content analysis");
+        freeReplyObject(reply);
         return NULL;
     }
     
     // Initialize all fields to NULL or 0
     memset(analysis, 0, sizeof(content_analysis_t));
-    
-    // Retrieve title
-    reply = redisCommand(ctx, "HGET %s title", key);
-    if (reply && reply->type == REDIS_REPLY_STRING) {
-        analysis->title = strdup(reply->str);
+
+    // Walk the field/value pairs once
+    for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+        redisReply *field = reply->element[i];
+        redisReply *value = reply->element[i + 1];
+        if (field->type != REDIS_REPLY_STRING || value->type != REDIS_REPLY_STRING) {
+            continue;
+        }
+
+        const char *name = field->str;
+        if (strcmp(name, "title") == 0) {
+            analysis->title = strdup(value->str);
+        } else if (strcmp(name, "description") == 0) {
+            analysis->description = strdup(value->str);
+        } else if (strcmp(name, "keywords") == 0) {
+            analysis->keywords = strdup(value->str);
+        } else if (strcmp(name, "author") == 0) {
+            analysis->author = strdup(value->str);
+        } else if (strcmp(name, "publish_date") == 0) {
+            analysis->publish_date = strdup(value->str);
+        } else if (strcmp(name, "language") == 0) {
+            analysis->language = strdup(value->str);
+        } else if (strcmp(name, "sentiment") == 0) {
+            analysis->sentiment_score = strtof(value->str, NULL);
+        } else if (strcmp(name, "topics") == 0) {
+            analysis->topics = decode_list(value->str, value->len, &analysis->topic_count);
+        } else if (strcmp(name, "entities") == 0) {
+            analysis->entities = decode_list(value->str, value->len, &analysis->entity_count);
+        } else if (strcmp(name, "categories") == 0) {
+            analysis->categories = decode_list(value->str, value->len, &analysis->category_count);
+        }
     }
+
     freeReplyObject(reply);
-    
-    // Retrieve description
-    reply = redisCommand(ctx, "HGET %s description", key);
-    if (reply && reply->type == REDIS_REPLY_STRING) {
-        analysis->description = strdup(reply->str);
+    return analysis;
+}
+
+// Read the analysis stored at key
+static content_analysis_t *get_analysis_key(const char *key) {
+    int node = shard_for_key(key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return NULL;
+    }
+    redisReply *reply = redisCommand(ctx, "GET %s", key);
+    shard_release(node);
+    if (!reply) {
+        LOG_ERROR("Failed to read analysis from Redis");
+        return NULL;
+    }
+
+    // Keys still holding the old hash layout answer GET with WRONGTYPE
+    if (reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "WRONGTYPE", 9) == 0) {
+        freeReplyObject(reply);
+        return get_legacy_analysis_key(key);
+    }
+
+    content_analysis_t *analysis = NULL;
+    if (reply->type == REDIS_REPLY_STRING) {
+        analysis = analysis_decode(reply->str, reply->len);
+        if (!analysis) {
+            LOG_WARNING("Ignoring malformed analysis stored at %s", key);
+        }
     }
     freeReplyObject(reply);
+    return analysis;
+}
+
+// Retrieve analysis results from Redis
+content_analysis_t *get_analysis_results(redisContext *ctx, const char *url) {
+    if (!ctx || !url) {
+        LOG_ERROR("Invalid parameters for retrieving analysis results");
+        return NULL;
+    }
     
-    // Retrieve keywords
-    reply = redisCommand(ctx, "HGET %s keywords", key);
-    if (reply && reply->type == REDIS_REPLY_STRING) {
-        analysis->keywords = strdup(reply->str);
+    // Create Redis key
+    char *key = create_analysis_key(ANALYSIS_KEY_PREFIX, url);
+    if (!key) {
+        return NULL;
     }
-    freeReplyObject(reply);
     
-    // Retrieve sentiment score
-    reply = redisCommand(ctx, "HGET %s sentiment", key);
-    if (reply && reply->type == REDIS_REPLY_STRING) {
-        analysis->sentiment_score = atof(reply->str);
+    content_analysis_t *analysis = get_analysis_key(key);
+    free(key);
+    
+    if (analysis) {
+        LOG_INFO("Retrieved analysis results for URL: %s", url);
+    } else {
+        LOG_INFO("No analysis results found for URL: %s", url);
+    }
+    return analysis;
+}
+
+// Retrieve analysis results memoized for a body hash
+content_analysis_t *get_analysis_by_hash(redisContext *ctx, uint64_t content_hash) {
+    if (!ctx) {
+        LOG_ERROR("Invalid parameters for retrieving memoized analysis");
+        return NULL;
     }
-    freeReplyObject(reply);
     
-    // Retrieve language
-    reply = redisCommand(ctx, "HGET %s language", key);
-    if (reply && reply->type == REDIS_REPLY_STRING) {
-        analysis->language = strdup(reply->str);
+    char hash_hex[CONTENT_HASH_HEX_LEN];
+    content_hash_hex(content_hash, hash_hex);
+    char *key = create_analysis_key(ANALYSIS_MEMO_PREFIX, hash_hex);
+    if (!key) {
+        return NULL;
     }
-    freeReplyObject(reply);
     
-    LOG_INFO("Retrieved analysis results for URL: %s", url);
+    content_analysis_t *analysis = get_analysis_key(key);
+    free(key);
     return analysis;
 }
 
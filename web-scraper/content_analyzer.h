@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include <hiredis/hiredis.h>
+#include <stdint.h>
 
 // Initialize the content analyzer
 // Returns 0 on success, -1 on failure
@@ -13,6 +14,10 @@ int init_content_analyzer(redisContext *ctx);
 // Caller is responsible for freeing the returned structure
 content_analysis_t *analyze_content(const char *html, const char *url);
 
+// Extract the visible text of an HTML document (script and style removed)
+// Returns a newly allocated string, caller must free
+char *extract_text_content(const char *html);
+
 // Free a content_analysis_t structure
 void free_content_analysis(content_analysis_t *analysis);
 
@@ -25,6 +30,16 @@ int store_analysis_results(redisContext *ctx, const char *url, content_analysis_
 // Caller is responsible for freeing the returned structure
 content_analysis_t *get_analysis_results(redisContext *ctx, const char *url);
 
+// Memoize analysis results for a body hash, so identical bytes served
+// under other URLs are not analyzed again
+// Returns 0 on success, -1 on failure
+int store_analysis_by_hash(redisContext *ctx, uint64_t content_hash, content_analysis_t *analysis);
+
+// Retrieve analysis results memoized for a body hash
+// Returns NULL if the body has not been analyzed yet
+// Caller is responsible for freeing the returned structure
+content_analysis_t *get_analysis_by_hash(redisContext *ctx, uint64_t content_hash);
+
 // Detect trends from a collection of analyzed content
 // Returns an array of trend_data_t structures
 // Caller is responsible for freeing the returned array
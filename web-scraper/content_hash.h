@@ -0,0 +1,16 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Length of a hash rendered as hex, including the terminator
+#define CONTENT_HASH_HEX_LEN 17
+
+// Fast non-cryptographic 64-bit hash of a buffer (XXH64)
+uint64_t content_hash64(const void *data, size_t len, uint64_t seed);
+
+// Render a hash as 16 lowercase hex digits
+void content_hash_hex(uint64_t hash, char out[CONTENT_HASH_HEX_LEN]);
+
+#endif // CONTENT_HASH_H
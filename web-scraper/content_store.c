@@ -0,0 +1,713 @@
+#include "content_store.h"
+#include "logger.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_MAGIC 0x43534331u  // "CSC1"
+#define RECORD_PUT 0
+#define RECORD_TOMBSTONE 1
+#define INITIAL_INDEX_CAPACITY 4096
+#define MAX_PATH_LENGTH 1024
+#define SEGMENT_PATH_LENGTH (MAX_PATH_LENGTH + 32)  // store_dir plus "/seg-NNNNNN.dat"
+
+// On-disk record header, followed by the data padded to 8 bytes
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t key;
+    uint64_t length;
+} record_header_t;
+
+typedef struct {
+    uint32_t id;
+    int fd;
+    char *map;
+    uint64_t size;        // Bytes written
+    uint64_t live_bytes;  // Bytes of records still referenced by the index
+} segment_t;
+
+// Index slot; segment == NULL marks an empty slot
+typedef struct {
+    uint64_t key;
+    segment_t *segment;
+    uint64_t offset;      // Offset of the data (after the header)
+    uint64_t length;
+} index_entry_t;
+
+static char store_dir[MAX_PATH_LENGTH];
+static segment_t **segments = NULL;
+static int segment_count = 0;
+static index_entry_t *index_table = NULL;
+static size_t index_capacity = 0;
+static size_t index_count = 0;
+static int store_open = 0;
+
+// Index and segment list; readers hold it while using mapped data
+static pthread_rwlock_t store_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Serializes appends to the active segment
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static content_store_live_fn live_fn = NULL;
+static uint32_t sweep_cursor = 0;   // Segment id the next sweep starts from
+
+static pthread_t compactor_thread;
+static pthread_mutex_t compactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_cond = PTHREAD_COND_INITIALIZER;
+static int compactor_running = 0;
+
+static uint64_t record_size(uint64_t length) {
+    return sizeof(record_header_t) + ((length + 7) & ~7ULL);
+}
+
+static uint64_t mix_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Returns 0 on success, -1 if the path does not fit
+static int segment_path(uint32_t id, char *path, size_t size) {
+    int len = snprintf(path, size, "%s/seg-%06u.dat", store_dir, id);
+    return len < 0 || (size_t)len >= size ? -1 : 0;
+}
+
+// Find the slot holding key, or the empty slot where it would go
+static index_entry_t *index_slot(uint64_t key) {
+    size_t mask = index_capacity - 1;
+    size_t slot = mix_key(key) & mask;
+    while (index_table[slot].segment && index_table[slot].key != key) {
+        slot = (slot + 1) & mask;
+    }
+    return &index_table[slot];
+}
+
+static int index_grow(void) {
+    size_t old_capacity = index_capacity;
+    index_entry_t *old_table = index_table;
+
+    index_capacity = old_capacity ? old_capacity * 2 : INITIAL_INDEX_CAPACITY;
+    index_table = calloc(index_capacity, sizeof(index_entry_t));
+    if (!index_table) {
+        index_table = old_table;
+        index_capacity = old_capacity;
+        return -1;
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_table[i].segment) {
+            *index_slot(old_table[i].key) = old_table[i];
+        }
+    }
+    free(old_table);
+    return 0;
+}
+
+// Insert or replace an entry, keeping segment live counts in step
+static int index_put(uint64_t key, segment_t *segment, uint64_t offset, uint64_t length) {
+    if ((index_count + 1) * 10 >= index_capacity * 7 && index_grow() != 0) {
+        return -1;
+    }
+    index_entry_t *entry = index_slot(key);
+    if (entry->segment) {
+        entry->segment->live_bytes -= record_size(entry->length);
+    } else {
+        index_count++;
+    }
+    entry->key = key;
+    entry->segment = segment;
+    entry->offset = offset;
+    entry->length = length;
+    segment->live_bytes += record_size(length);
+    return 0;
+}
+
+// Remove an entry with backward-shift deletion
+static int index_remove(uint64_t key) {
+    if (!index_capacity) {
+        return -1;
+    }
+    index_entry_t *entry = index_slot(key);
+    if (!entry->segment) {
+        return -1;
+    }
+    entry->segment->live_bytes -= record_size(entry->length);
+    index_count--;
+
+    size_t mask = index_capacity - 1;
+    size_t hole = entry - index_table;
+    size_t next = (hole + 1) & mask;
+    while (index_table[next].segment) {
+        size_t home = mix_key(index_table[next].key) & mask;
+        // Move the entry back if the hole lies between its home and its slot
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index_table[hole] = index_table[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index_table[hole].segment = NULL;
+    return 0;
+}
+
+static segment_t *open_segment(uint32_t id, int create) {
+    char path[SEGMENT_PATH_LENGTH];
+    if (segment_path(id, path, sizeof(path)) != 0) {
+        LOG_ERROR("Content segment path too long in %s", store_dir);
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open content segment %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // Map the full segment size up front so appends become visible without remapping
+    size_t map_len = (size_t)st.st_size > CONTENT_STORE_SEGMENT_SIZE ? (size_t)st.st_size
+                                                                      : CONTENT_STORE_SEGMENT_SIZE;
+    char *map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Failed to map content segment %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    segment_t *segment = calloc(1, sizeof(segment_t));
+    if (!segment) {
+        munmap(map, map_len);
+        close(fd);
+        return NULL;
+    }
+    segment->id = id;
+    segment->fd = fd;
+    segment->map = map;
+    segment->size = st.st_size;
+    return segment;
+}
+
+static void free_segment(segment_t *segment, int unlink_file) {
+    size_t map_len = segment->size > CONTENT_STORE_SEGMENT_SIZE ? segment->size
+                                                                : CONTENT_STORE_SEGMENT_SIZE;
+    munmap(segment->map, map_len);
+    close(segment->fd);
+    if (unlink_file) {
+        char path[SEGMENT_PATH_LENGTH];
+        if (segment_path(segment->id, path, sizeof(path)) == 0) {
+            unlink(path);
+        }
+    }
+    free(segment);
+}
+
+static int add_segment(segment_t *segment) {
+    segment_t **grown = realloc(segments, (segment_count + 1) * sizeof(segment_t *));
+    if (!grown) {
+        return -1;
+    }
+    segments = grown;
+    segments[segment_count++] = segment;
+    return 0;
+}
+
+// Replay a segment into the index, truncating a torn tail
+static void load_segment(segment_t *segment) {
+    uint64_t offset = 0;
+    while (offset + sizeof(record_header_t) <= segment->size) {
+        record_header_t header;
+        memcpy(&header, segment->map + offset, sizeof(header));
+        if (header.magic != RECORD_MAGIC ||
+            offset + record_size(header.length) > segment->size) {
+            break;
+        }
+        if (header.type == RECORD_PUT) {
+            index_put(header.key, segment, offset + sizeof(record_header_t), header.length);
+        } else {
+            index_remove(header.key);
+        }
+        offset += record_size(header.length);
+    }
+    if (offset < segment->size) {
+        LOG_WARNING("Truncating content segment %u at %llu bytes", segment->id,
+                    (unsigned long long)offset);
+        if (ftruncate(segment->fd, offset) == 0) {
+            segment->size = offset;
+        }
+    }
+}
+
+// Make segment creation and removal durable
+static void sync_dir(void) {
+    int fd = open(store_dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t ia = *(const uint32_t *)a;
+    uint32_t ib = *(const uint32_t *)b;
+    return ia < ib ? -1 : ia > ib;
+}
+
+// Append a record to the active segment; caller holds write_mutex
+static int append_record(uint32_t type, uint64_t key, const void *data, uint64_t length,
+                         segment_t **written_to, uint64_t *data_offset) {
+    uint64_t total = record_size(length);
+    if (total > CONTENT_STORE_SEGMENT_SIZE) {
+        LOG_ERROR("Content record of %llu bytes exceeds the segment size",
+                  (unsigned long long)length);
+        return -1;
+    }
+
+    segment_t *active = segments[segment_count - 1];
+    if (active->size + total > CONTENT_STORE_SEGMENT_SIZE) {
+        // A closed segment is never written again; make it durable first
+        if (fsync(active->fd) != 0) {
+            LOG_ERROR("Failed to sync content segment %u: %s", active->id, strerror(errno));
+            return -1;
+        }
+        segment_t *next = open_segment(active->id + 1, 1);
+        if (!next) {
+            return -1;
+        }
+        sync_dir();
+        pthread_rwlock_wrlock(&store_lock);
+        int added = add_segment(next);
+        pthread_rwlock_unlock(&store_lock);
+        if (added != 0) {
+            free_segment(next, 1);
+            return -1;
+        }
+        active = next;
+    }
+
+    record_header_t header = {RECORD_MAGIC, type, key, length};
+    static const char padding[8] = {0};
+    struct iovec_parts {
+        const void *ptr;
+        size_t len;
+    } parts[3] = {
+        {&header, sizeof(header)},
+        {data, length},
+        {padding, total - sizeof(header) - length}
+    };
+
+    uint64_t offset = active->size;
+    for (int i = 0; i < 3; i++) {
+        if (parts[i].len && pwrite(active->fd, parts[i].ptr, parts[i].len, offset) != (ssize_t)parts[i].len) {
+            LOG_ERROR("Failed to write content segment %u: %s", active->id, strerror(errno));
+            return -1;
+        }
+        offset += parts[i].len;
+    }
+
+    if (data_offset) {
+        *data_offset = active->size + sizeof(header);
+    }
+    if (written_to) {
+        *written_to = active;
+    }
+    active->size = offset;
+    return 0;
+}
+
+static void *compactor_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&compactor_mutex);
+    while (compactor_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CONTENT_STORE_COMPACT_INTERVAL;
+        pthread_cond_timedwait(&compactor_cond, &compactor_mutex, &deadline);
+        if (!compactor_running) {
+            break;
+        }
+        pthread_mutex_unlock(&compactor_mutex);
+        size_t swept = content_store_sweep();
+        if (swept > 0) {
+            LOG_INFO("Content store dropped %zu unreferenced records", swept);
+        }
+        size_t reclaimed = content_store_compact();
+        if (reclaimed > 0) {
+            LOG_INFO("Content store compaction reclaimed %zu bytes", reclaimed);
+        }
+        content_store_sync();
+        pthread_mutex_lock(&compactor_mutex);
+    }
+    pthread_mutex_unlock(&compactor_mutex);
+    return NULL;
+}
+
+// Open (or create) the store and start the compactor
+int content_store_open(const char *dir) {
+    if (!dir || store_open) {
+        return store_open ? 0 : -1;
+    }
+
+    if (strlen(dir) >= sizeof(store_dir)) {
+        LOG_ERROR("Content store directory name too long: %s", dir);
+        return -1;
+    }
+    snprintf(store_dir, sizeof(store_dir), "%s", dir);
+    if (mkdir(store_dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create content store directory %s: %s", store_dir, strerror(errno));
+        return -1;
+    }
+
+    // Collect existing segment ids in order
+    DIR *d = opendir(store_dir);
+    if (!d) {
+        LOG_ERROR("Failed to open content store directory %s: %s", store_dir, strerror(errno));
+        return -1;
+    }
+    uint32_t *ids = NULL;
+    int id_count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        unsigned int id;
+        if (sscanf(entry->d_name, "seg-%6u.dat", &id) == 1) {
+            uint32_t *grown = realloc(ids, (id_count + 1) * sizeof(uint32_t));
+            if (!grown) {
+                break;
+            }
+            ids = grown;
+            ids[id_count++] = id;
+        }
+    }
+    closedir(d);
+    if (id_count > 1) {
+        qsort(ids, id_count, sizeof(uint32_t), compare_ids);
+    }
+
+    if (index_grow() != 0) {
+        free(ids);
+        return -1;
+    }
+
+    // Replay segments oldest first so later records win
+    for (int i = 0; i < id_count; i++) {
+        segment_t *segment = open_segment(ids[i], 0);
+        if (!segment || add_segment(segment) != 0) {
+            if (segment) free_segment(segment, 0);
+            free(ids);
+            content_store_close();
+            return -1;
+        }
+        load_segment(segment);
+    }
+    uint32_t next_id = id_count ? ids[id_count - 1] + 1 : 0;
+    free(ids);
+
+    if (segment_count == 0) {
+        segment_t *segment = open_segment(next_id, 1);
+        if (!segment || add_segment(segment) != 0) {
+            if (segment) free_segment(segment, 1);
+            content_store_close();
+            return -1;
+        }
+    }
+
+    store_open = 1;
+    compactor_running = 1;
+    if (pthread_create(&compactor_thread, NULL, compactor_main, NULL) != 0) {
+        LOG_WARNING("Failed to start content store compactor");
+        compactor_running = 0;
+    }
+
+    LOG_INFO("Content store opened at %s (%d segments, %zu records)",
+             store_dir, segment_count, index_count);
+    return 0;
+}
+
+// Stop the compactor and release all segments
+void content_store_close(void) {
+    pthread_mutex_lock(&compactor_mutex);
+    int was_running = compactor_running;
+    compactor_running = 0;
+    pthread_cond_signal(&compactor_cond);
+    pthread_mutex_unlock(&compactor_mutex);
+    if (was_running) {
+        pthread_join(compactor_thread, NULL);
+    }
+
+    pthread_mutex_lock(&write_mutex);
+    pthread_rwlock_wrlock(&store_lock);
+    for (int i = 0; i < segment_count; i++) {
+        fsync(segments[i]->fd);
+        free_segment(segments[i], 0);
+    }
+    free(segments);
+    segments = NULL;
+    segment_count = 0;
+    free(index_table);
+    index_table = NULL;
+    index_capacity = 0;
+    index_count = 0;
+    store_open = 0;
+    pthread_rwlock_unlock(&store_lock);
+    pthread_mutex_unlock(&write_mutex);
+}
+
+// Whether the store is open
+int content_store_is_open(void) {
+    return store_open;
+}
+
+// Append a record; storing an existing key is a no-op
+int content_store_put(uint64_t key, const void *data, size_t len) {
+    if (!store_open || !data) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&write_mutex);
+
+    // Content-addressed keys never change their bytes
+    pthread_rwlock_rdlock(&store_lock);
+    int exists = index_slot(key)->segment != NULL;
+    pthread_rwlock_unlock(&store_lock);
+    if (exists) {
+        pthread_mutex_unlock(&write_mutex);
+        return 0;
+    }
+
+    segment_t *segment = NULL;
+    uint64_t offset = 0;
+    int result = append_record(RECORD_PUT, key, data, len, &segment, &offset);
+    if (result == 0) {
+        pthread_rwlock_wrlock(&store_lock);
+        result = index_put(key, segment, offset, len);
+        pthread_rwlock_unlock(&store_lock);
+    }
+
+    pthread_mutex_unlock(&write_mutex);
+    return result;
+}
+
+// Look up a record and point *data into the mapped segment
+int content_store_get(uint64_t key, const char **data, size_t *len) {
+    if (!store_open || !data || !len) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&store_lock);
+    index_entry_t *entry = index_slot(key);
+    if (!entry->segment) {
+        pthread_rwlock_unlock(&store_lock);
+        return -1;
+    }
+    *data = entry->segment->map + entry->offset;
+    *len = entry->length;
+    return 0;
+}
+
+// Release the read lock taken by a successful content_store_get()
+void content_store_release(void) {
+    pthread_rwlock_unlock(&store_lock);
+}
+
+// Delete a record
+int content_store_delete(uint64_t key) {
+    if (!store_open) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&write_mutex);
+    pthread_rwlock_wrlock(&store_lock);
+    int result = index_remove(key);
+    pthread_rwlock_unlock(&store_lock);
+
+    if (result == 0 && append_record(RECORD_TOMBSTONE, key, NULL, 0, NULL, NULL) != 0) {
+        LOG_WARNING("Failed to persist content store delete");
+    }
+    pthread_mutex_unlock(&write_mutex);
+    return result;
+}
+
+// Rewrite sparse segments now; returns bytes reclaimed
+size_t content_store_compact(void) {
+    if (!store_open) {
+        return 0;
+    }
+
+    size_t reclaimed = 0;
+    pthread_mutex_lock(&write_mutex);
+
+    // The active (last) segment is never compacted
+    for (int i = 0; i < segment_count - 1; i++) {
+        segment_t *victim = segments[i];
+        if (victim->size > 0 &&
+            (double)victim->live_bytes / victim->size >= CONTENT_STORE_COMPACT_RATIO) {
+            continue;
+        }
+
+        // Copy live records forward; tombstones only matter if an older
+        // segment could still hold the key
+        int oldest = (i == 0);
+        uint64_t offset = 0;
+        int failed = 0;
+        while (offset + sizeof(record_header_t) <= victim->size) {
+            record_header_t header;
+            memcpy(&header, victim->map + offset, sizeof(header));
+            uint64_t data_offset = offset + sizeof(record_header_t);
+            offset += record_size(header.length);
+
+            if (header.type == RECORD_TOMBSTONE) {
+                pthread_rwlock_rdlock(&store_lock);
+                int deleted = index_slot(header.key)->segment == NULL;
+                pthread_rwlock_unlock(&store_lock);
+                if (!oldest && deleted &&
+                    append_record(RECORD_TOMBSTONE, header.key, NULL, 0, NULL, NULL) != 0) {
+                    failed = 1;
+                    break;
+                }
+                continue;
+            }
+
+            pthread_rwlock_rdlock(&store_lock);
+            index_entry_t *entry = index_slot(header.key);
+            int live = entry->segment == victim && entry->offset == data_offset;
+            pthread_rwlock_unlock(&store_lock);
+            if (!live) {
+                continue;
+            }
+
+            segment_t *target = NULL;
+            uint64_t target_offset = 0;
+            if (append_record(RECORD_PUT, header.key, victim->map + data_offset, header.length,
+                              &target, &target_offset) != 0) {
+                failed = 1;
+                break;
+            }
+            pthread_rwlock_wrlock(&store_lock);
+            index_put(header.key, target, target_offset, header.length);
+            pthread_rwlock_unlock(&store_lock);
+        }
+        if (failed) {
+            break;
+        }
+
+        // The copies must be on disk before the originals go away
+        segment_t *active = segments[segment_count - 1];
+        if (fsync(active->fd) != 0) {
+            LOG_ERROR("Failed to sync content segment %u: %s", active->id, strerror(errno));
+            break;
+        }
+
+        // Nothing references the victim any more; drop it
+        pthread_rwlock_wrlock(&store_lock);
+        memmove(&segments[i], &segments[i + 1], (segment_count - i - 1) * sizeof(segment_t *));
+        segment_count--;
+        pthread_rwlock_unlock(&store_lock);
+
+        reclaimed += victim->size;
+        free_segment(victim, 1);
+        sync_dir();
+        i--;
+    }
+
+    pthread_mutex_unlock(&write_mutex);
+    return reclaimed;
+}
+
+// Let the compactor drop records whose owner no longer references them
+void content_store_set_liveness(content_store_live_fn fn) {
+    live_fn = fn;
+}
+
+// Keys indexed in the first closed segment with an id of at least sweep_cursor
+// Returns the key count (0 if there is nothing to sweep); caller frees *keys
+static int sweep_keys(uint64_t **keys) {
+    *keys = NULL;
+    pthread_rwlock_rdlock(&store_lock);
+    segment_t *target = NULL;
+    for (int pass = 0; pass < 2 && !target; pass++) {
+        // The active (last) segment is still being written
+        for (int i = 0; i < segment_count - 1; i++) {
+            if (segments[i]->id >= sweep_cursor) {
+                target = segments[i];
+                break;
+            }
+        }
+        if (!target) {
+            sweep_cursor = 0;   // Wrap around
+        }
+    }
+    int count = 0;
+    if (target) {
+        sweep_cursor = target->id + 1;
+        int capacity = 0;
+        for (size_t i = 0; i < index_capacity; i++) {
+            if (index_table[i].segment != target) {
+                continue;
+            }
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : CONTENT_STORE_SWEEP_BATCH;
+                uint64_t *grown = realloc(*keys, capacity * sizeof(uint64_t));
+                if (!grown) {
+                    break;
+                }
+                *keys = grown;
+            }
+            (*keys)[count++] = index_table[i].key;
+        }
+    }
+    pthread_rwlock_unlock(&store_lock);
+    return count;
+}
+
+// Delete the unreferenced records of the next closed segment
+size_t content_store_sweep(void) {
+    if (!store_open || !live_fn) {
+        return 0;
+    }
+
+    uint64_t *keys;
+    int count = sweep_keys(&keys);
+    size_t deleted = 0;
+    int live[CONTENT_STORE_SWEEP_BATCH];
+    for (int start = 0; start < count; start += CONTENT_STORE_SWEEP_BATCH) {
+        int batch = count - start < CONTENT_STORE_SWEEP_BATCH ? count - start
+                                                              : CONTENT_STORE_SWEEP_BATCH;
+        if (live_fn(keys + start, batch, live) != 0) {
+            break;
+        }
+        for (int i = 0; i < batch; i++) {
+            if (!live[i] && content_store_delete(keys[start + i]) == 0) {
+                deleted++;
+            }
+        }
+    }
+    free(keys);
+    return deleted;
+}
+
+// Flush the active segment to disk
+int content_store_sync(void) {
+    if (!store_open) {
+        return -1;
+    }
+    pthread_mutex_lock(&write_mutex);
+    segment_t *active = segments[segment_count - 1];
+    int result = fsync(active->fd);
+    pthread_mutex_unlock(&write_mutex);
+    if (result != 0) {
+        LOG_ERROR("Failed to sync content segment %u: %s", active->id, strerror(errno));
+    }
+    return result == 0 ? 0 : -1;
+}
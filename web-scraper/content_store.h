@@ -0,0 +1,71 @@
+#ifndef CONTENT_STORE_H
+#define CONTENT_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Disk-backed, append-only content store
+//
+// Bodies are appended to segment files (seg-NNNNNN.dat) in a directory and
+// located through an in-memory hash index (key -> segment, offset, length)
+// rebuilt from the segments at startup. Reads go through mmap. Deletes
+// append a tombstone; a background compactor rewrites segments whose live
+// data has dropped below CONTENT_STORE_COMPACT_RATIO.
+//
+// Each compactor pass also sweeps one closed segment: records the owner
+// reports as no longer referenced (their blob expired) are deleted, so the
+// store does not outgrow what is actually cached. The active segment is
+// fsynced every pass and when it is closed, and compaction fsyncs the
+// copied records before it removes the segment they came from.
+
+#define CONTENT_STORE_DIR "content_store"
+#define CONTENT_STORE_SEGMENT_SIZE (64UL * 1024 * 1024)  // Rotate segments at 64MB
+#define CONTENT_STORE_COMPACT_RATIO 0.5                   // Compact below 50% live
+#define CONTENT_STORE_COMPACT_INTERVAL 30                 // Seconds between compactor runs
+#define CONTENT_STORE_SWEEP_BATCH 256                     // Keys per liveness query
+
+// Reports which keys are still referenced: sets live[i] to 0 or 1
+// Returns 0 on success, -1 if it cannot tell (nothing is deleted then)
+typedef int (*content_store_live_fn)(const uint64_t *keys, int count, int *live);
+
+// Let the compactor drop records whose owner no longer references them
+void content_store_set_liveness(content_store_live_fn fn);
+
+// Open (or create) the store and start the compactor
+// Returns 0 on success, -1 on failure
+int content_store_open(const char *dir);
+
+// Stop the compactor and release all segments
+void content_store_close(void);
+
+// Whether the store is open
+int content_store_is_open(void);
+
+// Append a record; storing an existing key is a no-op
+// Returns 0 on success, -1 on failure
+int content_store_put(uint64_t key, const void *data, size_t len);
+
+// Look up a record and point *data into the mapped segment
+// On success (returns 0) the store stays read-locked until
+// content_store_release() is called; on a miss (returns -1) it does not
+int content_store_get(uint64_t key, const char **data, size_t *len);
+
+// Release the read lock taken by a successful content_store_get()
+void content_store_release(void);
+
+// Delete a record
+// Returns 0 if it existed, -1 otherwise
+int content_store_delete(uint64_t key);
+
+// Rewrite sparse segments now; returns bytes reclaimed
+size_t content_store_compact(void);
+
+// Delete the unreferenced records of the next closed segment
+// Returns the number of records deleted
+size_t content_store_sweep(void);
+
+// Flush the active segment to disk
+// Returns 0 on success, -1 on failure
+int content_store_sync(void);
+
+#endif // CONTENT_STORE_H
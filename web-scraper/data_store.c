@@ -1,10 +1,55 @@
 #include "data_store.h"
 #include "logger.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-static PGconn *conn = NULL;
+#define PG_EPOCH_OFFSET 946684800LL   // Seconds from 1970-01-01 to 2000-01-01
+
+enum { TABLE_PAGES, TABLE_IMAGES, TABLE_LINKS, TABLE_COUNT };
+
+// Binary COPY rows for one table, without the file header and trailer
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+    unsigned long rows;
+} copy_buffer_t;
+
+static char *store_conninfo = NULL;
+static PGconn *writer_conn = NULL;   // Batch writer thread only
+
+// Lookup connections, each used by one thread at a time
+typedef struct {
+    PGconn *pg;
+    int prepared;   // Lookup statements are prepared on pg
+    int busy;
+} pooled_conn_t;
+
+static pooled_conn_t pool[DATA_STORE_POOL_SIZE];
+static char *pool_conninfo = NULL;   // NULL while the store is closed
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+static copy_buffer_t pending[TABLE_COUNT];   // Filled by crawler threads
+static copy_buffer_t writing[TABLE_COUNT];   // Owned by the writer during a flush
+static size_t pending_bytes = 0;
+static unsigned long pending_rows = 0;
+static int flush_requested = 0;
+static unsigned long long swap_seq = 0;      // Batches taken by the writer
+static unsigned long long done_seq = 0;      // ... and finished
+static int last_flush_ok = 1;
+static int staging_ready = 0;
+static int running = 0;
+static pthread_t writer_thread;
+static data_store_stats_t stats;
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;   // Wakes the writer
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;    // Space freed, batch done
 
 // SQL statements
 static const char *CREATE_TABLES_SQL = 
@@ -34,177 +79,858 @@ static const char *CREATE_TABLES_SQL =
     "    PRIMARY KEY (from_url, to_url)"
     ");";
 
+// Session-local staging tables; ON COMMIT DELETE ROWS empties them after each merge
+static const char *CREATE_STAGING_SQL =
+    "CREATE TEMP TABLE IF NOT EXISTS pages_staging ("
+    "    url TEXT, title TEXT, description TEXT, keywords TEXT, author TEXT,"
+    "    crawl_time TIMESTAMP, content_size BIGINT, content_type TEXT,"
+    "    status_code INTEGER, response_time DOUBLE PRECISION"
+    ") ON COMMIT DELETE ROWS;"
+    "CREATE TEMP TABLE IF NOT EXISTS images_staging ("
+    "    page_url TEXT, src TEXT, alt TEXT, width INTEGER, height INTEGER"
+    ") ON COMMIT DELETE ROWS;"
+    "CREATE TEMP TABLE IF NOT EXISTS links_staging ("
+    "    from_url TEXT, to_url TEXT"
+    ") ON COMMIT DELETE ROWS;";
+
+static const char *COPY_SQL[TABLE_COUNT] = {
+    "COPY pages_staging (url, title, description, keywords, author, crawl_time, "
+    "content_size, content_type, status_code, response_time) FROM STDIN (FORMAT binary)",
+    "COPY images_staging (page_url, src, alt, width, height) FROM STDIN (FORMAT binary)",
+    "COPY links_staging (from_url, to_url) FROM STDIN (FORMAT binary)"
+};
+
+// Move staged rows into the tables; the latest crawl of a page wins
+static const char *MERGE_SQL =
+    "INSERT INTO pages (url, title, description, keywords, author, crawl_time, "
+    "content_size, content_type, status_code, response_time) "
+    "SELECT DISTINCT ON (url) url, title, description, keywords, author, crawl_time, "
+    "content_size, content_type, status_code, response_time "
+    "FROM pages_staging ORDER BY url, crawl_time DESC "
+    "ON CONFLICT (url) DO UPDATE SET "
+    "title = EXCLUDED.title, description = EXCLUDED.description, "
+    "keywords = EXCLUDED.keywords, author = EXCLUDED.author, "
+    "crawl_time = EXCLUDED.crawl_time, content_size = EXCLUDED.content_size, "
+    "content_type = EXCLUDED.content_type, status_code = EXCLUDED.status_code, "
+    "response_time = EXCLUDED.response_time;"
+    "INSERT INTO pages (url) "
+    "SELECT from_url FROM links_staging UNION SELECT to_url FROM links_staging "
+    "UNION SELECT page_url FROM images_staging ORDER BY 1 "
+    "ON CONFLICT DO NOTHING;"
+    "INSERT INTO links (from_url, to_url) "
+    "SELECT DISTINCT from_url, to_url FROM links_staging ORDER BY 1, 2 "
+    "ON CONFLICT DO NOTHING;"
+    "INSERT INTO images (page_url, src, alt, width, height) "
+    "SELECT page_url, src, alt, width, height FROM images_staging;";
+
+// Lookups, prepared once per pooled connection; results come back binary
+enum { STMT_PAGE_METADATA, STMT_PAGE_IMAGES, STMT_PAGE_LINKS, STMT_COUNT };
+
+static const struct {
+    const char *name;
+    const char *sql;
+} LOOKUP_STATEMENTS[STMT_COUNT] = {
+    {"page_metadata",
+     "SELECT url, title, description, keywords, author, crawl_time, content_size, "
+     "content_type, status_code, response_time FROM pages WHERE url = $1"},
+    {"page_images", "SELECT src, alt, width, height FROM images WHERE page_url = $1"},
+    {"page_links", "SELECT to_url FROM links WHERE from_url = $1"}
+};
+
+// Binary COPY file header: signature, flags, header extension length
+static const char COPY_HEADER[19] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0";
+static const char COPY_TRAILER[2] = "\377\377";
+
+// Store rows in the database at conninfo
+void data_store_set_conninfo(const char *conninfo) {
+    free(store_conninfo);
+    store_conninfo = conninfo ? strdup(conninfo) : NULL;
+}
+
+// Connection string, or NULL if the data store is disabled
+const char *data_store_get_conninfo(void) {
+    return store_conninfo;
+}
+
+// Run a statement that returns no rows
+static int exec_command(PGconn *pg, const char *sql, const char *what) {
+    PGresult *res = PQexec(pg, sql);
+    int ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) {
+        LOG_ERROR("Failed to %s: %s", what, PQerrorMessage(pg));
+    }
+    PQclear(res);
+    return ok ? 0 : -1;
+}
+
+// Open a connection to the database
+static PGconn *connect_db(const char *conninfo) {
+    PGconn *pg = PQconnectdb(conninfo);
+    if (PQstatus(pg) != CONNECTION_OK) {
+        LOG_ERROR("Database connection failed: %s", PQerrorMessage(pg));
+        PQfinish(pg);
+        return NULL;
+    }
+    return pg;
+}
+
+static void *batch_writer_thread(void *arg);
+
 int data_store_init(const char *conninfo) {
     LOG_INFO("Initializing database connection");
-    
-    conn = PQconnectdb(conninfo);
-    if (PQstatus(conn) != CONNECTION_OK) {
-        LOG_ERROR("Database connection failed: %s", PQerrorMessage(conn));
-        PQfinish(conn);
+    if (!conninfo) {
+        return -1;
+    }
+
+    // The writer streams batches over a connection of its own
+    writer_conn = connect_db(conninfo);
+    if (!writer_conn) {
         return -1;
     }
 
     // Create tables if they don't exist
-    PGresult *res = PQexec(conn, CREATE_TABLES_SQL);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        LOG_ERROR("Failed to create tables: %s", PQerrorMessage(conn));
-        PQclear(res);
-        PQfinish(conn);
+    if (exec_command(writer_conn, CREATE_TABLES_SQL, "create tables") != 0) {
+        PQfinish(writer_conn);
+        writer_conn = NULL;
         return -1;
     }
-    PQclear(res);
+    staging_ready = exec_command(writer_conn, CREATE_STAGING_SQL, "create staging tables") == 0;
+
+    // Lookup connections are opened on first use
+    pthread_mutex_lock(&pool_mutex);
+    pool_conninfo = strdup(conninfo);
+    pthread_mutex_unlock(&pool_mutex);
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (!pool_conninfo || pthread_create(&writer_thread, NULL, batch_writer_thread, NULL) != 0) {
+        LOG_ERROR("Failed to start database writer thread");
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        PQfinish(writer_conn);
+        writer_conn = NULL;
+        pthread_mutex_lock(&pool_mutex);
+        free(pool_conninfo);
+        pool_conninfo = NULL;
+        pthread_mutex_unlock(&pool_mutex);
+        return -1;
+    }
+    return 0;
+}
 
+// Whether rows are being stored
+bool data_store_is_open(void) {
+    return __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+}
+
+// Make room for n more bytes
+static int buffer_reserve(copy_buffer_t *buf, size_t n) {
+    if (buf->len + n <= buf->capacity) {
+        return 0;
+    }
+    size_t capacity = buf->capacity ? buf->capacity * 2 : 64 * 1024;
+    while (capacity < buf->len + n) {
+        capacity *= 2;
+    }
+    unsigned char *grown = realloc(buf->data, capacity);
+    if (!grown) {
+        return -1;
+    }
+    buf->data = grown;
+    buf->capacity = capacity;
     return 0;
 }
 
-void data_store_cleanup() {
-    LOG_INFO("Closing database connection");
-    if (conn) {
-        PQfinish(conn);
-        conn = NULL;
+// Append big-endian integers; space has been reserved
+static void put_u16(copy_buffer_t *buf, uint16_t v) {
+    buf->data[buf->len++] = v >> 8;
+    buf->data[buf->len++] = v & 0xFF;
+}
+
+static void put_u32(copy_buffer_t *buf, uint32_t v) {
+    put_u16(buf, v >> 16);
+    put_u16(buf, v & 0xFFFF);
+}
+
+static void put_u64(copy_buffer_t *buf, uint64_t v) {
+    put_u32(buf, v >> 32);
+    put_u32(buf, v & 0xFFFFFFFF);
+}
+
+// Bytes a text field takes, length word included
+static size_t text_size(const char *s) {
+    return 4 + (s ? strlen(s) : 0);
+}
+
+// Append a text field; NULL is stored as SQL NULL
+static void put_text(copy_buffer_t *buf, const char *s) {
+    if (!s) {
+        put_u32(buf, UINT32_MAX);
+        return;
     }
+    size_t len = strlen(s);
+    put_u32(buf, len);
+    memcpy(buf->data + buf->len, s, len);
+    buf->len += len;
 }
 
-// Store page metadata in the database
-bool store_page_metadata(const page_metadata_t *metadata) {
-    if (!conn || !metadata) return false;
-
-    const char *params[10];
-    params[0] = metadata->url;
-    params[1] = metadata->title;
-    params[2] = metadata->description;
-    params[3] = metadata->keywords;
-    params[4] = metadata->author;
-    params[5] = NULL; // Will be set to current timestamp
-    params[6] = NULL; // Will be set to content_size
-    params[7] = metadata->content_type;
-    params[8] = NULL; // Will be set to status_code
-    params[9] = NULL; // Will be set to response_time
-
-    char content_size_str[32];
-    char status_code_str[32];
-    char response_time_str[32];
-    char timestamp_str[32];
-
-    // Convert metadata values to strings
-    snprintf(content_size_str, sizeof(content_size_str), "%zu", metadata->content_size);
-    snprintf(status_code_str, sizeof(status_code_str), "%d", metadata->status_code);
-    snprintf(response_time_str, sizeof(response_time_str), "%.3f", metadata->response_time);
-    snprintf(timestamp_str, sizeof(timestamp_str), "%ld", (long)metadata->crawl_time);
-
-    params[5] = timestamp_str;
-    params[6] = content_size_str;
-    params[8] = status_code_str;
-    params[9] = response_time_str;
-
-    // Insert the page metadata into the database
-    const char *sql = "INSERT INTO pages (url, title, description, keywords, author, "
-                     "crawl_time, content_size, content_type, status_code, response_time) "
-                     "VALUES ($1, $2, $3, $4, $5, to_timestamp($6), $7, $8, $9, $10) "
-                     "ON CONFLICT (url) DO UPDATE SET "
-                     "title = EXCLUDED.title, description = EXCLUDED.description, "
-                     "keywords = EXCLUDED.keywords, author = EXCLUDED.author, "
-                     "crawl_time = EXCLUDED.crawl_time, content_size = EXCLUDED.content_size, "
-                     "content_type = EXCLUDED.content_type, status_code = EXCLUDED.status_code, "
-                     "response_time = EXCLUDED.response_time";
-
-    PGresult *res = PQexecParams(conn, sql, 10, NULL, params, NULL, NULL, 0);
-    bool success = (PQresultStatus(res) == PGRES_COMMAND_OK);
-    if (!success) {
-        LOG_ERROR("Failed to store page metadata: %s", PQerrorMessage(conn));
+static void put_int4(copy_buffer_t *buf, int32_t v) {
+    put_u32(buf, 4);
+    put_u32(buf, (uint32_t)v);
+}
+
+static void put_int8(copy_buffer_t *buf, int64_t v) {
+    put_u32(buf, 8);
+    put_u64(buf, (uint64_t)v);
+}
+
+static void put_float8(copy_buffer_t *buf, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_u32(buf, 8);
+    put_u64(buf, bits);
+}
+
+// Timestamps are microseconds since 2000-01-01
+static void put_timestamp(copy_buffer_t *buf, time_t t) {
+    put_int8(buf, ((int64_t)t - PG_EPOCH_OFFSET) * 1000000);
+}
+
+// Wait for queue space and reserve size bytes in a table's batch
+// Returns the batch with queue_mutex held, or NULL with it released
+static copy_buffer_t *begin_row(int table, size_t size) {
+    if (!data_store_is_open()) {
+        return NULL;
     }
-    PQclear(res);
-    return success;
+    pthread_mutex_lock(&queue_mutex);
+    if (running && pending_bytes >= DATA_STORE_MAX_PENDING) {
+        stats.producer_waits++;
+        pthread_cond_signal(&queue_cond);
+        while (running && pending_bytes >= DATA_STORE_MAX_PENDING) {
+            pthread_cond_wait(&done_cond, &queue_mutex);
+        }
+    }
+    copy_buffer_t *buf = &pending[table];
+    if (!running || buffer_reserve(buf, size) != 0) {
+        pthread_mutex_unlock(&queue_mutex);
+        return NULL;
+    }
+    return buf;
 }
 
-// Store image data in the database
-bool store_image_data(const image_data_t *image) {
-    if (!conn || !image) return false;
-
-    const char *params[5];
-    params[0] = image->url;
-    params[1] = image->src;
-    params[2] = image->alt;
-    params[3] = NULL; // Will be set to width
-    params[4] = NULL; // Will be set to height
-
-    char width_str[32];
-    char height_str[32];
-    snprintf(width_str, sizeof(width_str), "%d", image->width);
-    snprintf(height_str, sizeof(height_str), "%d", image->height);
-    params[3] = width_str;
-    params[4] = height_str;
-
-    const char *sql = "INSERT INTO images (page_url, src, alt, width, height) "
-                     "VALUES ($1, $2, $3, $4, $5)";
-
-    PGresult *res = PQexecParams(conn, sql, 5, NULL, params, NULL, NULL, 0);
-    bool success = (PQresultStatus(res) == PGRES_COMMAND_OK);
-    if (!success) {
-        LOG_ERROR("Failed to store image data: %s", PQerrorMessage(conn));
+// Account for rows written since begin_row and release the queue
+static void end_row(copy_buffer_t *buf, size_t size, int rows) {
+    buf->rows += rows;
+    pending_bytes += size;
+    pending_rows += rows;
+    stats.rows_queued += rows;
+    if (pending_rows >= DATA_STORE_BATCH_ROWS) {
+        pthread_cond_signal(&queue_cond);
     }
-    PQclear(res);
-    return success;
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Queue page metadata
+bool store_page_metadata(const page_metadata_t *metadata) {
+    if (!metadata || !metadata->url) return false;
+
+    size_t size = 2 + text_size(metadata->url) + text_size(metadata->title) +
+                  text_size(metadata->description) + text_size(metadata->keywords) +
+                  text_size(metadata->author) + 12 + 12 + text_size(metadata->content_type) +
+                  8 + 12;
+    copy_buffer_t *buf = begin_row(TABLE_PAGES, size);
+    if (!buf) return false;
+
+    put_u16(buf, 10);
+    put_text(buf, metadata->url);
+    put_text(buf, metadata->title);
+    put_text(buf, metadata->description);
+    put_text(buf, metadata->keywords);
+    put_text(buf, metadata->author);
+    put_timestamp(buf, metadata->crawl_time);
+    put_int8(buf, (int64_t)metadata->content_size);
+    put_text(buf, metadata->content_type);
+    put_int4(buf, metadata->status_code);
+    put_float8(buf, metadata->response_time);
+    end_row(buf, size, 1);
+    return true;
+}
+
+// Queue image data
+bool store_image_data(const image_data_t *image) {
+    if (!image || !image->url) return false;
+
+    size_t size = 2 + text_size(image->url) + text_size(image->src) + text_size(image->alt) + 8 + 8;
+    copy_buffer_t *buf = begin_row(TABLE_IMAGES, size);
+    if (!buf) return false;
+
+    put_u16(buf, 5);
+    put_text(buf, image->url);
+    put_text(buf, image->src);
+    put_text(buf, image->alt);
+    put_int4(buf, image->width);
+    put_int4(buf, image->height);
+    end_row(buf, size, 1);
+    return true;
 }
 
-// Store link relationship in the database
+// Queue a link relationship
 bool store_link_relationship(const char *from_url, const char *to_url) {
-    if (!conn || !from_url || !to_url) return false;
+    return store_page_links(from_url, &to_url, 1);
+}
+
+// Queue all out-links of a page under one lock
+bool store_page_links(const char *from_url, const char **links, int count) {
+    if (!from_url || !links || count <= 0) return false;
+
+    size_t from_size = text_size(from_url);
+    size_t size = 0;
+    int rows = 0;
+    for (int i = 0; i < count; i++) {
+        if (links[i]) {
+            size += 2 + from_size + text_size(links[i]);
+            rows++;
+        }
+    }
+    if (rows == 0) return false;
 
-    const char *params[2] = {from_url, to_url};
-    const char *sql = "INSERT INTO links (from_url, to_url) VALUES ($1, $2) "
-                     "ON CONFLICT DO NOTHING";
+    copy_buffer_t *buf = begin_row(TABLE_LINKS, size);
+    if (!buf) return false;
 
-    PGresult *res = PQexecParams(conn, sql, 2, NULL, params, NULL, NULL, 0);
-    bool success = (PQresultStatus(res) == PGRES_COMMAND_OK);
-    if (!success) {
-        LOG_ERROR("Failed to store link relationship: %s", PQerrorMessage(conn));
+    for (int i = 0; i < count; i++) {
+        if (links[i]) {
+            put_u16(buf, 2);
+            put_text(buf, from_url);
+            put_text(buf, links[i]);
+        }
     }
+    end_row(buf, size, rows);
+    return true;
+}
+
+// Stream one table's batch into its staging table
+static int copy_table(int table, const copy_buffer_t *buf) {
+    PGresult *res = PQexec(writer_conn, COPY_SQL[table]);
+    int ok = PQresultStatus(res) == PGRES_COPY_IN;
     PQclear(res);
-    return success;
+    if (!ok) {
+        LOG_ERROR("Failed to start COPY: %s", PQerrorMessage(writer_conn));
+        return -1;
+    }
+
+    ok = PQputCopyData(writer_conn, COPY_HEADER, sizeof(COPY_HEADER)) == 1;
+    for (size_t off = 0; ok && off < buf->len;) {
+        size_t n = buf->len - off < (1 << 20) ? buf->len - off : (1 << 20);
+        ok = PQputCopyData(writer_conn, (const char *)buf->data + off, (int)n) == 1;
+        off += n;
+    }
+    ok = ok && PQputCopyData(writer_conn, COPY_TRAILER, sizeof(COPY_TRAILER)) == 1;
+    if (PQputCopyEnd(writer_conn, ok ? NULL : "batch aborted") != 1) {
+        ok = 0;
+    }
+
+    while ((res = PQgetResult(writer_conn))) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            if (ok) {
+                LOG_ERROR("COPY failed: %s", PQerrorMessage(writer_conn));
+            }
+            ok = 0;
+        }
+        PQclear(res);
+    }
+    return ok ? 0 : -1;
 }
 
-// Get page metadata from the database
-bool get_page_metadata(const char *url, page_metadata_t *metadata) {
-    if (!conn || !url || !metadata) return false;
+// COPY a batch into staging and merge it in one transaction
+static int write_batch(copy_buffer_t *bufs) {
+    if (PQstatus(writer_conn) != CONNECTION_OK) {
+        LOG_WARNING("Database writer connection lost, reconnecting");
+        PQreset(writer_conn);
+        staging_ready = 0;
+        if (PQstatus(writer_conn) != CONNECTION_OK) {
+            return -1;
+        }
+    }
+    if (!staging_ready) {
+        if (exec_command(writer_conn, CREATE_STAGING_SQL, "create staging tables") != 0) {
+            return -1;
+        }
+        staging_ready = 1;
+    }
+
+    if (exec_command(writer_conn, "BEGIN", "begin batch") != 0) {
+        return -1;
+    }
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        if (bufs[t].rows > 0 && copy_table(t, &bufs[t]) != 0) {
+            exec_command(writer_conn, "ROLLBACK", "roll back batch");
+            return -1;
+        }
+    }
+    if (exec_command(writer_conn, MERGE_SQL, "merge batch") != 0) {
+        exec_command(writer_conn, "ROLLBACK", "roll back batch");
+        return -1;
+    }
+    return exec_command(writer_conn, "COMMIT", "commit batch");
+}
+
+// Byte offset just past the first rows rows of a COPY buffer
+static size_t row_offset(const copy_buffer_t *buf, unsigned long rows) {
+    size_t off = 0;
+    for (unsigned long r = 0; r < rows && off + 2 <= buf->len; r++) {
+        int fields = buf->data[off] << 8 | buf->data[off + 1];
+        off += 2;
+        for (int f = 0; f < fields && off + 4 <= buf->len; f++) {
+            int32_t len = (int32_t)((uint32_t)buf->data[off] << 24 |
+                                    (uint32_t)buf->data[off + 1] << 16 |
+                                    (uint32_t)buf->data[off + 2] << 8 | buf->data[off + 3]);
+            off += 4 + (len > 0 ? (size_t)len : 0);
+        }
+    }
+    return off < buf->len ? off : buf->len;
+}
+
+// Write a failed batch in smaller pieces, one table at a time and then in
+// halves, so that rows the database rejects only cost their own piece.
+// MERGE_SQL adds placeholder pages, so a table can be merged on its own
+// Returns the number of rows that could not be written
+static unsigned long write_pieces(const copy_buffer_t *bufs) {
+    unsigned long total = 0;
+    int tables = 0;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        total += bufs[t].rows;
+        tables += bufs[t].rows > 0;
+    }
+    if (total <= 1 || PQstatus(writer_conn) != CONNECTION_OK) {
+        return total;
+    }
+
+    copy_buffer_t pieces[TABLE_COUNT][TABLE_COUNT];
+    int piece_count = 0;
+    memset(pieces, 0, sizeof(pieces));
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        if (bufs[t].rows == 0) {
+            continue;
+        }
+        if (tables > 1) {
+            pieces[piece_count++][t] = bufs[t];
+        } else {
+            unsigned long first = bufs[t].rows / 2;
+            size_t split = row_offset(&bufs[t], first);
+            pieces[0][t] = (copy_buffer_t){bufs[t].data, split, 0, first};
+            pieces[1][t] = (copy_buffer_t){bufs[t].data + split, bufs[t].len - split, 0,
+                                           bufs[t].rows - first};
+            piece_count = 2;
+        }
+    }
+    unsigned long failed = 0;
+    for (int p = 0; p < piece_count; p++) {
+        if (write_batch(pieces[p]) != 0) {
+            failed += write_pieces(pieces[p]);
+        }
+    }
+    return failed;
+}
 
+// Hand the pending rows to the writer and write them
+// Called and returns with queue_mutex held
+static void flush_pending(void) {
+    flush_requested = 0;
+    if (pending_rows == 0) {
+        return;
+    }
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        copy_buffer_t swap = writing[t];
+        writing[t] = pending[t];
+        pending[t] = swap;
+        pending[t].len = 0;
+        pending[t].rows = 0;
+    }
+    unsigned long rows = pending_rows;
+    pending_rows = 0;
+    pending_bytes = 0;
+    unsigned long long seq = ++swap_seq;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&queue_mutex);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long failed = 0;
+    if (write_batch(writing) != 0) {
+        // Once more on a fresh connection, then piece by piece
+        LOG_WARNING("Database batch of %lu rows failed, retrying", rows);
+        PQreset(writer_conn);
+        staging_ready = 0;
+        if (write_batch(writing) != 0) {
+            failed = write_pieces(writing);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_mutex_lock(&queue_mutex);
+    stats.flushes++;
+    stats.last_flush_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    stats.rows_written += rows - failed;
+    if (failed > 0) {
+        stats.flush_failures++;
+        stats.rows_failed += failed;
+        LOG_ERROR("Dropped %lu of a batch of %lu database rows", failed, rows);
+    }
+    last_flush_ok = failed == 0;
+    done_seq = seq;
+    pthread_cond_broadcast(&done_cond);
+}
+
+// Flush when a batch fills up, on request, and every DATA_STORE_FLUSH_MS
+static void *batch_writer_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_mutex);
+    while (running) {
+        if (pending_rows < DATA_STORE_BATCH_ROWS && !flush_requested) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)DATA_STORE_FLUSH_MS * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&queue_cond, &queue_mutex, &deadline);
+        }
+        flush_pending();
+    }
+    flush_pending();
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+// Write every row queued so far and wait for it to be merged
+int data_store_flush(void) {
+    pthread_mutex_lock(&queue_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&queue_mutex);
+        return 0;
+    }
+    unsigned long long want = swap_seq + (pending_rows > 0);
+    flush_requested = 1;
+    pthread_cond_signal(&queue_cond);
+    while (running && done_seq < want) {
+        pthread_cond_wait(&done_cond, &queue_mutex);
+    }
+    int ok = last_flush_ok;
+    pthread_mutex_unlock(&queue_mutex);
+    return ok ? 0 : -1;
+}
+
+// Counters since startup
+void data_store_get_stats(data_store_stats_t *out) {
+    pthread_mutex_lock(&queue_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+void data_store_cleanup() {
+    LOG_INFO("Closing database connection");
+    pthread_mutex_lock(&queue_mutex);
+    int was_running = running;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&queue_cond);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    if (was_running) {
+        pthread_join(writer_thread, NULL);
+    }
+
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        free(pending[t].data);
+        free(writing[t].data);
+    }
+    memset(pending, 0, sizeof(pending));
+    memset(writing, 0, sizeof(writing));
+    pending_bytes = 0;
+    pending_rows = 0;
+
+    if (writer_conn) {
+        PQfinish(writer_conn);
+        writer_conn = NULL;
+    }
+
+    // Wait for lookups in progress, then close their connections
+    pthread_mutex_lock(&pool_mutex);
+    free(pool_conninfo);
+    pool_conninfo = NULL;
+    for (int i = 0; i < DATA_STORE_POOL_SIZE; i++) {
+        while (pool[i].busy) {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        }
+        if (pool[i].pg) {
+            PQfinish(pool[i].pg);
+        }
+        pool[i].pg = NULL;
+        pool[i].prepared = 0;
+    }
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Take a free lookup connection, waiting for one if all are busy
+// The connection is open and its statements prepared; NULL on failure
+static pooled_conn_t *pool_acquire(void) {
+    pthread_mutex_lock(&pool_mutex);
+    pooled_conn_t *slot = NULL;
+    while (pool_conninfo && !slot) {
+        for (int i = 0; i < DATA_STORE_POOL_SIZE && !slot; i++) {
+            if (!pool[i].busy) {
+                slot = &pool[i];
+            }
+        }
+        if (!slot) {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        }
+    }
+    if (!slot) {
+        pthread_mutex_unlock(&pool_mutex);
+        return NULL;
+    }
+    slot->busy = 1;
+    char *conninfo = slot->pg ? NULL : strdup(pool_conninfo);
+    pthread_mutex_unlock(&pool_mutex);
+
+    // (Re)connect outside the lock; a reset drops prepared statements
+    if (!slot->pg) {
+        slot->pg = conninfo ? connect_db(conninfo) : NULL;
+        slot->prepared = 0;
+    } else if (PQstatus(slot->pg) != CONNECTION_OK) {
+        LOG_WARNING("Database lookup connection lost, reconnecting");
+        PQreset(slot->pg);
+        slot->prepared = 0;
+    }
+    free(conninfo);
+
+    int ok = slot->pg && PQstatus(slot->pg) == CONNECTION_OK;
+    for (int s = 0; ok && !slot->prepared && s < STMT_COUNT; s++) {
+        PGresult *res = PQprepare(slot->pg, LOOKUP_STATEMENTS[s].name, LOOKUP_STATEMENTS[s].sql, 1, NULL);
+        ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        if (!ok) {
+            LOG_ERROR("Failed to prepare %s: %s", LOOKUP_STATEMENTS[s].name, PQerrorMessage(slot->pg));
+        }
+        PQclear(res);
+    }
+    if (!ok) {
+        // Start over from a fresh connection next time
+        if (slot->pg) {
+            PQfinish(slot->pg);
+            slot->pg = NULL;
+        }
+        pthread_mutex_lock(&pool_mutex);
+        slot->busy = 0;
+        pthread_cond_broadcast(&pool_cond);
+        pthread_mutex_unlock(&pool_mutex);
+        return NULL;
+    }
+    slot->prepared = 1;
+    return slot;
+}
+
+static void pool_release(pooled_conn_t *slot) {
+    pthread_mutex_lock(&pool_mutex);
+    slot->busy = 0;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Run a prepared lookup for one URL, with binary results
+static PGresult *exec_lookup(pooled_conn_t *slot, int stmt, const char *url) {
     const char *params[1] = {url};
-    const char *sql = "SELECT * FROM pages WHERE url = $1";
+    PGresult *res = PQexecPrepared(slot->pg, LOOKUP_STATEMENTS[stmt].name, 1, params, NULL, NULL, 1);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        LOG_ERROR("Lookup %s failed: %s", LOOKUP_STATEMENTS[stmt].name, PQerrorMessage(slot->pg));
+        PQclear(res);
+        return NULL;
+    }
+    return res;
+}
+
+// Decode big-endian binary result fields
+static uint64_t get_u64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
 
-    PGresult *res = PQexecParams(conn, sql, 1, NULL, params, NULL, NULL, 0);
-    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// A text column, copied; SQL NULL becomes NULL
+static char *get_text(const PGresult *res, int row, int col) {
+    if (PQgetisnull(res, row, col)) {
+        return NULL;
+    }
+    int len = PQgetlength(res, row, col);
+    char *s = malloc(len + 1);
+    if (s) {
+        memcpy(s, PQgetvalue(res, row, col), len);
+        s[len] = '\0';
+    }
+    return s;
+}
+
+static int32_t get_int4(const PGresult *res, int row, int col) {
+    return PQgetisnull(res, row, col) ? 0 : (int32_t)get_u32((const unsigned char *)PQgetvalue(res, row, col));
+}
+
+static int64_t get_int8(const PGresult *res, int row, int col) {
+    return PQgetisnull(res, row, col) ? 0 : (int64_t)get_u64((const unsigned char *)PQgetvalue(res, row, col));
+}
+
+static double get_float8(const PGresult *res, int row, int col) {
+    uint64_t bits = (uint64_t)get_int8(res, row, col);
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Microseconds since 2000-01-01 back to a time_t
+static time_t get_timestamp(const PGresult *res, int row, int col) {
+    if (PQgetisnull(res, row, col)) {
+        return 0;
+    }
+    int64_t usec = get_int8(res, row, col);
+    return (time_t)(usec / 1000000 + PG_EPOCH_OFFSET);
+}
+
+// Fill metadata from a page_metadata row
+static void decode_metadata(const PGresult *res, int row, page_metadata_t *metadata) {
+    metadata->url = get_text(res, row, 0);
+    metadata->title = get_text(res, row, 1);
+    metadata->description = get_text(res, row, 2);
+    metadata->keywords = get_text(res, row, 3);
+    metadata->author = get_text(res, row, 4);
+    metadata->crawl_time = get_timestamp(res, row, 5);
+    metadata->content_size = (size_t)get_int8(res, row, 6);
+    metadata->content_type = get_text(res, row, 7);
+    metadata->status_code = get_int4(res, row, 8);
+    metadata->response_time = get_float8(res, row, 9);
+}
+
+// Free the strings of a page_metadata_t (not the struct itself)
+void free_page_metadata(page_metadata_t *metadata) {
+    if (!metadata) return;
+    free(metadata->url);
+    free(metadata->title);
+    free(metadata->description);
+    free(metadata->keywords);
+    free(metadata->author);
+    free(metadata->content_type);
+    memset(metadata, 0, sizeof(*metadata));
+}
+
+// Get page metadata from the database
+bool get_page_metadata(const char *url, page_metadata_t *metadata) {
+    if (!url || !metadata) return false;
+
+    pooled_conn_t *slot = pool_acquire();
+    if (!slot) return false;
+    PGresult *res = exec_lookup(slot, STMT_PAGE_METADATA, url);
+    pool_release(slot);
+    if (!res || PQntuples(res) == 0) {
         PQclear(res);
         return false;
     }
 
-    // Fill metadata structure
-    metadata->url = strdup(PQgetvalue(res, 0, 0));
-    metadata->title = strdup(PQgetvalue(res, 0, 1));
-    metadata->description = strdup(PQgetvalue(res, 0, 2));
-    metadata->keywords = strdup(PQgetvalue(res, 0, 3));
-    metadata->author = strdup(PQgetvalue(res, 0, 4));
-    metadata->crawl_time = atol(PQgetvalue(res, 0, 5));
-    metadata->content_size = atol(PQgetvalue(res, 0, 6));
-    metadata->content_type = strdup(PQgetvalue(res, 0, 7));
-    metadata->status_code = atoi(PQgetvalue(res, 0, 8));
-    metadata->response_time = atof(PQgetvalue(res, 0, 9));
-
+    decode_metadata(res, 0, metadata);
     PQclear(res);
     return true;
 }
 
-// Get page images from the database
-bool get_page_images(const char *url, image_data_t **images, int *count) {
-    if (!conn || !url || !images || !count) return false;
+// Get metadata for many pages in one round trip
+int get_pages_metadata(const char **urls, int count, page_metadata_t *metadata) {
+    if (!urls || !metadata || count < 0) return -1;
+    memset(metadata, 0, count * sizeof(page_metadata_t));
+    if (count == 0) return 0;
 
-    const char *params[1] = {url};
-    const char *sql = "SELECT src, alt, width, height FROM images WHERE page_url = $1";
+    pooled_conn_t *slot = pool_acquire();
+    if (!slot) return -1;
+    int found = 0;
 
-    PGresult *res = PQexecParams(conn, sql, 1, NULL, params, NULL, NULL, 0);
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+#ifdef LIBPQ_HAS_PIPELINING
+    // Queue every lookup, then read the results back in order
+    if (PQenterPipelineMode(slot->pg) != 1) {
+        pool_release(slot);
+        return -1;
+    }
+    int sent = 0;
+    while (sent < count &&
+           PQsendQueryPrepared(slot->pg, LOOKUP_STATEMENTS[STMT_PAGE_METADATA].name, 1,
+                               &urls[sent], NULL, NULL, 1) == 1) {
+        sent++;
+    }
+    int ok = PQpipelineSync(slot->pg) == 1 && sent == count;
+
+    PGresult *res;
+    for (int i = 0; i < sent; i++) {
+        if (!(res = PQgetResult(slot->pg))) {
+            ok = 0;
+            break;
+        }
+        if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) {
+            decode_metadata(res, 0, &metadata[i]);
+            found++;
+        } else if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            ok = 0;
+        }
         PQclear(res);
-        return false;
+        // Each query's results end with a NULL
+        while ((res = PQgetResult(slot->pg))) {
+            PQclear(res);
+        }
+    }
+    if ((res = PQgetResult(slot->pg))) {
+        ok = ok && PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+        PQclear(res);
+    }
+    if (PQexitPipelineMode(slot->pg) != 1) {
+        // Results are still pending; drop the connection rather than reuse it
+        LOG_ERROR("Failed to leave pipeline mode: %s", PQerrorMessage(slot->pg));
+        PQfinish(slot->pg);
+        slot->pg = NULL;
+        ok = 0;
     }
+    if (!ok) {
+        LOG_ERROR("Batched page lookup failed");
+    }
+#else
+    int ok = 1;
+    for (int i = 0; ok && i < count; i++) {
+        PGresult *res = exec_lookup(slot, STMT_PAGE_METADATA, urls[i]);
+        ok = res != NULL;
+        if (res && PQntuples(res) > 0) {
+            decode_metadata(res, 0, &metadata[i]);
+            found++;
+        }
+        PQclear(res);
+    }
+#endif
+
+    pool_release(slot);
+    if (!ok) {
+        // A partial answer would pass missing rows off as pages not stored
+        for (int i = 0; i < count; i++) {
+            free_page_metadata(&metadata[i]);
+        }
+        return -1;
+    }
+    return found;
+}
+
+// Get page images from the database
+bool get_page_images(const char *url, image_data_t **images, int *count) {
+    if (!url || !images || !count) return false;
+
+    pooled_conn_t *slot = pool_acquire();
+    if (!slot) return false;
+    PGresult *res = exec_lookup(slot, STMT_PAGE_IMAGES, url);
+    pool_release(slot);
+    if (!res) return false;
 
     *count = PQntuples(res);
     *images = malloc(*count * sizeof(image_data_t));
@@ -216,10 +942,10 @@ bool get_page_images(const char *url, image_data_t **images, int *count) {
     // Fill the image data structure
     for (int i = 0; i < *count; i++) {
         (*images)[i].url = strdup(url);
-        (*images)[i].src = strdup(PQgetvalue(res, i, 0));
-        (*images)[i].alt = strdup(PQgetvalue(res, i, 1));
-        (*images)[i].width = atoi(PQgetvalue(res, i, 2));
-        (*images)[i].height = atoi(PQgetvalue(res, i, 3));
+        (*images)[i].src = get_text(res, i, 0);
+        (*images)[i].alt = get_text(res, i, 1);
+        (*images)[i].width = get_int4(res, i, 2);
+        (*images)[i].height = get_int4(res, i, 3);
     }
 
     PQclear(res);
@@ -228,16 +954,13 @@ bool get_page_images(const char *url, image_data_t **images, int *count) {
 
 // Get page links from the database
 bool get_page_links(const char *url, char ***links, int *count) {
-    if (!conn || !url || !links || !count) return false;
+    if (!url || !links || !count) return false;
 
-    const char *params[1] = {url};
-    const char *sql = "SELECT to_url FROM links WHERE from_url = $1";
-
-    PGresult *res = PQexecParams(conn, sql, 1, NULL, params, NULL, NULL, 0);
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        PQclear(res);
-        return false;
-    }
+    pooled_conn_t *slot = pool_acquire();
+    if (!slot) return false;
+    PGresult *res = exec_lookup(slot, STMT_PAGE_LINKS, url);
+    pool_release(slot);
+    if (!res) return false;
 
     *count = PQntuples(res);
     *links = malloc(*count * sizeof(char *));
@@ -247,9 +970,9 @@ bool get_page_links(const char *url, char ***links, int *count) {
     }
 
     for (int i = 0; i < *count; i++) {
-        (*links)[i] = strdup(PQgetvalue(res, i, 0));
+        (*links)[i] = get_text(res, i, 0);
     }
 
     PQclear(res);
     return true;
-} 
\ No newline at end of file
+}
@@ -3,6 +3,34 @@
 
 #include <libpq-fe.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Postgres data store
+//
+// Rows stored during the crawl are encoded straight into in-memory COPY
+// batches, one per table, and a writer thread with its own connection
+// streams them into session-local staging tables with
+// COPY ... FROM STDIN (FORMAT binary). The staging rows are then merged
+// into pages, images and links in the same transaction: pages are
+// upserted, link endpoints and image pages without a row of their own
+// get an empty one so the foreign keys hold, and duplicate links are
+// dropped. A batch is flushed once it holds DATA_STORE_BATCH_ROWS rows or
+// every DATA_STORE_FLUSH_MS, whichever comes first; producers wait when
+// DATA_STORE_MAX_PENDING bytes are queued. crawl_time is stored as UTC.
+// A failed batch is retried once on a fresh connection, then written one
+// table at a time and in halves, so only the rows that keep failing are
+// dropped.
+//
+// Lookups take a connection from a pool of DATA_STORE_POOL_SIZE, opened
+// on first use, on which every lookup statement is prepared once. Rows
+// come back in binary format; batched lookups are pipelined so many
+// URLs cost one round trip.
+
+#define DATA_STORE_BATCH_ROWS 10000                  // Rows that trigger a flush
+#define DATA_STORE_FLUSH_MS 1000                     // Longest a row waits to be flushed
+#define DATA_STORE_MAX_PENDING (64 * 1024 * 1024)    // Queued bytes before producers wait
+#define DATA_STORE_POOL_SIZE 4                       // Lookup connections
 
 // Data structures for extracted content
 typedef struct {
@@ -26,28 +54,67 @@ typedef struct {
     int height;
 } image_data_t;
 
-// Initialize database connection
+// Data store counters
+typedef struct {
+    unsigned long long rows_queued;
+    unsigned long long rows_written;    // Merged into the tables
+    unsigned long long rows_failed;     // Lost with a batch that could not be written
+    unsigned long flushes;
+    unsigned long flush_failures;
+    unsigned long last_flush_ms;        // Wall time of the last COPY and merge
+    unsigned long producer_waits;       // Stores that waited for queue space
+} data_store_stats_t;
+
+// Store rows in the database at conninfo; NULL disables the data store
+void data_store_set_conninfo(const char *conninfo);
+
+// Connection string, or NULL if the data store is disabled
+const char *data_store_get_conninfo(void);
+
+// Initialize database connections and start the batch writer
 int data_store_init(const char *conninfo);
 
-// Close database connection
+// Whether rows are being stored
+bool data_store_is_open(void);
+
+// Write every row queued so far and wait for it to be merged
+// Returns 0 on success, -1 if a batch failed
+int data_store_flush(void);
+
+// Counters since startup
+void data_store_get_stats(data_store_stats_t *out);
+
+// Flush queued rows, stop the writer and close database connections
 void data_store_cleanup();
 
-// Store page metadata
+// Queue page metadata
 bool store_page_metadata(const page_metadata_t *metadata);
 
-// Store image data
+// Queue image data
 bool store_image_data(const image_data_t *image);
 
-// Store link relationship
+// Queue a link relationship
 bool store_link_relationship(const char *from_url, const char *to_url);
 
-// Get page metadata by URL
+// Queue all out-links of a page
+bool store_page_links(const char *from_url, const char **links, int count);
+
+// Get page metadata by URL; columns that are SQL NULL come back NULL
+// Free the strings with free_page_metadata()
 bool get_page_metadata(const char *url, page_metadata_t *metadata);
 
+// Get metadata for count pages in one pipelined round trip
+// metadata[i].url is NULL for URLs without a row
+// Returns the number of pages found, or -1 on failure
+int get_pages_metadata(const char **urls, int count, page_metadata_t *metadata);
+
+// Free the strings of a page_metadata_t (not the struct itself)
+void free_page_metadata(page_metadata_t *metadata);
+
 // Get images for a page
 bool get_page_images(const char *url, image_data_t **images, int *count);
 
 // Get links from a page
 bool get_page_links(const char *url, char ***links, int *count);
 
-#endif // DATA_STORE_H 
\ No newline at end of file
+#endif // DATA_STORE_H
@@ -0,0 +1,56 @@
+#include "extract_canonical.h"
+#include "extract_hrefs.h"
+#include "logger.h"
+
+/**
+ * Extracts the canonical URL declared by the page, if any.
+ *
+ * @param html: Pointer to the HTML content.
+ * @param base_url: URL used to resolve a relative canonical href.
+ */
+char *extract_canonical(const char *html, const char *base_url) {
+  if (!html || !base_url)
+    return NULL;
+
+  xmlDocPtr doc = htmlReadMemory(html, strlen(html), NULL, NULL,
+                                 HTML_PARSE_RECOVER | HTML_PARSE_NOERROR |
+                                     HTML_PARSE_NOWARNING);
+  if (!doc) {
+    LOG_ERROR("Failed to parse HTML document");
+    return NULL;
+  }
+
+  xmlXPathContextPtr context = xmlXPathNewContext(doc);
+  if (!context) {
+    LOG_ERROR("Failed to create XPath context");
+    xmlFreeDoc(doc);
+    return NULL;
+  }
+
+  // rel values are case-insensitive
+  xmlXPathObjectPtr result = xmlXPathEvalExpression(
+      (xmlChar *)"//link[translate(@rel, 'CANONICAL', 'canonical')"
+                 "='canonical'][@href]",
+      context);
+  if (!result) {
+    LOG_ERROR("Failed to evaluate XPath expression");
+    xmlXPathFreeContext(context);
+    xmlFreeDoc(doc);
+    return NULL;
+  }
+
+  char *canonical = NULL;
+  if (result->nodesetval && result->nodesetval->nodeNr > 0) {
+    xmlChar *href =
+        xmlGetProp(result->nodesetval->nodeTab[0], (xmlChar *)"href");
+    if (href) {
+      canonical = normalize_url(base_url, (char *)href);
+      xmlFree(href);
+    }
+  }
+
+  xmlXPathFreeObject(result);
+  xmlXPathFreeContext(context);
+  xmlFreeDoc(doc);
+  return canonical;
+}
@@ -0,0 +1,17 @@
+#ifndef EXTRACT_CANONICAL_H
+#define EXTRACT_CANONICAL_H
+
+#include "scraper.h"
+
+/**
+ * Extracts the target of <link rel="canonical" href="..."> from the given HTML.
+ *
+ * @param html Pointer to the HTML content.
+ * @param base_url The URL the page was served from, used to resolve
+ *                 relative canonical links.
+ * @return A newly allocated absolute URL, or NULL if the page has no
+ *         usable canonical link. The caller must free the result.
+ */
+char *extract_canonical(const char *html, const char *base_url);
+
+#endif // EXTRACT_CANONICAL_H
@@ -1,4 +1,6 @@
+#include "extract_hrefs.h"
 #include "redis_helper.h"
+#include "redis_scripts.h"
 #include "scraper.h"
 #include <libxml/HTMLparser.h>
 #include <libxml/uri.h>
@@ -7,6 +9,8 @@
 #include <regex.h>
 #include "logger.h"
 #include "robots_parser.h"  // For redis_ctx declaration
+#include "link_graph.h"
+#include "data_store.h"
 
 // Redis context (declared in robots_parser.h)
 extern redisContext *redis_ctx;
@@ -80,6 +84,33 @@ char *normalize_url(const char *base_url, const char *href) {
  * @param base_url The base URL of the page.
  */
 void extract_hrefs(const char *html, const char *base_url) {
+  extract_hrefs_with_priority(html, base_url, DEFAULT_LINK_PRIORITY);
+}
+
+/**
+ * Extracts hyperlinks and queues the unvisited ones with the given priority.
+ *
+ * @param html Pointer to the HTML content.
+ * @param base_url The base URL of the page.
+ * @param priority Queue score for discovered links (lower is crawled first).
+ */
+void extract_hrefs_with_priority(const char *html, const char *base_url,
+                                 int priority) {
+  extract_hrefs_at_depth(html, base_url, priority, 0, -1);
+}
+
+/**
+ * Extracts hyperlinks and queues the unvisited ones one level below the
+ * page, unless that exceeds the maximum depth.
+ *
+ * @param html Pointer to the HTML content.
+ * @param base_url The base URL of the page.
+ * @param priority Queue score for discovered links (lower is crawled first).
+ * @param depth Crawl depth of the page itself.
+ * @param max_depth Deepest level to queue, or -1 for no limit.
+ */
+void extract_hrefs_at_depth(const char *html, const char *base_url,
+                            int priority, int depth, int max_depth) {
   if (!html || !base_url) {
     LOG_ERROR("Invalid parameters to extract_hrefs");
     return;
@@ -124,6 +155,16 @@ void extract_hrefs(const char *html, const char *base_url) {
     return;
   }
 
+  int link_count = 0;
+  char **links = malloc(result->nodesetval->nodeNr * sizeof(char *));
+  if (!links) {
+    LOG_ERROR("Failed to allocate memory for discovered links");
+    xmlXPathFreeObject(result);
+    xmlXPathFreeContext(context);
+    xmlFreeDoc(doc);
+    return;
+  }
+
   for (int i = 0; i < result->nodesetval->nodeNr; i++) {
     xmlNodePtr node = result->nodesetval->nodeTab[i];
     if (!node) continue;
@@ -135,16 +176,30 @@ void extract_hrefs(const char *html, const char *base_url) {
     xmlFree(href);
 
     if (normalized_url) {
-      // Check if URL is already visited
-      int visited = is_visited(normalized_url);
-      if (!visited) {
-        // Add to queue if not visited
-        push_url_to_queue(normalized_url, 1);
-        LOG_INFO("Discovered: %s", normalized_url);
-      }
-      free(normalized_url);
+      links[link_count++] = normalized_url;
+    }
+  }
+
+  // Rewrite links to known redirecting URLs before checking them
+  resolve_redirects_bulk(links, link_count);
+
+  // Record the page's out-links for the PageRank pass
+  link_graph_add_page(base_url, (const char **)links, link_count);
+
+  // Queue them for the Postgres links table
+  store_page_links(base_url, (const char **)links, link_count);
+
+  // Queue the unvisited links in one atomic round trip
+  int *admitted = link_count > 0 ? calloc(link_count, sizeof(int)) : NULL;
+  admit_links((const char **)links, link_count, priority, depth, max_depth, admitted);
+  for (int i = 0; i < link_count; i++) {
+    if (admitted && admitted[i]) {
+      LOG_INFO("Discovered: %s", links[i]);
     }
+    free(links[i]);
   }
+  free(admitted);
+  free(links);
 
   xmlXPathFreeObject(result);
   xmlXPathFreeContext(context);
@@ -4,6 +4,20 @@
 #include "scraper.h"
 #include "redis_helper.h"
 
+// Queue priorities for discovered links (lower scores are crawled first)
+#define DEFAULT_LINK_PRIORITY 1
+#define DUPLICATE_LINK_PRIORITY 10
+
+/**
+ * Normalizes a href found on a page into an absolute URL.
+ *
+ * @param base_url The base page URL.
+ * @param href The extracted href value (may be modified in place).
+ * @return A dynamically allocated absolute URL (caller must free) or NULL if
+ * invalid.
+ */
+char *normalize_url(const char *base_url, const char *href);
+
 /**
  * Extracts and processes all hyperlinks (<a href="...") from the given HTML.
  *
@@ -12,4 +26,28 @@
  */
 void extract_hrefs(const char *html, const char *base_url);
 
+/**
+ * Extracts hyperlinks like extract_hrefs(), queueing them with the given
+ * priority instead of the default.
+ *
+ * @param html Pointer to the HTML content.
+ * @param base_url The base URL of the page.
+ * @param priority Queue score for discovered links.
+ */
+void extract_hrefs_with_priority(const char *html, const char *base_url,
+                                 int priority);
+
+/**
+ * Extracts hyperlinks like extract_hrefs_with_priority(), queueing them at
+ * depth + 1 and only while that does not exceed max_depth.
+ *
+ * @param html Pointer to the HTML content.
+ * @param base_url The base URL of the page.
+ * @param priority Queue score for discovered links.
+ * @param depth Crawl depth of the page itself.
+ * @param max_depth Deepest level to queue, or -1 for no limit.
+ */
+void extract_hrefs_at_depth(const char *html, const char *base_url,
+                            int priority, int depth, int max_depth);
+
 #endif // EXTRACT_HREFS_H 
\ No newline at end of file
@@ -1,11 +1,15 @@
 #include "scraper.h"
+#include "result_sink.h"
 
 /**
- * Extracts and prints all <meta> tags (both name/content and property/content).
+ * Extracts all <meta> tags (both name/content and property/content) and
+ * emits one result record per tag, or prints them when no result sink is
+ * open.
  *
  * @param html: Pointer to the HTML content.
+ * @param url: URL of the page.
  */
-void extract_meta(const char *html) {
+void extract_meta(const char *html, const char *url) {
   if (!html)
     return;
 
@@ -34,7 +38,8 @@ void extract_meta(const char *html) {
   }
 
   if (!result->nodesetval || result->nodesetval->nodeNr == 0) {
-    fprintf(stderr, "No <meta> tags found\n");
+    if (!result_sink_is_open())
+      fprintf(stderr, "No <meta> tags found\n");
   } else {
     for (int i = 0; i < result->nodesetval->nodeNr; i++) {
       xmlNodePtr node = result->nodesetval->nodeTab[i];
@@ -44,8 +49,17 @@ void extract_meta(const char *html) {
           xmlGetProp(node, (xmlChar *)"property"); // For Open Graph meta tags
 
       if ((name && content) || (property && content)) {
-        printf("Meta: %s=\"%s\", content=\"%s\"\n", name ? "name" : "property",
-               name ? name : property, content);
+        if (result_sink_is_open()) {
+          result_record_t record;
+          result_record_init(&record, "meta", url);
+          result_record_add(&record, name ? "name" : "property",
+                            (const char *)(name ? name : property));
+          result_record_add(&record, "content", (const char *)content);
+          result_sink_emit(&record);
+        } else {
+          printf("Meta: %s=\"%s\", content=\"%s\"\n", name ? "name" : "property",
+                 name ? name : property, content);
+        }
       }
 
       xmlFree(name);
@@ -4,10 +4,13 @@
 #include "scraper.h"
 
 /**
- * Extracts and prints all <meta> tags (both name/content and property/content).
+ * Extracts all <meta> tags (both name/content and property/content) and
+ * emits one result record per tag, or prints them when no result sink is
+ * open.
  *
  * @param html Pointer to the HTML content.
+ * @param url URL of the page.
  */
-void extract_meta(const char *html);
+void extract_meta(const char *html, const char *url);
 
 #endif // EXTRACT_META_H 
\ No newline at end of file
@@ -1,11 +1,14 @@
 #include "scraper.h"
+#include "result_sink.h"
 
 /**
- * Extracts and prints the content inside the <title> tag from the given HTML.
+ * Extracts the content inside the <title> tag from the given HTML and
+ * emits it as a result record, or prints it when no result sink is open.
  *
  * @param html: Pointer to the HTML content.
+ * @param url: URL of the page.
  */
-void extract_title(const char *html) {
+void extract_title(const char *html, const char *url) {
   if (!html)
     return;
 
@@ -38,10 +41,17 @@ void extract_title(const char *html) {
     xmlChar *title = xmlNodeGetContent(node);
 
     if (title) {
-      printf("Title: %s\n", title);
+      if (result_sink_is_open()) {
+        result_record_t record;
+        result_record_init(&record, "title", url);
+        result_record_add(&record, "title", (const char *)title);
+        result_sink_emit(&record);
+      } else {
+        printf("Title: %s\n", title);
+      }
       xmlFree(title);
     }
-  } else {
+  } else if (!result_sink_is_open()) {
     printf("No <title> found.\n");
   }
 
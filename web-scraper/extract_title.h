@@ -4,10 +4,12 @@
 #include "scraper.h"
 
 /**
- * Extracts and prints the content inside the <title> tag from the given HTML.
+ * Extracts the content inside the <title> tag from the given HTML and
+ * emits it as a result record, or prints it when no result sink is open.
  *
  * @param html Pointer to the HTML content.
+ * @param url URL of the page.
  */
-void extract_title(const char *html);
+void extract_title(const char *html, const char *url);
 
 #endif // EXTRACT_TITLE_H 
\ No newline at end of file
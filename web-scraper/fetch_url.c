@@ -2,11 +2,70 @@
 #include "write_callback.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Appends a URL to the redirect chain of a fetch
+static void add_redirect(fetch_info_t *info, const char *url) {
+  char **chain = realloc(info->redirects,
+                         (info->redirect_count + 1) * sizeof(char *));
+  if (!chain) {
+    fprintf(stderr, "Memory allocation failed while recording redirect\n");
+    return;
+  }
+  info->redirects = chain;
+  info->redirects[info->redirect_count] = strdup(url);
+  if (info->redirects[info->redirect_count]) {
+    info->redirect_count++;
+  }
+}
+
+// Captures the request headers curl sends
+static int debug_callback(CURL *handle, curl_infotype type, char *data,
+                          size_t size, void *userp) {
+  (void)handle;
+  if (type == CURLINFO_HEADER_OUT) {
+    write_callback(data, 1, size, userp);
+  }
+  return 0;
+}
+
+// Whether a redirect target may be followed; only http and https are
+static int allowed_scheme(const char *url) {
+  return strncasecmp(url, "http://", 7) == 0 || strncasecmp(url, "https://", 8) == 0;
+}
+
+// Drops the body of a fetch that did not produce a page
+static void fail_fetch(struct Memory *chunk) {
+  free(chunk->response);
+  chunk->response = NULL;
+  chunk->size = 0;
+}
+
+// Copies a string reported by curl, if any
+static char *dup_curl_string(CURL *curl, CURLINFO what) {
+  char *value = NULL;
+  curl_easy_getinfo(curl, what, &value);
+  return value ? strdup(value) : NULL;
+}
 
 /**
  * Fetches the content of a URL using libcurl.
  */
 void fetch_url(const char *url, struct Memory *chunk) {
+  fetch_url_tracked(url, chunk, NULL);
+}
+
+/**
+ * Fetches the content of a URL using libcurl, following redirects manually
+ * so that every hop can be recorded.
+ */
+void fetch_url_tracked(const char *url, struct Memory *chunk,
+                       fetch_info_t *info) {
+  if (info) {
+    memset(info, 0, sizeof(fetch_info_t));
+  }
+
   CURL *curl = curl_easy_init();
   if (!curl) {
     fprintf(stderr, "Failed to initialize CURL\n");
@@ -16,16 +75,98 @@ void fetch_url(const char *url, struct Memory *chunk) {
   chunk->response = malloc(1);
   chunk->size = 0;
 
-  curl_easy_setopt(curl, CURLOPT_URL, url);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 0L);
   curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L); // Timeout for safety
+  // Redirects are followed by hand, so curl's own redirect protocol
+  // restriction does not apply; never leave http and https
+#if LIBCURL_VERSION_NUM >= 0x075500
+  curl_easy_setopt(curl, CURLOPT_PROTOCOLS_STR, "http,https");
+#else
+  curl_easy_setopt(curl, CURLOPT_PROTOCOLS, (long)(CURLPROTO_HTTP | CURLPROTO_HTTPS));
+#endif
+  if (info) {
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&info->response_headers);
+    curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_callback);
+    curl_easy_setopt(curl, CURLOPT_DEBUGDATA, (void *)&info->request_headers);
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+  }
+
+  char *current = strdup(url);
+  for (int hop = 0; current && hop <= FETCH_MAX_REDIRECTS; hop++) {
+    // Discard the body of the previous hop
+    chunk->size = 0;
+    if (chunk->response) {
+      chunk->response[0] = '\0';
+    }
+    if (info) {
+      info->request_headers.size = 0;
+      info->response_headers.size = 0;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, current);
+    CURLcode res = curl_easy_perform(curl);
+    if (res != CURLE_OK) {
+      fprintf(stderr, "CURL error: %s\n", curl_easy_strerror(res));
+      break;
+    }
+
+    long status = 0;
+    char *location = NULL;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(curl, CURLINFO_REDIRECT_URL, &location);
+    if (info) {
+      info->status_code = status;
+    }
 
-  CURLcode res = curl_easy_perform(curl);
-  if (res != CURLE_OK) {
-    fprintf(stderr, "CURL error: %s\n", curl_easy_strerror(res));
+    if (status < 300 || status >= 400 || !location) {
+      break;
+    }
+    if (hop == FETCH_MAX_REDIRECTS) {
+      // The body is the last redirect response, not a page
+      fprintf(stderr, "Too many redirects for %s\n", url);
+      fail_fetch(chunk);
+      break;
+    }
+    if (!allowed_scheme(location)) {
+      fprintf(stderr, "Refusing redirect from %s to %s\n", current, location);
+      fail_fetch(chunk);
+      break;
+    }
+
+    if (info) {
+      add_redirect(info, current);
+    }
+    free(current);
+    current = strdup(location);
+  }
+
+  if (info) {
+    char *effective = NULL;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective);
+    info->effective_url = strdup(effective ? effective : url);
+    info->content_type = dup_curl_string(curl, CURLINFO_CONTENT_TYPE);
+    info->remote_ip = dup_curl_string(curl, CURLINFO_PRIMARY_IP);
   }
 
+  free(current);
   curl_easy_cleanup(curl);
 }
+
+void free_fetch_info(fetch_info_t *info) {
+  if (!info) {
+    return;
+  }
+  for (int i = 0; i < info->redirect_count; i++) {
+    free(info->redirects[i]);
+  }
+  free(info->redirects);
+  free(info->effective_url);
+  free(info->content_type);
+  free(info->remote_ip);
+  free(info->request_headers.response);
+  free(info->response_headers.response);
+  memset(info, 0, sizeof(fetch_info_t));
+}
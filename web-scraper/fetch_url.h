@@ -4,6 +4,28 @@
 #include "scraper.h" // For struct Memory
 #include <curl/curl.h>
 
+#define FETCH_MAX_REDIRECTS 10
+
+/**
+ * Details about how a fetch was resolved.
+ *
+ * `redirects` lists every URL that answered with a redirect, in the order
+ * they were followed (the requested URL first if it redirected).
+ * `effective_url` is the URL the body was finally served from.
+ * The request and response headers are captured verbatim for the final hop
+ * so the exchange can be archived.
+ */
+typedef struct {
+  char *effective_url;
+  char **redirects;
+  int redirect_count;
+  long status_code;
+  char *content_type;
+  char *remote_ip;
+  struct Memory request_headers;
+  struct Memory response_headers;
+} fetch_info_t;
+
 /**
  * Fetches the content of a URL and stores it in a dynamically allocated buffer.
  *
@@ -12,4 +34,23 @@
  */
 void fetch_url(const char *url, struct Memory *chunk);
 
+/**
+ * Fetches a URL like fetch_url(), following redirects one hop at a time so
+ * the redirect chain and effective URL can be reported. Only http and https
+ * URLs are fetched. If a redirect leaves them or more than
+ * FETCH_MAX_REDIRECTS redirects are needed, chunk->response is left NULL.
+ *
+ * @param url The URL to fetch.
+ * @param chunk Pointer to a Memory struct to store the response.
+ * @param info Filled with the redirect details; release with free_fetch_info().
+ *             May be NULL.
+ */
+void fetch_url_tracked(const char *url, struct Memory *chunk,
+                       fetch_info_t *info);
+
+/**
+ * Frees the strings owned by a fetch_info_t (not the struct itself).
+ */
+void free_fetch_info(fetch_info_t *info);
+
 #endif // FETCH_URL_H
@@ -0,0 +1,696 @@
+#include "frontier.h"
+#include "frontier_runs.h"
+#include "logger.h"
+#include "shard_router.h"
+#include <hiredis/hiredis.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARINT_MAX_BYTES 10
+#define HTTPS_PREFIX "https://"
+#define HTTP_PREFIX "http://"
+
+// Queue member for a URL of the host tag
+const char *frontier_member(const char *url, const char *tag, char *buf, size_t size) {
+    size_t tag_len = strlen(tag);
+    if (strncmp(url, HTTPS_PREFIX, 8) == 0 && strncmp(url + 8, tag, tag_len) == 0 &&
+        url[8 + tag_len] == '/') {
+        return url + 8 + tag_len;
+    }
+    if (strncmp(url, HTTP_PREFIX, 7) == 0 && strncmp(url + 7, tag, tag_len) == 0 &&
+        url[7 + tag_len] == '/') {
+        const char *path = url + 7 + tag_len;
+        size_t path_len = strlen(path);
+        if (buf && path_len + 2 <= size) {
+            buf[0] = ':';
+            memcpy(buf + 1, path, path_len + 1);
+            return buf;
+        }
+    }
+    return url;
+}
+
+// Full URL for a queue member of the host tag
+char *frontier_url(const char *member, size_t len, const char *tag) {
+    const char *prefix = "";
+    const char *host = "";
+    if (len > 0 && member[0] == '/') {
+        prefix = HTTPS_PREFIX;
+        host = tag;
+    } else if (len > 0 && member[0] == ':') {
+        prefix = HTTP_PREFIX;
+        host = tag;
+        member++;
+        len--;
+    }
+
+    size_t prefix_len = strlen(prefix), host_len = strlen(host);
+    char *url = malloc(prefix_len + host_len + len + 1);
+    if (!url) {
+        return NULL;
+    }
+    memcpy(url, prefix, prefix_len);
+    memcpy(url + prefix_len, host, host_len);
+    memcpy(url + prefix_len + host_len, member, len);
+    url[prefix_len + host_len + len] = '\0';
+    return url;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t len = 0;
+    do {
+        unsigned char byte = value & 0x7F;
+        value >>= 7;
+        out[len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return len;
+}
+
+static int get_varint(const unsigned char **pos, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        unsigned char byte = *(*pos)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint64_t zigzag(long long value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static long long unzigzag(uint64_t value) {
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+typedef struct {
+    const char *member;
+    size_t len;
+    long long score;
+} block_entry_t;
+
+// Priority first, then bytewise, the order ZRANGE returns
+static int compare_entries(const void *a, const void *b) {
+    const block_entry_t *ea = a, *eb = b;
+    if (ea->score != eb->score) {
+        return ea->score < eb->score ? -1 : 1;
+    }
+    size_t len = ea->len < eb->len ? ea->len : eb->len;
+    int cmp = memcmp(ea->member, eb->member, len);
+    if (cmp) {
+        return cmp;
+    }
+    return ea->len < eb->len ? -1 : ea->len > eb->len;
+}
+
+// Front-code members with their priorities into a block
+int frontier_block_encode(const char **members, const size_t *lens, const long long *scores,
+                          int count, unsigned char **out, size_t *out_len) {
+    if (!members || count < 0) {
+        return -1;
+    }
+
+    // Sort a copy; within a priority, neighbours share long prefixes
+    size_t bound = 2 + VARINT_MAX_BYTES;
+    block_entry_t *entries = malloc((count ? count : 1) * sizeof(block_entry_t));
+    if (!entries) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        entries[i].member = members[i];
+        entries[i].len = lens[i];
+        entries[i].score = scores[i];
+        bound += lens[i] + 3 * VARINT_MAX_BYTES;
+    }
+    qsort(entries, count, sizeof(block_entry_t), compare_entries);
+
+    unsigned char *data = malloc(bound);
+    if (!data) {
+        free(entries);
+        return -1;
+    }
+    size_t len = 0;
+    data[len++] = FRONTIER_BLOCK_MAGIC;
+    data[len++] = FRONTIER_BLOCK_VERSION;
+    len += put_varint(data + len, count);
+
+    const char *previous = "";
+    size_t previous_len = 0;
+    for (int i = 0; i < count; i++) {
+        size_t shared = 0;
+        while (shared < previous_len && shared < entries[i].len &&
+               previous[shared] == entries[i].member[shared]) {
+            shared++;
+        }
+        len += put_varint(data + len, shared);
+        len += put_varint(data + len, entries[i].len - shared);
+        memcpy(data + len, entries[i].member + shared, entries[i].len - shared);
+        len += entries[i].len - shared;
+        len += put_varint(data + len, zigzag(entries[i].score));
+        previous = entries[i].member;
+        previous_len = entries[i].len;
+    }
+    free(entries);
+
+    *out = data;
+    *out_len = len;
+    return 0;
+}
+
+// Walk a block without storing it; returns the bytes needed for the
+// decoded members, or -1 if the block is malformed
+static long long measure_block(const unsigned char *pos, const unsigned char *end,
+                               uint64_t count) {
+    long long total = 0;
+    uint64_t previous_len = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t shared, suffix, score;
+        if (get_varint(&pos, end, &shared) != 0 || get_varint(&pos, end, &suffix) != 0 ||
+            shared > previous_len || suffix > (uint64_t)(end - pos)) {
+            return -1;
+        }
+        pos += suffix;
+        if (get_varint(&pos, end, &score) != 0) {
+            return -1;
+        }
+        previous_len = shared + suffix;
+        total += previous_len + 1;
+    }
+    return pos == end ? total : -1;
+}
+
+// Decode a block
+frontier_block_t *frontier_block_decode(const unsigned char *data, size_t len) {
+    if (!data || len < 3 || data[0] != FRONTIER_BLOCK_MAGIC ||
+        data[1] != FRONTIER_BLOCK_VERSION) {
+        return NULL;
+    }
+    const unsigned char *pos = data + 2, *end = data + len;
+    uint64_t count;
+    if (get_varint(&pos, end, &count) != 0 || count > len) {
+        return NULL;
+    }
+    long long text_size = measure_block(pos, end, count);
+    if (text_size < 0) {
+        return NULL;
+    }
+
+    // One allocation: header, member pointers, lengths, scores, then text
+    size_t size = sizeof(frontier_block_t) +
+                  count * (sizeof(char *) + sizeof(size_t) + sizeof(long long)) + text_size;
+    frontier_block_t *block = malloc(size);
+    if (!block) {
+        return NULL;
+    }
+    block->count = (int)count;
+    block->members = (char **)(block + 1);
+    block->lens = (size_t *)(block->members + count);
+    block->scores = (long long *)(block->lens + count);
+    char *text = (char *)(block->scores + count);
+
+    const char *previous = "";
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t shared, suffix, score;
+        if (get_varint(&pos, end, &shared) != 0 || get_varint(&pos, end, &suffix) != 0) {
+            free(block);
+            return NULL;
+        }
+        memcpy(text, previous, shared);
+        memcpy(text + shared, pos, suffix);
+        text[shared + suffix] = '\0';
+        pos += suffix;
+        if (get_varint(&pos, end, &score) != 0) {
+            free(block);
+            return NULL;
+        }
+
+        block->members[i] = text;
+        block->lens[i] = shared + suffix;
+        block->scores[i] = unzigzag(score);
+        previous = text;
+        text += shared + suffix + 1;
+    }
+    return block;
+}
+
+static int queue_keys(const char *tag, char *queue_key, char *blocks_key) {
+    if (shard_tag_key(queue_key, SHARD_KEY_MAX, URL_QUEUE_PREFIX, tag, NULL) != 0 ||
+        shard_tag_key(blocks_key, SHARD_KEY_MAX, URL_QUEUE_PREFIX, tag,
+                      FRONTIER_BLOCKS_SUFFIX) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Move one block's worth of the lowest-priority tail into a block
+static int spill_block(int node, const char *queue_key, const char *blocks_key, int count) {
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *tail = redisCommand(ctx, "ZRANGE %s %d -1 WITHSCORES", queue_key, -count);
+    shard_release(node);
+    if (!tail || tail->type != REDIS_REPLY_ARRAY || tail->elements % 2 != 0) {
+        freeReplyObject(tail);
+        return -1;
+    }
+
+    int n = (int)(tail->elements / 2);
+    const char **members = malloc((n + 2) * sizeof(char *));
+    size_t *lens = malloc((n + 2) * sizeof(size_t));
+    long long *scores = malloc((n ? n : 1) * sizeof(long long));
+    unsigned char *block = NULL;
+    size_t block_len = 0;
+    if (!members || !lens || !scores) {
+        free(members);
+        free(lens);
+        free(scores);
+        freeReplyObject(tail);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        members[i + 2] = tail->element[2 * i]->str;
+        lens[i + 2] = tail->element[2 * i]->len;
+        scores[i] = strtoll(tail->element[2 * i + 1]->str, NULL, 10);
+    }
+
+    int moved = -1;
+    if (n > 0 && frontier_block_encode(members + 2, lens + 2, scores, n, &block, &block_len) == 0) {
+        // Store the block and drop its members in one transaction
+        ctx = shard_acquire(node);
+        if (ctx) {
+            members[0] = "ZREM";
+            lens[0] = 4;
+            members[1] = queue_key;
+            lens[1] = strlen(queue_key);
+            redisAppendCommand(ctx, "MULTI");
+            redisAppendCommand(ctx, "RPUSH %s %b", blocks_key, block, block_len);
+            redisAppendCommandArgv(ctx, n + 2, members, lens);
+            redisAppendCommand(ctx, "EXEC");
+            moved = n;
+            for (int i = 0; i < 4; i++) {
+                redisReply *reply = NULL;
+                if (redisGetReply(ctx, (void **)&reply) != REDIS_OK ||
+                    (i == 3 && (!reply || reply->type != REDIS_REPLY_ARRAY))) {
+                    moved = -1;
+                }
+                freeReplyObject(reply);
+            }
+            shard_release(node);
+        }
+    } else if (n == 0) {
+        moved = 0;
+    }
+
+    free(block);
+    free(members);
+    free(lens);
+    free(scores);
+    freeReplyObject(tail);
+    return moved;
+}
+
+// Remove members from a host queue, a block's worth per command
+static void remove_members(int node, const char *queue_key, redisReply *range) {
+    const char *argv[FRONTIER_BLOCK_SIZE + 2];
+    size_t argvlen[FRONTIER_BLOCK_SIZE + 2];
+    argv[0] = "ZREM";
+    argvlen[0] = 4;
+    argv[1] = queue_key;
+    argvlen[1] = strlen(queue_key);
+
+    size_t n = range->elements / 2;
+    for (size_t start = 0; start < n; start += FRONTIER_BLOCK_SIZE) {
+        int argc = 2;
+        for (size_t i = start; i < n && i < start + FRONTIER_BLOCK_SIZE; i++) {
+            argv[argc] = range->element[2 * i]->str;
+            argvlen[argc++] = range->element[2 * i]->len;
+        }
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            return;
+        }
+        freeReplyObject(redisCommandArgv(ctx, argc, argv, argvlen));
+        shard_release(node);
+    }
+}
+
+// Move everything past FRONTIER_HOT_TARGET into a run on local disk
+static int spill_to_disk(const char *tag, int node, const char *queue_key) {
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *range = redisCommand(ctx, "ZRANGE %s %d -1 WITHSCORES", queue_key,
+                                     FRONTIER_HOT_TARGET);
+    shard_release(node);
+    if (!range || range->type != REDIS_REPLY_ARRAY || range->elements % 2 != 0) {
+        freeReplyObject(range);
+        return -1;
+    }
+
+    int n = (int)(range->elements / 2);
+    const char **members = malloc((n ? n : 1) * sizeof(char *));
+    size_t *lens = malloc((n ? n : 1) * sizeof(size_t));
+    long long *scores = malloc((n ? n : 1) * sizeof(long long));
+    int moved = -1;
+    if (members && lens && scores) {
+        for (int i = 0; i < n; i++) {
+            members[i] = range->element[2 * i]->str;
+            lens[i] = range->element[2 * i]->len;
+            scores[i] = strtoll(range->element[2 * i + 1]->str, NULL, 10);
+        }
+        // The run is on disk before Redis lets go of the entries
+        if (n == 0) {
+            moved = 0;
+        } else if (frontier_runs_write(tag, members, lens, scores, n) == 0) {
+            remove_members(node, queue_key, range);
+            moved = n;
+        }
+    }
+    free(members);
+    free(lens);
+    free(scores);
+    freeReplyObject(range);
+    return moved;
+}
+
+// Move the tail of a host's hot queue out of it if it is over the limit
+int frontier_spill(const char *tag) {
+    char queue_key[SHARD_KEY_MAX], blocks_key[SHARD_KEY_MAX];
+    if (!tag || queue_keys(tag, queue_key, blocks_key) != 0) {
+        return -1;
+    }
+    int node = shard_for_key(queue_key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *card = redisCommand(ctx, "ZCARD %s", queue_key);
+    shard_release(node);
+    long long size = card && card->type == REDIS_REPLY_INTEGER ? card->integer : -1;
+    freeReplyObject(card);
+    if (size <= FRONTIER_HOT_MAX) {
+        return size < 0 ? -1 : 0;
+    }
+
+    // Prefer local disk; Redis blocks are the fallback when it fails
+    if (frontier_get_spill_dir()) {
+        int moved = spill_to_disk(tag, node, queue_key);
+        if (moved >= 0) {
+            LOG_DEBUG("Spilled %d queued URLs of %s to disk", moved, tag);
+            return moved;
+        }
+        LOG_WARNING("Failed to spill the frontier of %s to disk, using Redis blocks", tag);
+    }
+
+    int moved = 0;
+    long long excess = size - FRONTIER_HOT_TARGET;
+    while (excess > 0) {
+        int count = excess < FRONTIER_BLOCK_SIZE ? (int)excess : FRONTIER_BLOCK_SIZE;
+        int spilled = spill_block(node, queue_key, blocks_key, count);
+        if (spilled <= 0) {
+            break;
+        }
+        moved += spilled;
+        excess -= spilled;
+    }
+    LOG_DEBUG("Spilled %d queued URLs of %s into blocks", moved, tag);
+    return moved;
+}
+
+// ZADD key NX score member ...; an entry queued again meanwhile keeps its score
+static int restore_block(int node, const char *queue_key, const frontier_block_t *block) {
+    if (block->count == 0) {
+        return 0;
+    }
+    int restored = -1;
+    int argc = 3 + 2 * block->count;
+    const char **argv = malloc(argc * sizeof(char *));
+    size_t *argvlen = malloc(argc * sizeof(size_t));
+    char *scores = malloc((size_t)block->count * 24);
+    redisContext *ctx = argv && argvlen && scores ? shard_acquire(node) : NULL;
+    if (ctx) {
+        argv[0] = "ZADD";
+        argvlen[0] = 4;
+        argv[1] = queue_key;
+        argvlen[1] = strlen(queue_key);
+        argv[2] = "NX";
+        argvlen[2] = 2;
+        for (int i = 0; i < block->count; i++) {
+            char *score = scores + (size_t)i * 24;
+            argvlen[3 + 2 * i] = snprintf(score, 24, "%lld", block->scores[i]);
+            argv[3 + 2 * i] = score;
+            argv[4 + 2 * i] = block->members[i];
+            argvlen[4 + 2 * i] = block->lens[i];
+        }
+        redisReply *reply = redisCommandArgv(ctx, argc, argv, argvlen);
+        shard_release(node);
+        if (reply && reply->type == REDIS_REPLY_INTEGER) {
+            restored = block->count;
+        }
+        freeReplyObject(reply);
+    }
+    free(argv);
+    free(argvlen);
+    free(scores);
+    return restored;
+}
+
+typedef struct {
+    int node;
+    const char *queue_key;
+} restore_target_t;
+
+static int restore_run_entries(const frontier_block_t *block, void *ctx) {
+    const restore_target_t *target = ctx;
+    return restore_block(target->node, target->queue_key, block);
+}
+
+// Remove one copy of a block from the host's block list
+static void drop_block(int node, const char *blocks_key, const char *data, size_t len) {
+    redisContext *ctx = shard_acquire(node);
+    if (ctx) {
+        freeReplyObject(redisCommand(ctx, "LREM %s 1 %b", blocks_key, data, len));
+        shard_release(node);
+    }
+}
+
+// Move the best spilled URLs of a host back into its hot queue: the
+// best block of its disk runs, or else its oldest Redis block. The
+// entries are queued before they leave the run or the block list, so a
+// failed refill loses nothing.
+int frontier_refill(const char *tag) {
+    char queue_key[SHARD_KEY_MAX], blocks_key[SHARD_KEY_MAX];
+    if (!tag || queue_keys(tag, queue_key, blocks_key) != 0) {
+        return -1;
+    }
+    int node = shard_for_key(queue_key);
+
+    restore_target_t target = {node, queue_key};
+    int restored = frontier_runs_take(tag, FRONTIER_BLOCK_SIZE, restore_run_entries, &target);
+    if (restored != 0) {
+        return restored;
+    }
+
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *reply = redisCommand(ctx, "LINDEX %s 0", blocks_key);
+    shard_release(node);
+    if (!reply || reply->type != REDIS_REPLY_STRING) {
+        freeReplyObject(reply);
+        return reply ? 0 : -1;
+    }
+
+    // LREM rather than LPOP: a concurrent refill of the same host may have
+    // taken this block already, and then the next one must stay
+    frontier_block_t *block = frontier_block_decode((unsigned char *)reply->str, reply->len);
+    if (!block) {
+        LOG_WARNING("Dropping malformed frontier block of %s", tag);
+        drop_block(node, blocks_key, reply->str, reply->len);
+        freeReplyObject(reply);
+        return -1;
+    }
+    restored = restore_block(node, queue_key, block);
+    if (restored >= 0) {
+        drop_block(node, blocks_key, reply->str, reply->len);
+    }
+    free(block);
+    freeReplyObject(reply);
+    return restored;
+}
+
+// Pop up to max of a host's best URLs with one read
+int frontier_pop(const char *tag, int max, char **urls) {
+    char queue_key[SHARD_KEY_MAX], blocks_key[SHARD_KEY_MAX];
+    if (!tag || max <= 0 || queue_keys(tag, queue_key, blocks_key) != 0) {
+        return -1;
+    }
+    int node = shard_for_key(queue_key);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            return -1;
+        }
+        redisReply *reply = redisCommand(ctx, "ZPOPMIN %s %d", queue_key, max);
+        shard_release(node);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+            freeReplyObject(reply);
+            return -1;
+        }
+
+        // Members and scores alternate
+        int count = 0;
+        for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+            redisReply *member = reply->element[i];
+            if (member->type != REDIS_REPLY_STRING) {
+                continue;
+            }
+            char *url = frontier_url(member->str, member->len, tag);
+            if (url) {
+                urls[count++] = url;
+            }
+        }
+        freeReplyObject(reply);
+        if (count > 0 || attempt > 0 || frontier_refill(tag) <= 0) {
+            return count;
+        }
+    }
+    return 0;
+}
+
+// Lower a host's place on the schedule to priority, adding it if needed
+int frontier_schedule_at(const char *tag, long long priority) {
+    if (!tag) {
+        return -1;
+    }
+    int node = shard_for_key(FRONTIER_HOSTS_KEY);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    // Sent synchronously: a lost schedule entry would strand the host's URLs
+    redisReply *reply = redisCommand(ctx, "ZADD %s LT %lld %s", FRONTIER_HOSTS_KEY, priority,
+                                     tag);
+    shard_release(node);
+    int ok = reply && reply->type == REDIS_REPLY_INTEGER;
+    freeReplyObject(reply);
+    return ok ? 0 : -1;
+}
+
+// Put a host on the schedule at the best priority in its hot queue
+int frontier_schedule(const char *tag) {
+    char queue_key[SHARD_KEY_MAX], blocks_key[SHARD_KEY_MAX];
+    if (!tag || queue_keys(tag, queue_key, blocks_key) != 0) {
+        return -1;
+    }
+    int node = shard_for_key(queue_key);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            return -1;
+        }
+        redisReply *best = redisCommand(ctx, "ZRANGE %s 0 0 WITHSCORES", queue_key);
+        shard_release(node);
+        if (!best || best->type != REDIS_REPLY_ARRAY) {
+            freeReplyObject(best);
+            return -1;
+        }
+        if (best->elements == 2) {
+            long long priority = strtoll(best->element[1]->str, NULL, 10);
+            freeReplyObject(best);
+            return frontier_schedule_at(tag, priority) == 0 ? 1 : -1;
+        }
+        freeReplyObject(best);
+
+        // Spilled URLs only come back through the hot queue
+        int refilled = attempt == 0 ? frontier_refill(tag) : 0;
+        if (refilled <= 0) {
+            return refilled < 0 ? -1 : 0;
+        }
+    }
+    return 0;
+}
+
+// Convert a frontier:hosts set left by an earlier version into the schedule
+long frontier_schedule_upgrade(void) {
+    int node = shard_for_key(FRONTIER_HOSTS_KEY);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *type = redisCommand(ctx, "TYPE %s", FRONTIER_HOSTS_KEY);
+    int is_set = type && type->type == REDIS_REPLY_STATUS && strcmp(type->str, "set") == 0;
+    freeReplyObject(type);
+    if (!is_set) {
+        shard_release(node);
+        return 0;
+    }
+    // Take the members and drop the set in one step, so the key is free
+    // for the sorted set
+    redisAppendCommand(ctx, "MULTI");
+    redisAppendCommand(ctx, "SMEMBERS %s", FRONTIER_HOSTS_KEY);
+    redisAppendCommand(ctx, "DEL %s", FRONTIER_HOSTS_KEY);
+    redisAppendCommand(ctx, "EXEC");
+    redisReply *exec = NULL;
+    int ok = 1;
+    for (int i = 0; i < 4; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            ok = 0;
+            break;
+        }
+        if (i == 3) {
+            exec = reply;
+        } else {
+            freeReplyObject(reply);
+        }
+    }
+    shard_release(node);
+    if (!ok || !exec || exec->type != REDIS_REPLY_ARRAY || exec->elements != 2 ||
+        exec->element[0]->type != REDIS_REPLY_ARRAY) {
+        freeReplyObject(exec);
+        LOG_ERROR("Failed to convert %s into a host schedule", FRONTIER_HOSTS_KEY);
+        return -1;
+    }
+
+    long scheduled = 0;
+    redisReply *hosts = exec->element[0];
+    size_t count = hosts->elements;
+    for (size_t i = 0; i < count; i++) {
+        if (frontier_schedule(hosts->element[i]->str) > 0) {
+            scheduled++;
+        }
+    }
+    freeReplyObject(exec);
+    LOG_INFO("Converted %s into a host schedule: %ld of %zu hosts have queued URLs",
+             FRONTIER_HOSTS_KEY, scheduled, count);
+    return scheduled;
+}
+
+// Whether a host still has queued URLs, hot or spilled
+int frontier_pending(const char *tag) {
+    char queue_key[SHARD_KEY_MAX], blocks_key[SHARD_KEY_MAX];
+    if (!tag || queue_keys(tag, queue_key, blocks_key) != 0) {
+        return 0;
+    }
+    int node = shard_for_key(queue_key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return 0;
+    }
+    redisReply *reply = redisCommand(ctx, "EXISTS %s %s", queue_key, blocks_key);
+    shard_release(node);
+    int pending = reply && reply->type == REDIS_REPLY_INTEGER && reply->integer > 0;
+    freeReplyObject(reply);
+    return pending || frontier_runs_pending(tag);
+}
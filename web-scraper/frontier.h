@@ -0,0 +1,98 @@
+#ifndef FRONTIER_H
+#define FRONTIER_H
+
+#include <stddef.h>
+
+// Per-host URL frontier
+//
+// Each host has a hot queue, queue:{host}, a sorted set scored by
+// priority. frontier:hosts schedules the hosts that may have work: a
+// sorted set scored by the best priority queued for each host, so the
+// next URL comes from the host at its head. A worker takes that host off
+// the schedule while it pops from it and puts it back at its new best
+// priority afterwards; admissions only ever lower a host's score.
+// Members are stored relative to the host rather than as full URLs:
+//   "/path?query"   https://<host>/path?query
+//   ":/path?query"  http://<host>/path?query
+//   anything else   a full URL (other schemes, ports, user info)
+// A member never starts with '/' or ':' otherwise, so full URLs queued
+// before this encoding still decode to themselves.
+//
+// When a hot queue grows past FRONTIER_HOT_MAX, its lowest-priority tail
+// is moved out: to sorted runs on local disk when a spill directory is
+// set (see frontier_runs.h), otherwise to queue:{host}:blocks, a list of
+// front-coded blocks. Each block holds up to FRONTIER_BLOCK_SIZE members
+// sorted by priority, then bytewise, and each member only stores what
+// differs from the one before it. Spilled URLs are pulled back once the
+// hot queue runs dry, best first from disk and oldest first from Redis.
+// Two workers spilling the same host at once can store a URL twice; the
+// claim and visited checks make the second copy harmless.
+//
+// Block layout (version 1), integers are unsigned LEB128 varints:
+//   magic byte, version byte, varint count, then per member:
+//   varint shared prefix length, varint suffix length, suffix bytes,
+//   varint zigzag-encoded priority.
+
+#define FRONTIER_HOT_MAX 4096       // Spill a host's queue above this size
+#define FRONTIER_HOT_TARGET 2048    // ... down to this size
+#define FRONTIER_BLOCK_SIZE 256     // Members per front-coded block
+#define FRONTIER_BLOCKS_SUFFIX ":blocks"
+#define FRONTIER_BLOCK_MAGIC 0xF7
+#define FRONTIER_BLOCK_VERSION 1
+
+// Queue member for a URL of the host tag. Returns url itself, a pointer
+// into it, or buf (which needs strlen(url) + 2 bytes) for http URLs.
+const char *frontier_member(const char *url, const char *tag, char *buf, size_t size);
+
+// Full URL for a queue member of the host tag
+// Returns a newly allocated string, or NULL on allocation failure
+char *frontier_url(const char *member, size_t len, const char *tag);
+
+// Front-code members with their priorities into a block
+// Returns 0 on success (free *out), -1 on failure
+int frontier_block_encode(const char **members, const size_t *lens, const long long *scores,
+                          int count, unsigned char **out, size_t *out_len);
+
+// Decoded block; members point into the same allocation
+typedef struct {
+    int count;
+    char **members;
+    size_t *lens;
+    long long *scores;
+} frontier_block_t;
+
+// Decode a block; free the result with free()
+// Returns NULL if the block is malformed or allocation fails
+frontier_block_t *frontier_block_decode(const unsigned char *data, size_t len);
+
+// Move the tail of a host's hot queue to disk or into blocks if it is
+// over FRONTIER_HOT_MAX
+// Returns the number of URLs moved, or -1 on failure
+int frontier_spill(const char *tag);
+
+// Move a block of a host's best spilled URLs back into its hot queue
+// Returns the number of URLs restored, 0 if there are no blocks, -1 on failure
+int frontier_refill(const char *tag);
+
+// Pop up to max of a host's best URLs with one read, refilling from the
+// blocks if the hot queue is empty. urls receives allocated strings.
+// Returns the number of URLs popped, or -1 on failure
+int frontier_pop(const char *tag, int max, char **urls);
+
+// Whether a host still has queued URLs, hot or spilled
+int frontier_pending(const char *tag);
+
+// Put a host on the schedule at the best priority in its hot queue,
+// refilling an empty hot queue from its spilled URLs first
+// Returns 1 if scheduled, 0 if the host has nothing queued, -1 on failure
+int frontier_schedule(const char *tag);
+
+// Lower a host's place on the schedule to priority, adding it if needed
+// Returns 0 on success, -1 on failure
+int frontier_schedule_at(const char *tag, long long priority);
+
+// Convert a frontier:hosts set left by an earlier version into the schedule
+// Returns the number of hosts scheduled, or -1 on failure
+long frontier_schedule_upgrade(void);
+
+#endif // FRONTIER_H
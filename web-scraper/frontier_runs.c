@@ -0,0 +1,735 @@
+#include "frontier_runs.h"
+#include "content_hash.h"
+#include "frontier.h"
+#include "logger.h"
+#include "shard_router.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_BUCKETS 1024
+#define RUN_HEADER_FIXED 6    // Magic and tag length
+
+typedef struct {
+    char *path;
+    long offset;    // First block that still has entries
+    int skip;       // Entries of that block already taken
+} run_t;
+
+typedef struct host_runs {
+    char *tag;
+    run_t runs[FRONTIER_MAX_RUNS];   // Oldest first
+    int run_count;
+    struct host_runs *next;
+} host_runs_t;
+
+typedef enum {
+    READER_OK,
+    READER_EOF,           // Read to the end; the run can be removed
+    READER_DAMAGED,       // Malformed or gone; the rest of it is dropped
+    READER_UNAVAILABLE    // Could not be opened or read now; kept for a later try
+} reader_state_t;
+
+// Sequential reader over one run
+typedef struct {
+    FILE *fp;
+    long block_offset;          // Where the loaded block starts
+    frontier_block_t *block;    // NULL unless state is READER_OK
+    int pos;
+    reader_state_t state;
+} run_reader_t;
+
+// Entries copied out of readers, whose blocks do not outlive a step
+typedef struct {
+    char *members[FRONTIER_BLOCK_SIZE];
+    size_t lens[FRONTIER_BLOCK_SIZE];
+    long long scores[FRONTIER_BLOCK_SIZE];
+    int count;
+} block_builder_t;
+
+static int builder_add(block_builder_t *builder, const run_reader_t *reader);
+
+static char *spill_dir = NULL;
+static host_runs_t *hosts[HOST_BUCKETS];
+static frontier_stats_t stats;
+static unsigned long run_seq = 0;
+
+// Guards the index, the counters and all run file I/O
+static pthread_mutex_t runs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Keep spilled frontier runs under dir
+void frontier_set_spill_dir(const char *dir) {
+    pthread_mutex_lock(&runs_mutex);
+    free(spill_dir);
+    spill_dir = dir ? strdup(dir) : NULL;
+    pthread_mutex_unlock(&runs_mutex);
+}
+
+// Spill directory, or NULL if runs are disabled
+const char *frontier_get_spill_dir(void) {
+    return spill_dir;
+}
+
+static host_runs_t **bucket_for(const char *tag) {
+    return &hosts[content_hash64(tag, strlen(tag), 0) % HOST_BUCKETS];
+}
+
+static host_runs_t *find_host(const char *tag) {
+    for (host_runs_t *host = *bucket_for(tag); host; host = host->next) {
+        if (strcmp(host->tag, tag) == 0) {
+            return host;
+        }
+    }
+    return NULL;
+}
+
+static host_runs_t *find_or_add_host(const char *tag) {
+    host_runs_t *host = find_host(tag);
+    if (host) {
+        return host;
+    }
+    host = calloc(1, sizeof(host_runs_t));
+    if (!host || !(host->tag = strdup(tag))) {
+        free(host);
+        return NULL;
+    }
+    host_runs_t **bucket = bucket_for(tag);
+    host->next = *bucket;
+    *bucket = host;
+    stats.hosts_spilled++;
+    return host;
+}
+
+static void remove_host(host_runs_t *host) {
+    for (host_runs_t **link = bucket_for(host->tag); *link; link = &(*link)->next) {
+        if (*link == host) {
+            *link = host->next;
+            free(host->tag);
+            free(host);
+            stats.hosts_spilled--;
+            return;
+        }
+    }
+}
+
+// Drop a run from a host and delete its file
+static void remove_run(host_runs_t *host, int index) {
+    unlink(host->runs[index].path);
+    free(host->runs[index].path);
+    memmove(&host->runs[index], &host->runs[index + 1],
+            (host->run_count - index - 1) * sizeof(run_t));
+    host->run_count--;
+    stats.runs_live--;
+}
+
+// Read the next block of a run; sets block to NULL at the end and on
+// failure, with state saying which
+static int reader_load(run_reader_t *reader) {
+    free(reader->block);
+    reader->block = NULL;
+    reader->pos = 0;
+    reader->block_offset = ftell(reader->fp);
+
+    unsigned char len_bytes[4];
+    size_t got = fread(len_bytes, 1, 4, reader->fp);
+    if (got == 0 && feof(reader->fp)) {
+        reader->state = READER_EOF;
+        return 0;
+    }
+    uint32_t len = len_bytes[0] | len_bytes[1] << 8 | len_bytes[2] << 16 |
+                   (uint32_t)len_bytes[3] << 24;
+    unsigned char *data = got == 4 ? malloc(len ? len : 1) : NULL;
+    if (!data || fread(data, 1, len, reader->fp) != len) {
+        // A read error or allocation failure may pass; a short file will not
+        reader->state = (got == 4 && !data) || ferror(reader->fp) ? READER_UNAVAILABLE :
+                        READER_DAMAGED;
+        free(data);
+        return -1;
+    }
+    reader->block = frontier_block_decode(data, len);
+    free(data);
+    stats.bytes_read += len + 4;
+    if (!reader->block) {
+        reader->state = READER_DAMAGED;
+        return -1;
+    }
+    return reader->block->count > 0 ? 0 : reader_load(reader);
+}
+
+// Step past the current entry, loading the next block when needed
+static int reader_advance(run_reader_t *reader) {
+    if (++reader->pos < reader->block->count) {
+        return 0;
+    }
+    return reader_load(reader);
+}
+
+static int reader_open(run_reader_t *reader, const run_t *run) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fopen(run->path, "rb");
+    if (!reader->fp || fseek(reader->fp, run->offset, SEEK_SET) != 0) {
+        // Out of descriptors and the like pass; only a missing file is gone for good
+        reader->state = !reader->fp && errno == ENOENT ? READER_DAMAGED : READER_UNAVAILABLE;
+        reader->block_offset = run->offset;
+        reader->pos = run->skip;
+        return -1;
+    }
+    if (reader_load(reader) != 0) {
+        if (reader->state == READER_UNAVAILABLE) {
+            reader->pos = run->skip;
+        }
+        return -1;
+    }
+    reader->pos = reader->block ? run->skip : 0;
+    if (reader->block && reader->pos >= reader->block->count) {
+        return reader_load(reader);
+    }
+    return 0;
+}
+
+// Open a reader per run; runs that cannot be read yield no entries
+// Returns the number of runs that could not be read now but may be later
+static int open_readers(host_runs_t *host, run_reader_t *readers) {
+    int unavailable = 0;
+    for (int i = 0; i < host->run_count; i++) {
+        if (reader_open(&readers[i], &host->runs[i]) == 0) {
+            continue;
+        }
+        if (readers[i].state == READER_UNAVAILABLE) {
+            LOG_WARNING("Cannot read frontier run %s now, keeping it: %s", host->runs[i].path,
+                        strerror(errno));
+            unavailable++;
+        } else {
+            LOG_WARNING("Skipping damaged frontier run %s", host->runs[i].path);
+        }
+    }
+    return unavailable;
+}
+
+// Take the best entry of a reader and move it on
+static int take_entry(block_builder_t *builder, run_reader_t *reader, const char *path) {
+    if (builder_add(builder, reader) != 0) {
+        return -1;
+    }
+    if (reader_advance(reader) != 0) {
+        if (reader->state == READER_DAMAGED) {
+            LOG_WARNING("Frontier run %s is damaged, dropping the rest of it", path);
+        } else {
+            LOG_WARNING("Cannot read frontier run %s now, keeping the rest of it", path);
+        }
+    }
+    return 0;
+}
+
+static void reader_close(run_reader_t *reader) {
+    if (reader->fp) {
+        fclose(reader->fp);
+    }
+    free(reader->block);
+}
+
+// Reader holding the best (lowest priority, then bytewise) entry
+static int pick_best(run_reader_t *readers, int count) {
+    int best = -1;
+    const char *best_member = NULL;
+    size_t best_len = 0;
+    long long best_score = 0;
+    for (int i = 0; i < count; i++) {
+        const frontier_block_t *block = readers[i].block;
+        if (!block) {
+            continue;
+        }
+        const char *member = block->members[readers[i].pos];
+        size_t len = block->lens[readers[i].pos];
+        long long score = block->scores[readers[i].pos];
+        int better = best < 0 || score < best_score;
+        if (!better && score == best_score) {
+            int cmp = memcmp(member, best_member, len < best_len ? len : best_len);
+            better = cmp < 0 || (cmp == 0 && len < best_len);
+        }
+        if (better) {
+            best = i;
+            best_member = member;
+            best_len = len;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+// Copy the current entry of a reader into a builder
+static int builder_add(block_builder_t *builder, const run_reader_t *reader) {
+    const frontier_block_t *block = reader->block;
+    size_t len = block->lens[reader->pos];
+    char *member = malloc(len + 1);
+    if (!member) {
+        return -1;
+    }
+    memcpy(member, block->members[reader->pos], len + 1);
+    builder->members[builder->count] = member;
+    builder->lens[builder->count] = len;
+    builder->scores[builder->count] = block->scores[reader->pos];
+    builder->count++;
+    return 0;
+}
+
+static void builder_reset(block_builder_t *builder) {
+    for (int i = 0; i < builder->count; i++) {
+        free(builder->members[i]);
+    }
+    builder->count = 0;
+}
+
+// Append one block to a run file
+// Returns the bytes written, or -1 on failure
+static long write_block(FILE *fp, const char **members, const size_t *lens,
+                        const long long *scores, int count) {
+    unsigned char *block;
+    size_t block_len;
+    if (frontier_block_encode(members, lens, scores, count, &block, &block_len) != 0) {
+        return -1;
+    }
+    unsigned char len_bytes[4] = {block_len & 0xFF, (block_len >> 8) & 0xFF,
+                                  (block_len >> 16) & 0xFF, (block_len >> 24) & 0xFF};
+    long written = fwrite(len_bytes, 1, 4, fp) == 4 &&
+                   fwrite(block, 1, block_len, fp) == block_len ? (long)block_len + 4 : -1;
+    free(block);
+    if (written > 0) {
+        stats.bytes_written += written;
+    }
+    return written;
+}
+
+static long write_builder(FILE *fp, block_builder_t *builder) {
+    long written = write_block(fp, (const char **)builder->members, builder->lens,
+                               builder->scores, builder->count);
+    builder_reset(builder);
+    return written;
+}
+
+// Create a new run file with its header
+static FILE *create_run(const char *tag, char **path_out, long *header_len) {
+    if (mkdir(spill_dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create frontier spill directory %s: %s", spill_dir, strerror(errno));
+        return NULL;
+    }
+    if (run_seq == 0) {
+        run_seq = (unsigned long)time(NULL) << 16;
+    }
+
+    size_t tag_len = strlen(tag);
+    size_t path_size = strlen(spill_dir) + 64;
+    char *path = malloc(path_size);
+    if (!path) {
+        return NULL;
+    }
+    FILE *fp = NULL;
+    while (!fp) {
+        snprintf(path, path_size, "%s/%016llx-%lu.run", spill_dir,
+                 (unsigned long long)content_hash64(tag, tag_len, 0), run_seq++);
+        fp = fopen(path, "wbx");
+        if (!fp && errno != EEXIST) {
+            LOG_ERROR("Failed to create frontier run %s: %s", path, strerror(errno));
+            free(path);
+            return NULL;
+        }
+    }
+
+    unsigned char len_bytes[2] = {tag_len & 0xFF, (tag_len >> 8) & 0xFF};
+    if (fwrite(FRONTIER_RUN_MAGIC, 1, 4, fp) != 4 || fwrite(len_bytes, 1, 2, fp) != 2 ||
+        fwrite(tag, 1, tag_len, fp) != tag_len) {
+        fclose(fp);
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+    *path_out = path;
+    *header_len = RUN_HEADER_FIXED + tag_len;
+    return fp;
+}
+
+// Flush a finished run to disk before Redis forgets its entries
+static int finish_run(FILE *fp, int ok) {
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    return fclose(fp) == 0 && ok ? 0 : -1;
+}
+
+// Merge all of a host's runs into one
+static int compact_host(host_runs_t *host) {
+    run_reader_t readers[FRONTIER_MAX_RUNS];
+    int opened = host->run_count;
+    // Every run is deleted afterwards, so all of them must be readable
+    int ok = open_readers(host, readers) == 0;
+
+    char *path = NULL;
+    long header_len = 0;
+    FILE *fp = ok ? create_run(host->tag, &path, &header_len) : NULL;
+    ok = fp != NULL;
+
+    static block_builder_t builder;   // Only used under runs_mutex
+    int best;
+    while (ok && (best = pick_best(readers, opened)) >= 0) {
+        ok = take_entry(&builder, &readers[best], host->runs[best].path) == 0 &&
+             readers[best].state != READER_UNAVAILABLE;
+        if (ok && builder.count == FRONTIER_BLOCK_SIZE) {
+            ok = write_builder(fp, &builder) > 0;
+        }
+    }
+    if (ok && builder.count > 0) {
+        ok = write_builder(fp, &builder) > 0;
+    }
+    builder_reset(&builder);
+    for (int i = 0; i < opened; i++) {
+        reader_close(&readers[i]);
+    }
+
+    if (fp && finish_run(fp, ok) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        if (path) {
+            unlink(path);
+        }
+        free(path);
+        LOG_ERROR("Failed to compact frontier runs of %s", host->tag);
+        return -1;
+    }
+
+    while (host->run_count > 0) {
+        remove_run(host, host->run_count - 1);
+    }
+    host->runs[0].path = path;
+    host->runs[0].offset = header_len;
+    host->runs[0].skip = 0;
+    host->run_count = 1;
+    stats.runs_live++;
+    stats.compactions++;
+    return 0;
+}
+
+// Write entries, sorted by priority, as a new run of a host
+int frontier_runs_write(const char *tag, const char **members, const size_t *lens,
+                        const long long *scores, int count) {
+    if (!tag || count <= 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&runs_mutex);
+    host_runs_t *host = spill_dir ? find_or_add_host(tag) : NULL;
+    if (!host || host->run_count >= FRONTIER_MAX_RUNS) {
+        pthread_mutex_unlock(&runs_mutex);
+        return -1;
+    }
+
+    char *path = NULL;
+    long header_len = 0;
+    FILE *fp = create_run(tag, &path, &header_len);
+    int ok = fp != NULL;
+    for (int start = 0; ok && start < count; start += FRONTIER_BLOCK_SIZE) {
+        int n = count - start < FRONTIER_BLOCK_SIZE ? count - start : FRONTIER_BLOCK_SIZE;
+        ok = write_block(fp, members + start, lens + start, scores + start, n) > 0;
+    }
+    if (fp && finish_run(fp, ok) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        if (path) {
+            unlink(path);
+        }
+        free(path);
+        if (host->run_count == 0) {
+            remove_host(host);
+        }
+        pthread_mutex_unlock(&runs_mutex);
+        return -1;
+    }
+
+    run_t *run = &host->runs[host->run_count++];
+    run->path = path;
+    run->offset = header_len;
+    run->skip = 0;
+    stats.runs_live++;
+    stats.spills++;
+    stats.urls_spilled += count;
+    if (host->run_count == FRONTIER_MAX_RUNS) {
+        compact_host(host);
+    }
+    pthread_mutex_unlock(&runs_mutex);
+    return 0;
+}
+
+// Copy a builder into a block in one allocation, like frontier_block_decode()
+static frontier_block_t *builder_to_block(const block_builder_t *builder) {
+    size_t text_size = 0;
+    for (int i = 0; i < builder->count; i++) {
+        text_size += builder->lens[i] + 1;
+    }
+    int n = builder->count;
+    frontier_block_t *block = malloc(sizeof(frontier_block_t) +
+                                     n * (sizeof(char *) + sizeof(size_t) + sizeof(long long)) +
+                                     text_size);
+    if (!block) {
+        return NULL;
+    }
+    block->count = n;
+    block->members = (char **)(block + 1);
+    block->lens = (size_t *)(block->members + n);
+    block->scores = (long long *)(block->lens + n);
+    char *text = (char *)(block->scores + n);
+    for (int i = 0; i < n; i++) {
+        memcpy(text, builder->members[i], builder->lens[i] + 1);
+        block->members[i] = text;
+        block->lens[i] = builder->lens[i];
+        block->scores[i] = builder->scores[i];
+        text += builder->lens[i] + 1;
+    }
+    return block;
+}
+
+// Hand up to max of a host's best spilled entries to restore, and remove
+// them from the runs once it has stored them
+int frontier_runs_take(const char *tag, int max, frontier_restore_fn restore, void *ctx) {
+    if (!tag || max <= 0 || !restore) {
+        return -1;
+    }
+    if (max > FRONTIER_BLOCK_SIZE) {
+        max = FRONTIER_BLOCK_SIZE;
+    }
+    pthread_mutex_lock(&runs_mutex);
+    host_runs_t *host = find_host(tag);
+    if (!host) {
+        pthread_mutex_unlock(&runs_mutex);
+        return 0;
+    }
+
+    run_reader_t readers[FRONTIER_MAX_RUNS];
+    int opened = host->run_count;
+    open_readers(host, readers);
+
+    static block_builder_t builder;   // Only used under runs_mutex
+    int ok = 1, best;
+    while (ok && builder.count < max && (best = pick_best(readers, opened)) >= 0) {
+        ok = take_entry(&builder, &readers[best], host->runs[best].path) == 0;
+    }
+    int taken = builder.count;
+    frontier_block_t *block = ok && taken > 0 ? builder_to_block(&builder) : NULL;
+    builder_reset(&builder);
+
+    // The runs only move on once the entries are stored elsewhere
+    int restored = !ok || (taken > 0 && !block) ? -1 : block ? restore(block, ctx) : 0;
+    if (restored >= 0) {
+        // Remember how far each run has been consumed; drop finished and
+        // damaged runs, keep unreadable ones for a later try
+        for (int i = opened - 1; i >= 0; i--) {
+            if (readers[i].state == READER_EOF || readers[i].state == READER_DAMAGED) {
+                remove_run(host, i);
+            } else {
+                host->runs[i].offset = readers[i].block_offset;
+                host->runs[i].skip = readers[i].pos;
+            }
+        }
+    }
+    if (block && restored >= 0) {
+        stats.refills++;
+        stats.urls_refilled += block->count;
+    }
+    free(block);
+    for (int i = 0; i < opened; i++) {
+        reader_close(&readers[i]);
+    }
+    if (host->run_count == 0) {
+        remove_host(host);
+    }
+    pthread_mutex_unlock(&runs_mutex);
+    return restored;
+}
+
+// Whether a host has spilled entries
+int frontier_runs_pending(const char *tag) {
+    if (!tag) {
+        return 0;
+    }
+    pthread_mutex_lock(&runs_mutex);
+    int pending = spill_dir && find_host(tag) != NULL;
+    pthread_mutex_unlock(&runs_mutex);
+    return pending;
+}
+
+// Read the host tag from a run file's header
+static int read_run_tag(const char *path, char *tag, size_t size, long *header_len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    unsigned char header[RUN_HEADER_FIXED];
+    int ok = fread(header, 1, RUN_HEADER_FIXED, fp) == RUN_HEADER_FIXED &&
+             memcmp(header, FRONTIER_RUN_MAGIC, 4) == 0;
+    size_t tag_len = ok ? (size_t)(header[4] | header[5] << 8) : 0;
+    ok = ok && tag_len > 0 && tag_len < size && fread(tag, 1, tag_len, fp) == tag_len;
+    fclose(fp);
+    if (!ok) {
+        return -1;
+    }
+    tag[tag_len] = '\0';
+    *header_len = RUN_HEADER_FIXED + tag_len;
+    return 0;
+}
+
+// Rebuild the run index from the spill directory
+int frontier_runs_load(void) {
+    pthread_mutex_lock(&runs_mutex);
+    if (!spill_dir) {
+        pthread_mutex_unlock(&runs_mutex);
+        return 0;
+    }
+    DIR *dir = opendir(spill_dir);
+    if (!dir) {
+        pthread_mutex_unlock(&runs_mutex);
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    int loaded = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        if (name_len < 5 || strcmp(entry->d_name + name_len - 4, ".run") != 0) {
+            continue;
+        }
+        size_t path_size = strlen(spill_dir) + name_len + 2;
+        char *path = malloc(path_size);
+        char tag[SHARD_TAG_MAX];
+        long header_len;
+        if (!path) {
+            break;
+        }
+        snprintf(path, path_size, "%s/%s", spill_dir, entry->d_name);
+        host_runs_t *host = NULL;
+        if (read_run_tag(path, tag, sizeof(tag), &header_len) != 0 ||
+            !(host = find_or_add_host(tag))) {
+            LOG_WARNING("Ignoring unreadable frontier run %s", path);
+            free(path);
+            continue;
+        }
+
+        run_t *run = &host->runs[host->run_count++];
+        run->path = path;
+        run->offset = header_len;
+        run->skip = 0;
+        stats.runs_live++;
+        loaded++;
+        if (host->run_count == FRONTIER_MAX_RUNS && compact_host(host) != 0) {
+            // Keep the file for a later start rather than losing it
+            free(host->runs[--host->run_count].path);
+            stats.runs_live--;
+        }
+    }
+    closedir(dir);
+
+    // Copy the tags out: scheduling may refill, which takes runs_mutex
+    int tag_count = 0;
+    for (int b = 0; b < HOST_BUCKETS; b++) {
+        for (host_runs_t *host = hosts[b]; host; host = host->next) {
+            tag_count++;
+        }
+    }
+    char **tags = tag_count > 0 ? calloc(tag_count, sizeof(*tags)) : NULL;
+    int tagged = 0;
+    for (int b = 0; tags && b < HOST_BUCKETS; b++) {
+        for (host_runs_t *host = hosts[b]; host; host = host->next) {
+            tags[tagged++] = strdup(host->tag);
+        }
+    }
+    pthread_mutex_unlock(&runs_mutex);
+
+    // Let fetch_url_from_queue() find the hosts again
+    if (tag_count > 0 && !tags) {
+        LOG_WARNING("Out of memory scheduling hosts with frontier runs");
+    }
+    for (int i = 0; i < tagged; i++) {
+        if (tags[i] && frontier_schedule(tags[i]) < 0) {
+            LOG_WARNING("Failed to schedule host %s with frontier runs", tags[i]);
+        }
+        free(tags[i]);
+    }
+    free(tags);
+
+    if (loaded > 0) {
+        LOG_INFO("Loaded %d frontier runs from %s", loaded, spill_dir);
+    }
+    return loaded;
+}
+
+// Call visit for every live run
+void frontier_runs_for_each(void (*visit)(const char *path, long offset, int skip, void *ctx),
+                            void *ctx) {
+    pthread_mutex_lock(&runs_mutex);
+    for (int b = 0; b < HOST_BUCKETS; b++) {
+        for (host_runs_t *host = hosts[b]; host; host = host->next) {
+            for (int i = 0; i < host->run_count; i++) {
+                visit(host->runs[i].path, host->runs[i].offset, host->runs[i].skip, ctx);
+            }
+        }
+    }
+    pthread_mutex_unlock(&runs_mutex);
+}
+
+// Move a run's read position forward to a saved one
+int frontier_runs_seek(const char *path, long offset, int skip) {
+    if (!path || offset < 0 || skip < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&runs_mutex);
+    for (int b = 0; b < HOST_BUCKETS; b++) {
+        for (host_runs_t *host = hosts[b]; host; host = host->next) {
+            for (int i = 0; i < host->run_count; i++) {
+                run_t *run = &host->runs[i];
+                if (strcmp(run->path, path) != 0) {
+                    continue;
+                }
+                // Never move backwards past entries already taken
+                if (offset > run->offset || (offset == run->offset && skip > run->skip)) {
+                    run->offset = offset;
+                    run->skip = skip;
+                }
+                pthread_mutex_unlock(&runs_mutex);
+                return 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&runs_mutex);
+    return -1;
+}
+
+// Counters since startup
+void frontier_get_stats(frontier_stats_t *out) {
+    pthread_mutex_lock(&runs_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&runs_mutex);
+}
+
+// Drop the run index; run files stay on disk
+void frontier_runs_cleanup(void) {
+    pthread_mutex_lock(&runs_mutex);
+    for (int b = 0; b < HOST_BUCKETS; b++) {
+        host_runs_t *host = hosts[b];
+        while (host) {
+            host_runs_t *next = host->next;
+            for (int i = 0; i < host->run_count; i++) {
+                free(host->runs[i].path);
+            }
+            free(host->tag);
+            free(host);
+            host = next;
+        }
+        hosts[b] = NULL;
+    }
+    stats.runs_live = 0;
+    stats.hosts_spilled = 0;
+    pthread_mutex_unlock(&runs_mutex);
+}
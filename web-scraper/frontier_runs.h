@@ -0,0 +1,87 @@
+#ifndef FRONTIER_RUNS_H
+#define FRONTIER_RUNS_H
+
+#include "frontier.h"
+#include <stddef.h>
+
+// Local disk tier of the frontier
+//
+// With a spill directory set, frontier_spill() moves the tail of an
+// oversized host queue into a sorted run file instead of Redis blocks,
+// so Redis only ever holds about FRONTIER_HOT_MAX URLs per host. A run
+// is written once, sequentially, as a series of front-coded blocks
+// sorted by priority. Refills k-way merge the best entries of all of a
+// host's runs, reading one block per run at a time. Once a host has
+// FRONTIER_MAX_RUNS runs they are merged into one, LSM style, so a
+// refill never has to look at more than that many files.
+//
+// Run file layout: "FRN1", 2-byte little-endian host tag length, host
+// tag, then per block a 4-byte little-endian length and a frontier block
+// (see frontier.h).
+//
+// Runs belong to the process that wrote them. The index of runs is kept
+// in memory and rebuilt from the directory by frontier_runs_load();
+// entries already refilled before a restart are read again, and the
+// visited checks drop them, unless a checkpoint restores how far each
+// run had been read (frontier_runs_seek()).
+
+#define FRONTIER_MAX_RUNS 8
+#define FRONTIER_RUN_MAGIC "FRN1"
+
+// Spill and refill counters
+typedef struct {
+    unsigned long spills;          // Runs written
+    unsigned long urls_spilled;
+    unsigned long refills;         // Batches paged back into Redis
+    unsigned long urls_refilled;
+    unsigned long compactions;     // Merges of a host's runs into one
+    unsigned long long bytes_written;
+    unsigned long long bytes_read;
+    unsigned long runs_live;       // Run files currently on disk
+    unsigned long hosts_spilled;   // Hosts with at least one run
+} frontier_stats_t;
+
+// Keep spilled frontier runs under dir; NULL keeps them in Redis
+void frontier_set_spill_dir(const char *dir);
+
+// Spill directory, or NULL if runs are disabled
+const char *frontier_get_spill_dir(void);
+
+// Rebuild the run index from the spill directory and schedule the hosts
+// that still have runs
+// Returns the number of runs found, or -1 on failure
+int frontier_runs_load(void);
+
+// Write entries, sorted by priority, as a new run of a host
+// Returns 0 on success, -1 on failure
+int frontier_runs_write(const char *tag, const char **members, const size_t *lens,
+                        const long long *scores, int count);
+
+// Stores entries taken from the runs elsewhere
+// Returns the number stored, or -1 if they could not be stored
+typedef int (*frontier_restore_fn)(const frontier_block_t *block, void *ctx);
+
+// Pass up to max of a host's best spilled entries to restore; they are
+// removed from the runs only if it succeeds. A run that cannot be opened
+// or read right now (e.g. out of file descriptors) is kept as it is.
+// Returns what restore returned, 0 if the host has no entries, or -1 on failure
+int frontier_runs_take(const char *tag, int max, frontier_restore_fn restore, void *ctx);
+
+// Whether a host has spilled entries
+int frontier_runs_pending(const char *tag);
+
+// Call visit with the path and read position of every live run
+void frontier_runs_for_each(void (*visit)(const char *path, long offset, int skip, void *ctx),
+                            void *ctx);
+
+// Move a loaded run's read position forward to a saved one
+// Returns 0 on success, -1 if no loaded run has that path
+int frontier_runs_seek(const char *path, long offset, int skip);
+
+// Counters since startup
+void frontier_get_stats(frontier_stats_t *out);
+
+// Drop the run index; run files stay on disk
+void frontier_runs_cleanup(void);
+
+#endif // FRONTIER_RUNS_H
@@ -0,0 +1,775 @@
+#include "link_graph.h"
+#include "content_hash.h"
+#include "extract_hrefs.h"
+#include "frontier.h"
+#include "logger.h"
+#include "shard_router.h"
+#include "url_intern.h"
+#include "visited_store.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NODES_FILE "nodes.log"      // URL dictionary, unless --url-ids names another
+#define EDGES_FILE "edges.log"
+#define EDGES_COMPACTING_FILE "edges.log.compacting"
+#define GRAPH_FILE "graph.csr"
+#define GRAPH_HEADER_LEN 20
+#define GRAPH_MAX_NODES UINT32_MAX   // Graph ids are 32 bits
+
+// Graph in compressed sparse row form: the targets of node u are
+// cols[row_ptr[u]] .. cols[row_ptr[u + 1] - 1]
+typedef struct {
+    uint32_t nodes;
+    uint64_t *row_ptr;
+    uint32_t *cols;
+} csr_t;
+
+// Shared state of one PageRank run
+typedef struct {
+    const csr_t *in;            // Incoming edges
+    const uint64_t *out_degree;
+    double *rank;
+    double *contrib;            // rank / out-degree, per iteration
+    double base;                // Rank every page gets, per iteration
+    double dangling_part[LINK_GRAPH_THREADS];
+    double delta_part[LINK_GRAPH_THREADS];
+} pagerank_t;
+
+typedef struct {
+    pagerank_t *run;
+    int index;
+    uint32_t first;
+    uint32_t last;
+} pagerank_worker_t;
+
+static char *graph_dir = NULL;
+static FILE *edges_fp = NULL;
+static link_graph_stats_t stats;
+
+// Guards the edge log and the counters
+static pthread_mutex_t graph_mutex = PTHREAD_MUTEX_INITIALIZER;
+// One compaction and rank pass at a time
+static pthread_mutex_t update_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t rank_thread;
+static int running = 0;
+
+// Keep the link graph under dir
+void link_graph_set_dir(const char *dir) {
+    pthread_mutex_lock(&graph_mutex);
+    free(graph_dir);
+    graph_dir = dir ? strdup(dir) : NULL;
+    pthread_mutex_unlock(&graph_mutex);
+}
+
+// Link graph directory, or NULL if the graph is disabled
+const char *link_graph_get_dir(void) {
+    return graph_dir;
+}
+
+static char *graph_path(const char *name) {
+    size_t size = strlen(graph_dir) + strlen(name) + 2;
+    char *path = malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/%s", graph_dir, name);
+    }
+    return path;
+}
+
+static void put_varint(FILE *fp, uint64_t value) {
+    while (value >= 0x80) {
+        putc((int)(value & 0x7F) | 0x80, fp);
+        value >>= 7;
+    }
+    putc((int)value, fp);
+}
+
+// Returns 0 on success, -1 at the end of the file or on a bad varint
+static int get_varint(FILE *fp, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(fp);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Cut a torn last record off the edge log so new records follow whole ones
+static int trim_log(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    long good = 0;
+    uint64_t value, count;
+    while (get_varint(fp, &value) == 0 && get_varint(fp, &count) == 0) {
+        uint64_t i = 0;
+        while (i < count && get_varint(fp, &value) == 0) {
+            i++;
+        }
+        if (i < count) {
+            break;
+        }
+        good = ftell(fp);
+    }
+    fseek(fp, 0, SEEK_END);
+    int torn = ftell(fp) != good;
+    fclose(fp);
+    return torn ? truncate(path, good) : 0;
+}
+
+static void *rank_main(void *arg);
+
+// Open the graph files and start the background rank pass
+int link_graph_start(void) {
+    pthread_mutex_lock(&graph_mutex);
+    if (!graph_dir || edges_fp) {
+        pthread_mutex_unlock(&graph_mutex);
+        return 0;
+    }
+    if (mkdir(graph_dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create link graph directory %s: %s", graph_dir, strerror(errno));
+        pthread_mutex_unlock(&graph_mutex);
+        return -1;
+    }
+
+    // Graph ids are URL dictionary ids, so the dictionary must persist too
+    if (!url_intern_get_file()) {
+        char *nodes_path = graph_path(NODES_FILE);
+        url_intern_set_file(nodes_path);
+        free(nodes_path);
+    }
+    char *edges_path = graph_path(EDGES_FILE);
+    int ok = edges_path && url_intern_get_file() && url_intern_open() >= 0 &&
+             trim_log(edges_path) == 0 && (edges_fp = fopen(edges_path, "ab")) != NULL;
+    free(edges_path);
+    pthread_mutex_unlock(&graph_mutex);
+    if (!ok) {
+        LOG_ERROR("Failed to open link graph under %s", graph_dir);
+        return -1;
+    }
+
+    pthread_mutex_lock(&thread_mutex);
+    running = 1;
+    if (pthread_create(&rank_thread, NULL, rank_main, NULL) != 0) {
+        LOG_ERROR("Failed to start link graph thread: %s", strerror(errno));
+        running = 0;
+    }
+    pthread_mutex_unlock(&thread_mutex);
+    LOG_INFO("Link graph opened under %s with %llu URL ids", graph_dir,
+             (unsigned long long)url_intern_count());
+    return 0;
+}
+
+// Graph id of a URL; the graph numbers nodes with 32 bits
+static int graph_id(const char *url, uint32_t *id) {
+    url_id_t url_id = url ? url_intern(url) : URL_ID_NONE;
+    if (url_id >= GRAPH_MAX_NODES) {
+        return -1;
+    }
+    *id = (uint32_t)url_id;
+    return 0;
+}
+
+// Record a page's out-links
+int link_graph_add_page(const char *url, const char **links, int count) {
+    if (!url || !links || count <= 0 || !graph_dir) {
+        return 0;
+    }
+    uint32_t *targets = malloc(count * sizeof(uint32_t));
+    uint32_t source;
+    if (!targets || graph_id(url, &source) != 0) {
+        free(targets);
+        return -1;
+    }
+    int logged = 0;
+    for (int i = 0; i < count; i++) {
+        if (graph_id(links[i], &targets[logged]) == 0 && targets[logged] != source) {
+            logged++;
+        }
+    }
+
+    pthread_mutex_lock(&graph_mutex);
+    if (logged > 0 && edges_fp) {
+        put_varint(edges_fp, source);
+        put_varint(edges_fp, (uint64_t)logged);
+        for (int i = 0; i < logged; i++) {
+            put_varint(edges_fp, targets[i]);
+        }
+        stats.edges_logged += logged;
+    }
+    pthread_mutex_unlock(&graph_mutex);
+    free(targets);
+    return logged;
+}
+
+// Called for every edge read back from the graph files
+typedef void (*edge_fn)(uint32_t source, uint32_t target, void *ctx);
+
+// Read the edges of graph.csr; a missing file has none
+static int scan_graph(const char *path, uint32_t nodes, edge_fn visit, void *ctx) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    unsigned char header[GRAPH_HEADER_LEN];
+    int ok = fread(header, 1, GRAPH_HEADER_LEN, fp) == GRAPH_HEADER_LEN &&
+             memcmp(header, LINK_GRAPH_MAGIC, 4) == 0;
+    uint64_t rows = 0;
+    for (int i = 0; ok && i < 8; i++) {
+        rows |= (uint64_t)header[4 + i] << (8 * i);
+    }
+    for (uint64_t u = 0; ok && u < rows; u++) {
+        uint64_t degree, target = 0, gap;
+        ok = get_varint(fp, &degree) == 0;
+        for (uint64_t i = 0; ok && i < degree; i++) {
+            ok = get_varint(fp, &gap) == 0;
+            target += gap;
+            if (ok && u < nodes && target < nodes) {
+                visit((uint32_t)u, (uint32_t)target, ctx);
+            }
+        }
+    }
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+// Read the edges of an edge log, stopping at a torn last record
+static int scan_log(const char *path, uint32_t nodes, edge_fn visit, void *ctx) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    uint64_t source, count, target;
+    while (get_varint(fp, &source) == 0 && get_varint(fp, &count) == 0) {
+        for (uint64_t i = 0; i < count && get_varint(fp, &target) == 0; i++) {
+            if (source < nodes && target < nodes) {
+                visit((uint32_t)source, (uint32_t)target, ctx);
+            }
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void count_edge(uint32_t source, uint32_t target, void *ctx) {
+    (void)target;
+    ((csr_t *)ctx)->row_ptr[source + 1]++;
+}
+
+// row_ptr holds each row's next free slot while filling
+static void fill_edge(uint32_t source, uint32_t target, void *ctx) {
+    csr_t *graph = ctx;
+    graph->cols[graph->row_ptr[source]++] = target;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void csr_free(csr_t *graph) {
+    free(graph->row_ptr);
+    free(graph->cols);
+    graph->row_ptr = NULL;
+    graph->cols = NULL;
+}
+
+// Merge graph.csr and an edge log into one graph with sorted, unique rows
+static int build_graph(const char *graph_file, const char *log_file, uint32_t nodes, csr_t *graph) {
+    graph->nodes = nodes;
+    graph->cols = NULL;
+    graph->row_ptr = calloc((size_t)nodes + 1, sizeof(uint64_t));
+    if (!graph->row_ptr) {
+        return -1;
+    }
+    if (scan_graph(graph_file, nodes, count_edge, graph) != 0 ||
+        scan_log(log_file, nodes, count_edge, graph) != 0) {
+        LOG_ERROR("Failed to read link graph %s", graph_file);
+        csr_free(graph);
+        return -1;
+    }
+    for (uint32_t u = 0; u < nodes; u++) {
+        graph->row_ptr[u + 1] += graph->row_ptr[u];
+    }
+    graph->cols = malloc((graph->row_ptr[nodes] ? graph->row_ptr[nodes] : 1) * sizeof(uint32_t));
+    if (!graph->cols) {
+        csr_free(graph);
+        return -1;
+    }
+    // Fill shifts every row start up by one row, so shift them back after
+    scan_graph(graph_file, nodes, fill_edge, graph);
+    scan_log(log_file, nodes, fill_edge, graph);
+    memmove(graph->row_ptr + 1, graph->row_ptr, (size_t)nodes * sizeof(uint64_t));
+    graph->row_ptr[0] = 0;
+
+    uint64_t out = 0, start = 0;
+    for (uint32_t u = 0; u < nodes; u++) {
+        uint64_t end = graph->row_ptr[u + 1];
+        qsort(graph->cols + start, end - start, sizeof(uint32_t), compare_ids);
+        graph->row_ptr[u] = out;
+        for (uint64_t i = start; i < end; i++) {
+            if (i == start || graph->cols[i] != graph->cols[i - 1]) {
+                graph->cols[out++] = graph->cols[i];
+            }
+        }
+        start = end;
+    }
+    graph->row_ptr[nodes] = out;
+    return 0;
+}
+
+// Write a graph to graph.csr, replacing the old one once it is on disk
+static int write_graph(const char *path, const csr_t *graph) {
+    size_t tmp_size = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_size);
+    FILE *fp = NULL;
+    if (tmp_path) {
+        snprintf(tmp_path, tmp_size, "%s.tmp", path);
+        fp = fopen(tmp_path, "wb");
+    }
+    if (!fp) {
+        free(tmp_path);
+        return -1;
+    }
+    unsigned char header[GRAPH_HEADER_LEN];
+    memcpy(header, LINK_GRAPH_MAGIC, 4);
+    for (int i = 0; i < 8; i++) {
+        header[4 + i] = ((uint64_t)graph->nodes >> (8 * i)) & 0xFF;
+        header[12 + i] = (graph->row_ptr[graph->nodes] >> (8 * i)) & 0xFF;
+    }
+    fwrite(header, 1, GRAPH_HEADER_LEN, fp);
+    for (uint32_t u = 0; u < graph->nodes; u++) {
+        uint64_t start = graph->row_ptr[u], end = graph->row_ptr[u + 1];
+        put_varint(fp, end - start);
+        for (uint64_t i = start; i < end; i++) {
+            put_varint(fp, graph->cols[i] - (i > start ? graph->cols[i - 1] : 0));
+        }
+    }
+    int ok = !ferror(fp) && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return ok ? 0 : -1;
+}
+
+// Move the edge log aside and merge it into graph.csr
+static int compact_graph(csr_t *graph) {
+    char *graph_file = graph_path(GRAPH_FILE);
+    char *edges_file = graph_path(EDGES_FILE);
+    char *compacting_file = graph_path(EDGES_COMPACTING_FILE);
+    int ok = graph_file && edges_file && compacting_file;
+
+    // A log left over from an interrupted pass is merged as it is
+    pthread_mutex_lock(&graph_mutex);
+    ok = ok && edges_fp && fflush(edges_fp) == 0;
+    if (ok && access(compacting_file, F_OK) != 0) {
+        fclose(edges_fp);
+        ok = rename(edges_file, compacting_file) == 0;
+        edges_fp = fopen(edges_file, "ab");
+        ok = ok && edges_fp != NULL;
+    }
+    pthread_mutex_unlock(&graph_mutex);
+
+    // URLs are interned before their edges are logged, so once the log has
+    // moved the dictionary covers every id in it
+    ok = ok && url_intern_sync() == 0;
+    uint64_t known = url_intern_count();
+    uint32_t nodes = known < GRAPH_MAX_NODES ? (uint32_t)known : GRAPH_MAX_NODES;
+
+    ok = ok && build_graph(graph_file, compacting_file, nodes, graph) == 0;
+    if (ok && write_graph(graph_file, graph) != 0) {
+        LOG_ERROR("Failed to write link graph %s", graph_file);
+        csr_free(graph);
+        ok = 0;
+    }
+    if (ok) {
+        unlink(compacting_file);
+    }
+    free(graph_file);
+    free(edges_file);
+    free(compacting_file);
+    return ok ? 0 : -1;
+}
+
+// Incoming edges of a graph, with the out-degree of every node
+static int transpose(const csr_t *graph, csr_t *in, uint64_t **out_degree) {
+    uint32_t nodes = graph->nodes;
+    uint64_t edges = graph->row_ptr[nodes];
+    in->nodes = nodes;
+    in->row_ptr = calloc((size_t)nodes + 1, sizeof(uint64_t));
+    in->cols = malloc((edges ? edges : 1) * sizeof(uint32_t));
+    *out_degree = malloc(((size_t)nodes ? nodes : 1) * sizeof(uint64_t));
+    if (!in->row_ptr || !in->cols || !*out_degree) {
+        csr_free(in);
+        free(*out_degree);
+        return -1;
+    }
+    for (uint64_t i = 0; i < edges; i++) {
+        in->row_ptr[graph->cols[i] + 1]++;
+    }
+    for (uint32_t v = 0; v < nodes; v++) {
+        in->row_ptr[v + 1] += in->row_ptr[v];
+    }
+    for (uint32_t u = 0; u < nodes; u++) {
+        (*out_degree)[u] = graph->row_ptr[u + 1] - graph->row_ptr[u];
+        for (uint64_t i = graph->row_ptr[u]; i < graph->row_ptr[u + 1]; i++) {
+            in->cols[in->row_ptr[graph->cols[i]]++] = u;
+        }
+    }
+    memmove(in->row_ptr + 1, in->row_ptr, (size_t)nodes * sizeof(uint64_t));
+    in->row_ptr[0] = 0;
+    return 0;
+}
+
+// Contributions of a worker's sources, and the rank of those without links
+static void *contrib_worker(void *arg) {
+    pagerank_worker_t *worker = arg;
+    pagerank_t *run = worker->run;
+    double dangling = 0.0;
+    for (uint32_t u = worker->first; u < worker->last; u++) {
+        if (run->out_degree[u]) {
+            run->contrib[u] = run->rank[u] / run->out_degree[u];
+        } else {
+            run->contrib[u] = 0.0;
+            dangling += run->rank[u];
+        }
+    }
+    run->dangling_part[worker->index] = dangling;
+    return NULL;
+}
+
+// New ranks of a worker's targets; only reads the contributions
+static void *rank_worker(void *arg) {
+    pagerank_worker_t *worker = arg;
+    pagerank_t *run = worker->run;
+    double delta = 0.0;
+    for (uint32_t v = worker->first; v < worker->last; v++) {
+        double sum = 0.0;
+        for (uint64_t i = run->in->row_ptr[v]; i < run->in->row_ptr[v + 1]; i++) {
+            sum += run->contrib[run->in->cols[i]];
+        }
+        double rank = run->base + PAGERANK_DAMPING * sum;
+        delta += fabs(rank - run->rank[v]);
+        run->rank[v] = rank;
+    }
+    run->delta_part[worker->index] = delta;
+    return NULL;
+}
+
+// Run one phase over all nodes split between LINK_GRAPH_THREADS threads;
+// a share whose thread cannot be started runs on the caller
+static void run_phase(pagerank_worker_t *workers, void *(*phase)(void *)) {
+    pthread_t threads[LINK_GRAPH_THREADS];
+    int started[LINK_GRAPH_THREADS] = {0};
+    for (int t = 1; t < LINK_GRAPH_THREADS; t++) {
+        started[t] = pthread_create(&threads[t], NULL, phase, &workers[t]) == 0;
+    }
+    phase(&workers[0]);
+    for (int t = 1; t < LINK_GRAPH_THREADS; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            phase(&workers[t]);
+        }
+    }
+}
+
+static double sum_parts(const double *parts) {
+    double sum = 0.0;
+    for (int t = 0; t < LINK_GRAPH_THREADS; t++) {
+        sum += parts[t];
+    }
+    return sum;
+}
+
+// PageRank of every node of a graph
+// Returns an array of ranks summing to 1, or NULL on failure
+static double *pagerank(const csr_t *graph) {
+    uint32_t nodes = graph->nodes;
+    csr_t in;
+    uint64_t *out_degree;
+    if (nodes == 0 || transpose(graph, &in, &out_degree) != 0) {
+        return NULL;
+    }
+    pagerank_t run = {.in = &in, .out_degree = out_degree};
+    run.rank = malloc(nodes * sizeof(double));
+    run.contrib = malloc(nodes * sizeof(double));
+    if (!run.rank || !run.contrib) {
+        free(run.rank);
+        free(run.contrib);
+        free(out_degree);
+        csr_free(&in);
+        return NULL;
+    }
+    for (uint32_t u = 0; u < nodes; u++) {
+        run.rank[u] = 1.0 / nodes;
+    }
+    pagerank_worker_t workers[LINK_GRAPH_THREADS];
+    for (int t = 0; t < LINK_GRAPH_THREADS; t++) {
+        workers[t].run = &run;
+        workers[t].index = t;
+        workers[t].first = (uint32_t)((uint64_t)nodes * t / LINK_GRAPH_THREADS);
+        workers[t].last = (uint32_t)((uint64_t)nodes * (t + 1) / LINK_GRAPH_THREADS);
+    }
+
+    int iteration = 0;
+    while (iteration++ < PAGERANK_ITERATIONS) {
+        run_phase(workers, contrib_worker);
+        // Rank on pages without links is spread over every page
+        double dangling = sum_parts(run.dangling_part);
+        run.base = (1.0 - PAGERANK_DAMPING + PAGERANK_DAMPING * dangling) / nodes;
+        run_phase(workers, rank_worker);
+        if (sum_parts(run.delta_part) < PAGERANK_TOLERANCE) {
+            break;
+        }
+    }
+
+    free(run.contrib);
+    free(out_degree);
+    csr_free(&in);
+    LOG_DEBUG("PageRank stopped after %d iterations over %u URLs", iteration, nodes);
+    return run.rank;
+}
+
+#define REPRIORITIZE_BATCH 256   // URLs checked per pipeline
+
+// A URL whose queue score the rank may lower
+typedef struct {
+    int node;
+    int priority;
+    char tag[SHARD_TAG_MAX];
+    char key[SHARD_KEY_MAX];
+    char *buf;
+    const char *member;
+    visited_ref_t ref;
+} rank_update_t;
+
+// Lower the scores of one node's URLs in a batch: pipelined visited and
+// ZSCORE checks first, then ZADD XX LT CH for the URLs still queued worse,
+// and their hosts move up the schedule to match
+// Returns the number of scores changed
+static long apply_rank_updates(int node, rank_update_t *updates, int count) {
+    int *lower = calloc(count, sizeof(int));
+    redisContext *ctx = lower ? shard_acquire(node) : NULL;
+    if (!ctx) {
+        free(lower);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (updates[i].node == node) {
+            redisAppendCommand(ctx, "%s %s %b", visited_check_command(), updates[i].ref.key,
+                               updates[i].ref.member, updates[i].ref.member_len);
+            redisAppendCommand(ctx, "ZSCORE %s %s", updates[i].key, updates[i].member);
+        }
+    }
+    int ok = 1, sent = 0;
+    for (int i = 0; i < count; i++) {
+        if (updates[i].node != node) {
+            continue;
+        }
+        redisReply *visited = NULL, *score = NULL;
+        ok = ok && redisGetReply(ctx, (void **)&visited) == REDIS_OK &&
+             redisGetReply(ctx, (void **)&score) == REDIS_OK;
+        lower[i] = ok && visited->type == REDIS_REPLY_INTEGER && visited->integer == 0 &&
+                   score->type == REDIS_REPLY_STRING &&
+                   strtod(score->str, NULL) > updates[i].priority;
+        freeReplyObject(visited);
+        freeReplyObject(score);
+    }
+    for (int i = 0; ok && i < count; i++) {
+        if (lower[i]) {
+            redisAppendCommand(ctx, "ZADD %s XX LT CH %d %s", updates[i].key,
+                               updates[i].priority, updates[i].member);
+            sent++;
+        }
+    }
+    long changed = 0;
+    for (int i = 0; ok && sent > 0 && i < count; i++) {
+        if (!lower[i]) {
+            continue;
+        }
+        redisReply *reply = NULL;
+        ok = redisGetReply(ctx, (void **)&reply) == REDIS_OK;
+        lower[i] = ok && reply->type == REDIS_REPLY_INTEGER && reply->integer > 0;
+        changed += lower[i];
+        freeReplyObject(reply);
+    }
+    shard_release(node);
+    if (!ok) {
+        LOG_WARNING("Failed to reprioritize queued URLs on node %d", node);
+    }
+    for (int i = 0; ok && i < count; i++) {
+        if (lower[i]) {
+            frontier_schedule_at(updates[i].tag, updates[i].priority);
+        }
+    }
+    free(lower);
+    return changed;
+}
+
+// Send a batch of rank updates, one node at a time
+static long flush_rank_updates(rank_update_t *updates, int count) {
+    long changed = 0;
+    for (int node = 0; node < shard_count(); node++) {
+        for (int i = 0; i < count; i++) {
+            if (updates[i].node == node) {
+                changed += apply_rank_updates(node, updates, count);
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(updates[i].buf);
+    }
+    return changed;
+}
+
+// Lower the queue score of URLs ranked well above average. A rank
+// 2^k times the average takes k off the default link priority. Visited
+// URLs and URLs already queued at or below that score are left alone.
+// Returns the number of queue scores lowered
+static long reprioritize(const double *rank, uint32_t nodes) {
+    rank_update_t *updates = malloc(REPRIORITIZE_BATCH * sizeof(rank_update_t));
+    if (!updates) {
+        return -1;
+    }
+    long updated = 0;
+    int pending = 0;
+    for (uint32_t id = 0; id < nodes; id++) {
+        double relative = rank[id] * nodes;
+        int boost = relative >= 2.0 ? (int)log2(relative) : 0;
+        if (boost > LINK_GRAPH_MAX_BOOST) {
+            boost = LINK_GRAPH_MAX_BOOST;
+        }
+        const char *url = boost > 0 ? url_lookup(id) : NULL;
+        if (!url) {
+            continue;
+        }
+        rank_update_t *update = &updates[pending];
+        char *tag = update->tag;
+        if (shard_url_tag(url, tag, sizeof(update->tag)) != 0) {
+            strcpy(tag, "_");
+        }
+        if (shard_tag_key(update->key, sizeof(update->key), URL_QUEUE_PREFIX, tag, NULL) != 0 ||
+            visited_ref(url, &update->ref) != 0) {
+            continue;
+        }
+        size_t buf_size = strlen(url) + 2;
+        update->buf = malloc(buf_size);
+        update->member = frontier_member(url, tag, update->buf, update->buf ? buf_size : 0);
+        update->node = shard_for_key(update->key);
+        update->priority = DEFAULT_LINK_PRIORITY - boost;
+        if (++pending == REPRIORITIZE_BATCH) {
+            updated += flush_rank_updates(updates, pending);
+            pending = 0;
+        }
+    }
+    updated += flush_rank_updates(updates, pending);
+    free(updates);
+    return updated;
+}
+
+// Compact the edge log, rank the graph and reprioritize the frontier now
+long link_graph_update(void) {
+    if (!graph_dir) {
+        return 0;
+    }
+    pthread_mutex_lock(&update_mutex);
+    csr_t graph;
+    if (compact_graph(&graph) != 0) {
+        pthread_mutex_unlock(&update_mutex);
+        return -1;
+    }
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    double *rank = pagerank(&graph);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long updated = rank ? reprioritize(rank, graph.nodes) : -1;
+
+    pthread_mutex_lock(&graph_mutex);
+    stats.compactions++;
+    stats.edges = graph.row_ptr[graph.nodes];
+    if (rank) {
+        stats.rank_passes++;
+        stats.last_rank_ms = (finished.tv_sec - started.tv_sec) * 1000 +
+                             (finished.tv_nsec - started.tv_nsec) / 1000000;
+    }
+    if (updated > 0) {
+        stats.priorities_updated += updated;
+    }
+    pthread_mutex_unlock(&graph_mutex);
+
+    if (rank) {
+        LOG_INFO("Ranked %u URLs over %llu links, lowered %ld queue scores", graph.nodes,
+                 (unsigned long long)graph.row_ptr[graph.nodes], updated);
+    }
+    free(rank);
+    csr_free(&graph);
+    pthread_mutex_unlock(&update_mutex);
+    return updated;
+}
+
+static void *rank_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&thread_mutex);
+    while (running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += LINK_GRAPH_INTERVAL;
+        pthread_cond_timedwait(&thread_wake, &thread_mutex, &deadline);
+        if (!running) {
+            break;
+        }
+        pthread_mutex_unlock(&thread_mutex);
+        link_graph_update();
+        pthread_mutex_lock(&thread_mutex);
+    }
+    pthread_mutex_unlock(&thread_mutex);
+    return NULL;
+}
+
+// Counters since startup
+void link_graph_get_stats(link_graph_stats_t *out) {
+    pthread_mutex_lock(&graph_mutex);
+    *out = stats;
+    out->nodes = edges_fp ? url_intern_count() : 0;
+    pthread_mutex_unlock(&graph_mutex);
+}
+
+// Stop the background pass and close the graph files
+void link_graph_stop(void) {
+    pthread_mutex_lock(&thread_mutex);
+    int was_running = running;
+    running = 0;
+    pthread_cond_signal(&thread_wake);
+    pthread_mutex_unlock(&thread_mutex);
+    if (was_running) {
+        pthread_join(rank_thread, NULL);
+    }
+
+    pthread_mutex_lock(&graph_mutex);
+    if (edges_fp) {
+        fclose(edges_fp);
+        edges_fp = NULL;
+    }
+    pthread_mutex_unlock(&graph_mutex);
+}
@@ -0,0 +1,70 @@
+#ifndef LINK_GRAPH_H
+#define LINK_GRAPH_H
+
+#include <stdint.h>
+
+// Link graph and PageRank prioritization
+//
+// Every crawled page appends its out-links to an edge log under the link
+// graph directory. Nodes are URL dictionary ids (see url_intern.h), so
+// only ids go into the edge log; the dictionary is kept in nodes.log
+// unless it has a file of its own. Every LINK_GRAPH_INTERVAL seconds a
+// background pass:
+//   1. moves the edge log aside and merges it into graph.csr, a
+//      compressed sparse row file with one sorted, deduplicated row of
+//      targets per source
+//   2. runs PageRank over the merged graph on LINK_GRAPH_THREADS threads
+//   3. lowers the frontier score of queued URLs that rank above average,
+//      so important pages are crawled first
+// Only URLs still in a host's hot queue are reprioritized; spilled ones
+// keep the score they were admitted with.
+//
+// Files, integers little-endian, varints unsigned LEB128:
+//   edges.log  per page: varint source id, varint count, varint target ids
+//   graph.csr  "LGR1", 8-byte node count, 8-byte edge count, then per
+//              node: varint degree, first target, gaps to the next targets
+
+#define LINK_GRAPH_MAGIC "LGR1"
+#define LINK_GRAPH_INTERVAL 600      // Seconds between rank passes
+#define LINK_GRAPH_THREADS 4
+#define PAGERANK_DAMPING 0.85
+#define PAGERANK_ITERATIONS 30
+#define PAGERANK_TOLERANCE 1e-6      // Stop once ranks move less than this in total
+#define LINK_GRAPH_MAX_BOOST 8       // Most a rank can lower a URL's score by
+
+// Link graph counters
+typedef struct {
+    unsigned long nodes;               // URLs with an id
+    unsigned long long edges_logged;   // Edges appended since startup
+    unsigned long long edges;          // Edges in graph.csr after the last pass
+    unsigned long compactions;
+    unsigned long rank_passes;
+    unsigned long last_rank_ms;        // Wall time of the last PageRank run
+    unsigned long priorities_updated;  // Frontier scores lowered since startup
+} link_graph_stats_t;
+
+// Keep the link graph under dir; NULL disables it
+void link_graph_set_dir(const char *dir);
+
+// Link graph directory, or NULL if the graph is disabled
+const char *link_graph_get_dir(void);
+
+// Open the graph files and start the background rank pass
+// Returns 0 on success or when disabled, -1 on failure
+int link_graph_start(void);
+
+// Record a page's out-links
+// Returns the number of edges logged, or -1 on failure
+int link_graph_add_page(const char *url, const char **links, int count);
+
+// Compact the edge log, rank the graph and reprioritize the frontier now
+// Returns the number of frontier scores lowered, or -1 on failure
+long link_graph_update(void);
+
+// Counters since startup
+void link_graph_get_stats(link_graph_stats_t *out);
+
+// Stop the background pass and close the graph files
+void link_graph_stop(void);
+
+#endif // LINK_GRAPH_H
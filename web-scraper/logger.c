@@ -1,10 +1,50 @@
 #include "logger.h"
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+
+#define LOG_TEXT_SIZE (LOG_SLOT_SIZE - sizeof(time_t) - 2 * sizeof(uint16_t))
+#define LOG_WRITE_BUFFER (256 * 1024)
+
+// One formatted message, without its prefix
+typedef struct {
+    time_t time;
+    uint16_t level;
+    uint16_t len;
+    char text[LOG_TEXT_SIZE];
+} log_slot_t;
+
+// A thread's messages; head is advanced by the thread, tail by the writer
+typedef struct {
+    log_slot_t slots[LOG_RING_SLOTS];
+    unsigned long head;
+    unsigned long tail;
+    int abandoned;   // The thread exited; freed by the writer once empty
+} log_ring_t;
+
+int logger_level = LOG_DEBUG;
 
 static FILE *log_file = NULL;
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *log_buffer = NULL;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;   // Guards log_file
+
+static log_ring_t *rings[LOG_MAX_THREADS];
+static int ring_count = 0;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring_t *thread_ring = NULL;
+static __thread int thread_ring_failed = 0;
+
+static pthread_t writer_thread;
+static int writer_running = 0;
+
+// Timestamp of the second last formatted, per formatting thread
+static __thread time_t cached_second = -1;
+static __thread char cached_time[20];
 
 // Get log level string
 static const char *get_level_str(log_level_t level) {
@@ -17,7 +57,159 @@ static const char *get_level_str(log_level_t level) {
     }
 }
 
+// Formatted local time of a second, recomputed only when the second changes
+static const char *time_string(time_t t) {
+    if (t != cached_second) {
+        struct tm tm_info;
+        localtime_r(&t, &tm_info);
+        strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &tm_info);
+        cached_second = t;
+    }
+    return cached_time;
+}
+
+// Current second without a system call where the clock allows it
+static time_t current_second(void) {
+    struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return ts.tv_sec;
+}
+
+// Write one line; the caller holds log_mutex
+static void write_line(log_level_t level, time_t t, const char *text, size_t len) {
+    const char *time_str = time_string(t);
+    if (log_file) {
+        fprintf(log_file, "[%s] [%s] ", time_str, get_level_str(level));
+        fwrite(text, 1, len, log_file);
+        fputc('\n', log_file);
+    }
+
+    // Always print errors to stderr
+    if (level == LOG_ERROR) {
+        fprintf(stderr, "[%s] [%s] %.*s\n", time_str, get_level_str(level), (int)len, text);
+    }
+}
+
+// Write a ring's pending lines; the caller holds log_mutex
+// Returns the number of lines written
+static unsigned long drain_ring(log_ring_t *ring) {
+    unsigned long tail = ring->tail;
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (unsigned long i = tail; i != head; i++) {
+        const log_slot_t *slot = &ring->slots[i % LOG_RING_SLOTS];
+        write_line(slot->level, slot->time, slot->text, slot->len);
+    }
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    return head - tail;
+}
+
+// Drain every ring once, dropping rings of exited threads once empty
+// Returns the number of lines written
+static unsigned long drain_all(void) {
+    unsigned long written = 0;
+    pthread_mutex_lock(&rings_mutex);
+    pthread_mutex_lock(&log_mutex);
+    for (int i = 0; i < ring_count;) {
+        log_ring_t *ring = rings[i];
+        int abandoned = __atomic_load_n(&ring->abandoned, __ATOMIC_ACQUIRE);
+        written += drain_ring(ring);
+        if (abandoned) {
+            free(ring);
+            rings[i] = rings[--ring_count];
+        } else {
+            i++;
+        }
+    }
+    if (written && log_file) {
+        fflush(log_file);
+    }
+    pthread_mutex_unlock(&log_mutex);
+    pthread_mutex_unlock(&rings_mutex);
+    return written;
+}
+
+// Format and write lines until the logger is closed
+static void *log_writer_thread(void *arg) {
+    (void)arg;
+    while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        if (drain_all() == 0) {
+            struct timespec idle = {0, LOG_IDLE_MS * 1000000L};
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain_all();
+    return NULL;
+}
+
+// A thread's ring is handed to the writer when the thread exits
+static void release_ring(void *arg) {
+    log_ring_t *ring = arg;
+    __atomic_store_n(&ring->abandoned, 1, __ATOMIC_RELEASE);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+// The calling thread's ring, registered on first use
+// Returns NULL if it cannot have one; the thread then writes directly
+static log_ring_t *get_thread_ring(void) {
+    if (thread_ring || thread_ring_failed) {
+        return thread_ring;
+    }
+    pthread_once(&ring_key_once, create_ring_key);
+    log_ring_t *ring = calloc(1, sizeof(log_ring_t));
+    pthread_mutex_lock(&rings_mutex);
+    if (ring && ring_count < LOG_MAX_THREADS) {
+        rings[ring_count++] = ring;
+        thread_ring = ring;
+    } else {
+        free(ring);
+        thread_ring_failed = 1;
+    }
+    pthread_mutex_unlock(&rings_mutex);
+    if (thread_ring) {
+        pthread_setspecific(ring_key, thread_ring);
+    }
+    return thread_ring;
+}
+
+// Wait until the writer has taken every line of a ring
+static void wait_for_ring(log_ring_t *ring) {
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head &&
+           __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+// Start the writer; the caller holds log_mutex
+static void start_writer(void) {
+    if (!log_buffer) {
+        log_buffer = malloc(LOG_WRITE_BUFFER);
+    }
+    if (log_buffer) {
+        setvbuf(log_file, log_buffer, _IOFBF, LOG_WRITE_BUFFER);
+    }
+    __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer_thread, NULL, log_writer_thread, NULL) != 0) {
+        __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+        fprintf(stderr, "Failed to start log writer thread, logging synchronously\n");
+    }
+}
+
+// Stop the writer after it has written every line
+static void stop_writer(void) {
+    if (__atomic_exchange_n(&writer_running, 0, __ATOMIC_ACQ_REL)) {
+        pthread_join(writer_thread, NULL);
+    }
+}
+
 void logger_init(const char *log_file_path) {
+    stop_writer();
     pthread_mutex_lock(&log_mutex);
     if (log_file) {
         fclose(log_file);
@@ -25,48 +217,103 @@ void logger_init(const char *log_file_path) {
     log_file = fopen(log_file_path, "w");
     if (!log_file) {
         fprintf(stderr, "Failed to open log file: %s\n", strerror(errno));
+    } else {
+        start_writer();
     }
     pthread_mutex_unlock(&log_mutex);
 }
 
 void logger_close() {
+    stop_writer();
+    drain_all();
     pthread_mutex_lock(&log_mutex);
     if (log_file) {
         fclose(log_file);
         log_file = NULL;
     }
+    free(log_buffer);
+    log_buffer = NULL;
     pthread_mutex_unlock(&log_mutex);
 }
 
+// Log messages of level and above
+void logger_set_level(log_level_t level) {
+    __atomic_store_n(&logger_level, level > LOG_ERROR ? LOG_ERROR : level, __ATOMIC_RELAXED);
+}
+
+// Parse a level name
+int logger_parse_level(const char *name) {
+    static const char *names[] = {"debug", "info", "warning", "error"};
+    for (int i = 0; name && i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 void logger_log(log_level_t level, const char *format, ...) {
+    if (!LOG_ENABLED(level) && level != LOG_ERROR) {
+        return;
+    }
+    time_t now = current_second();
+    log_ring_t *ring = __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE) ? get_thread_ring() : NULL;
+
+    if (ring) {
+        // Wait for a free slot; the writer empties rings continuously
+        unsigned long head = ring->head;
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS &&
+               __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < LOG_RING_SLOTS) {
+            log_slot_t *slot = &ring->slots[head % LOG_RING_SLOTS];
+            va_list args;
+            va_start(args, format);
+            int len = vsnprintf(slot->text, sizeof(slot->text), format, args);
+            va_end(args);
+            if (len >= 0 && (size_t)len < sizeof(slot->text)) {
+                slot->time = now;
+                slot->level = level;
+                slot->len = len;
+                __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+                return;
+            }
+        }
+        // Too long for a slot: write it directly after this thread's earlier lines
+        wait_for_ring(ring);
+    }
+
+    va_list args;
+    va_start(args, format);
+    char stack_text[LOG_TEXT_SIZE];
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(stack_text, sizeof(stack_text), format, copy);
+    va_end(copy);
+    char *text = stack_text;
+    if (len >= (int)sizeof(stack_text)) {
+        text = malloc(len + 1);
+        if (text) {
+            vsnprintf(text, len + 1, format, args);
+        } else {
+            text = stack_text;
+            len = sizeof(stack_text) - 1;
+        }
+    }
+    va_end(args);
+
     pthread_mutex_lock(&log_mutex);
-    
-    // Get current time
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    // Print to log file if open
-    if (log_file) {
-        fprintf(log_file, "[%s] [%s] ", time_str, get_level_str(level));
-        va_list args;
-        va_start(args, format);
-        vfprintf(log_file, format, args);
-        va_end(args);
-        fprintf(log_file, "\n");
+    if (ring) {
+        // Lines the writer has not picked up yet go first
+        drain_ring(ring);
+    }
+    write_line(level, now, text, len > 0 ? (size_t)len : 0);
+    if (log_file && !__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
         fflush(log_file);
     }
-    
-    // Always print errors to stderr
-    if (level == LOG_ERROR) {
-        fprintf(stderr, "[%s] [%s] ", time_str, get_level_str(level));
-        va_list args;
-        va_start(args, format);
-        vfprintf(stderr, format, args);
-        va_end(args);
-        fprintf(stderr, "\n");
-    }
-    
     pthread_mutex_unlock(&log_mutex);
-} 
\ No newline at end of file
+    if (text != stack_text) {
+        free(text);
+    }
+}
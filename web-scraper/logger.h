@@ -5,6 +5,23 @@
 #include <time.h>
 #include <pthread.h>
 
+// Asynchronous logging
+//
+// Each logging thread formats its message into a ring buffer of its own
+// (single producer, single consumer, no locks) and returns; a background
+// thread drains the rings, prefixes each line with its level and a
+// timestamp formatted once per second, and writes the lines in batches.
+// Lines of one thread stay in order. A message longer than a ring slot,
+// or logged while the background thread is not running, is written
+// directly once the thread's earlier lines are out. Messages below the
+// current level are skipped by the macros before their arguments are
+// evaluated.
+
+#define LOG_RING_SLOTS 1024      // Lines buffered per thread
+#define LOG_SLOT_SIZE 512        // Bytes per line, header included
+#define LOG_MAX_THREADS 256      // Threads with a ring of their own
+#define LOG_IDLE_MS 5            // Writer sleep when every ring is empty
+
 // Log levels
 typedef enum {
     LOG_DEBUG,
@@ -13,19 +30,33 @@ typedef enum {
     LOG_ERROR
 } log_level_t;
 
+// Lowest level that is logged; read by the macros
+extern int logger_level;
+
 // Initialize logger
 void logger_init(const char *log_file);
 
 // Close logger
 void logger_close();
 
+// Log messages of level and above; LOG_ERROR is always logged
+void logger_set_level(log_level_t level);
+
+// Parse "debug", "info", "warning" or "error"
+// Returns the level, or -1 if the name is unknown
+int logger_parse_level(const char *name);
+
 // Log a message with timestamp and log level
-void logger_log(log_level_t level, const char *format, ...);
+void logger_log(log_level_t level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Whether a level is logged at all
+#define LOG_ENABLED(level) ((int)(level) >= __atomic_load_n(&logger_level, __ATOMIC_RELAXED))
 
-// Convenience macros
-#define LOG_DEBUG(...) logger_log(LOG_DEBUG, __VA_ARGS__)
-#define LOG_INFO(...) logger_log(LOG_INFO, __VA_ARGS__)
-#define LOG_WARNING(...) logger_log(LOG_WARNING, __VA_ARGS__)
+// Convenience macros; arguments are not evaluated for filtered levels
+#define LOG_DEBUG(...) (LOG_ENABLED(LOG_DEBUG) ? logger_log(LOG_DEBUG, __VA_ARGS__) : (void)0)
+#define LOG_INFO(...) (LOG_ENABLED(LOG_INFO) ? logger_log(LOG_INFO, __VA_ARGS__) : (void)0)
+#define LOG_WARNING(...) (LOG_ENABLED(LOG_WARNING) ? logger_log(LOG_WARNING, __VA_ARGS__) : (void)0)
 #define LOG_ERROR(...) logger_log(LOG_ERROR, __VA_ARGS__)
 
-#endif // LOGGER_H 
\ No newline at end of file
+#endif // LOGGER_H
@@ -10,6 +10,19 @@
 #include "rate_limiter.h"
 #include "types.h"
 #include "content_analyzer.h"
+#include "cache.h"
+#include "compression.h"
+#include "cache_policy.h"
+#include "warc_writer.h"
+#include "shard_router.h"
+#include "visited_store.h"
+#include "frontier_runs.h"
+#include "checkpoint.h"
+#include "link_graph.h"
+#include "url_intern.h"
+#include "data_store.h"
+#include "column_export.h"
+#include "result_sink.h"
 
 // External declarations
 extern thread_pool_t *scraper_pool;  // Defined in scraper.c
@@ -29,13 +42,35 @@ void print_usage(const char *program_name) {
     printf("  -a, --analyze <url>        Analyze content of a URL\n");
     printf("  -t, --trends [limit]       Show trending topics (default limit: 10)\n");
     printf("  -c, --config               Show current scraper configuration\n");
+    printf("      --cache-policy <name>  Cache eviction policy: ttl, lru or cost (default: lru)\n");
+    printf("      --cache-budget <n>     Total cache size in MB (default: 512)\n");
+    printf("      --cache-dir <dir>      Keep cached pages in a local segment store under <dir>\n");
+    printf("      --warc <dir>           Archive raw responses as WARC files under <dir>\n");
+    printf("      --warc-size <n>        Rotate WARC files at <n> MB (default: 1024)\n");
+    printf("      --redis-shard <h:p>    Spread crawl state over another Redis node (repeatable)\n");
+    printf("      --frontier-dir <dir>   Spill oversized host queues to sorted runs under <dir>\n");
+    printf("      --link-graph <dir>     Log links under <dir> and crawl highly ranked pages first\n");
+    printf("      --db <conninfo>        Store page metadata and links in Postgres\n");
+    printf("      --export <dir>         Write crawled pages and analyses as columnar files under <dir>\n");
+    printf("      --export-analysis      Export all stored analyses to the export directory (default: %s)\n", EXPORT_DEFAULT_DIR);
+    printf("      --results <file>       Append results to <file> as NDJSON instead of printing them\n");
+    printf("      --results-stream <key> Add results to the Redis stream <key> instead of printing them\n");
+    printf("      --url-ids <file>       Keep the URL id dictionary in <file> across runs\n");
+    printf("      --checkpoint <file>    Save crawl state to <file> every %d seconds and on exit\n", CHECKPOINT_INTERVAL);
+    printf("      --resume               Resume the crawl saved in the checkpoint file (default: %s)\n", CHECKPOINT_FILE);
+    printf("      --visited-fingerprints <64|96>  Store visited URLs as bucketed fingerprints\n");
+    printf("      --migrate-visited      Convert existing visited sets to the selected storage\n");
+    printf("      --visited-report       Compare the memory used by visited URL storage\n");
+    printf("      --train-dict           Train the cache compression dictionary from cached pages\n");
     printf("  -d, --depth <n>            Set maximum crawl depth (default: 3)\n");
     printf("  -p, --pages <n>            Set maximum pages to crawl (default: 1000)\n");
     printf("  -m, --memory <n>           Set maximum memory usage in MB (default: 1024)\n");
     printf("  -j, --javascript           Enable JavaScript rendering\n");
     printf("  -r, --no-robots            Disable robots.txt compliance\n");
     printf("  -f, --force                Force re-scraping of already visited URLs\n");
+    printf("  -n, --no-dedup             Disable near-duplicate page detection\n");
     printf("  -v, --verbose              Enable verbose output\n");
+    printf("      --log-level <name>     Log debug, info, warning or error and above (default: debug)\n");
 }
 
 // Print content analysis results
@@ -143,10 +178,38 @@ void print_config(scraper_config_t *config) {
     printf("Analyze Content: %s\n", config->analyze_content ? "Yes" : "No");
     printf("Track Trends: %s\n", config->track_trends ? "Yes" : "No");
     printf("Force Re-scrape: %s\n", config->force_rescrape ? "Yes" : "No");
+    printf("Skip Near-Duplicates: %s\n", config->skip_near_duplicates ? "Yes" : "No");
+    printf("Deprioritize Duplicate Links: %s\n", config->deprioritize_duplicate_links ? "Yes" : "No");
     printf("User Agent: %s\n", config->user_agent ? config->user_agent : "Default");
     printf("Request Timeout: %d seconds\n", config->request_timeout);
     printf("Retry Count: %d\n", config->retry_count);
     printf("Retry Delay: %d seconds\n", config->retry_delay);
+    const char *level_names[] = {"debug", "info", "warning", "error"};
+    printf("Log Level: %s\n", level_names[logger_level]);
+    
+    const cache_policy_t *policy = cache_get_policy();
+    const char *policy_names[] = {"ttl", "lru", "cost"};
+    printf("Cache Policy: %s\n", policy_names[policy->policy]);
+    printf("Cache Budget: %zu MB\n", policy->max_total_bytes / (1024 * 1024));
+    printf("Max Cache Entry: %zu bytes\n", policy->max_entry_bytes);
+    printf("Cache Store: %s\n", cache_get_content_dir() ? cache_get_content_dir() : "Redis");
+    printf("WARC Archive: %s\n", warc_get_output_dir() ? warc_get_output_dir() : "Disabled");
+    printf("Redis Nodes: %d\n", shard_count());
+    printf("Frontier Spill: %s\n", frontier_get_spill_dir() ? frontier_get_spill_dir() : "Redis");
+    printf("Link Graph: %s\n", link_graph_get_dir() ? link_graph_get_dir() : "Disabled");
+    if (result_sink_get_name()) {
+        printf("Results: %s %s\n", result_sink_get_name(), result_sink_get_target());
+    } else {
+        printf("Results: Console\n");
+    }
+    printf("Export: %s\n", export_get_dir() ? export_get_dir() : "Disabled");
+    printf("Data Store: %s\n", data_store_get_conninfo() ? "Postgres" : "Disabled");
+    printf("URL Ids: %s\n", url_intern_get_file() ? url_intern_get_file() : "Memory");
+    if (visited_get_mode() == VISITED_MODE_URLS) {
+        printf("Visited Store: URL sets\n");
+    } else {
+        printf("Visited Store: %d-bit fingerprints\n", visited_get_mode());
+    }
     printf("============================\n\n");
 }
 
@@ -162,7 +225,12 @@ int main(int argc, char *argv[]) {
     int trends_mode = 0;
     int trends_limit = 10;
     int config_mode = 0;
-    int force_mode = 0;
+    int train_mode = 0;
+    int migrate_visited_mode = 0;
+    int visited_report_mode = 0;
+    int export_mode = 0;
+    int resume_mode = 0;
+    const char *checkpoint_file = NULL;
     
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
@@ -183,8 +251,128 @@ int main(int argc, char *argv[]) {
             }
         } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--config") == 0) {
             config_mode = 1;
+        } else if (strcmp(argv[i], "--cache-policy") == 0) {
+            cache_policy_t policy = *cache_get_policy();
+            if (i + 1 >= argc || cache_policy_parse(argv[i + 1], &policy.policy) != 0) {
+                fprintf(stderr, "Error: --cache-policy expects ttl, lru or cost\n");
+                return 1;
+            }
+            i++;
+            cache_set_policy(&policy);
+        } else if (strcmp(argv[i], "--cache-budget") == 0) {
+            if (i + 1 < argc) {
+                cache_policy_t policy = *cache_get_policy();
+                policy.max_total_bytes = (size_t)atol(argv[++i]) * 1024 * 1024;
+                cache_set_policy(&policy);
+            } else {
+                fprintf(stderr, "Error: Missing value for cache budget\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache-dir") == 0) {
+            if (i + 1 < argc) {
+                cache_set_content_dir(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing directory for cache store\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--warc") == 0) {
+            if (i + 1 < argc) {
+                warc_set_output_dir(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing directory for WARC output\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--warc-size") == 0) {
+            if (i + 1 < argc) {
+                warc_set_max_file_size((size_t)atol(argv[++i]) * 1024 * 1024);
+            } else {
+                fprintf(stderr, "Error: Missing value for WARC file size\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--redis-shard") == 0) {
+            if (i + 1 < argc) {
+                if (shard_add_node_spec(argv[++i]) != 0) {
+                    fprintf(stderr, "Error: Invalid Redis node '%s' (expected host:port)\n", argv[i]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "Error: Missing host:port for Redis shard\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frontier-dir") == 0) {
+            if (i + 1 < argc) {
+                frontier_set_spill_dir(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing directory for frontier runs\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--link-graph") == 0) {
+            if (i + 1 < argc) {
+                link_graph_set_dir(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing directory for link graph\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--db") == 0) {
+            if (i + 1 < argc) {
+                data_store_set_conninfo(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing Postgres connection string\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--export") == 0) {
+            if (i + 1 < argc) {
+                export_set_dir(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing directory for export\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--export-analysis") == 0) {
+            export_mode = 1;
+        } else if (strcmp(argv[i], "--results") == 0) {
+            if (i + 1 < argc) {
+                result_sink_set(RESULT_SINK_NDJSON, argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing file for results\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--results-stream") == 0) {
+            if (i + 1 < argc) {
+                result_sink_set(RESULT_SINK_STREAM, argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing stream key for results\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--url-ids") == 0) {
+            if (i + 1 < argc) {
+                url_intern_set_file(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Missing file for URL ids\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--checkpoint") == 0) {
+            if (i + 1 < argc) {
+                checkpoint_file = argv[++i];
+            } else {
+                fprintf(stderr, "Error: --checkpoint requires a file\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume_mode = 1;
+        } else if (strcmp(argv[i], "--visited-fingerprints") == 0) {
+            if (i + 1 >= argc || visited_set_mode(atoi(argv[i + 1])) != 0 ||
+                visited_get_mode() == VISITED_MODE_URLS) {
+                fprintf(stderr, "Error: --visited-fingerprints expects 64 or 96\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--migrate-visited") == 0) {
+            migrate_visited_mode = 1;
+        } else if (strcmp(argv[i], "--visited-report") == 0) {
+            visited_report_mode = 1;
+        } else if (strcmp(argv[i], "--train-dict") == 0) {
+            train_mode = 1;
         } else if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--force") == 0) {
-            force_mode = 1;
             scraper_config_t *config = get_scraper_config();
             if (config) {
                 config->force_rescrape = 1;
@@ -192,6 +380,14 @@ int main(int argc, char *argv[]) {
                 free(config->user_agent);
                 free(config);
             }
+        } else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--no-dedup") == 0) {
+            scraper_config_t *config = get_scraper_config();
+            if (config) {
+                config->skip_near_duplicates = 0;
+                set_scraper_config(config);
+                free(config->user_agent);
+                free(config);
+            }
         } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--depth") == 0) {
             if (i + 1 < argc) {
                 int depth = atoi(argv[++i]);
@@ -251,7 +447,15 @@ int main(int argc, char *argv[]) {
                 free(config);
             }
         } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
-            // Set verbose mode (implement as needed)
+            logger_set_level(LOG_DEBUG);
+        } else if (strcmp(argv[i], "--log-level") == 0) {
+            int level = i + 1 < argc ? logger_parse_level(argv[i + 1]) : -1;
+            if (level < 0) {
+                fprintf(stderr, "Error: --log-level expects debug, info, warning or error\n");
+                return 1;
+            }
+            logger_set_level(level);
+            i++;
         } else if (argv[i][0] != '-') {
             // Assume this is the URL
             url = argv[i];
@@ -270,6 +474,28 @@ int main(int argc, char *argv[]) {
         print_config(config);
         free(config->user_agent);
         free(config);
+    } else if (train_mode) {
+        if (cache_train_dictionary(get_redis_context(), COMPRESSION_DICT_FILE) == 0) {
+            printf("Compression dictionary written to %s\n", COMPRESSION_DICT_FILE);
+        } else {
+            fprintf(stderr, "Failed to train compression dictionary\n");
+        }
+    } else if (migrate_visited_mode) {
+        long migrated = visited_migrate();
+        if (migrated >= 0) {
+            printf("Migrated %ld visited URLs\n", migrated);
+        } else {
+            fprintf(stderr, "Failed to migrate visited URLs\n");
+        }
+    } else if (export_mode) {
+        long rows = export_redis_analysis();
+        if (rows >= 0) {
+            printf("Exported %ld analyses to %s\n", rows, export_get_dir());
+        } else {
+            fprintf(stderr, "Failed to export analyses\n");
+        }
+    } else if (visited_report_mode) {
+        visited_print_report();
     } else if (trends_mode) {
         trend_data_t **trends = get_trending_topics(trends_limit);
         if (trends) {
@@ -282,39 +508,42 @@ int main(int argc, char *argv[]) {
             print_analysis(analysis);
             free_content_analysis(analysis);
         }
-    } else if (url) {
-        // Regular scraping mode
-        LOG_INFO("Starting web scraper with URL: %s", url);
-        
-        // Create URL task
-        url_task_t *task = malloc(sizeof(url_task_t));
-        if (!task) {
-            LOG_ERROR("Failed to allocate memory for URL task");
-            cleanup_scraper();
-            return 1;
+    } else if (url || resume_mode) {
+        // Regular scraping mode, optionally picking up a saved crawl first
+        if (resume_mode) {
+            if (!checkpoint_file) {
+                checkpoint_file = CHECKPOINT_FILE;
+            }
+            if (checkpoint_restore(checkpoint_file) < 0) {
+                fprintf(stderr, "Error: Failed to resume from checkpoint %s\n", checkpoint_file);
+                cleanup_scraper();
+                return 1;
+            }
         }
-        
-        task->url = strdup(url);
-        if (!task->url) {
-            LOG_ERROR("Failed to allocate memory for URL string");
-            free(task);
-            cleanup_scraper();
-            return 1;
+        if (checkpoint_file && checkpoint_start(checkpoint_file, CHECKPOINT_INTERVAL) != 0) {
+            LOG_WARNING("Checkpointing to %s disabled", checkpoint_file);
         }
-        
-        task->priority = 1;
-        task->depth = 0;
-        task->parent_url = NULL;
-        
-        LOG_INFO("Adding URL task to thread pool: %s", task->url);
-        if (!thread_pool_add_task(scraper_pool, process_url_thread, task)) {
-            LOG_ERROR("Failed to add URL task to thread pool");
-            free(task->url);
-            free(task);
-            cleanup_scraper();
-            return 1;
+
+        if (url) {
+            LOG_INFO("Starting web scraper with URL: %s", url);
+            
+            // Create URL task
+            url_task_t *task = url_task_create(url, 1, 0);
+            if (!task) {
+                LOG_ERROR("Failed to allocate memory for URL task");
+                cleanup_scraper();
+                return 1;
+            }
+            
+            LOG_INFO("Adding URL task to thread pool: %s", task->url);
+            if (!thread_pool_add_task(scraper_pool, process_url_thread, task)) {
+                LOG_ERROR("Failed to add URL task to thread pool");
+                free(task);
+                cleanup_scraper();
+                return 1;
+            }
+            LOG_INFO("URL task added to thread pool successfully");
         }
-        LOG_INFO("URL task added to thread pool successfully");
         
         // Wait for task to complete
         LOG_INFO("Waiting for task to complete...");
@@ -5,6 +5,5 @@
 
 extern pthread_mutex_t redis_mutex;
 extern pthread_mutex_t print_mutex;
-extern pthread_mutex_t stats_mutex;
 
 #endif // MUTEXES_H 
\ No newline at end of file
@@ -143,4 +143,18 @@ void rate_limiter_set_crawl_delay(const char *domain, double delay, rate_limiter
     rate->min_delay = fmax(delay, MIN_DELAY);
     rate->current_delay = fmax(rate->current_delay, rate->min_delay);
     pthread_mutex_unlock(&limiter->mutex);
-} 
\ No newline at end of file
+}
+
+// Restore a domain's saved state
+void rate_limiter_restore(const domain_rate_t *saved, rate_limiter_t *limiter) {
+    if (!saved || !saved->domain || !limiter) return;
+    domain_rate_t *rate = get_domain_rate(saved->domain, limiter);
+    if (!rate) return;
+
+    pthread_mutex_lock(&limiter->mutex);
+    rate->min_delay = fmax(saved->min_delay, MIN_DELAY);
+    rate->current_delay = fmin(fmax(saved->current_delay, rate->min_delay), MAX_DELAY);
+    rate->last_request = saved->last_request;
+    rate->consecutive_errors = saved->consecutive_errors;
+    pthread_mutex_unlock(&limiter->mutex);
+}
@@ -39,4 +39,8 @@ void rate_limiter_update(const char *domain, double response_time, int status_co
 // Set crawl delay from robots.txt
 void rate_limiter_set_crawl_delay(const char *domain, double delay, rate_limiter_t *limiter);
 
+// Restore a domain's delays, last request time and error count, e.g.
+// from a checkpoint
+void rate_limiter_restore(const domain_rate_t *saved, rate_limiter_t *limiter);
+
 #endif // RATE_LIMITER_H 
\ No newline at end of file
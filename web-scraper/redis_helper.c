@@ -1,6 +1,10 @@
 #include "redis_helper.h"
+#include "frontier.h"
 #include "logger.h"
 #include "robots_parser.h"
+#include "shard_router.h"
+#include "visited_store.h"
+#include "write_behind.h"
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <hiredis/hiredis.h>
@@ -16,10 +20,11 @@
 
 #define REDIS_HOST "127.0.0.1"
 #define REDIS_PORT 6379
-#define VISITED_SET "visited_urls"
-#define URL_QUEUE "url_queue"
+#define REDIRECT_CACHE "redirect_cache"
+#define LEGACY_URL_QUEUE "url_queue" // Single queue used before sharding
+#define LEGACY_DRAIN_BATCH 512
 #define MAX_RETRIES 3
-#define RETRY_DELAY 1 // seconds
+#define RETRY_DELAY_MS 10 // first retry delay, doubled per attempt
 
 // Define Redis context and mutex as global variables
 redisContext *redis_ctx = NULL;
@@ -93,7 +98,7 @@ redisReply *execute_redis_command(const char *format, ...) {
     } else {
       LOG_WARNING("Redis command failed (attempt %d/%d): %s", attempt + 1,
                   MAX_RETRIES, redis_ctx->errstr);
-      sleep(RETRY_DELAY);
+      usleep((RETRY_DELAY_MS << attempt) * 1000);
     }
   }
 
@@ -208,61 +213,85 @@ void close_redis(void) {
  * Returns 1 if visited, 0 otherwise.
  */
 int is_visited(const char *url) {
-  if (!is_redis_initialized()) {
+  if (!url || !is_redis_initialized()) {
     return 0;
   }
+  return visited_contains(url) == 1;
+}
 
-  pthread_mutex_lock(&redis_mutex);
-  redisReply *reply =
-      execute_redis_command("SISMEMBER %s %s", VISITED_SET, url);
-  pthread_mutex_unlock(&redis_mutex);
+// Mark multiple URLs as visited with one command per visited key, sent by
+// the write-behind flusher
+int mark_visited_bulk(const char **urls, int count) {
+  if (!urls || count <= 0) {
+    return 0;
+  }
+  return visited_mark_urls(urls, count) == 0;
+}
 
-  if (!reply) {
+// Record that a URL redirects to another one
+int record_redirect(const char *from_url, const char *to_url) {
+  if (!from_url || !to_url || strcmp(from_url, to_url) == 0) {
     return 0;
   }
 
-  int result = reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
-  freeReplyObject(reply);
-  return result;
+  return write_behind_command("HSET %s %s %s", REDIRECT_CACHE, from_url,
+                              to_url) == 0;
 }
 
-int mark_visited_bulk(const char **urls, int count) {
+/**
+ * Looks up all URLs in the redirect cache with a single HMGET and replaces
+ * the ones that are known to redirect.
+ */
+int resolve_redirects_bulk(char **urls, int count) {
   if (!is_redis_initialized() || !urls || count <= 0) {
     return 0;
   }
 
-  pthread_mutex_lock(&redis_mutex);
-  redisReply *reply = execute_redis_command("MULTI");
-  if (!reply) {
-    pthread_mutex_unlock(&redis_mutex);
+  const char **argv = malloc((count + 2) * sizeof(char *));
+  if (!argv) {
+    LOG_ERROR("Failed to allocate memory for redirect lookup");
     return 0;
   }
-  freeReplyObject(reply);
-
+  argv[0] = "HMGET";
+  argv[1] = REDIRECT_CACHE;
   for (int i = 0; i < count; i++) {
-    reply = execute_redis_command("SADD %s %s", VISITED_SET, urls[i]);
-    if (!reply) {
-      execute_redis_command("DISCARD");
-      pthread_mutex_unlock(&redis_mutex);
-      return 0;
-    }
-    freeReplyObject(reply);
+    argv[i + 2] = urls[i];
   }
 
-  reply = execute_redis_command("EXEC");
+  pthread_mutex_lock(&redis_mutex);
+  redisReply *reply = redisCommandArgv(redis_ctx, count + 2, argv, NULL);
   pthread_mutex_unlock(&redis_mutex);
+  free(argv);
 
-  if (!reply) {
+  if (!reply || reply->type != REDIS_REPLY_ARRAY ||
+      reply->elements != (size_t)count) {
+    if (reply) {
+      freeReplyObject(reply);
+    }
     return 0;
   }
 
-  int result = reply->type == REDIS_REPLY_ARRAY;
+  int rewritten = 0;
+  for (int i = 0; i < count; i++) {
+    redisReply *target = reply->element[i];
+    if (target && target->type == REDIS_REPLY_STRING) {
+      char *resolved = strdup(target->str);
+      if (resolved) {
+        free(urls[i]);
+        urls[i] = resolved;
+        rewritten++;
+      }
+    }
+  }
+
   freeReplyObject(reply);
-  return result;
+  return rewritten;
 }
 
 /**
- * Fetches a URL from the Redis queue.
+ * Fetches a URL from the Redis queue: takes the host with the best queued
+ * priority off the schedule, pops its best URL and puts the host back at
+ * its new best priority.
  * Returns NULL if the queue is empty.
  */
 char *fetch_url_from_queue(void) {
@@ -270,49 +299,158 @@ char *fetch_url_from_queue(void) {
     return NULL;
   }
 
-  pthread_mutex_lock(&redis_mutex);
-  redisReply *reply =
-      execute_redis_command("ZRANGE %s 0 0 WITHSCORES", URL_QUEUE);
-  pthread_mutex_unlock(&redis_mutex);
+  int hosts_node = shard_for_key(FRONTIER_HOSTS_KEY);
+  for (int attempt = 0; attempt < MAX_RETRIES; attempt++) {
+    redisContext *ctx = shard_acquire(hosts_node);
+    if (!ctx) {
+      return NULL;
+    }
+    redisReply *head = redisCommand(ctx, "ZPOPMIN %s", FRONTIER_HOSTS_KEY);
+    shard_release(hosts_node);
+    if (!head || head->type != REDIS_REPLY_ARRAY || head->elements != 2) {
+      if (head) {
+        freeReplyObject(head);
+      }
+      return NULL;
+    }
+    const char *host = head->element[0]->str;
+    long long score = strtoll(head->element[1]->str, NULL, 10);
 
-  if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements == 0) {
-    if (reply) {
-      freeReplyObject(reply);
+    char *url = NULL;
+    int popped = frontier_pop(host, 1, &url);
+
+    // Back on the schedule while it has URLs left; a drained host stays
+    // off until an admission lowers it onto the schedule again
+    int scheduled = frontier_schedule(host);
+    if (scheduled < 0 || (scheduled == 0 && popped < 0)) {
+      frontier_schedule_at(host, score);
+    }
+    freeReplyObject(head);
+    if (popped > 0) {
+      return url;
     }
-    return NULL;
   }
+  return NULL;
+}
 
-  char *url = strdup(reply->element[0]->str);
-  // Remove the URL from the queue
-  pthread_mutex_lock(&redis_mutex);
-  redisReply *del_reply = execute_redis_command("ZREM %s %s", URL_QUEUE, url);
-  pthread_mutex_unlock(&redis_mutex);
-  if (del_reply) {
-    freeReplyObject(del_reply);
+// Push URL to its host's queue with priority
+int push_url_to_queue(const char *url, int priority) {
+  char tag[SHARD_TAG_MAX], key[SHARD_KEY_MAX];
+  if (!url) {
+    return 0;
+  }
+  if (shard_url_tag(url, tag, sizeof(tag)) != 0) {
+    strcpy(tag, "_");
+  }
+  if (shard_tag_key(key, sizeof(key), URL_QUEUE_PREFIX, tag, NULL) != 0) {
+    return 0;
   }
 
+  // Queue members are stored relative to the host, see frontier.h
+  size_t buf_size = strlen(url) + 2;
+  char *buf = malloc(buf_size);
+  const char *member = frontier_member(url, tag, buf, buf ? buf_size : 0);
+
+  // Sent synchronously: a ZADD replayed by write-behind could queue a URL
+  // again after a worker has popped it. ZCARD rides along for the spill check
+  int node = shard_for_key(key);
+  redisContext *ctx = shard_acquire(node);
+  redisReply *reply = NULL, *card = NULL;
+  if (ctx) {
+    redisAppendCommand(ctx, "ZADD %s %d %s", key, priority, member);
+    redisAppendCommand(ctx, "ZCARD %s", key);
+    if (redisGetReply(ctx, (void **)&reply) == REDIS_OK) {
+      redisGetReply(ctx, (void **)&card);
+    }
+    shard_release(node);
+  }
+  free(buf);
+  int queued = reply && reply->type == REDIS_REPLY_INTEGER;
+  long long size = card && card->type == REDIS_REPLY_INTEGER ? card->integer : 0;
   if (reply) {
     freeReplyObject(reply);
   }
-  return url;
+  if (card) {
+    freeReplyObject(card);
+  }
+  if (queued) {
+    frontier_schedule_at(tag, priority);
+  }
+  if (size > FRONTIER_HOT_MAX) {
+    frontier_spill(tag);
+  }
+  return queued;
 }
 
-// Push URL to queue with priority
-int push_url_to_queue(const char *url, int priority) {
-  if (!is_redis_initialized() || !url) {
-    return 0;
-  }
+/**
+ * Moves URLs from the pre-sharding url_queue into their hosts' queues, a
+ * batch at a time. A batch is removed from url_queue only once every URL
+ * in it has been queued again, so an interrupted drain loses nothing.
+ * Returns the number of URLs moved, or -1 on failure.
+ */
+long drain_legacy_queue(void) {
+  long moved = 0;
+  for (;;) {
+    // The single queue always lives on the primary
+    redisContext *ctx = shard_acquire(0);
+    if (!ctx) {
+      return -1;
+    }
+    redisReply *batch = redisCommand(ctx, "ZRANGE %s 0 %d WITHSCORES", LEGACY_URL_QUEUE,
+                                     LEGACY_DRAIN_BATCH - 1);
+    shard_release(0);
+    if (!batch || batch->type != REDIS_REPLY_ARRAY) {
+      if (batch) {
+        freeReplyObject(batch);
+      }
+      LOG_ERROR("Failed to read %s", LEGACY_URL_QUEUE);
+      return -1;
+    }
+    size_t count = batch->elements / 2;
+    if (count == 0) {
+      freeReplyObject(batch);
+      break;
+    }
 
-  pthread_mutex_lock(&redis_mutex);
-  redisReply *reply =
-      execute_redis_command("ZADD url_queue %d %s", priority, url);
-  pthread_mutex_unlock(&redis_mutex);
+    const char **argv = malloc((count + 2) * sizeof(char *));
+    size_t *argvlen = malloc((count + 2) * sizeof(size_t));
+    int ok = argv && argvlen;
+    for (size_t i = 0; ok && i < count; i++) {
+      redisReply *url = batch->element[2 * i];
+      int priority = atoi(batch->element[2 * i + 1]->str);
+      ok = push_url_to_queue(url->str, priority);
+      argv[i + 2] = url->str;
+      argvlen[i + 2] = url->len;
+    }
 
-  if (!reply) {
-    return 0;
+    redisReply *removed = NULL;
+    if (ok) {
+      argv[0] = "ZREM";
+      argvlen[0] = 4;
+      argv[1] = LEGACY_URL_QUEUE;
+      argvlen[1] = strlen(LEGACY_URL_QUEUE);
+      ctx = shard_acquire(0);
+      if (ctx) {
+        removed = redisCommandArgv(ctx, (int)count + 2, argv, argvlen);
+        shard_release(0);
+      }
+      ok = removed && removed->type == REDIS_REPLY_INTEGER;
+    }
+    if (removed) {
+      freeReplyObject(removed);
+    }
+    free(argv);
+    free(argvlen);
+    freeReplyObject(batch);
+    if (!ok) {
+      LOG_ERROR("Failed to move URLs out of %s after %ld", LEGACY_URL_QUEUE, moved);
+      return -1;
+    }
+    moved += count;
   }
 
-  int result = reply->type == REDIS_REPLY_INTEGER;
-  freeReplyObject(reply);
-  return result;
+  if (moved > 0) {
+    LOG_INFO("Moved %ld URLs from %s into per-host queues", moved, LEGACY_URL_QUEUE);
+  }
+  return moved;
 }
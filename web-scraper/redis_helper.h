@@ -26,12 +26,24 @@ int mark_visited(const char *url);
 // Mark multiple URLs as visited
 int mark_visited_bulk(const char **urls, int count);
 
+// Record that a URL redirects to another one
+int record_redirect(const char *from_url, const char *to_url);
+
+// Rewrite URLs through the redirect cache, in place. Entries that have a
+// known redirect target are freed and replaced with the target URL.
+// Returns the number of URLs rewritten.
+int resolve_redirects_bulk(char **urls, int count);
+
 // Fetch URL from queue
 char *fetch_url_from_queue(void);
 
 // Push URL to queue with priority
 int push_url_to_queue(const char *url, int priority);
 
+// Move URLs left in url_queue, the single queue used before sharding,
+// into the per-host queues. Returns the number moved, or -1 on failure
+long drain_legacy_queue(void);
+
 // Execute Redis command with retries
 redisReply *execute_redis_command(const char *format, ...);
 
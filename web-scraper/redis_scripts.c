@@ -0,0 +1,531 @@
+#include "redis_scripts.h"
+#include "async_redis.h"
+#include "frontier.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include "shard_router.h"
+#include "stats.h"
+#include "visited_store.h"
+#include "write_behind.h"
+#include <hiredis/hiredis.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SHA_HEX_LEN 40
+
+typedef enum {
+    SCRIPT_CLAIM,
+    SCRIPT_ADMIT,
+    SCRIPT_COMPLETE,
+    SCRIPT_COUNT
+} script_id_t;
+
+typedef struct {
+    const char *name;
+    const char *body;
+    char sha[SHA_HEX_LEN + 1];
+} redis_script_t;
+
+// Visited checks and marks for either representation (see visited_store.h):
+// ARGV[1] is 's' for URL sets or 'f' for fingerprint hashes
+#define VISITED_LUA \
+    "local function visited(key, member)\n" \
+    "  if ARGV[1] == 'f' then return redis.call('HEXISTS', key, member) == 1 end\n" \
+    "  return redis.call('SISMEMBER', key, member) == 1\n" \
+    "end\n" \
+    "local function mark(key, member)\n" \
+    "  if ARGV[1] == 'f' then return redis.call('HSET', key, member, '1') end\n" \
+    "  return redis.call('SADD', key, member)\n" \
+    "end\n"
+
+// KEYS: visited key, claim key   ARGV: mode, member, ttl ms
+// Returns 1 when claimed, 0 when visited, -1 when claimed elsewhere
+#define CLAIM_SCRIPT VISITED_LUA \
+    "if visited(KEYS[1], ARGV[2]) then return 0 end\n" \
+    "if redis.call('SET', KEYS[2], '1', 'NX', 'PX', ARGV[3]) then return 1 end\n" \
+    "return -1\n"
+
+// KEYS: queue, depth hash, visited key per URL
+// ARGV: mode, priority, depth, then url, queue member and visited member
+// per URL. Returns one flag per URL (1 queued, 2 score lowered, 0 neither)
+// followed by the queue size; an already queued URL keeps the better score
+#define ADMIT_SCRIPT VISITED_LUA \
+    "local priority = tonumber(ARGV[2])\n" \
+    "local result = {}\n" \
+    "for i = 4, #ARGV, 3 do\n" \
+    "  local member = ARGV[i + 1]\n" \
+    "  local added = 0\n" \
+    "  if not visited(KEYS[(i - 4) / 3 + 3], ARGV[i + 2]) then\n" \
+    "    local score = redis.call('ZSCORE', KEYS[1], member)\n" \
+    "    if not score then\n" \
+    "      redis.call('ZADD', KEYS[1], priority, member)\n" \
+    "      redis.call('HSETNX', KEYS[2], ARGV[i], ARGV[3])\n" \
+    "      added = 1\n" \
+    "    elseif tonumber(score) > priority then\n" \
+    "      redis.call('ZADD', KEYS[1], priority, member)\n" \
+    "      added = 2\n" \
+    "    end\n" \
+    "  end\n" \
+    "  result[#result + 1] = added\n" \
+    "end\n" \
+    "result[#result + 1] = redis.call('ZCARD', KEYS[1])\n" \
+    "return result\n"
+
+// KEYS: visited key per alias, then the claim key if ARGV[2] is '1'
+// ARGV: mode, has claim, visited member per alias
+#define COMPLETE_SCRIPT VISITED_LUA \
+    "local added = 0\n" \
+    "for i = 3, #ARGV do added = added + mark(KEYS[i - 2], ARGV[i]) end\n" \
+    "if ARGV[2] == '1' then redis.call('DEL', KEYS[#ARGV - 1]) end\n" \
+    "return added\n"
+
+static redis_script_t scripts[SCRIPT_COUNT] = {
+    [SCRIPT_CLAIM] = {"claim", CLAIM_SCRIPT, ""},
+    [SCRIPT_ADMIT] = {"admit", ADMIT_SCRIPT, ""},
+    [SCRIPT_COMPLETE] = {"complete", COMPLETE_SCRIPT, ""},
+};
+
+// Set once every node has the scripts; cleared when scripting fails
+static int scripts_loaded = 0;
+static pthread_mutex_t scripts_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int scripts_ready(void) {
+    pthread_mutex_lock(&scripts_mutex);
+    int result = scripts_loaded;
+    pthread_mutex_unlock(&scripts_mutex);
+    return result;
+}
+
+static void disable_scripts(void) {
+    pthread_mutex_lock(&scripts_mutex);
+    scripts_loaded = 0;
+    pthread_mutex_unlock(&scripts_mutex);
+}
+
+// Load the scripts on one node; SHA-1 digests are the same everywhere
+static int load_on_node(int node) {
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    for (int i = 0; i < SCRIPT_COUNT; i++) {
+        redisReply *reply = redisCommand(ctx, "SCRIPT LOAD %s", scripts[i].body);
+        if (!reply || reply->type != REDIS_REPLY_STRING || reply->len != SHA_HEX_LEN) {
+            LOG_WARNING("Failed to load Redis script %s on %s:%d: %s", scripts[i].name,
+                        shard_node_host(node), shard_node_port(node),
+                        reply && reply->type == REDIS_REPLY_ERROR ? reply->str : "no reply");
+            freeReplyObject(reply);
+            shard_release(node);
+            return -1;
+        }
+        memcpy(scripts[i].sha, reply->str, SHA_HEX_LEN + 1);
+        freeReplyObject(reply);
+    }
+    shard_release(node);
+    return 0;
+}
+
+// Load every script into the script cache of every node
+int redis_scripts_load(void) {
+    if (!is_redis_initialized()) {
+        return -1;
+    }
+
+    disable_scripts();
+    for (int node = 0; node < shard_count(); node++) {
+        if (load_on_node(node) != 0) {
+            return -1;
+        }
+    }
+    pthread_mutex_lock(&scripts_mutex);
+    scripts_loaded = 1;
+    pthread_mutex_unlock(&scripts_mutex);
+
+    LOG_INFO("Loaded %d Redis scripts on %d node(s)", SCRIPT_COUNT, shard_count());
+    return 0;
+}
+
+// Whether calls currently go through the scripts
+int redis_scripts_available(void) {
+    return scripts_ready();
+}
+
+// Run a script on a node; argv[0] and argv[1] (and their lengths) are
+// filled in here. Returns NULL when the caller should fall back to plain
+// commands.
+// Microseconds since start on the monotonic clock
+static unsigned long elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long us = (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+    return us > 0 ? (unsigned long)us : 0;
+}
+
+static redisReply *run_script(int node, script_id_t id, int argc, const char **argv,
+                              size_t *argvlen) {
+    if (!scripts_ready()) {
+        return NULL;
+    }
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return NULL;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ops = 1;
+    argv[0] = "EVALSHA";
+    argvlen[0] = 7;
+    argv[1] = scripts[id].sha;
+    argvlen[1] = SHA_HEX_LEN;
+    redisReply *reply = redisCommandArgv(ctx, argc, argv, argvlen);
+
+    // The script cache was flushed; EVAL runs the script and caches it again
+    if (reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0) {
+        freeReplyObject(reply);
+        argv[0] = "EVAL";
+        argvlen[0] = 4;
+        argv[1] = scripts[id].body;
+        argvlen[1] = strlen(scripts[id].body);
+        reply = redisCommandArgv(ctx, argc, argv, argvlen);
+        ops++;
+    }
+    shard_release(node);
+    update_redis_stats(ops, !reply || reply->type == REDIS_REPLY_ERROR, elapsed_us(&start));
+
+    if (reply && reply->type == REDIS_REPLY_ERROR) {
+        LOG_WARNING("Redis script %s failed, using plain commands: %s", scripts[id].name,
+                    reply->str);
+        disable_scripts();
+        freeReplyObject(reply);
+        reply = NULL;
+    }
+    return reply;
+}
+
+// Store a string argument and its length
+static void set_arg(const char **argv, size_t *argvlen, int index, const char *value) {
+    argv[index] = value;
+    argvlen[index] = strlen(value);
+}
+
+// Script mode argument for the current visited representation
+static const char *visited_mode_arg(void) {
+    return visited_get_mode() == VISITED_MODE_URLS ? "s" : "f";
+}
+
+// Fallback: check, then claim with SET NX; a race between the two can
+// only let another worker see the URL as claimed
+static claim_result_t claim_url_plain(const char *url, const char *claim_key) {
+    if (is_visited(url)) {
+        return CLAIM_VISITED;
+    }
+    int node = shard_for_key(claim_key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return CLAIM_ERROR;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    redisReply *reply = redisCommand(ctx, "SET %s 1 NX PX %d", claim_key, CLAIM_TTL_MS);
+    shard_release(node);
+    update_redis_stats(1, !reply, elapsed_us(&start));
+    if (!reply) {
+        return CLAIM_ERROR;
+    }
+    claim_result_t result = reply->type == REDIS_REPLY_STATUS ? CLAIM_ACQUIRED : CLAIM_BUSY;
+    freeReplyObject(reply);
+    return result;
+}
+
+// Atomically check the visited set and claim the URL
+claim_result_t claim_url(const char *url) {
+    visited_ref_t ref;
+    char claim_key[SHARD_KEY_MAX];
+    if (!url || !is_redis_initialized() || visited_ref(url, &ref) != 0 ||
+        shard_url_key(claim_key, sizeof(claim_key), CLAIM_KEY_PREFIX, url, ":") != 0 ||
+        strlen(claim_key) + strlen(url) >= sizeof(claim_key)) {
+        return CLAIM_ERROR;
+    }
+    strcat(claim_key, url);
+
+    char ttl[16];
+    snprintf(ttl, sizeof(ttl), "%d", CLAIM_TTL_MS);
+    const char *argv[8];
+    size_t argvlen[8];
+    set_arg(argv, argvlen, 2, "2");
+    set_arg(argv, argvlen, 3, ref.key);
+    set_arg(argv, argvlen, 4, claim_key);
+    set_arg(argv, argvlen, 5, visited_mode_arg());
+    argv[6] = ref.member;
+    argvlen[6] = ref.member_len;
+    set_arg(argv, argvlen, 7, ttl);
+    redisReply *reply = run_script(shard_for_key(ref.key), SCRIPT_CLAIM, 8, argv, argvlen);
+    if (!reply) {
+        return claim_url_plain(url, claim_key);
+    }
+
+    claim_result_t result = CLAIM_ERROR;
+    if (reply->type == REDIS_REPLY_INTEGER) {
+        result = reply->integer == 1 ? CLAIM_ACQUIRED :
+                 reply->integer == 0 ? CLAIM_VISITED : CLAIM_BUSY;
+    }
+    freeReplyObject(reply);
+    return result;
+}
+
+// Give up a claim without marking the URL visited, so it can be retried
+void release_claim(const char *url) {
+    char claim_key[SHARD_KEY_MAX];
+    if (!url || shard_url_key(claim_key, sizeof(claim_key), CLAIM_KEY_PREFIX, url, ":") != 0) {
+        return;
+    }
+    // Sent synchronously: write-behind must not replay a DEL after another
+    // worker has claimed the URL again
+    int node = shard_for_key(claim_key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    redisReply *reply = redisCommand(ctx, "DEL %s%s", claim_key, url);
+    shard_release(node);
+    update_redis_stats(1, !reply, elapsed_us(&start));
+    if (!reply) {
+        LOG_WARNING("Failed to release claim on %s; it expires in %d ms", url, CLAIM_TTL_MS);
+    }
+    freeReplyObject(reply);
+}
+
+// Fallback for one host: pipelined visited checks, then queue what is new
+static int admit_group_plain(const char **urls, const shard_group_t *group, int priority,
+                             const char *depth_key, int child_depth, int *admitted) {
+    redis_future_t **checks = malloc(group->count * sizeof(redis_future_t *));
+    if (!checks) {
+        return -1;
+    }
+    for (int i = 0; i < group->count; i++) {
+        checks[i] = async_is_visited(urls[group->indexes[i]]);
+    }
+
+    int queued = 0;
+    for (int i = 0; i < group->count; i++) {
+        const char *url = urls[group->indexes[i]];
+        int visited = checks[i] ? redis_future_get_bool(checks[i]) : is_visited(url);
+        int added = !visited && push_url_to_queue(url, priority);
+        if (added) {
+            write_behind_command_at(group->node, "HSETNX %s %s %d", depth_key, url, child_depth);
+            queued++;
+        }
+        if (admitted) admitted[group->indexes[i]] = added;
+    }
+    free(checks);
+    return queued;
+}
+
+// Queue one host's links with the admit script; refs and members hold the
+// visited refs and queue members of all links, indexed like urls
+static int admit_group(const char **urls, const visited_ref_t *refs, const char **members,
+                       const shard_group_t *group, const char **argv, size_t *argvlen,
+                       const char *priority_arg, const char *depth_arg, int priority,
+                       int child_depth, int *admitted) {
+    char queue_key[SHARD_KEY_MAX], depth_key[SHARD_KEY_MAX], numkeys[16];
+    if (shard_tag_key(queue_key, sizeof(queue_key), URL_QUEUE_PREFIX, group->tag, NULL) != 0 ||
+        shard_tag_key(depth_key, sizeof(depth_key), URL_DEPTH_PREFIX, group->tag, NULL) != 0) {
+        return -1;
+    }
+    snprintf(numkeys, sizeof(numkeys), "%d", group->count + 2);
+
+    // argv[0] and argv[1] are the command and SHA, filled in by run_script;
+    // KEYS are the queue, the depth hash and one visited key per link
+    int argc = 2;
+    set_arg(argv, argvlen, argc++, numkeys);
+    set_arg(argv, argvlen, argc++, queue_key);
+    set_arg(argv, argvlen, argc++, depth_key);
+    for (int i = 0; i < group->count; i++) {
+        set_arg(argv, argvlen, argc++, refs[group->indexes[i]].key);
+    }
+    set_arg(argv, argvlen, argc++, visited_mode_arg());
+    set_arg(argv, argvlen, argc++, priority_arg);
+    set_arg(argv, argvlen, argc++, depth_arg);
+    for (int i = 0; i < group->count; i++) {
+        const visited_ref_t *ref = &refs[group->indexes[i]];
+        set_arg(argv, argvlen, argc++, urls[group->indexes[i]]);
+        set_arg(argv, argvlen, argc++, members[group->indexes[i]]);
+        argv[argc] = ref->member;
+        argvlen[argc++] = ref->member_len;
+    }
+
+    redisReply *reply = run_script(group->node, SCRIPT_ADMIT, argc, argv, argvlen);
+    if (!reply) {
+        return admit_group_plain(urls, group, priority, depth_key, child_depth, admitted);
+    }
+
+    int queued = -1, lowered = 0;
+    long long queue_size = 0;
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements == (size_t)group->count + 1) {
+        queued = 0;
+        for (int i = 0; i < group->count; i++) {
+            int flag = reply->element[i]->type == REDIS_REPLY_INTEGER ?
+                       (int)reply->element[i]->integer : 0;
+            if (admitted) admitted[group->indexes[i]] = flag == 1;
+            queued += flag == 1;
+            lowered |= flag == 2;
+        }
+        if (reply->element[group->count]->type == REDIS_REPLY_INTEGER) {
+            queue_size = reply->element[group->count]->integer;
+        }
+    }
+    freeReplyObject(reply);
+
+    // Let fetch_url_from_queue() find the host at its new best priority
+    if (queued > 0 || lowered) {
+        frontier_schedule_at(group->tag, priority);
+    }
+    if (queue_size > FRONTIER_HOT_MAX) {
+        frontier_spill(group->tag);
+    }
+    return queued;
+}
+
+// Queue links found on a page at the given depth, skipping visited ones
+int admit_links(const char **urls, int count, int priority, int depth, int max_depth,
+                int *admitted) {
+    if (!urls || count <= 0) {
+        return 0;
+    }
+    if (admitted) {
+        memset(admitted, 0, count * sizeof(int));
+    }
+    int child_depth = depth + 1;
+    if (max_depth >= 0 && child_depth > max_depth) {
+        return 0;
+    }
+
+    char priority_arg[16], depth_arg[16];
+    snprintf(priority_arg, sizeof(priority_arg), "%d", priority);
+    snprintf(depth_arg, sizeof(depth_arg), "%d", child_depth);
+
+    // Every host's keys share a hash tag, so each host is one script call
+    shard_group_t *groups = NULL;
+    int group_count = shard_group_urls(urls, count, &groups);
+    int arg_max = count * 4 + 8;
+    size_t text_size = 0;
+    for (int i = 0; i < count; i++) {
+        text_size += strlen(urls[i]) + 2;
+    }
+    const char **argv = malloc(arg_max * sizeof(char *));
+    size_t *argvlen = malloc(arg_max * sizeof(size_t));
+    visited_ref_t *refs = malloc(count * sizeof(visited_ref_t));
+    const char **members = malloc(count * sizeof(char *));
+    char *text = malloc(text_size);
+    int failed = group_count < 0 || !argv || !argvlen || !refs || !members || !text;
+    if (failed) {
+        LOG_ERROR("Failed to allocate memory for link admission");
+    }
+
+    // Queue members are stored relative to the host, see frontier.h
+    char *pos = text;
+    for (int g = 0; g < group_count && !failed; g++) {
+        for (int i = 0; i < groups[g].count && !failed; i++) {
+            int index = groups[g].indexes[i];
+            size_t size = strlen(urls[index]) + 2;
+            failed = visited_ref(urls[index], &refs[index]) != 0;
+            members[index] = frontier_member(urls[index], groups[g].tag, pos, size);
+            pos += size;
+        }
+    }
+
+    int queued = failed ? -1 : 0;
+    for (int g = 0; g < group_count && !failed; g++) {
+        int added = admit_group(urls, refs, members, &groups[g], argv, argvlen, priority_arg,
+                                depth_arg, priority, child_depth, admitted);
+        if (added > 0) {
+            queued += added;
+        }
+    }
+    free(argv);
+    free(argvlen);
+    free(refs);
+    free(members);
+    free(text);
+    free(groups);
+    return queued;
+}
+
+// Mark a page and its aliases visited and release the claim on url
+int complete_page(const char *url, const char **aliases, int count) {
+    char url_tag[SHARD_TAG_MAX], claim_key[SHARD_KEY_MAX];
+    if (!url || !aliases || count <= 0 ||
+        shard_url_key(claim_key, sizeof(claim_key), CLAIM_KEY_PREFIX, url, ":") != 0 ||
+        strlen(claim_key) + strlen(url) >= sizeof(claim_key)) {
+        return 0;
+    }
+    strcat(claim_key, url);
+    if (shard_url_tag(url, url_tag, sizeof(url_tag)) != 0) {
+        strcpy(url_tag, "_");
+    }
+
+    // Aliases can span hosts after cross-host redirects
+    shard_group_t *groups = NULL;
+    int group_count = shard_group_urls(aliases, count, &groups);
+    int arg_max = count * 2 + 6;
+    const char **argv = malloc(arg_max * sizeof(char *));
+    size_t *argvlen = malloc(arg_max * sizeof(size_t));
+    visited_ref_t *refs = malloc(count * sizeof(visited_ref_t));
+    if (group_count < 0 || !argv || !argvlen || !refs) {
+        LOG_ERROR("Failed to allocate memory for page completion");
+        free(groups);
+        free(argv);
+        free(argvlen);
+        free(refs);
+        return 0;
+    }
+
+    int completed = 1;
+    for (int i = 0; i < count && completed; i++) {
+        completed = visited_ref(aliases[i], &refs[i]) == 0;
+    }
+    for (int g = 0; g < group_count && completed; g++) {
+        // The claim lives with the requested URL's host
+        int has_claim = strcmp(groups[g].tag, url_tag) == 0;
+        char numkeys[16];
+        snprintf(numkeys, sizeof(numkeys), "%d", groups[g].count + has_claim);
+
+        int argc = 2;
+        set_arg(argv, argvlen, argc++, numkeys);
+        for (int i = 0; i < groups[g].count; i++) {
+            set_arg(argv, argvlen, argc++, refs[groups[g].indexes[i]].key);
+        }
+        if (has_claim) {
+            set_arg(argv, argvlen, argc++, claim_key);
+        }
+        set_arg(argv, argvlen, argc++, visited_mode_arg());
+        set_arg(argv, argvlen, argc++, has_claim ? "1" : "0");
+        for (int i = 0; i < groups[g].count; i++) {
+            const visited_ref_t *ref = &refs[groups[g].indexes[i]];
+            argv[argc] = ref->member;
+            argvlen[argc++] = ref->member_len;
+        }
+
+        redisReply *reply = run_script(groups[g].node, SCRIPT_COMPLETE, argc, argv, argvlen);
+        if (!reply) {
+            completed = 0;
+        }
+        freeReplyObject(reply);
+    }
+    free(argv);
+    free(argvlen);
+    free(refs);
+    free(groups);
+    if (completed) {
+        return 1;
+    }
+
+    // Fallback: the writes are idempotent, so redoing finished groups is harmless
+    int result = mark_visited_bulk(aliases, count);
+    release_claim(url);
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef REDIS_SCRIPTS_H
+#define REDIS_SCRIPTS_H
+
+// Server-side Lua scripts for the crawl critical path
+//
+// Each script runs atomically inside Redis and replaces several round
+// trips with one EVALSHA:
+//   claim     - claim a URL for fetching unless it is visited or claimed
+//   admit     - queue the unvisited links of a page, honouring max depth
+//   complete  - mark a page and its aliases visited and drop its claim
+//
+// Scripts are loaded once with SCRIPT LOAD. If Redis has forgotten one
+// (NOSCRIPT, e.g. after a restart) it is resent with EVAL. If scripting
+// is not available at all, every call falls back to the plain commands,
+// which behave the same minus the atomicity.
+//
+// Keys are per host (see shard_router.h), so a call touches one node per
+// host involved: claim:{host}:<url>, visited:{host} (or its fingerprint
+// buckets, see visited_store.h), queue:{host} and url_depth:{host}.
+
+#define CLAIM_TTL_MS 300000  // Claims expire so a crashed worker cannot hold a URL forever
+
+typedef enum {
+    CLAIM_ACQUIRED = 1,   // The caller owns the URL and should fetch it
+    CLAIM_VISITED = 0,    // Already crawled
+    CLAIM_BUSY = -1,      // Another worker holds the claim
+    CLAIM_ERROR = -2
+} claim_result_t;
+
+// Load every script into the script cache
+// Returns 0 on success, -1 if scripting is unavailable
+int redis_scripts_load(void);
+
+// Whether calls currently go through the scripts
+int redis_scripts_available(void);
+
+// Atomically check the visited set and claim the URL
+claim_result_t claim_url(const char *url);
+
+// Give up a claim without marking the URL visited, so it can be retried
+void release_claim(const char *url);
+
+// Queue links found on a page at the given depth, skipping visited ones.
+// Links are stored at depth + 1; nothing is queued if that exceeds
+// max_depth (max_depth < 0 means unlimited). If admitted is not NULL,
+// admitted[i] is set to 1 for each link that was newly queued.
+// Returns the number of links queued, or -1 on failure.
+int admit_links(const char **urls, int count, int priority, int depth, int max_depth,
+                int *admitted);
+
+// Mark a page and its aliases visited and release the claim on url
+// Returns 1 on success, 0 on failure
+int complete_page(const char *url, const char **aliases, int count);
+
+#endif // REDIS_SCRIPTS_H
@@ -0,0 +1,400 @@
+#include "result_sink.h"
+#include "logger.h"
+#include "shard_router.h"
+#include <errno.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NDJSON_BUFFER_SIZE (1024 * 1024)
+
+// A result backend; records are complete JSON objects without a newline
+typedef struct {
+    const char *name;
+    int (*open)(const char *target);
+    int (*write)(char *const *records, const size_t *lens, int count);
+    void (*close)(void);
+} result_backend_t;
+
+// Records waiting for the writer, stored back to back
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+    size_t *lens;
+    int count;
+    int lens_capacity;
+} record_batch_t;
+
+static result_sink_kind_t sink_kind = RESULT_SINK_NONE;
+static char *sink_target = NULL;
+static const result_backend_t *backend = NULL;
+
+static record_batch_t pending;
+static int running = 0;
+static int flush_requested = 0;
+static pthread_t writer_thread;
+static result_sink_stats_t stats;
+
+static pthread_mutex_t sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sink_cond = PTHREAD_COND_INITIALIZER;    // Wakes the writer
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;   // Queue drained
+
+// NDJSON file backend
+static FILE *ndjson_fp = NULL;
+static char *ndjson_buffer = NULL;
+
+static int ndjson_open(const char *path) {
+    ndjson_fp = fopen(path, "a");
+    if (!ndjson_fp) {
+        LOG_ERROR("Failed to open results file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    ndjson_buffer = malloc(NDJSON_BUFFER_SIZE);
+    if (ndjson_buffer) {
+        setvbuf(ndjson_fp, ndjson_buffer, _IOFBF, NDJSON_BUFFER_SIZE);
+    }
+    return 0;
+}
+
+static int ndjson_write(char *const *records, const size_t *lens, int count) {
+    int ok = 1;
+    for (int i = 0; ok && i < count; i++) {
+        ok = fwrite(records[i], 1, lens[i], ndjson_fp) == lens[i] && fputc('\n', ndjson_fp) != EOF;
+    }
+    // Consumers tail the file, so every batch is made visible
+    return ok && fflush(ndjson_fp) == 0 ? 0 : -1;
+}
+
+static void ndjson_close(void) {
+    if (ndjson_fp) {
+        fclose(ndjson_fp);
+        ndjson_fp = NULL;
+    }
+    free(ndjson_buffer);
+    ndjson_buffer = NULL;
+}
+
+// Redis Stream backend
+static int stream_open(const char *key) {
+    (void)key;
+    return shard_count() > 0 ? 0 : -1;
+}
+
+static int stream_write(char *const *records, const size_t *lens, int count) {
+    int node = shard_for_key(sink_target);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        redisAppendCommand(ctx, "XADD %s MAXLEN ~ %d * record %b", sink_target,
+                           RESULT_STREAM_MAXLEN, records[i], lens[i]);
+    }
+    int ok = 1;
+    for (int i = 0; i < count; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            ok = 0;
+            break;
+        }
+        if (reply->type == REDIS_REPLY_ERROR) {
+            if (ok) {
+                LOG_ERROR("XADD to %s failed: %s", sink_target, reply->str);
+            }
+            ok = 0;
+        }
+        freeReplyObject(reply);
+    }
+    shard_release(node);
+    return ok ? 0 : -1;
+}
+
+static void stream_close(void) {
+}
+
+static const result_backend_t BACKENDS[RESULT_SINK_KINDS] = {
+    [RESULT_SINK_NDJSON] = {"ndjson", ndjson_open, ndjson_write, ndjson_close},
+    [RESULT_SINK_STREAM] = {"redis-stream", stream_open, stream_write, stream_close}
+};
+
+// Send results to a backend
+void result_sink_set(result_sink_kind_t kind, const char *target) {
+    free(sink_target);
+    sink_target = target && kind != RESULT_SINK_NONE ? strdup(target) : NULL;
+    sink_kind = sink_target ? kind : RESULT_SINK_NONE;
+}
+
+// Backend name, or NULL when results are printed
+const char *result_sink_get_name(void) {
+    return sink_kind != RESULT_SINK_NONE ? BACKENDS[sink_kind].name : NULL;
+}
+
+// Backend target, or NULL when results are printed
+const char *result_sink_get_target(void) {
+    return sink_target;
+}
+
+// Hand queued records to the backend; called and returns with sink_mutex held
+static void flush_pending(void) {
+    flush_requested = 0;
+    if (pending.count == 0) {
+        return;
+    }
+    record_batch_t batch = pending;
+    memset(&pending, 0, sizeof(pending));
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&sink_mutex);
+
+    // Write in backend-sized slices
+    char **records = malloc(batch.count * sizeof(char *));
+    unsigned long long written = 0, failed = 0;
+    unsigned long batches = 0;
+    size_t offset = 0;
+    for (int i = 0; records && i < batch.count; i++) {
+        records[i] = batch.data + offset;
+        offset += batch.lens[i];
+    }
+    for (int i = 0; i < batch.count; i += RESULT_SINK_BATCH) {
+        int n = batch.count - i < RESULT_SINK_BATCH ? batch.count - i : RESULT_SINK_BATCH;
+        if (records && backend->write(records + i, batch.lens + i, n) == 0) {
+            written += n;
+        } else {
+            failed += n;
+        }
+        batches++;
+    }
+    if (failed) {
+        LOG_ERROR("Failed to write %llu results to %s", failed, sink_target);
+    }
+    free(records);
+    free(batch.data);
+    free(batch.lens);
+
+    pthread_mutex_lock(&sink_mutex);
+    stats.records_written += written;
+    stats.records_failed += failed;
+    stats.batches += batches;
+}
+
+// Write a batch once one fills up, on request, and every RESULT_SINK_FLUSH_MS
+static void *sink_writer_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&sink_mutex);
+    while (running) {
+        if (pending.count < RESULT_SINK_BATCH && !flush_requested) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)RESULT_SINK_FLUSH_MS * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&sink_cond, &sink_mutex, &deadline);
+        }
+        flush_pending();
+    }
+    flush_pending();
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&sink_mutex);
+    return NULL;
+}
+
+// Open the backend and start the writer thread
+int result_sink_open(void) {
+    if (sink_kind == RESULT_SINK_NONE || running) {
+        return 0;
+    }
+    backend = &BACKENDS[sink_kind];
+    if (backend->open(sink_target) != 0) {
+        backend = NULL;
+        return -1;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer_thread, NULL, sink_writer_thread, NULL) != 0) {
+        LOG_ERROR("Failed to start result writer thread");
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        backend->close();
+        backend = NULL;
+        return -1;
+    }
+    LOG_INFO("Writing results to %s %s", backend->name, sink_target);
+    return 0;
+}
+
+// Whether results go to the sink instead of the console
+int result_sink_is_open(void) {
+    return __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+}
+
+static void record_reserve(result_record_t *record, size_t n) {
+    if (record->failed || record->len + n <= record->capacity) {
+        return;
+    }
+    size_t capacity = record->capacity ? record->capacity * 2 : 256;
+    while (capacity < record->len + n) {
+        capacity *= 2;
+    }
+    char *grown = realloc(record->data, capacity);
+    if (!grown) {
+        record->failed = 1;
+        return;
+    }
+    record->data = grown;
+    record->capacity = capacity;
+}
+
+static void record_append(result_record_t *record, const char *s, size_t n) {
+    record_reserve(record, n);
+    if (!record->failed) {
+        memcpy(record->data + record->len, s, n);
+        record->len += n;
+    }
+}
+
+// Append a JSON string literal, escaping quotes, backslashes and control characters
+static void record_append_string(result_record_t *record, const char *s) {
+    record_append(record, "\"", 1);
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        record_append(record, run, s - run);
+        char escaped[8];
+        int n = c == '"' ? snprintf(escaped, sizeof(escaped), "\\\"") :
+                c == '\\' ? snprintf(escaped, sizeof(escaped), "\\\\") :
+                c == '\n' ? snprintf(escaped, sizeof(escaped), "\\n") :
+                c == '\t' ? snprintf(escaped, sizeof(escaped), "\\t") :
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        record_append(record, escaped, n);
+        run = s + 1;
+    }
+    record_append(record, run, s - run);
+    record_append(record, "\"", 1);
+}
+
+// Append ,"name": ahead of a value
+static void record_append_name(result_record_t *record, const char *name) {
+    record_append(record, ",", 1);
+    record_append_string(record, name);
+    record_append(record, ":", 1);
+}
+
+// Start a record of the given type for url
+void result_record_init(result_record_t *record, const char *type, const char *url) {
+    memset(record, 0, sizeof(*record));
+    record_append(record, "{\"type\":", 8);
+    record_append_string(record, type);
+    result_record_add(record, "url", url);
+}
+
+// Add a string field; NULL is written as null
+void result_record_add(result_record_t *record, const char *name, const char *value) {
+    record_append_name(record, name);
+    if (value) {
+        record_append_string(record, value);
+    } else {
+        record_append(record, "null", 4);
+    }
+}
+
+// Add an integer field
+void result_record_add_int(result_record_t *record, const char *name, long long value) {
+    char number[32];
+    int n = snprintf(number, sizeof(number), "%lld", value);
+    record_append_name(record, name);
+    record_append(record, number, n);
+}
+
+// Add a floating-point field
+void result_record_add_double(result_record_t *record, const char *name, double value) {
+    char number[32];
+    int n = snprintf(number, sizeof(number), "%.6g", value);
+    record_append_name(record, name);
+    record_append(record, number, n);
+}
+
+// Release a record without emitting it
+void result_record_free(result_record_t *record) {
+    free(record->data);
+    memset(record, 0, sizeof(*record));
+}
+
+// Queue a finished record and release it
+int result_sink_emit(result_record_t *record) {
+    record_append(record, "}", 1);
+    if (record->failed || !result_sink_is_open()) {
+        result_record_free(record);
+        return -1;
+    }
+
+    pthread_mutex_lock(&sink_mutex);
+    if (running && pending.len >= RESULT_SINK_MAX_PENDING) {
+        stats.producer_waits++;
+        flush_requested = 1;
+        pthread_cond_signal(&sink_cond);
+        while (running && pending.len >= RESULT_SINK_MAX_PENDING) {
+            pthread_cond_wait(&space_cond, &sink_mutex);
+        }
+    }
+    int ok = running;
+    if (ok && pending.count == pending.lens_capacity) {
+        int capacity = pending.lens_capacity ? pending.lens_capacity * 2 : RESULT_SINK_BATCH;
+        size_t *grown = realloc(pending.lens, capacity * sizeof(size_t));
+        ok = grown != NULL;
+        if (ok) {
+            pending.lens = grown;
+            pending.lens_capacity = capacity;
+        }
+    }
+    if (ok && pending.len + record->len > pending.capacity) {
+        size_t capacity = pending.capacity ? pending.capacity * 2 : 64 * 1024;
+        while (capacity < pending.len + record->len) {
+            capacity *= 2;
+        }
+        char *grown = realloc(pending.data, capacity);
+        ok = grown != NULL;
+        if (ok) {
+            pending.data = grown;
+            pending.capacity = capacity;
+        }
+    }
+    if (ok) {
+        memcpy(pending.data + pending.len, record->data, record->len);
+        pending.len += record->len;
+        pending.lens[pending.count++] = record->len;
+        stats.records_emitted++;
+        if (pending.count >= RESULT_SINK_BATCH) {
+            pthread_cond_signal(&sink_cond);
+        }
+    }
+    pthread_mutex_unlock(&sink_mutex);
+    result_record_free(record);
+    return ok ? 0 : -1;
+}
+
+// Counters since startup
+void result_sink_get_stats(result_sink_stats_t *out) {
+    pthread_mutex_lock(&sink_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&sink_mutex);
+}
+
+// Write queued records, stop the writer thread and close the backend
+void result_sink_close(void) {
+    pthread_mutex_lock(&sink_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&sink_mutex);
+        return;
+    }
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&sink_cond);
+    pthread_cond_broadcast(&space_cond);
+    pthread_mutex_unlock(&sink_mutex);
+    pthread_join(writer_thread, NULL);
+    backend->close();
+    backend = NULL;
+}
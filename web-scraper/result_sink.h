@@ -0,0 +1,90 @@
+#ifndef RESULT_SINK_H
+#define RESULT_SINK_H
+
+#include <stddef.h>
+
+// Machine-readable crawl results
+//
+// Extracted titles, meta tags, crawled pages and already visited URLs
+// are emitted as one JSON object per record instead of being printed.
+// Records are queued and a writer thread hands them to the backend in
+// batches of up to RESULT_SINK_BATCH records, at least every
+// RESULT_SINK_FLUSH_MS. Producers wait once RESULT_SINK_MAX_PENDING
+// bytes are queued, so a slow consumer slows the crawl down instead of
+// growing memory.
+//
+// Backends:
+//   RESULT_SINK_NDJSON  appends records to a file, one per line
+//   RESULT_SINK_STREAM  XADD <key> MAXLEN ~ RESULT_STREAM_MAXLEN * record <json>,
+//                       pipelined per batch
+//
+// Every record has "type" and "url" fields; the other fields depend on
+// the type (title, meta, page, visited).
+
+#define RESULT_SINK_BATCH 512                        // Records per backend write
+#define RESULT_SINK_FLUSH_MS 200                     // Longest a record waits
+#define RESULT_SINK_MAX_PENDING (16 * 1024 * 1024)   // Queued bytes before producers wait
+#define RESULT_STREAM_MAXLEN 1000000                 // Approximate stream length cap
+
+typedef enum {
+    RESULT_SINK_NONE,
+    RESULT_SINK_NDJSON,
+    RESULT_SINK_STREAM,
+    RESULT_SINK_KINDS
+} result_sink_kind_t;
+
+// A JSON object being built
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} result_record_t;
+
+// Result sink counters
+typedef struct {
+    unsigned long long records_emitted;
+    unsigned long long records_written;
+    unsigned long long records_failed;    // Lost with a batch the backend rejected
+    unsigned long batches;
+    unsigned long producer_waits;         // Emits that waited for queue space
+} result_sink_stats_t;
+
+// Send results to a backend; target is the file path or stream key
+void result_sink_set(result_sink_kind_t kind, const char *target);
+
+// Backend name and target, or NULL when results are printed
+const char *result_sink_get_name(void);
+const char *result_sink_get_target(void);
+
+// Open the backend and start the writer thread
+// Returns 0 on success or when no sink is set, -1 on failure
+int result_sink_open(void);
+
+// Whether results go to the sink instead of the console
+int result_sink_is_open(void);
+
+// Start a record of the given type for url
+void result_record_init(result_record_t *record, const char *type, const char *url);
+
+// Add a string field; NULL is written as null
+void result_record_add(result_record_t *record, const char *name, const char *value);
+
+// Add a numeric field
+void result_record_add_int(result_record_t *record, const char *name, long long value);
+void result_record_add_double(result_record_t *record, const char *name, double value);
+
+// Queue a finished record and release it
+// Returns 0 if queued, -1 if the sink is closed or the record is incomplete
+int result_sink_emit(result_record_t *record);
+
+// Release a record without emitting it
+void result_record_free(result_record_t *record);
+
+// Counters since startup
+void result_sink_get_stats(result_sink_stats_t *out);
+
+// Write queued records, stop the writer thread and close the backend
+void result_sink_close(void);
+
+#endif // RESULT_SINK_H
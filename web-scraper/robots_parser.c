@@ -1,6 +1,7 @@
 #include "robots_parser.h"
 #include "logger.h"
 #include "redis_helper.h"
+#include "shard_router.h"
 #include "fetch_url.h"
 #include <curl/curl.h>
 #include <libxml/HTMLparser.h>
@@ -154,51 +155,60 @@ void fetch_robots_txt(const char *url, rate_limiter_t *limiter) {
     char *domain = extract_domain(url);
     CHECK_NULL(domain, );
     
+    // Both rule lists share the domain's hash tag, so MULTI below stays on one node
     char redis_key[256];
-    int key_len = snprintf(redis_key, sizeof(redis_key), "robots:%s", domain);
-    if (key_len < 0 || (size_t)key_len >= sizeof(redis_key)) {
+    if (shard_tag_key(redis_key, sizeof(redis_key), ROBOTS_KEY_PREFIX, domain, NULL) != 0) {
         fprintf(stderr, "Redis key too long\n");
         free(domain);
         return;
     }
+    int node = shard_for_key(redis_key);
     
     // Check if rules are already cached and have correct type
-    pthread_mutex_lock(&redis_mutex);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        free(domain);
+        return;
+    }
     
     // Check if allow key exists and has correct type
-    redisReply *type_check = redisCommand(limiter->redis_ctx, "TYPE %s:allow", redis_key);
+    redisReply *type_check = redisCommand(ctx, "TYPE %s:allow", redis_key);
     if (type_check && type_check->type == REDIS_REPLY_STATUS) {
         if (strcmp(type_check->str, "list") != 0) {
             // Delete the key if it exists with wrong type
-            redisReply *del_reply = redisCommand(limiter->redis_ctx, "DEL %s:allow", redis_key);
+            redisReply *del_reply = redisCommand(ctx, "DEL %s:allow", redis_key);
             freeReplyObject(del_reply);
         }
     }
     freeReplyObject(type_check);
     
     // Check if disallow key exists and has correct type
-    type_check = redisCommand(limiter->redis_ctx, "TYPE %s:disallow", redis_key);
+    type_check = redisCommand(ctx, "TYPE %s:disallow", redis_key);
     if (type_check && type_check->type == REDIS_REPLY_STATUS) {
         if (strcmp(type_check->str, "list") != 0) {
             // Delete the key if it exists with wrong type
-            redisReply *del_reply = redisCommand(limiter->redis_ctx, "DEL %s:disallow", redis_key);
+            redisReply *del_reply = redisCommand(ctx, "DEL %s:disallow", redis_key);
             freeReplyObject(del_reply);
         }
     }
     freeReplyObject(type_check);
     
     // Check if rules are already cached
-    redisReply *exists = redisCommand(limiter->redis_ctx, "EXISTS %s:allow", redis_key);
-    CHECK_REDIS_REPLY(exists, );
+    redisReply *exists = redisCommand(ctx, "EXISTS %s:allow", redis_key);
+    shard_release(node);
+    if (!exists || exists->type == REDIS_REPLY_ERROR) {
+        fprintf(stderr, "Redis error: %s\n", exists ? exists->str : "Unknown error");
+        freeReplyObject(exists);
+        free(domain);
+        return;
+    }
     
     if (exists->integer > 0) {
         freeReplyObject(exists);
-        pthread_mutex_unlock(&redis_mutex);
         free(domain);
         return;
     }
     freeReplyObject(exists);
-    pthread_mutex_unlock(&redis_mutex);
     
     char robots_url[512];
     int url_len = snprintf(robots_url, sizeof(robots_url), "https://%s/robots.txt", domain);
@@ -263,35 +273,38 @@ void fetch_robots_txt(const char *url, rate_limiter_t *limiter) {
     qsort(disallow_rules, disallow_count, sizeof(char *), rule_compare);
     
     // Store sorted rules in Redis
-    pthread_mutex_lock(&redis_mutex);
+    ctx = shard_acquire(node);
+    if (!ctx) {
+        goto cleanup;
+    }
     
     // Use pipeline for better performance
-    redisAppendCommand(limiter->redis_ctx, "MULTI");
+    redisAppendCommand(ctx, "MULTI");
     
     // Store allow rules
     for (size_t i = 0; i < allow_count; i++) {
-        redisAppendCommand(limiter->redis_ctx, "RPUSH %s:allow %s", redis_key, allow_rules[i]);
+        redisAppendCommand(ctx, "RPUSH %s:allow %s", redis_key, allow_rules[i]);
     }
     
     // Store disallow rules
     for (size_t i = 0; i < disallow_count; i++) {
-        redisAppendCommand(limiter->redis_ctx, "RPUSH %s:disallow %s", redis_key, disallow_rules[i]);
+        redisAppendCommand(ctx, "RPUSH %s:disallow %s", redis_key, disallow_rules[i]);
     }
     
     // Set expiration
-    redisAppendCommand(limiter->redis_ctx, "EXPIRE %s:allow %d", redis_key, RULE_EXPIRY_SECONDS);
-    redisAppendCommand(limiter->redis_ctx, "EXPIRE %s:disallow %d", redis_key, RULE_EXPIRY_SECONDS);
+    redisAppendCommand(ctx, "EXPIRE %s:allow %d", redis_key, RULE_EXPIRY_SECONDS);
+    redisAppendCommand(ctx, "EXPIRE %s:disallow %d", redis_key, RULE_EXPIRY_SECONDS);
     
-    redisAppendCommand(limiter->redis_ctx, "EXEC");
+    redisAppendCommand(ctx, "EXEC");
     
     // Execute pipeline
     redisReply *reply;
     for (size_t i = 0; i < allow_count + disallow_count + 3; i++) {
-        redisGetReply(limiter->redis_ctx, (void **)&reply);
+        redisGetReply(ctx, (void **)&reply);
         freeReplyObject(reply);
     }
     
-    pthread_mutex_unlock(&redis_mutex);
+    shard_release(node);
     
 cleanup:
     // Free all allocated memory
@@ -384,8 +397,7 @@ int is_crawl_allowed(const char *base_url, const char *target_path, rate_limiter
     CHECK_NULL(domain, 1);
     
     char redis_key[256];
-    int key_len = snprintf(redis_key, sizeof(redis_key), "robots:%s", domain);
-    if (key_len < 0 || (size_t)key_len >= sizeof(redis_key)) {
+    if (shard_tag_key(redis_key, sizeof(redis_key), ROBOTS_KEY_PREFIX, domain, NULL) != 0) {
         fprintf(stderr, "Redis key too long\n");
         free(domain);
         return 1;
@@ -395,17 +407,22 @@ int is_crawl_allowed(const char *base_url, const char *target_path, rate_limiter
     char *normalized_path = normalize_path(target_path);
     CHECK_NULL(normalized_path, 1);
     
-    pthread_mutex_lock(&redis_mutex);
+    int node = shard_for_key(redis_key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        free(normalized_path);
+        return 1;
+    }
     
     // Use pipeline for better performance
-    redisAppendCommand(limiter->redis_ctx, "LRANGE %s:allow 0 -1", redis_key);
-    redisAppendCommand(limiter->redis_ctx, "LRANGE %s:disallow 0 -1", redis_key);
+    redisAppendCommand(ctx, "LRANGE %s:allow 0 -1", redis_key);
+    redisAppendCommand(ctx, "LRANGE %s:disallow 0 -1", redis_key);
     
-    redisReply *allow_rules, *disallow_rules;
-    redisGetReply(limiter->redis_ctx, (void **)&allow_rules);
-    redisGetReply(limiter->redis_ctx, (void **)&disallow_rules);
+    redisReply *allow_rules = NULL, *disallow_rules = NULL;
+    redisGetReply(ctx, (void **)&allow_rules);
+    redisGetReply(ctx, (void **)&disallow_rules);
     
-    pthread_mutex_unlock(&redis_mutex);
+    shard_release(node);
     
     int result = 1; // Default to allowed
     
@@ -8,6 +8,19 @@
 #include "url_processor.h"
 #include "content_analyzer.h"
 #include "fetch_url.h"
+#include "content_hash.h"
+#include "write_behind.h"
+#include "async_redis.h"
+#include "redis_scripts.h"
+#include "shard_router.h"
+#include "frontier_runs.h"
+#include "checkpoint.h"
+#include "link_graph.h"
+#include "url_intern.h"
+#include "data_store.h"
+#include "column_export.h"
+#include "result_sink.h"
+#include "visited_store.h"
 #include <pthread.h>
 #include <sys/resource.h>
 #include <time.h>
@@ -30,9 +43,6 @@
 // Global variables
 extern pthread_mutex_t redis_mutex;  // Defined in redis_helper.c
 extern rate_limiter_t *rate_limiter; // Defined in url_processor.c
-extern pthread_mutex_t stats_mutex;  // Defined in stats.c
-extern ScraperStats scraper_stats;   // Defined in stats.c
-extern RedisStats redis_stats;       // Defined in stats.c
 pthread_mutex_t print_mutex = PTHREAD_MUTEX_INITIALIZER;
 thread_pool_t *scraper_pool = NULL;
 
@@ -40,6 +50,9 @@ thread_pool_t *scraper_pool = NULL;
 static CURL *curl = NULL;
 static redisContext *redis = NULL;
 
+// Default user agent; never freed
+static char default_user_agent[] = "AI-Powered Web Scraper/1.0";
+
 // Global scraper configuration
 static scraper_config_t scraper_config = {
     .max_depth = 3,
@@ -51,7 +64,9 @@ static scraper_config_t scraper_config = {
     .analyze_content = 1,
     .track_trends = 1,
     .force_rescrape = 0,
-    .user_agent = "AI-Powered Web Scraper/1.0",
+    .skip_near_duplicates = 1,
+    .deprioritize_duplicate_links = 1,
+    .user_agent = default_user_agent,
     .request_timeout = 30,
     .retry_count = 3,
     .retry_delay = 5
@@ -130,6 +145,73 @@ int init_scraper() {
     }
     redis = get_redis_context();
 
+    // Connect any extra nodes before anything routes keys to them
+    if (shard_router_init(REDIS_HOST, REDIS_PORT) != 0) {
+        fprintf(stderr, "Failed to connect Redis shard nodes\n");
+        curl_easy_cleanup(curl);
+        return -1;
+    }
+
+    // Load the crawl scripts; without them the plain commands are used
+    if (redis_scripts_load() != 0) {
+        LOG_WARNING("Redis scripts unavailable, using individual commands");
+    }
+
+    // Start the write-behind flusher; without it writes stay synchronous
+    if (write_behind_start(REDIS_HOST, REDIS_PORT) != 0) {
+        LOG_WARNING("Write-behind unavailable, Redis writes will be synchronous");
+    }
+
+    // Bucket counts of hosts sized by visited_migrate()
+    if (visited_load_layout() < 0) {
+        LOG_WARNING("Failed to read the visited bucket layout");
+    }
+
+    // Hosts scheduled by an earlier version sit in a plain set
+    if (frontier_schedule_upgrade() < 0) {
+        LOG_WARNING("Failed to convert the host set into a schedule");
+    }
+
+    // URLs queued before sharding sit in url_queue until they are moved
+    if (drain_legacy_queue() < 0) {
+        LOG_WARNING("Failed to drain the legacy URL queue");
+    }
+
+    // Pick up frontier runs spilled by an earlier run of this process
+    if (frontier_runs_load() < 0) {
+        LOG_WARNING("Failed to read frontier runs from %s", frontier_get_spill_dir());
+    }
+
+    // Open the link graph; without it pages are not ranked
+    if (link_graph_start() != 0) {
+        LOG_WARNING("Link graph unavailable, frontier priorities will not be ranked");
+    }
+
+    // Load the URL dictionary; without a file its ids only last this run
+    if (url_intern_open() < 0) {
+        LOG_WARNING("URL dictionary %s unreadable, ids will not persist", url_intern_get_file());
+    }
+
+    // Connect the data store; without it pages are only kept in Redis
+    if (data_store_get_conninfo() && data_store_init(data_store_get_conninfo()) != 0) {
+        LOG_WARNING("Data store unavailable, pages will not be written to Postgres");
+    }
+
+    // Start the columnar export; without it pages stay in Redis only
+    if (export_start() != 0) {
+        LOG_WARNING("Columnar export to %s disabled", export_get_dir());
+    }
+
+    // Open the result sink; without it results are printed
+    if (result_sink_open() != 0) {
+        LOG_WARNING("Result sink %s unavailable, results will be printed", result_sink_get_target());
+    }
+
+    // Start the async event loop; without it lookups stay synchronous
+    if (async_redis_start(REDIS_HOST, REDIS_PORT) != 0) {
+        LOG_WARNING("Async Redis unavailable, lookups will be synchronous");
+    }
+
     // Initialize thread pool
     init_scraper_pool(NUM_THREADS);
     if (!scraper_pool) {
@@ -182,29 +264,15 @@ int process_url(const char *url) {
     }
 
     // Create a task for the URL
-    url_task_t *task = malloc(sizeof(url_task_t));
+    url_task_t *task = url_task_create(url, 1, 0);
     if (!task) {
         LOG_ERROR("Failed to allocate memory for URL task");
         return -1;
     }
 
-    // Copy URL to task
-    task->url = strdup(url);
-    if (!task->url) {
-        LOG_ERROR("Failed to allocate memory for URL string");
-        free(task);
-        return -1;
-    }
-    
-    // Set task properties
-    task->priority = 1;
-    task->depth = 0;
-    task->parent_url = NULL;
-
     // Add task to thread pool
     if (!thread_pool_add_task(scraper_pool, process_url_thread, task)) {
         LOG_ERROR("Failed to add URL task to thread pool");
-        free(task->url);
         free(task);
         return -1;
     }
@@ -215,12 +283,32 @@ int process_url(const char *url) {
 
 void cleanup_scraper() {
     LOG_INFO("Cleaning up scraper resources");
+
+    // Save queued and in-flight tasks while the pool still holds them
+    checkpoint_stop();
     
     // Cleanup thread pool
     cleanup_scraper_pool();
+    link_graph_stop();
+
+    // Merge the last database batch and write the last export file
+    data_store_cleanup();
+    export_stop();
+
+    // Deliver the last results while Redis is still connected
+    result_sink_close();
+
+    // Send every buffered write before the connections go away
+    write_behind_stop();
+    async_redis_stop();
+    frontier_runs_cleanup();
+    shard_router_cleanup();
     
     // Cleanup URL processor
     cleanup_url_processor();
+
+    // Nothing refers to interned URLs any more
+    url_intern_cleanup();
     
     // Cleanup CURL
     if (curl) {
@@ -263,9 +351,19 @@ content_analysis_t *analyze_url_content(const char *url) {
         return NULL;
     }
     
-    // Analyze content
-    LOG_INFO("Analyzing content from URL: %s", url);
-    analysis = analyze_content(chunk.response, url);
+    // Reuse the analysis of identical bytes if we have one
+    uint64_t body_hash = content_hash64(chunk.response, chunk.size, 0);
+    analysis = get_analysis_by_hash(redis, body_hash);
+    if (analysis) {
+        LOG_INFO("Reusing memoized analysis for URL: %s", url);
+    } else {
+        // Analyze content
+        LOG_INFO("Analyzing content from URL: %s", url);
+        analysis = analyze_content(chunk.response, url);
+        if (analysis) {
+            store_analysis_by_hash(redis, body_hash, analysis);
+        }
+    }
     
     // Free chunk
     free(chunk.response);
@@ -312,12 +410,13 @@ void set_scraper_config(scraper_config_t *config) {
     }
     
     // Copy configuration
+    char *old_user_agent = scraper_config.user_agent;
     memcpy(&scraper_config, config, sizeof(scraper_config_t));
     
     // Make a deep copy of user agent string
-    if (config->user_agent) {
-        free(scraper_config.user_agent);
-        scraper_config.user_agent = strdup(config->user_agent);
+    scraper_config.user_agent = config->user_agent ? strdup(config->user_agent) : NULL;
+    if (old_user_agent != default_user_agent) {
+        free(old_user_agent);
     }
     
     LOG_INFO("Scraper configuration updated");
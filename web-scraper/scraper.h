@@ -25,8 +25,8 @@ struct Memory {
 };
 
 // Function prototypes
-void extract_title(const char *html);
-void extract_meta(const char *html);
+void extract_title(const char *html, const char *url);
+void extract_meta(const char *html, const char *url);
 void extract_hrefs(const char *html, const char *base_url);
 int is_allowed_by_robots(const char *url);
 void split_url(const char *url, char *base_url, char *target_path);
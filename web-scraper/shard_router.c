@@ -0,0 +1,340 @@
+#include "shard_router.h"
+#include "content_hash.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char *host;
+    int port;
+    redisContext *ctx;       // Unused for node 0, which is redis_ctx
+    pthread_mutex_t lock;    // Unused for node 0, which is redis_mutex
+} shard_node_t;
+
+typedef struct {
+    uint64_t hash;
+    int node;
+} ring_point_t;
+
+// Node 0 is filled in by shard_router_init(); extra nodes start at 1
+static shard_node_t nodes[SHARD_MAX_NODES];
+static int node_count = 1;
+
+// Built once by shard_router_init() and read-only afterwards
+static ring_point_t *ring = NULL;
+static int ring_size = 0;
+
+// Register an extra node; call before shard_router_init()
+int shard_add_node(const char *host, int port) {
+    if (!host || port <= 0 || node_count >= SHARD_MAX_NODES) {
+        return -1;
+    }
+    nodes[node_count].host = strdup(host);
+    if (!nodes[node_count].host) {
+        return -1;
+    }
+    nodes[node_count].port = port;
+    nodes[node_count].ctx = NULL;
+    pthread_mutex_init(&nodes[node_count].lock, NULL);
+    node_count++;
+    return 0;
+}
+
+// Parse "host:port" and register it
+int shard_add_node_spec(const char *spec) {
+    const char *colon = spec ? strrchr(spec, ':') : NULL;
+    if (!colon || colon == spec) {
+        return -1;
+    }
+    int port = atoi(colon + 1);
+    char host[SHARD_TAG_MAX];
+    size_t host_len = colon - spec;
+    if (port <= 0 || port > 65535 || host_len >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, spec, host_len);
+    host[host_len] = '\0';
+    return shard_add_node(host, port);
+}
+
+static int compare_points(const void *a, const void *b) {
+    const ring_point_t *pa = a, *pb = b;
+    if (pa->hash != pb->hash) {
+        return pa->hash < pb->hash ? -1 : 1;
+    }
+    return pa->node - pb->node;
+}
+
+static int build_ring(void) {
+    ring = malloc(node_count * SHARD_VNODES * sizeof(ring_point_t));
+    if (!ring) {
+        return -1;
+    }
+    ring_size = 0;
+    for (int n = 0; n < node_count; n++) {
+        for (int v = 0; v < SHARD_VNODES; v++) {
+            char label[SHARD_TAG_MAX + 32];
+            int len = snprintf(label, sizeof(label), "%s:%d#%d", nodes[n].host, nodes[n].port, v);
+            ring[ring_size].hash = content_hash64(label, len, 0);
+            ring[ring_size].node = n;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring_point_t), compare_points);
+    return 0;
+}
+
+static int connect_node(shard_node_t *node) {
+    if (node->ctx) {
+        redisFree(node->ctx);
+    }
+    struct timeval timeout = {1, 500000};  // 1.5 seconds
+    node->ctx = redisConnectWithTimeout(node->host, node->port, timeout);
+    if (!node->ctx || node->ctx->err) {
+        LOG_ERROR("Failed to connect to Redis shard %s:%d: %s", node->host, node->port,
+                  node->ctx ? node->ctx->errstr : "Unknown error");
+        if (node->ctx) {
+            redisFree(node->ctx);
+            node->ctx = NULL;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Connect the extra nodes and build the ring
+int shard_router_init(const char *host, int port) {
+    free(nodes[0].host);
+    nodes[0].host = strdup(host);
+    nodes[0].port = port;
+    if (!nodes[0].host) {
+        return -1;
+    }
+
+    for (int n = 1; n < node_count; n++) {
+        if (connect_node(&nodes[n]) != 0) {
+            return -1;
+        }
+    }
+
+    free(ring);
+    if (build_ring() != 0) {
+        LOG_ERROR("Failed to build shard ring");
+        return -1;
+    }
+    if (node_count > 1) {
+        LOG_INFO("Routing crawl state over %d Redis nodes", node_count);
+    }
+    return 0;
+}
+
+// Close the extra connections and drop the ring
+void shard_router_cleanup(void) {
+    for (int n = 1; n < node_count; n++) {
+        pthread_mutex_lock(&nodes[n].lock);
+        if (nodes[n].ctx) {
+            redisFree(nodes[n].ctx);
+            nodes[n].ctx = NULL;
+        }
+        pthread_mutex_unlock(&nodes[n].lock);
+    }
+    free(ring);
+    ring = NULL;
+    ring_size = 0;
+}
+
+// Number of nodes (1 when sharding is not configured)
+int shard_count(void) {
+    return node_count;
+}
+
+const char *shard_node_host(int node) {
+    return node >= 0 && node < node_count ? nodes[node].host : NULL;
+}
+
+int shard_node_port(int node) {
+    return node >= 0 && node < node_count ? nodes[node].port : 0;
+}
+
+// Node that owns a key
+int shard_for_key(const char *key) {
+    if (!key || !ring || node_count == 1) {
+        return 0;
+    }
+
+    // Hash only the tag when the key has a non-empty {tag}
+    size_t len = strlen(key);
+    const char *open = strchr(key, '{');
+    if (open) {
+        const char *close = strchr(open + 1, '}');
+        if (close && close > open + 1) {
+            key = open + 1;
+            len = close - key;
+        }
+    }
+    uint64_t hash = content_hash64(key, len, 0);
+
+    // First ring point at or after the hash, wrapping around
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return ring[lo == ring_size ? 0 : lo].node;
+}
+
+// Lock a node's connection and return it
+redisContext *shard_acquire(int node) {
+    if (node <= 0 || node >= node_count) {
+        redisContext *ctx = get_redis_context();
+        pthread_mutex_lock(&redis_mutex);
+        if (!ctx) {
+            pthread_mutex_unlock(&redis_mutex);
+        }
+        return ctx;
+    }
+
+    pthread_mutex_lock(&nodes[node].lock);
+    if ((!nodes[node].ctx || nodes[node].ctx->err) && connect_node(&nodes[node]) != 0) {
+        pthread_mutex_unlock(&nodes[node].lock);
+        return NULL;
+    }
+    return nodes[node].ctx;
+}
+
+// Unlock a node's connection
+void shard_release(int node) {
+    if (node <= 0 || node >= node_count) {
+        pthread_mutex_unlock(&redis_mutex);
+    } else {
+        pthread_mutex_unlock(&nodes[node].lock);
+    }
+}
+
+// Host of a URL as a hash tag
+int shard_url_tag(const char *url, char *tag, size_t size) {
+    if (!url || size == 0) {
+        return -1;
+    }
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+
+    // The authority ends at the first path, query or fragment delimiter
+    size_t authority_len = strcspn(start, "/?#");
+    const char *at = memchr(start, '@', authority_len);
+    if (at) {
+        authority_len -= at + 1 - start;
+        start = at + 1;
+    }
+
+    // Bracketed IPv6 literals contain colons; the port follows the bracket
+    size_t host_len = authority_len;
+    if (start[0] == '[') {
+        const char *bracket = memchr(start, ']', authority_len);
+        host_len = bracket ? (size_t)(bracket + 1 - start) : authority_len;
+    } else {
+        const char *colon = memchr(start, ':', authority_len);
+        host_len = colon ? (size_t)(colon - start) : authority_len;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < host_len; i++) {
+        if (len + 1 >= size) {
+            return -1;
+        }
+        char c = start[i];
+        // Braces would end the tag early; they never appear in valid hosts
+        tag[len++] = (c == '{' || c == '}') ? '_' : (char)tolower((unsigned char)c);
+    }
+    tag[len] = '\0';
+    return len > 0 ? 0 : -1;
+}
+
+// Build <prefix>{tag}<suffix> for a tag that is already known
+int shard_tag_key(char *buf, size_t size, const char *prefix, const char *tag,
+                  const char *suffix) {
+    int len = snprintf(buf, size, "%s{%s}%s", prefix, tag, suffix ? suffix : "");
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+// Build <prefix>{host}<suffix> for a URL
+int shard_url_key(char *buf, size_t size, const char *prefix, const char *url,
+                  const char *suffix) {
+    char tag[SHARD_TAG_MAX];
+    if (shard_url_tag(url, tag, sizeof(tag)) != 0) {
+        // Keep URLs without a host together under an empty-host tag
+        strcpy(tag, "_");
+    }
+    return shard_tag_key(buf, size, prefix, tag, suffix);
+}
+
+typedef struct {
+    const char *tag;
+    int index;
+} tagged_url_t;
+
+static int compare_tagged(const void *a, const void *b) {
+    const tagged_url_t *ta = a, *tb = b;
+    int cmp = strcmp(ta->tag, tb->tag);
+    return cmp ? cmp : ta->index - tb->index;
+}
+
+// Split URLs into groups that share a host
+int shard_group_urls(const char **urls, int count, shard_group_t **groups) {
+    *groups = NULL;
+    if (!urls || count <= 0) {
+        return 0;
+    }
+
+    // One block: groups, their index lists, then the tag strings
+    size_t size = count * (sizeof(shard_group_t) + sizeof(int) + SHARD_TAG_MAX);
+    char *block = malloc(size);
+    tagged_url_t *tagged = malloc(count * sizeof(tagged_url_t));
+    if (!block || !tagged) {
+        free(block);
+        free(tagged);
+        return -1;
+    }
+    shard_group_t *out = (shard_group_t *)block;
+    int *indexes = (int *)(block + count * sizeof(shard_group_t));
+    char *tags = (char *)(indexes + count);
+
+    for (int i = 0; i < count; i++) {
+        char *tag = tags + (size_t)i * SHARD_TAG_MAX;
+        if (!urls[i] || shard_url_tag(urls[i], tag, SHARD_TAG_MAX) != 0) {
+            strcpy(tag, "_");
+        }
+        tagged[i].tag = tag;
+        tagged[i].index = i;
+    }
+    qsort(tagged, count, sizeof(tagged_url_t), compare_tagged);
+
+    int group_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || strcmp(tagged[i].tag, tagged[i - 1].tag) != 0) {
+            shard_group_t *group = &out[group_count++];
+            group->tag = tagged[i].tag;
+            group->indexes = &indexes[i];
+            group->count = 0;
+
+            char key[SHARD_KEY_MAX];
+            shard_tag_key(key, sizeof(key), "", group->tag, NULL);
+            group->node = shard_for_key(key);
+        }
+        indexes[i] = tagged[i].index;
+        out[group_count - 1].count++;
+    }
+
+    free(tagged);
+    *groups = out;
+    return group_count;
+}
@@ -0,0 +1,92 @@
+#ifndef SHARD_ROUTER_H
+#define SHARD_ROUTER_H
+
+#include <hiredis/hiredis.h>
+#include <stddef.h>
+
+// Client-side routing of crawl state over several Redis nodes
+//
+// Node 0 is always the primary connection from init_redis(). Extra nodes
+// are added with shard_add_node() before shard_router_init(). Keys are
+// placed on a consistent-hash ring (SHARD_VNODES points per node), so
+// adding a node only moves about 1/N of the keys.
+//
+// Keys follow the Redis Cluster hash-tag rule: when a key contains
+// "{tag}", only the tag is hashed. Per-host state is tagged with the
+// host, e.g. visited:{example.com} and queue:{example.com}. All keys of a
+// host then live on one node, so scripts and MULTI blocks that touch
+// several of them stay valid, and the same layout works unchanged on a
+// Redis Cluster.
+
+#define SHARD_MAX_NODES 16
+#define SHARD_VNODES 160        // Ring points per node
+#define SHARD_KEY_MAX 2048      // Longest key built by shard_url_key()
+#define SHARD_TAG_MAX 256       // Longest host tag
+
+// Key layout for per-host crawl state: <prefix>{host}
+#define VISITED_KEY_PREFIX "visited:"     // Visited URLs, see visited_store.h
+#define URL_QUEUE_PREFIX "queue:"         // Queued URLs by priority, see frontier.h
+#define URL_DEPTH_PREFIX "url_depth:"     // Hash of URL -> crawl depth
+#define CLAIM_KEY_PREFIX "claim:"         // claim:{host}:<url>, see redis_scripts.h
+#define ROBOTS_KEY_PREFIX "robots:"       // robots:{host}:allow / :disallow
+#define FRONTIER_HOSTS_KEY "frontier:hosts"  // Host schedule by best priority, see frontier.h
+
+// Register an extra node; call before shard_router_init()
+// Returns 0 on success, -1 if the node list is full
+int shard_add_node(const char *host, int port);
+
+// Parse "host:port" and register it
+int shard_add_node_spec(const char *spec);
+
+// Connect the extra nodes and build the ring; node 0 is host:port,
+// which must be the address init_redis() connected to
+// Returns 0 on success, -1 on failure
+int shard_router_init(const char *host, int port);
+
+// Close the extra connections and drop the ring
+void shard_router_cleanup(void);
+
+// Number of nodes (1 when sharding is not configured)
+int shard_count(void);
+
+// Address of a node
+const char *shard_node_host(int node);
+int shard_node_port(int node);
+
+// Node that owns a key
+int shard_for_key(const char *key);
+
+// Lock a node's connection and return it; NULL if it is unavailable
+// (the lock is released again in that case)
+redisContext *shard_acquire(int node);
+
+// Unlock a node's connection
+void shard_release(int node);
+
+// Host of a URL as a hash tag: lowercased, without port or user info
+// Returns 0 on success, -1 if the URL has no usable host
+int shard_url_tag(const char *url, char *tag, size_t size);
+
+// Build <prefix>{host}<suffix> for a URL; suffix may be NULL
+// Returns 0 on success, -1 if the key does not fit
+int shard_url_key(char *buf, size_t size, const char *prefix, const char *url,
+                  const char *suffix);
+
+// Build <prefix>{tag}<suffix> for a tag that is already known
+int shard_tag_key(char *buf, size_t size, const char *prefix, const char *tag,
+                  const char *suffix);
+
+// URLs of one host, as produced by shard_group_urls()
+typedef struct {
+    const char *tag;   // Host tag shared by the group
+    int node;          // Node that owns the host's keys
+    int count;
+    int *indexes;      // Positions in the input array, ascending
+} shard_group_t;
+
+// Split URLs into groups that share a host, so each group can be sent to
+// its node as one command. Free the result with free().
+// Returns the number of groups, or -1 on failure
+int shard_group_urls(const char **urls, int count, shard_group_t **groups);
+
+#endif // SHARD_ROUTER_H
@@ -0,0 +1,338 @@
+#include "simhash.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include "write_behind.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define SIMHASH_URLS_KEY SIMHASH_KEY_PREFIX "urls"
+#define SIMHASH_SHA_LEN 40
+
+// KEYS: band key per band, URL hash   ARGV: fingerprint, url, max distance,
+// max candidates. Returns {1, url} for a duplicate ('' if its URL is
+// unknown), or {0} after indexing the fingerprint. Fingerprints are
+// compared as two 32-bit halves since Lua's bit library is 32-bit.
+static const char *FIND_OR_INDEX_SCRIPT =
+    "local function popcount(x)\n"
+    "  local n = 0\n"
+    "  while x ~= 0 do x = bit.band(x, x - 1); n = n + 1 end\n"
+    "  return n\n"
+    "end\n"
+    "local function distance(a, b)\n"
+    "  return popcount(bit.bxor(tonumber(a:sub(1, 8), 16), tonumber(b:sub(1, 8), 16))) +\n"
+    "         popcount(bit.bxor(tonumber(a:sub(9, 16), 16), tonumber(b:sub(9, 16), 16)))\n"
+    "end\n"
+    "local max_distance = tonumber(ARGV[3])\n"
+    "local max_candidates = tonumber(ARGV[4])\n"
+    "local seen = {}\n"
+    "local candidates = 0\n"
+    "for b = 1, #KEYS - 1 do\n"
+    "  for _, fp in ipairs(redis.call('SMEMBERS', KEYS[b])) do\n"
+    "    if candidates < max_candidates and not seen[fp] and #fp == 16 and\n"
+    "       distance(ARGV[1], fp) <= max_distance then\n"
+    "      seen[fp] = true\n"
+    "      candidates = candidates + 1\n"
+    "      local url = redis.call('HGET', KEYS[#KEYS], fp)\n"
+    "      if url ~= ARGV[2] then return {1, url or ''} end\n"
+    "    end\n"
+    "  end\n"
+    "end\n"
+    "for b = 1, #KEYS - 1 do redis.call('SADD', KEYS[b], ARGV[1]) end\n"
+    "redis.call('HSETNX', KEYS[#KEYS], ARGV[1], ARGV[2])\n"
+    "return {0}\n";
+
+// SHA-1 of the script once loaded; guarded by redis_mutex
+static char script_sha[SIMHASH_SHA_LEN + 1] = "";
+static int script_failed = 0;
+
+// Hash a single lowercased word with FNV-1a
+static uint64_t hash_word(const char *start, size_t len) {
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)tolower((unsigned char)start[i]);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Mix the word hashes of a shingle into one 64-bit feature
+static uint64_t hash_shingle(const uint64_t *words, int start) {
+    uint64_t hash = FNV_OFFSET;
+    for (int i = 0; i < SIMHASH_SHINGLE_WORDS; i++) {
+        hash ^= words[(start + i) % SIMHASH_SHINGLE_WORDS];
+        hash *= FNV_PRIME;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Compute a 64-bit SimHash over word shingles of the given text
+uint64_t simhash_compute(const char *text) {
+    if (!text) {
+        return 0;
+    }
+
+    int weights[64] = {0};
+    uint64_t window[SIMHASH_SHINGLE_WORDS];
+    int word_count = 0;
+    int shingle_count = 0;
+
+    const char *p = text;
+    while (*p) {
+        // Skip to the start of the next word
+        while (*p && !isalnum((unsigned char)*p)) p++;
+        const char *start = p;
+        while (*p && isalnum((unsigned char)*p)) p++;
+        if (p == start) {
+            continue;
+        }
+
+        window[word_count % SIMHASH_SHINGLE_WORDS] = hash_word(start, p - start);
+        word_count++;
+        if (word_count < SIMHASH_SHINGLE_WORDS) {
+            continue;
+        }
+
+        // Oldest word of the current window sits at word_count % size
+        uint64_t feature = hash_shingle(window, word_count % SIMHASH_SHINGLE_WORDS);
+        for (int bit = 0; bit < 64; bit++) {
+            weights[bit] += (feature >> bit) & 1 ? 1 : -1;
+        }
+        shingle_count++;
+    }
+
+    if (shingle_count == 0) {
+        return 0;
+    }
+
+    uint64_t fingerprint = 0;
+    for (int bit = 0; bit < 64; bit++) {
+        if (weights[bit] > 0) {
+            fingerprint |= 1ULL << bit;
+        }
+    }
+    return fingerprint;
+}
+
+// Hamming distance between two fingerprints
+int simhash_distance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+// Extract one 16-bit band of a fingerprint
+static unsigned int band_value(uint64_t fingerprint, int band) {
+    return (unsigned int)((fingerprint >> (band * 16)) & 0xFFFF);
+}
+
+// Look up an indexed fingerprint within SIMHASH_MAX_DISTANCE
+// Any fingerprint within distance 3 shares at least one of the 4 bands
+// exactly, so only the band buckets need to be scanned.
+int simhash_find_duplicate(redisContext *ctx, uint64_t fingerprint, const char *exclude_url,
+                           char **match_url) {
+    if (!ctx) {
+        LOG_ERROR("Invalid parameters for simhash lookup");
+        return -1;
+    }
+
+    pthread_mutex_lock(&redis_mutex);
+    for (int band = 0; band < SIMHASH_BANDS; band++) {
+        redisAppendCommand(ctx, "SMEMBERS %sband:%d:%04x", SIMHASH_KEY_PREFIX,
+                           band, band_value(fingerprint, band));
+    }
+
+    // Collect distinct fingerprints within range across all bands
+    uint64_t candidates[SIMHASH_MAX_CANDIDATES];
+    int candidate_count = 0;
+    for (int band = 0; band < SIMHASH_BANDS; band++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            LOG_ERROR("Failed to read simhash band from Redis");
+            pthread_mutex_unlock(&redis_mutex);
+            return -1;
+        }
+        if (reply->type == REDIS_REPLY_ARRAY) {
+            for (size_t i = 0; i < reply->elements && candidate_count < SIMHASH_MAX_CANDIDATES; i++) {
+                uint64_t candidate = strtoull(reply->element[i]->str, NULL, 16);
+                if (simhash_distance(fingerprint, candidate) > SIMHASH_MAX_DISTANCE) {
+                    continue;
+                }
+                int seen = 0;
+                for (int j = 0; j < candidate_count && !seen; j++) {
+                    seen = candidates[j] == candidate;
+                }
+                if (!seen) {
+                    candidates[candidate_count++] = candidate;
+                }
+            }
+        }
+        freeReplyObject(reply);
+    }
+
+    // A page never duplicates itself: skip fingerprints indexed for exclude_url
+    int found = 0;
+    if (match_url) {
+        *match_url = NULL;
+    }
+    if (candidate_count > 0 && (exclude_url || match_url)) {
+        for (int i = 0; i < candidate_count; i++) {
+            redisAppendCommand(ctx, "HGET %s %016llx", SIMHASH_URLS_KEY,
+                               (unsigned long long)candidates[i]);
+        }
+        for (int i = 0; i < candidate_count; i++) {
+            redisReply *reply = NULL;
+            if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+                LOG_ERROR("Failed to read simhash URL from Redis");
+                pthread_mutex_unlock(&redis_mutex);
+                if (match_url) {
+                    free(*match_url);
+                    *match_url = NULL;
+                }
+                return -1;
+            }
+            const char *url = reply->type == REDIS_REPLY_STRING ? reply->str : NULL;
+            if (!found && !(url && exclude_url && strcmp(url, exclude_url) == 0)) {
+                found = 1;
+                if (match_url && url) {
+                    *match_url = strdup(url);
+                }
+            }
+            freeReplyObject(reply);
+        }
+    } else {
+        found = candidate_count > 0;
+    }
+    pthread_mutex_unlock(&redis_mutex);
+
+    return found;
+}
+
+// Add a fingerprint to the banded index
+int simhash_index(redisContext *ctx, uint64_t fingerprint, const char *url) {
+    if (!ctx || !url) {
+        LOG_ERROR("Invalid parameters for simhash index");
+        return -1;
+    }
+
+    char fp_hex[17];
+    snprintf(fp_hex, sizeof(fp_hex), "%016llx", (unsigned long long)fingerprint);
+
+    // Nothing reads the replies, so the writes go through the write-behind buffer
+    int result = 0;
+    for (int band = 0; band < SIMHASH_BANDS; band++) {
+        if (write_behind_command("SADD %sband:%d:%04x %s", SIMHASH_KEY_PREFIX,
+                                 band, band_value(fingerprint, band), fp_hex) != 0) {
+            result = -1;
+        }
+    }
+    if (write_behind_command("HSETNX %s %s %s", SIMHASH_URLS_KEY, fp_hex, url) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        LOG_ERROR("Failed to index simhash in Redis");
+    }
+    return result;
+}
+
+// Run the find-or-index script; the caller holds redis_mutex
+// Returns the reply, or NULL if scripting failed
+static redisReply *run_find_or_index(redisContext *ctx, const char **argv, size_t *argvlen,
+                                     int argc) {
+    if (!script_sha[0]) {
+        redisReply *reply = redisCommand(ctx, "SCRIPT LOAD %s", FIND_OR_INDEX_SCRIPT);
+        if (reply && reply->type == REDIS_REPLY_STRING && reply->len == SIMHASH_SHA_LEN) {
+            memcpy(script_sha, reply->str, SIMHASH_SHA_LEN + 1);
+        }
+        freeReplyObject(reply);
+        if (!script_sha[0]) {
+            return NULL;
+        }
+    }
+    argv[0] = "EVALSHA";
+    argvlen[0] = 7;
+    argv[1] = script_sha;
+    argvlen[1] = SIMHASH_SHA_LEN;
+    redisReply *reply = redisCommandArgv(ctx, argc, argv, argvlen);
+
+    // The script cache was flushed; EVAL runs the script and caches it again
+    if (reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0) {
+        freeReplyObject(reply);
+        argv[0] = "EVAL";
+        argvlen[0] = 4;
+        argv[1] = FIND_OR_INDEX_SCRIPT;
+        argvlen[1] = strlen(FIND_OR_INDEX_SCRIPT);
+        reply = redisCommandArgv(ctx, argc, argv, argvlen);
+    }
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements < 1 ||
+        reply->element[0]->type != REDIS_REPLY_INTEGER) {
+        LOG_WARNING("Simhash script failed, using plain commands: %s",
+                    reply && reply->type == REDIS_REPLY_ERROR ? reply->str : "no reply");
+        freeReplyObject(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+// Look up a near-duplicate and index the fingerprint if there is none
+int simhash_find_or_index(redisContext *ctx, uint64_t fingerprint, const char *url,
+                          char **match_url) {
+    if (!ctx || !url) {
+        LOG_ERROR("Invalid parameters for simhash lookup");
+        return -1;
+    }
+    if (match_url) {
+        *match_url = NULL;
+    }
+
+    char keys[SIMHASH_BANDS][64];
+    char fp_hex[17], max_distance[16], max_candidates[16];
+    const char *argv[SIMHASH_BANDS + 8];
+    size_t argvlen[SIMHASH_BANDS + 8];
+    int argc = 2;
+    char numkeys[16];
+    snprintf(numkeys, sizeof(numkeys), "%d", SIMHASH_BANDS + 1);
+    argv[argc++] = numkeys;
+    for (int band = 0; band < SIMHASH_BANDS; band++) {
+        snprintf(keys[band], sizeof(keys[band]), "%sband:%d:%04x", SIMHASH_KEY_PREFIX,
+                 band, band_value(fingerprint, band));
+        argv[argc++] = keys[band];
+    }
+    argv[argc++] = SIMHASH_URLS_KEY;
+    snprintf(fp_hex, sizeof(fp_hex), "%016llx", (unsigned long long)fingerprint);
+    snprintf(max_distance, sizeof(max_distance), "%d", SIMHASH_MAX_DISTANCE);
+    snprintf(max_candidates, sizeof(max_candidates), "%d", SIMHASH_MAX_CANDIDATES);
+    argv[argc++] = fp_hex;
+    argv[argc++] = url;
+    argv[argc++] = max_distance;
+    argv[argc++] = max_candidates;
+    for (int i = 2; i < argc; i++) {
+        argvlen[i] = strlen(argv[i]);
+    }
+
+    pthread_mutex_lock(&redis_mutex);
+    redisReply *reply = script_failed ? NULL : run_find_or_index(ctx, argv, argvlen, argc);
+    if (!reply) {
+        script_failed = 1;
+    }
+    pthread_mutex_unlock(&redis_mutex);
+
+    // Fallback: a page fetched twice at once may be indexed twice
+    if (!reply) {
+        int found = simhash_find_duplicate(ctx, fingerprint, url, match_url);
+        if (found == 1) {
+            return 1;
+        }
+        return simhash_index(ctx, fingerprint, url) == 0 && found == 0 ? 0 : -1;
+    }
+
+    int found = reply->element[0]->integer == 1;
+    if (found && match_url && reply->elements > 1 &&
+        reply->element[1]->type == REDIS_REPLY_STRING && reply->element[1]->len > 0) {
+        *match_url = strdup(reply->element[1]->str);
+    }
+    freeReplyObject(reply);
+    return found;
+}
@@ -0,0 +1,42 @@
+#ifndef SIMHASH_H
+#define SIMHASH_H
+
+#include <hiredis/hiredis.h>
+#include <stdint.h>
+
+// Fingerprint configuration
+#define SIMHASH_SHINGLE_WORDS 4   // Words per shingle
+#define SIMHASH_BANDS 4           // 64-bit fingerprint split into 4 x 16-bit bands
+#define SIMHASH_MAX_DISTANCE 3    // Max Hamming distance for a near-duplicate
+#define SIMHASH_MAX_CANDIDATES 16 // Fingerprints in range checked per lookup
+#define SIMHASH_KEY_PREFIX "simhash:"
+
+// Compute a 64-bit SimHash over word shingles of the given text
+// Returns 0 if the text is too short to fingerprint
+uint64_t simhash_compute(const char *text);
+
+// Hamming distance between two fingerprints
+int simhash_distance(uint64_t a, uint64_t b);
+
+// Look up an indexed fingerprint within SIMHASH_MAX_DISTANCE, ignoring
+// fingerprints indexed for exclude_url (the page itself) if non-NULL
+// Returns 1 if found (and sets *match_url if non-NULL; caller must free),
+// 0 if none, -1 on error
+int simhash_find_duplicate(redisContext *ctx, uint64_t fingerprint, const char *exclude_url,
+                           char **match_url);
+
+// Add a fingerprint to the banded index
+// Returns 0 on success, -1 on failure
+int simhash_index(redisContext *ctx, uint64_t fingerprint, const char *url);
+
+// Look up a near-duplicate of url's fingerprint and index the fingerprint
+// if there is none, as one atomic script so two copies of a page fetched
+// at once cannot both miss each other. Without scripting it falls back to
+// simhash_find_duplicate() then simhash_index().
+// Returns 1 if a duplicate was found (and sets *match_url as
+// simhash_find_duplicate() does), 0 if the fingerprint was indexed,
+// -1 on error
+int simhash_find_or_index(redisContext *ctx, uint64_t fingerprint, const char *url,
+                          char **match_url);
+
+#endif // SIMHASH_H
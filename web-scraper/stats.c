@@ -1,54 +1,138 @@
 #include "stats.h"
-#include "redis_helper.h"
+#include "write_behind.h"
+#include "frontier_runs.h"
+#include "link_graph.h"
+#include "url_intern.h"
+#include "data_store.h"
+#include "column_export.h"
+#include "result_sink.h"
 #include "logger.h"
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/resource.h>
 
-// Global variables
-ScraperStats scraper_stats = {0};
-RedisStats redis_stats = {0};
-pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Counters of one thread, alone on its cache line
+typedef struct {
+    unsigned long urls_processed;
+    unsigned long urls_skipped;
+    unsigned long urls_disallowed;
+    unsigned long bytes_downloaded;
+    unsigned long redis_ops;
+    unsigned long redis_errors;
+    unsigned long redis_latency_us;
+    unsigned long entries_compressed;
+    unsigned long bytes_raw;
+    unsigned long bytes_stored;
+    unsigned long compress_cpu_us;
+    unsigned long decompress_cpu_us;
+} __attribute__((aligned(STATS_CACHE_LINE))) stats_slot_t;
+
+static stats_slot_t stats_slots[STATS_MAX_THREADS];
+static unsigned int slots_claimed = 0;
+static time_t start_time = 0;
+static __thread stats_slot_t *thread_slot = NULL;
+
+// The calling thread's slot, claimed on first use
+static stats_slot_t *get_slot(void) {
+    if (!thread_slot) {
+        unsigned int index = __atomic_fetch_add(&slots_claimed, 1, __ATOMIC_RELAXED);
+        thread_slot = &stats_slots[index % STATS_MAX_THREADS];
+    }
+    return thread_slot;
+}
+
+// Add to a counter of the calling thread's slot
+#define STAT_ADD(slot, field, value) \
+    __atomic_fetch_add(&(slot)->field, (unsigned long)(value), __ATOMIC_RELAXED)
+
+// Sum a counter over all slots
+#define STAT_SUM(total, field) do { \
+    (total) = 0; \
+    for (int i = 0; i < STATS_MAX_THREADS; i++) { \
+        (total) += __atomic_load_n(&stats_slots[i].field, __ATOMIC_RELAXED); \
+    } \
+} while (0)
 
 // Initialize performance monitoring
 void init_stats(void) {
-    scraper_stats.start_time = time(NULL);
-    scraper_stats.last_report_time = scraper_stats.start_time;
-    scraper_stats.urls_processed = 0;
-    scraper_stats.urls_skipped = 0;
-    scraper_stats.urls_disallowed = 0;
-    scraper_stats.bytes_downloaded = 0;
-    
-    redis_stats.redis_ops = 0;
-    redis_stats.redis_errors = 0;
-    redis_stats.redis_latency_ms = 0;
+    for (int i = 0; i < STATS_MAX_THREADS; i++) {
+        memset(&stats_slots[i], 0, sizeof(stats_slots[i]));
+    }
+    __atomic_store_n(&start_time, time(NULL), __ATOMIC_RELAXED);
+}
+
+// Sum the counters of all threads
+void stats_snapshot(ScraperStats *scraper, RedisStats *redis, CompressionStats *compression) {
+    if (scraper) {
+        STAT_SUM(scraper->urls_processed, urls_processed);
+        STAT_SUM(scraper->urls_skipped, urls_skipped);
+        STAT_SUM(scraper->urls_disallowed, urls_disallowed);
+        STAT_SUM(scraper->bytes_downloaded, bytes_downloaded);
+        scraper->start_time = __atomic_load_n(&start_time, __ATOMIC_RELAXED);
+    }
+    if (redis) {
+        STAT_SUM(redis->redis_ops, redis_ops);
+        STAT_SUM(redis->redis_errors, redis_errors);
+        STAT_SUM(redis->redis_latency_us, redis_latency_us);
+    }
+    if (compression) {
+        STAT_SUM(compression->entries_compressed, entries_compressed);
+        STAT_SUM(compression->bytes_raw, bytes_raw);
+        STAT_SUM(compression->bytes_stored, bytes_stored);
+        STAT_SUM(compression->compress_cpu_us, compress_cpu_us);
+        STAT_SUM(compression->decompress_cpu_us, decompress_cpu_us);
+    }
+}
+
+// Add the counters of an earlier run and move the start time back by its length
+void stats_restore(const ScraperStats *saved, time_t elapsed) {
+    stats_slot_t *slot = get_slot();
+    STAT_ADD(slot, urls_processed, saved->urls_processed);
+    STAT_ADD(slot, urls_skipped, saved->urls_skipped);
+    STAT_ADD(slot, urls_disallowed, saved->urls_disallowed);
+    STAT_ADD(slot, bytes_downloaded, saved->bytes_downloaded);
+    __atomic_fetch_sub(&start_time, elapsed, __ATOMIC_RELAXED);
 }
 
 // Update scraper statistics
 void update_stats(unsigned long bytes, int skipped, int disallowed) {
-    pthread_mutex_lock(&stats_mutex);
-    scraper_stats.bytes_downloaded += bytes;
-    if (skipped) scraper_stats.urls_skipped++;
-    if (disallowed) scraper_stats.urls_disallowed++;
-    scraper_stats.urls_processed++;
-    
-    // Update Redis stats
-    redis_stats.redis_ops += 3; // SISMEMBER, RPUSH processed_urls, SADD visited_urls
-    pthread_mutex_unlock(&stats_mutex);
+    stats_slot_t *slot = get_slot();
+    STAT_ADD(slot, bytes_downloaded, bytes);
+    if (skipped) STAT_ADD(slot, urls_skipped, 1);
+    if (disallowed) STAT_ADD(slot, urls_disallowed, 1);
+    STAT_ADD(slot, urls_processed, 1);
 }
 
 // Update Redis statistics
-void update_redis_stats(int ops, int errors, int latency_ms) {
-    pthread_mutex_lock(&stats_mutex);
-    redis_stats.redis_ops += ops;
-    redis_stats.redis_errors += errors;
-    redis_stats.redis_latency_ms += latency_ms;
-    pthread_mutex_unlock(&stats_mutex);
+void update_redis_stats(int ops, int errors, unsigned long latency_us) {
+    stats_slot_t *slot = get_slot();
+    STAT_ADD(slot, redis_ops, ops);
+    STAT_ADD(slot, redis_errors, errors);
+    STAT_ADD(slot, redis_latency_us, latency_us);
+}
+
+// Update cache compression statistics
+void update_compression_stats(size_t raw_bytes, size_t stored_bytes, unsigned long cpu_us) {
+    stats_slot_t *slot = get_slot();
+    STAT_ADD(slot, entries_compressed, 1);
+    STAT_ADD(slot, bytes_raw, raw_bytes);
+    STAT_ADD(slot, bytes_stored, stored_bytes);
+    STAT_ADD(slot, compress_cpu_us, cpu_us);
+}
+
+// Update cache decompression statistics
+void update_decompression_stats(unsigned long cpu_us) {
+    STAT_ADD(get_slot(), decompress_cpu_us, cpu_us);
 }
 
 // Print current statistics
 void print_stats(void) {
-    pthread_mutex_lock(&stats_mutex);
+    ScraperStats scraper_stats;
+    RedisStats redis_stats;
+    CompressionStats compression_stats;
+    stats_snapshot(&scraper_stats, &redis_stats, &compression_stats);
+
     time_t now = time(NULL);
     double elapsed = difftime(now, scraper_stats.start_time);
     
@@ -71,7 +155,7 @@ void print_stats(void) {
         
         if (redis_stats.redis_ops > 0) {
             printf("Average Redis latency: %.2f ms\n",
-                   redis_stats.redis_latency_ms / (double)redis_stats.redis_ops);
+                   redis_stats.redis_latency_us / 1000.0 / redis_stats.redis_ops);
         } else {
             printf("Average Redis latency: N/A (no operations performed)\n");
         }
@@ -85,33 +169,92 @@ void print_stats(void) {
         printf("Average Redis latency: N/A (no operations performed)\n");
     }
     
+    // Cache compression
+    if (compression_stats.entries_compressed > 0) {
+        unsigned long saved = compression_stats.bytes_raw - compression_stats.bytes_stored;
+        printf("Cache entries stored: %lu (%.2f MB raw, %.2f MB stored)\n",
+               compression_stats.entries_compressed,
+               compression_stats.bytes_raw / (1024.0 * 1024.0),
+               compression_stats.bytes_stored / (1024.0 * 1024.0));
+        printf("Cache bytes saved: %lu (%.1f%%)\n", saved,
+               compression_stats.bytes_raw > 0 ? 100.0 * saved / compression_stats.bytes_raw : 0.0);
+    }
+    printf("Compression CPU: %.2f ms, decompression CPU: %.2f ms\n",
+           compression_stats.compress_cpu_us / 1000.0,
+           compression_stats.decompress_cpu_us / 1000.0);
+
+    // Buffered Redis writes
+    write_behind_stats_t wb;
+    write_behind_get_stats(&wb);
+    if (wb.commands_queued > 0) {
+        printf("Write-behind: %lu queued, %lu flushed in %lu batches, %lu failed, %zu bytes pending\n",
+               wb.commands_queued, wb.commands_flushed, wb.batches, wb.commands_failed,
+               wb.bytes_pending);
+    }
+    
+    // Frontier spill tier
+    frontier_stats_t fs;
+    frontier_get_stats(&fs);
+    if (fs.spills > 0 || fs.runs_live > 0) {
+        double secs = elapsed > 0 ? elapsed : 1;
+        printf("Frontier spill: %lu URLs in %lu runs (%.1f URLs/sec), %.2f MB written\n",
+               fs.urls_spilled, fs.spills, fs.urls_spilled / secs,
+               fs.bytes_written / (1024.0 * 1024.0));
+        printf("Frontier refill: %lu URLs in %lu batches (%.1f URLs/sec), %.2f MB read\n",
+               fs.urls_refilled, fs.refills, fs.urls_refilled / secs,
+               fs.bytes_read / (1024.0 * 1024.0));
+        printf("Frontier runs: %lu live across %lu hosts, %lu compactions\n",
+               fs.runs_live, fs.hosts_spilled, fs.compactions);
+    }
+
+    // URL dictionary
+    url_intern_stats_t ui;
+    url_intern_get_stats(&ui);
+    if (ui.urls > 0) {
+        printf("URL ids: %llu URLs, %.2f MB of strings, %.2f MB of index, %llu lookups\n",
+               (unsigned long long)ui.urls, ui.string_bytes / (1024.0 * 1024.0),
+               ui.table_bytes / (1024.0 * 1024.0), (unsigned long long)ui.lookups);
+    }
+
+    // Link graph and PageRank passes
+    link_graph_stats_t lg;
+    link_graph_get_stats(&lg);
+    if (lg.nodes > 0) {
+        printf("Link graph: %lu URLs, %llu links logged, %llu links compacted\n",
+               lg.nodes, lg.edges_logged, lg.edges);
+        printf("PageRank: %lu passes, last took %lu ms, %lu queue scores lowered\n",
+               lg.rank_passes, lg.last_rank_ms, lg.priorities_updated);
+    }
+
+    // Postgres batches
+    if (data_store_is_open()) {
+        data_store_stats_t ds;
+        data_store_get_stats(&ds);
+        printf("Data store: %llu rows queued, %llu merged, %llu lost, %lu batches (%lu failed, last %lu ms)\n",
+               ds.rows_queued, ds.rows_written, ds.rows_failed, ds.flushes, ds.flush_failures,
+               ds.last_flush_ms);
+    }
+
+    // Result sink
+    if (result_sink_is_open()) {
+        result_sink_stats_t rs;
+        result_sink_get_stats(&rs);
+        printf("Results: %llu emitted, %llu written in %lu batches, %llu lost, %lu waits\n",
+               rs.records_emitted, rs.records_written, rs.batches, rs.records_failed,
+               rs.producer_waits);
+    }
+
+    // Columnar export
+    if (export_get_dir()) {
+        export_stats_t ex;
+        export_get_stats(&ex);
+        printf("Export: %llu rows in %lu files (%.2f MB), %llu dropped\n", ex.rows_exported,
+               ex.files_written, ex.bytes_written / (1024.0 * 1024.0), ex.rows_dropped);
+    }
+
     // Get memory usage
     struct rusage usage;
     getrusage(RUSAGE_SELF, &usage);
     printf("Memory usage: %.2f MB\n", 
            usage.ru_maxrss / 1024.0);
-    
-    // Print processed URLs - only if Redis is available
-    if (is_redis_initialized()) {
-        pthread_mutex_lock(&redis_mutex);
-        redisReply *reply = redisCommand(redis_ctx, "LRANGE processed_urls 0 -1");
-        pthread_mutex_unlock(&redis_mutex);
-        
-        if (reply && reply->type == REDIS_REPLY_ARRAY) {
-            printf("\n=== Processed URLs ===\n");
-            for (size_t i = 0; i < reply->elements; i++) {
-                printf("%zu. %s\n", i + 1, reply->element[i]->str);
-            }
-        } else {
-            printf("\n=== Processed URLs ===\n");
-            printf("No URLs processed yet or Redis not available\n");
-        }
-        if (reply) freeReplyObject(reply);
-    } else {
-        printf("\n=== Processed URLs ===\n");
-        printf("Redis not available - cannot display processed URLs\n");
-    }
-    
-    scraper_stats.last_report_time = now;
-    pthread_mutex_unlock(&stats_mutex);
 } 
\ No newline at end of file
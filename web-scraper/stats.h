@@ -1,34 +1,51 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include <stddef.h>
 #include <time.h>
-#include <pthread.h>
 
-// Performance monitoring structures
+// Performance monitoring
+//
+// Every thread counts into a slot of its own, padded to a cache line, so
+// updates never take a lock or share a line with another thread. Readers
+// add up the slots; a report costs O(threads) and does not touch Redis.
+// Threads beyond STATS_MAX_THREADS share slots, which stay correct
+// because slots are only ever updated atomically.
+
+#define STATS_MAX_THREADS 256    // Threads with a slot of their own
+#define STATS_CACHE_LINE 64
+
+// Snapshots of the counters, summed over all threads
 typedef struct {
     unsigned long urls_processed;
     unsigned long urls_skipped;
     unsigned long urls_disallowed;
     unsigned long bytes_downloaded;
     time_t start_time;
-    time_t last_report_time;
 } ScraperStats;
 
 typedef struct {
     unsigned long redis_ops;
     unsigned long redis_errors;
-    unsigned long redis_latency_ms;
+    unsigned long redis_latency_us;   // Summed over redis_ops
 } RedisStats;
 
-// Global stats
-extern ScraperStats scraper_stats;
-extern RedisStats redis_stats;
-extern pthread_mutex_t stats_mutex;
+typedef struct {
+    unsigned long entries_compressed;
+    unsigned long bytes_raw;          // Size of bodies before compression
+    unsigned long bytes_stored;       // Size actually written to the cache
+    unsigned long compress_cpu_us;    // Thread CPU time spent compressing
+    unsigned long decompress_cpu_us;  // Thread CPU time spent decompressing
+} CompressionStats;
 
 // Function prototypes
 void init_stats(void);
+void stats_snapshot(ScraperStats *scraper, RedisStats *redis, CompressionStats *compression);  // Any may be NULL
+void stats_restore(const ScraperStats *saved, time_t elapsed);  // Add counters of an earlier run
 void update_stats(unsigned long bytes, int skipped, int disallowed);
-void update_redis_stats(int ops, int errors, int latency_ms);
+void update_redis_stats(int ops, int errors, unsigned long latency_us);
+void update_compression_stats(size_t raw_bytes, size_t stored_bytes, unsigned long cpu_us);
+void update_decompression_stats(unsigned long cpu_us);
 void print_stats(void);
 
 #endif // STATS_H 
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "analysis_codec.h"
+#include "column_export.h"
+#include "content_analyzer.h"
+#include "frontier.h"
+#include "logger.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Round-trip and malformed-input checks for the binary codecs
+//
+// Usage: test_codecs
+// Every encoder's output is decoded and compared with the input, then
+// every truncated prefix and a sweep of single-byte corruptions are fed to
+// the decoder, which must reject them (or, for corruptions, at least not
+// read out of bounds; run under -fsanitize=address to check that).
+// Exits non-zero if any check fails.
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+static int same_string(const char *a, const char *b) {
+    return (!a && !b) || (a && b && strcmp(a, b) == 0);
+}
+
+static int same_list(char **a, int a_count, char **b, int b_count) {
+    if (a_count != b_count) {
+        return 0;
+    }
+    for (int i = 0; i < a_count; i++) {
+        if (!same_string(a[i], b[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int same_analysis(const content_analysis_t *a, const content_analysis_t *b) {
+    return same_string(a->title, b->title) && same_string(a->description, b->description) &&
+           same_string(a->keywords, b->keywords) && same_string(a->author, b->author) &&
+           same_string(a->publish_date, b->publish_date) &&
+           same_string(a->main_content, b->main_content) &&
+           same_string(a->language, b->language) && a->sentiment_score == b->sentiment_score &&
+           same_list(a->topics, a->topic_count, b->topics, b->topic_count) &&
+           same_list(a->entities, a->entity_count, b->entities, b->entity_count) &&
+           same_list(a->categories, a->category_count, b->categories, b->category_count);
+}
+
+// Decodes data for check_decoder() and frees the result
+// Returns 1 if data was accepted
+typedef int (*decode_fn)(const unsigned char *data, size_t len);
+
+// Feed a decoder every strict prefix of an encoding, which it must reject,
+// then a sweep of single-byte corruptions, which may decode to something
+// else but must stay in bounds. Each input sits in a buffer of exactly its
+// length so the sanitizer sees any overread.
+static void check_decoder(const char *what, const unsigned char *buf, size_t len,
+                          decode_fn decode) {
+    for (size_t cut = 0; cut < len; cut++) {
+        unsigned char *prefix = malloc(cut ? cut : 1);
+        memcpy(prefix, buf, cut);
+        int accepted = decode(prefix, cut);
+        CHECK(!accepted);
+        if (accepted) {
+            fprintf(stderr, "  %s prefix of %zu/%zu bytes was accepted\n", what, cut, len);
+        }
+        free(prefix);
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        static const unsigned char values[] = {0x00, 0x7f, 0x80, 0xff};
+        for (size_t v = 0; v < sizeof(values); v++) {
+            unsigned char *copy = malloc(len);
+            memcpy(copy, buf, len);
+            copy[i] = values[v];
+            decode(copy, len);
+            free(copy);
+        }
+    }
+}
+
+static int decode_analysis(const unsigned char *data, size_t len) {
+    content_analysis_t *analysis = analysis_decode((const char *)data, len);
+    if (analysis) {
+        free_content_analysis(analysis);
+    }
+    return analysis != NULL;
+}
+
+static int decode_block(const unsigned char *data, size_t len) {
+    frontier_block_t *block = frontier_block_decode(data, len);
+    free(block);
+    return block != NULL;
+}
+
+static int decode_export(const unsigned char *data, size_t len) {
+    export_table_t table;
+    if (export_read(data, len, &table) != 0) {
+        return 0;
+    }
+    export_table_free(&table);
+    return 1;
+}
+
+// Encode, decode and compare one analysis, then feed the decoder broken copies
+static void check_analysis(const content_analysis_t *analysis, time_t timestamp) {
+    char *buf = NULL;
+    size_t len = 0;
+    CHECK(analysis_encode(analysis, timestamp, &buf, &len) == 0);
+    if (!buf) {
+        return;
+    }
+    CHECK(analysis_is_encoded(buf, len));
+
+    content_analysis_t *decoded = analysis_decode(buf, len);
+    CHECK(decoded != NULL);
+    if (decoded) {
+        CHECK(same_analysis(analysis, decoded));
+        free_content_analysis(decoded);
+    }
+
+    analysis_view_t view;
+    CHECK(analysis_view_init(&view, buf, len) == 0);
+    CHECK(view.timestamp == timestamp);
+    analysis_list_iter_t it;
+    analysis_str_t item;
+    int topics = 0;
+    analysis_view_list(&view, ANALYSIS_LIST_TOPICS, &it);
+    while (analysis_list_next(&view, &it, &item)) {
+        CHECK(item.len == strlen(analysis->topics[topics]) &&
+              memcmp(item.ptr, analysis->topics[topics], item.len) == 0);
+        topics++;
+    }
+    CHECK(topics == analysis->topic_count);
+    analysis_view_release(&view);
+
+    // Every strict prefix is missing at least the last list
+    check_decoder("analysis", (const unsigned char *)buf, len, decode_analysis);
+    free(buf);
+}
+
+static void test_analysis_codec(void) {
+    char *topics[] = {"technology", "science", "technology"};
+    char *entities[] = {"science", "Ada Lovelace"};
+    char *categories[] = {"news"};
+    content_analysis_t full = {
+        .title = "Example title",
+        .description = "A page used to check the codec",
+        .keywords = "codec, test",
+        .author = "Someone",
+        .publish_date = "2024-01-02",
+        .main_content = "Body text of the page",
+        .language = "en",
+        .sentiment_score = -0.25f,
+        .topics = topics,
+        .topic_count = 3,
+        .entities = entities,
+        .entity_count = 2,
+        .categories = categories,
+        .category_count = 1
+    };
+    check_analysis(&full, 1700000000);
+
+    content_analysis_t empty = {0};
+    check_analysis(&empty, 0);
+
+    // More table entries than a view holds inline
+    int many = ANALYSIS_VIEW_INLINE_TABLE * 2;
+    char **names = malloc(many * sizeof(char *));
+    for (int i = 0; i < many; i++) {
+        names[i] = malloc(16);
+        snprintf(names[i], 16, "topic-%d", i);
+    }
+    content_analysis_t wide = {.title = "wide", .topics = names, .topic_count = many,
+                               .sentiment_score = 0.5f};
+    check_analysis(&wide, 42);
+    for (int i = 0; i < many; i++) {
+        free(names[i]);
+    }
+    free(names);
+
+    // Wrong magic or version
+    char *buf;
+    size_t len;
+    if (analysis_encode(&full, 1, &buf, &len) == 0) {
+        buf[1] = ANALYSIS_CODEC_VERSION + 1;
+        CHECK(analysis_decode(buf, len) == NULL);
+        buf[0] = 0;
+        CHECK(!analysis_is_encoded(buf, len));
+        free(buf);
+    }
+}
+
+// Order frontier_block_decode() returns members in: priority, then bytewise
+typedef struct {
+    const char *member;
+    long long score;
+} test_member_t;
+
+static int compare_members(const void *a, const void *b) {
+    const test_member_t *ma = a, *mb = b;
+    if (ma->score != mb->score) {
+        return ma->score < mb->score ? -1 : 1;
+    }
+    return strcmp(ma->member, mb->member);
+}
+
+// Encode, decode and compare one block, then feed the decoder broken copies
+static void check_block(test_member_t *members, int count) {
+    const char **names = malloc((count ? count : 1) * sizeof(char *));
+    size_t *lens = malloc((count ? count : 1) * sizeof(size_t));
+    long long *scores = malloc((count ? count : 1) * sizeof(long long));
+    for (int i = 0; i < count; i++) {
+        names[i] = members[i].member;
+        lens[i] = strlen(members[i].member);
+        scores[i] = members[i].score;
+    }
+    unsigned char *buf = NULL;
+    size_t len = 0;
+    CHECK(frontier_block_encode(names, lens, scores, count, &buf, &len) == 0);
+    free(names);
+    free(lens);
+    free(scores);
+    if (!buf) {
+        return;
+    }
+
+    qsort(members, count, sizeof(test_member_t), compare_members);
+    frontier_block_t *block = frontier_block_decode(buf, len);
+    CHECK(block != NULL);
+    if (block) {
+        CHECK(block->count == count);
+        for (int i = 0; i < block->count && i < count; i++) {
+            CHECK(block->lens[i] == strlen(members[i].member) &&
+                  strcmp(block->members[i], members[i].member) == 0);
+            CHECK(block->scores[i] == members[i].score);
+        }
+        free(block);
+    }
+
+    // Every strict prefix is missing at least the last member's score
+    check_decoder("block", buf, len, decode_block);
+    free(buf);
+}
+
+static void test_frontier_block(void) {
+    // Shared prefixes, equal priorities, negative and extreme priorities
+    test_member_t members[] = {
+        {"/articles/2024/01/first", 10},
+        {"/articles/2024/01/second", 10},
+        {"/articles/2024/02/first", 10},
+        {"/articles", 10},
+        {":/plain-http/page", -3},
+        {"https://other.example.com:8443/x", 0},
+        {"/", -9223372036854775807LL - 1},
+        {"/last", 9223372036854775807LL},
+        {"", 5}
+    };
+    check_block(members, sizeof(members) / sizeof(members[0]));
+    test_member_t none[1];
+    check_block(none, 0);
+
+    // A full block of members that differ only at the end
+    int count = FRONTIER_BLOCK_SIZE;
+    test_member_t *many = malloc(count * sizeof(test_member_t));
+    char (*text)[48] = malloc(count * sizeof(*text));
+    for (int i = 0; i < count; i++) {
+        snprintf(text[i], sizeof(text[i]), "/catalog/items/page-%d", count - i);
+        many[i].member = text[i];
+        many[i].score = i % 4;
+    }
+    check_block(many, count);
+    free(many);
+    free(text);
+
+    // Wrong magic or version, and a count larger than the block
+    unsigned char bad[] = {FRONTIER_BLOCK_MAGIC, FRONTIER_BLOCK_VERSION + 1, 0};
+    CHECK(frontier_block_decode(bad, sizeof(bad)) == NULL);
+    bad[0] = 0;
+    bad[1] = FRONTIER_BLOCK_VERSION;
+    CHECK(frontier_block_decode(bad, sizeof(bad)) == NULL);
+    unsigned char huge[] = {FRONTIER_BLOCK_MAGIC, FRONTIER_BLOCK_VERSION,
+                            0xff, 0xff, 0xff, 0xff, 0x0f};
+    CHECK(frontier_block_decode(huge, sizeof(huge)) == NULL);
+}
+
+// Check one list column against the analyses, using its count column
+static void check_list_column(export_table_t *t, const char *name, const char *count_name,
+                              const export_page_t *pages, int page_count, int which) {
+    export_column_t *items = export_find_column(t, name);
+    export_column_t *counts = export_find_column(t, count_name);
+    CHECK(items && counts && counts->count == (size_t)page_count);
+    if (!items || !counts || counts->count != (size_t)page_count) {
+        return;
+    }
+    size_t next = 0;
+    for (int row = 0; row < page_count; row++) {
+        const content_analysis_t *a = pages[row].analysis;
+        char **list = !a ? NULL : which == 0 ? a->topics : which == 1 ? a->entities : a->categories;
+        int n = !a ? 0 : which == 0 ? a->topic_count : which == 1 ? a->entity_count :
+                a->category_count;
+        CHECK(counts->values[row].i == n);
+        for (int i = 0; i < n && next < items->count; i++, next++) {
+            CHECK(same_string(items->values[next].str, list[i]));
+        }
+    }
+    CHECK(next == items->count);
+}
+
+// Read the only .wsc file in dir; returns its contents or NULL
+static unsigned char *read_export_file(const char *dir, size_t *len) {
+    DIR *d = opendir(dir);
+    char path[1100] = "";
+    int files = 0;
+    struct dirent *entry;
+    while (d && (entry = readdir(d)) != NULL) {
+        size_t n = strlen(entry->d_name);
+        if (n > 4 && strcmp(entry->d_name + n - 4, ".wsc") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            files++;
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    CHECK(files == 1);
+    FILE *fp = files == 1 ? fopen(path, "rb") : NULL;
+    if (!fp) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = malloc(size > 0 ? size : 1);
+    if (data && fread(data, 1, size, fp) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    *len = size;
+    return data;
+}
+
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *entry;
+        char path[1100];
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+static void test_column_export(void) {
+    char dir[] = "/tmp/test_codecs.XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+
+    // Repeated content types, topics and statuses take the dictionary and
+    // run-length encodings; unique URLs and times stay plain
+    char *topics[] = {"technology", "science"};
+    char *entities[] = {"Ada Lovelace"};
+    char *categories[] = {"news", "science"};
+    content_analysis_t analysis = {
+        .title = "Example title",
+        .description = "A page used to check the export",
+        .language = "en",
+        .sentiment_score = -0.75f,
+        .topics = topics,
+        .topic_count = 2,
+        .entities = entities,
+        .entity_count = 1,
+        .categories = categories,
+        .category_count = 2
+    };
+    content_analysis_t bare = {.title = "", .sentiment_score = 1.0f};
+
+    enum { PAGES = 40 };
+    export_page_t pages[PAGES];
+    char urls[PAGES][64];
+    for (int i = 0; i < PAGES; i++) {
+        snprintf(urls[i], sizeof(urls[i]), "https://example.com/page/%d", i);
+        pages[i] = (export_page_t){
+            .url = urls[i],
+            .crawl_time = 1700000000 + i * 7,
+            .status_code = i < 30 ? 200 : 404,
+            .content_size = (size_t)i * 1000,
+            .content_type = i % 5 == 4 ? NULL : "text/html",
+            .analysis = i % 3 == 0 ? NULL : i % 3 == 1 ? &analysis : &bare
+        };
+    }
+
+    export_set_dir(dir);
+    CHECK(export_start() == 0);
+    for (int i = 0; i < PAGES; i++) {
+        CHECK(export_add_page(&pages[i]) == 0);
+    }
+    export_stop();
+    export_set_dir(NULL);
+
+    size_t len = 0;
+    unsigned char *data = read_export_file(dir, &len);
+    remove_dir(dir);
+    if (!data) {
+        return;
+    }
+
+    export_table_t table;
+    CHECK(export_read(data, len, &table) == 0);
+    CHECK(table.rows == PAGES);
+    export_column_t *url = export_find_column(&table, "url");
+    export_column_t *crawl_time = export_find_column(&table, "crawl_time");
+    export_column_t *status = export_find_column(&table, "status_code");
+    export_column_t *size = export_find_column(&table, "content_size");
+    export_column_t *type = export_find_column(&table, "content_type");
+    export_column_t *title = export_find_column(&table, "title");
+    export_column_t *sentiment = export_find_column(&table, "sentiment");
+    CHECK(url && crawl_time && status && size && type && title && sentiment);
+    if (url && crawl_time && status && size && type && title && sentiment &&
+        table.rows == PAGES) {
+        CHECK(url->encoding == EXPORT_PLAIN_STRING && crawl_time->encoding == EXPORT_PLAIN_INT);
+        CHECK(status->encoding == EXPORT_RLE_INT && type->encoding == EXPORT_DICT_STRING);
+        for (int i = 0; i < PAGES; i++) {
+            const content_analysis_t *a = pages[i].analysis;
+            CHECK(same_string(url->values[i].str, pages[i].url));
+            CHECK(crawl_time->values[i].i == pages[i].crawl_time);
+            CHECK(status->values[i].i == pages[i].status_code);
+            CHECK(size->values[i].i == (int64_t)pages[i].content_size);
+            CHECK(same_string(type->values[i].str, pages[i].content_type));
+            CHECK(same_string(title->values[i].str, a ? a->title : NULL));
+            CHECK(sentiment->values[i].f == (a ? a->sentiment_score : 0.0f));
+        }
+        check_list_column(&table, "topics", "topic_count", pages, PAGES, 0);
+        check_list_column(&table, "entities", "entity_count", pages, PAGES, 1);
+        check_list_column(&table, "categories", "category_count", pages, PAGES, 2);
+    }
+    export_table_free(&table);
+
+    // A truncated file must never read as a complete one
+    check_decoder("export", data, len, decode_export);
+    free(data);
+}
+
+int main(void) {
+    logger_init("/dev/null");
+    test_analysis_codec();
+    test_frontier_block();
+    test_column_export();
+    logger_close();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -158,4 +158,18 @@ int thread_pool_get_queue_size(thread_pool_t *pool) {
     pthread_mutex_unlock(&pool->queue_mutex);
     
     return size;
-} 
\ No newline at end of file
+}
+
+// Visit every task still waiting in the queue
+void thread_pool_for_each_queued(thread_pool_t *pool,
+                                 void (*visit)(void *(*function)(void *), void *arg, void *ctx),
+                                 void *ctx) {
+    if (!pool || !visit) return;
+
+    pthread_mutex_lock(&pool->queue_mutex);
+    for (int i = 0; i < pool->queue_count; i++) {
+        task_t *task = &pool->queue[(pool->queue_front + i) % pool->queue_size];
+        visit(task->function, task->arg, ctx);
+    }
+    pthread_mutex_unlock(&pool->queue_mutex);
+}
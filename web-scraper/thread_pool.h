@@ -41,4 +41,10 @@ void thread_pool_wait(thread_pool_t *pool);
 // Get current number of tasks in queue
 int thread_pool_get_queue_size(thread_pool_t *pool);
 
+// Call visit for every task still waiting in the queue, oldest first.
+// The queue is locked meanwhile, so visit must not add tasks.
+void thread_pool_for_each_queued(thread_pool_t *pool,
+                                 void (*visit)(void *(*function)(void *), void *arg, void *ctx),
+                                 void *ctx);
+
 #endif // THREAD_POOL_H 
\ No newline at end of file
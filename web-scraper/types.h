@@ -1,9 +1,12 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include "url_intern.h"
+
 // URL processing task data
 typedef struct {
-    char *url;
+    url_id_t url_id;   // Id in the URL dictionary, or URL_ID_NONE if not interned
+    const char *url;   // Dictionary string of url_id, or a copy allocated with the task
     int priority;
     int depth;  // Crawling depth
     char *parent_url;  // URL that led to this one
@@ -49,6 +52,8 @@ typedef struct {
     int analyze_content;
     int track_trends;
     int force_rescrape;  // Force re-scraping of already visited URLs
+    int skip_near_duplicates;  // Skip caching/analysis of near-duplicate pages
+    int deprioritize_duplicate_links;  // Queue outlinks of near-duplicates last
     char *user_agent;
     int request_timeout;
     int retry_count;
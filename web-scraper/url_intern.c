@@ -0,0 +1,335 @@
+#include "url_intern.h"
+#include "content_hash.h"
+#include "logger.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TABLE_MIN 4096
+
+// A table slot; fingerprint 0 marks a free slot
+typedef struct {
+    uint64_t fingerprint;
+    url_id_t id;
+} intern_slot_t;
+
+static char *intern_file = NULL;
+static FILE *intern_fp = NULL;
+static int opened = 0;
+
+static intern_slot_t *table = NULL;
+static size_t table_size = 0;
+static const char **strings = NULL;   // By id
+static size_t strings_capacity = 0;
+static uint64_t url_count = 0;
+
+static char **chunks = NULL;
+static size_t chunk_count = 0;
+static size_t chunks_capacity = 0;
+static size_t chunk_used = URL_INTERN_CHUNK_SIZE;   // Of the last chunk
+
+static url_intern_stats_t stats;
+
+// Readers look URLs up in parallel; adding one takes the write lock
+static pthread_rwlock_t intern_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Persist the dictionary to path
+void url_intern_set_file(const char *path) {
+    pthread_rwlock_wrlock(&intern_lock);
+    free(intern_file);
+    intern_file = path ? strdup(path) : NULL;
+    pthread_rwlock_unlock(&intern_lock);
+}
+
+// Dictionary file, or NULL if it is not persisted
+const char *url_intern_get_file(void) {
+    return intern_file;
+}
+
+static uint64_t fingerprint_of(const char *url, size_t len) {
+    uint64_t fp = content_hash64(url, len, 0);
+    return fp ? fp : 1;
+}
+
+// Find a URL's slot; returns the free slot it would go in if it is absent
+static intern_slot_t *find_slot(const char *url, size_t len, uint64_t fp) {
+    size_t mask = table_size - 1;
+    for (size_t i = fp & mask;; i = (i + 1) & mask) {
+        intern_slot_t *slot = &table[i];
+        if (!slot->fingerprint) {
+            return slot;
+        }
+        if (slot->fingerprint == fp && strncmp(strings[slot->id], url, len) == 0 &&
+            strings[slot->id][len] == '\0') {
+            return slot;
+        }
+    }
+}
+
+// Keep the table at most half full; the caller holds the write lock
+static int reserve_table(uint64_t count) {
+    if (count * 2 < table_size) {
+        return 0;
+    }
+    size_t size = table_size ? table_size * 2 : TABLE_MIN;
+    while (count * 2 >= size) {
+        size *= 2;
+    }
+    intern_slot_t *grown = calloc(size, sizeof(intern_slot_t));
+    if (!grown) {
+        return -1;
+    }
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].fingerprint) {
+            size_t j = table[i].fingerprint & (size - 1);
+            while (grown[j].fingerprint) {
+                j = (j + 1) & (size - 1);
+            }
+            grown[j] = table[i];
+        }
+    }
+    free(table);
+    table = grown;
+    table_size = size;
+    return 0;
+}
+
+// Copy a string into the chunks; copies never move
+static char *store_string(const char *url, size_t len) {
+    size_t need = len + 1;
+    if (chunk_used + need > URL_INTERN_CHUNK_SIZE) {
+        if (chunk_count == chunks_capacity) {
+            size_t capacity = chunks_capacity ? chunks_capacity * 2 : 16;
+            char **grown = realloc(chunks, capacity * sizeof(char *));
+            if (!grown) {
+                return NULL;
+            }
+            chunks = grown;
+            chunks_capacity = capacity;
+        }
+        // An oversized URL gets a chunk of its own, full right away
+        char *chunk = malloc(need > URL_INTERN_CHUNK_SIZE ? need : URL_INTERN_CHUNK_SIZE);
+        if (!chunk) {
+            return NULL;
+        }
+        chunks[chunk_count++] = chunk;
+        chunk_used = 0;
+    }
+    char *copy = chunks[chunk_count - 1] + chunk_used;
+    memcpy(copy, url, len);
+    copy[len] = '\0';
+    chunk_used += need;
+    stats.string_bytes += need;
+    return copy;
+}
+
+// Add a URL known to be absent; the caller holds the write lock
+static url_id_t add_url(const char *url, size_t len, uint64_t fp) {
+    if (reserve_table(url_count + 1) != 0) {
+        return URL_ID_NONE;
+    }
+    if (url_count == strings_capacity) {
+        size_t capacity = strings_capacity ? strings_capacity * 2 : TABLE_MIN;
+        const char **grown = realloc(strings, capacity * sizeof(char *));
+        if (!grown) {
+            return URL_ID_NONE;
+        }
+        strings = grown;
+        strings_capacity = capacity;
+    }
+    char *copy = store_string(url, len);
+    if (!copy) {
+        return URL_ID_NONE;
+    }
+    url_id_t id = url_count++;
+    strings[id] = copy;
+    intern_slot_t *slot = find_slot(url, len, fp);
+    slot->fingerprint = fp;
+    slot->id = id;
+    stats.urls = url_count;
+    stats.table_bytes = table_size * sizeof(intern_slot_t) + strings_capacity * sizeof(char *);
+    return id;
+}
+
+// Read one dictionary record into buf, growing it as needed
+// Returns the URL length, or -1 at the end of the file
+static long read_record(FILE *fp, char **buf, size_t *size) {
+    unsigned char len_bytes[4];
+    if (fread(len_bytes, 1, 4, fp) != 4) {
+        return -1;
+    }
+    size_t len = len_bytes[0] | len_bytes[1] << 8 | len_bytes[2] << 16 |
+                 (size_t)len_bytes[3] << 24;
+    if (len + 1 > *size) {
+        char *grown = realloc(*buf, len + 1);
+        if (!grown) {
+            return -1;
+        }
+        *buf = grown;
+        *size = len + 1;
+    }
+    return fread(*buf, 1, len, fp) == len ? (long)len : -1;
+}
+
+// Load the dictionary file, dropping a torn last record
+static long load_file(void) {
+    FILE *fp = fopen(intern_file, "rb");
+    if (!fp) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    char *buf = NULL;
+    size_t size = 0;
+    long len, good = 0, loaded = 0;
+    while ((len = read_record(fp, &buf, &size)) >= 0) {
+        if (add_url(buf, len, fingerprint_of(buf, len)) == URL_ID_NONE) {
+            loaded = -1;
+            break;
+        }
+        good = ftell(fp);
+        loaded++;
+    }
+    int torn = loaded >= 0 && (!feof(fp) || ftell(fp) != good);
+    free(buf);
+    fclose(fp);
+    if (torn && truncate(intern_file, good) != 0) {
+        return -1;
+    }
+    return loaded;
+}
+
+// Load the dictionary file, if any
+long url_intern_open(void) {
+    pthread_rwlock_wrlock(&intern_lock);
+    if (opened) {
+        pthread_rwlock_unlock(&intern_lock);
+        return (long)url_count;
+    }
+    long loaded = 0;
+    if (intern_file) {
+        loaded = load_file();
+        intern_fp = loaded >= 0 ? fopen(intern_file, "ab") : NULL;
+        if (!intern_fp) {
+            LOG_ERROR("Failed to open URL dictionary %s: %s", intern_file, strerror(errno));
+            pthread_rwlock_unlock(&intern_lock);
+            return -1;
+        }
+    }
+    opened = 1;
+    pthread_rwlock_unlock(&intern_lock);
+    if (loaded > 0) {
+        LOG_INFO("Loaded %ld URL ids from %s", loaded, intern_file);
+    }
+    return loaded;
+}
+
+// Id of a URL, adding it if it is new
+url_id_t url_intern(const char *url) {
+    if (!url) {
+        return URL_ID_NONE;
+    }
+    size_t len = strlen(url);
+    uint64_t fp = fingerprint_of(url, len);
+    __atomic_add_fetch(&stats.lookups, 1, __ATOMIC_RELAXED);
+
+    pthread_rwlock_rdlock(&intern_lock);
+    intern_slot_t *slot = table_size ? find_slot(url, len, fp) : NULL;
+    url_id_t id = slot && slot->fingerprint ? slot->id : URL_ID_NONE;
+    pthread_rwlock_unlock(&intern_lock);
+    if (id != URL_ID_NONE) {
+        return id;
+    }
+
+    // Another thread may have added it between the two locks
+    pthread_rwlock_wrlock(&intern_lock);
+    slot = table_size ? find_slot(url, len, fp) : NULL;
+    if (slot && slot->fingerprint) {
+        id = slot->id;
+    } else {
+        id = add_url(url, len, fp);
+        if (id != URL_ID_NONE && intern_fp) {
+            unsigned char len_bytes[4] = {len & 0xFF, (len >> 8) & 0xFF, (len >> 16) & 0xFF,
+                                          (len >> 24) & 0xFF};
+            if (fwrite(len_bytes, 1, 4, intern_fp) != 4 ||
+                fwrite(url, 1, len, intern_fp) != len) {
+                LOG_WARNING("Failed to persist URL id %llu", (unsigned long long)id);
+            }
+        }
+        if (id != URL_ID_NONE) {
+            stats.added++;
+        }
+    }
+    pthread_rwlock_unlock(&intern_lock);
+    return id;
+}
+
+// Id of a URL without adding it
+url_id_t url_intern_find(const char *url) {
+    if (!url) {
+        return URL_ID_NONE;
+    }
+    size_t len = strlen(url);
+    pthread_rwlock_rdlock(&intern_lock);
+    intern_slot_t *slot = table_size ? find_slot(url, len, fingerprint_of(url, len)) : NULL;
+    url_id_t id = slot && slot->fingerprint ? slot->id : URL_ID_NONE;
+    pthread_rwlock_unlock(&intern_lock);
+    return id;
+}
+
+// String of an id
+const char *url_lookup(url_id_t id) {
+    pthread_rwlock_rdlock(&intern_lock);
+    const char *url = id < url_count ? strings[id] : NULL;
+    pthread_rwlock_unlock(&intern_lock);
+    return url;
+}
+
+// Number of ids handed out
+uint64_t url_intern_count(void) {
+    pthread_rwlock_rdlock(&intern_lock);
+    uint64_t count = url_count;
+    pthread_rwlock_unlock(&intern_lock);
+    return count;
+}
+
+// Flush URLs added so far to the dictionary file
+int url_intern_sync(void) {
+    pthread_rwlock_wrlock(&intern_lock);
+    int ok = !intern_fp || fflush(intern_fp) == 0;
+    pthread_rwlock_unlock(&intern_lock);
+    return ok ? 0 : -1;
+}
+
+// Counters since startup
+void url_intern_get_stats(url_intern_stats_t *out) {
+    pthread_rwlock_rdlock(&intern_lock);
+    *out = stats;
+    out->lookups = __atomic_load_n(&stats.lookups, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&intern_lock);
+}
+
+// Close the file and free every string
+void url_intern_cleanup(void) {
+    pthread_rwlock_wrlock(&intern_lock);
+    if (intern_fp) {
+        fclose(intern_fp);
+        intern_fp = NULL;
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+        free(chunks[i]);
+    }
+    free(chunks);
+    free(table);
+    free(strings);
+    chunks = NULL;
+    table = NULL;
+    strings = NULL;
+    chunk_count = chunks_capacity = table_size = strings_capacity = 0;
+    chunk_used = URL_INTERN_CHUNK_SIZE;
+    url_count = 0;
+    opened = 0;
+    memset(&stats, 0, sizeof(stats));
+    pthread_rwlock_unlock(&intern_lock);
+}
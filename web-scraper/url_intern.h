@@ -0,0 +1,73 @@
+#ifndef URL_INTERN_H
+#define URL_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// URL dictionary
+//
+// Numbers every URL the crawler works with densely, from 0 in first-seen
+// order, and keeps one copy of its string. The link graph carries ids,
+// and so do tasks while the link graph or a dictionary file is in use;
+// otherwise nothing needs ids and tasks keep their own copy, because the
+// dictionary never forgets a URL. A URL's string never moves or goes
+// away while the dictionary is open.
+//
+// Lookups by string go through an open-addressing table of 64-bit
+// fingerprints; strings are packed into large chunks. With a file set,
+// new URLs are appended to it (4-byte little-endian length, then the
+// URL) and the dictionary is reloaded from it on the next start, so ids
+// stay the same across runs. Ids are local to this process: Redis keeps
+// URLs, host-relative members and fingerprints, which any crawler can
+// read.
+
+typedef uint64_t url_id_t;
+
+#define URL_ID_NONE UINT64_MAX
+#define URL_INTERN_CHUNK_SIZE (1024 * 1024)   // Bytes of strings per chunk
+
+// Dictionary counters
+typedef struct {
+    uint64_t urls;
+    uint64_t string_bytes;   // Bytes of URL strings held, including terminators
+    uint64_t table_bytes;    // Bytes of lookup table and id index
+    uint64_t lookups;        // url_intern() calls
+    uint64_t added;          // ... that added a new URL
+} url_intern_stats_t;
+
+// Persist the dictionary to path; NULL keeps it in memory only
+void url_intern_set_file(const char *path);
+
+// Dictionary file, or NULL if it is not persisted
+const char *url_intern_get_file(void);
+
+// Load the dictionary file, if any; does nothing when already open
+// Returns the number of URLs loaded, or -1 on failure
+long url_intern_open(void);
+
+// Id of a URL, adding it if it is new
+// Returns URL_ID_NONE on failure
+url_id_t url_intern(const char *url);
+
+// Id of a URL without adding it
+// Returns URL_ID_NONE if the URL has no id
+url_id_t url_intern_find(const char *url);
+
+// String of an id, valid until url_intern_cleanup()
+// Returns NULL for an unknown id
+const char *url_lookup(url_id_t id);
+
+// Number of ids handed out
+uint64_t url_intern_count(void);
+
+// Flush URLs added so far to the dictionary file
+// Returns 0 on success, -1 on failure
+int url_intern_sync(void);
+
+// Counters since startup
+void url_intern_get_stats(url_intern_stats_t *out);
+
+// Close the file and free every string
+void url_intern_cleanup(void);
+
+#endif // URL_INTERN_H
@@ -1,7 +1,10 @@
 #include "url_processor.h"
 #include "redis_helper.h"
+#include "async_redis.h"
+#include "redis_scripts.h"
 #include "robots_parser.h"
 #include "cache.h"
+#include "warc_writer.h"
 #include "logger.h"
 #include "stats.h"
 #include "thread_pool.h"
@@ -9,6 +12,15 @@
 #include "scraper.h"
 #include "rate_limiter.h"
 #include "content_analyzer.h"
+#include "extract_canonical.h"
+#include "extract_hrefs.h"
+#include "simhash.h"
+#include "content_hash.h"
+#include "data_store.h"
+#include "column_export.h"
+#include "result_sink.h"
+#include "link_graph.h"
+#include "shard_router.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -24,8 +36,186 @@
 extern thread_pool_t *scraper_pool;  // Defined in scraper.c
 rate_limiter_t *rate_limiter = NULL; // Global rate limiter instance
 
+// Maximum aliases per page: requested URL, redirect hops, effective URL, canonical
+#define MAX_URL_ALIASES (FETCH_MAX_REDIRECTS + 3)
+
+// Tasks currently being processed, so a checkpoint can save them. The
+// table grows with the number of tasks in flight; slots are indexes, so
+// they stay valid when it moves
+#define INFLIGHT_INITIAL 256
+
+static url_task_t *inflight = NULL;   // url is NULL in free slots
+static int inflight_capacity = 0;
+static pthread_mutex_t inflight_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Record a task as in flight; the slot shares an interned URL and copies
+// any other, since the task is freed before its slot
+// Returns its slot, or -1 if it could not be recorded
+static int inflight_add(const url_task_t *task) {
+    char *copy = NULL;
+    if (task->url_id == URL_ID_NONE && !(copy = strdup(task->url))) {
+        return -1;
+    }
+    pthread_mutex_lock(&inflight_mutex);
+    int slot = 0;
+    while (slot < inflight_capacity && inflight[slot].url) {
+        slot++;
+    }
+    if (slot == inflight_capacity) {
+        int capacity = inflight_capacity ? inflight_capacity * 2 : INFLIGHT_INITIAL;
+        url_task_t *grown = realloc(inflight, capacity * sizeof(url_task_t));
+        if (!grown) {
+            pthread_mutex_unlock(&inflight_mutex);
+            free(copy);
+            LOG_WARNING("Cannot track %s as in flight; a checkpoint will miss it", task->url);
+            return -1;
+        }
+        memset(grown + inflight_capacity, 0,
+               (capacity - inflight_capacity) * sizeof(url_task_t));
+        inflight = grown;
+        inflight_capacity = capacity;
+    }
+    inflight[slot] = *task;
+    inflight[slot].url = copy ? copy : task->url;
+    inflight[slot].parent_url = NULL;
+    pthread_mutex_unlock(&inflight_mutex);
+    return slot;
+}
+
+static void inflight_remove(int slot) {
+    if (slot < 0) {
+        return;
+    }
+    pthread_mutex_lock(&inflight_mutex);
+    if (inflight[slot].url_id == URL_ID_NONE) {
+        free((char *)inflight[slot].url);
+    }
+    inflight[slot].url = NULL;
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
+// Add a URL to an alias list, skipping NULLs and duplicates
+static void add_url_alias(const char **aliases, int *count, const char *url) {
+    if (!url || *count >= MAX_URL_ALIASES) {
+        return;
+    }
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(aliases[i], url) == 0) {
+            return;
+        }
+    }
+    aliases[(*count)++] = url;
+}
+
+// Whether two URLs are on the same host; a page may only name a canonical
+// URL on its own host, or any site could mark another's pages visited
+static int same_host(const char *a, const char *b) {
+    char host_a[SHARD_TAG_MAX], host_b[SHARD_TAG_MAX];
+    return shard_url_tag(a, host_a, sizeof(host_a)) == 0 &&
+           shard_url_tag(b, host_b, sizeof(host_b)) == 0 && strcmp(host_a, host_b) == 0;
+}
+
+// Check whether any alias other than the requested URL was already crawled
+static int is_known_alias(const char **aliases, int count, const char *url) {
+    redis_future_t *checks[MAX_URL_ALIASES] = {0};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int issued = 0;
+    for (int i = 0; i < count && i < MAX_URL_ALIASES; i++) {
+        if (strcmp(aliases[i], url) != 0) {
+            checks[i] = async_is_visited(aliases[i]);
+            issued += checks[i] != NULL;
+        }
+    }
+    // Resolve every future so none is leaked
+    int known = 0;
+    for (int i = 0; i < count && i < MAX_URL_ALIASES; i++) {
+        if (checks[i] && redis_future_get_bool(checks[i])) {
+            known = 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    update_redis_stats(issued, 0, (end.tv_sec - start.tv_sec) * 1000000L +
+                                  (end.tv_nsec - start.tv_nsec) / 1000);
+    return known;
+}
+
+// Print one list field of a stored analysis
+static void print_analysis_list(const char *name, char **items, int count) {
+    if (count == 0) {
+        return;
+    }
+    printf("  %s: ", name);
+    for (int i = 0; i < count; i++) {
+        printf("%s%s", i ? ", " : "", items[i]);
+    }
+    printf("\n");
+}
+
+// Print the stored analysis of an already visited URL
+static void print_previous_analysis(const content_analysis_t *analysis) {
+    if (analysis->title) printf("  title: %s\n", analysis->title);
+    if (analysis->description) printf("  description: %s\n", analysis->description);
+    if (analysis->keywords) printf("  keywords: %s\n", analysis->keywords);
+    if (analysis->language) printf("  language: %s\n", analysis->language);
+    printf("  sentiment: %.2f\n", analysis->sentiment_score);
+    print_analysis_list("topics", analysis->topics, analysis->topic_count);
+    print_analysis_list("entities", analysis->entities, analysis->entity_count);
+    print_analysis_list("categories", analysis->categories, analysis->category_count);
+}
+
+// Record a crawled page in the result sink, the export and the data store;
+// analysis may be NULL
+static void store_page_row(const char *page_url, const struct Memory *chunk,
+                           const fetch_info_t *fetch_info, double response_time,
+                           const content_analysis_t *analysis) {
+    if (result_sink_is_open()) {
+        result_record_t record;
+        result_record_init(&record, "page", page_url);
+        result_record_add_int(&record, "status_code", fetch_info->status_code);
+        result_record_add(&record, "content_type", fetch_info->content_type);
+        result_record_add_int(&record, "content_size", (long long)chunk->size);
+        result_record_add_double(&record, "response_time", response_time);
+        result_record_add(&record, "title", analysis ? analysis->title : NULL);
+        result_record_add(&record, "language", analysis ? analysis->language : NULL);
+        if (analysis) {
+            result_record_add_double(&record, "sentiment", analysis->sentiment_score);
+        }
+        result_sink_emit(&record);
+    }
+    if (export_get_dir()) {
+        export_page_t page = {
+            .url = page_url,
+            .crawl_time = time(NULL),
+            .status_code = (int)fetch_info->status_code,
+            .content_size = chunk->size,
+            .content_type = fetch_info->content_type,
+            .analysis = analysis
+        };
+        export_add_page(&page);
+    }
+    if (!data_store_is_open()) {
+        return;
+    }
+    page_metadata_t metadata = {
+        .url = (char *)page_url,
+        .title = analysis ? analysis->title : NULL,
+        .description = analysis ? analysis->description : NULL,
+        .keywords = analysis ? analysis->keywords : NULL,
+        .author = analysis ? analysis->author : NULL,
+        .crawl_time = time(NULL),
+        .content_size = chunk->size,
+        .content_type = fetch_info->content_type,
+        .status_code = (int)fetch_info->status_code,
+        .response_time = response_time
+    };
+    if (!store_page_metadata(&metadata)) {
+        LOG_WARNING("Failed to queue page metadata for URL: %s", page_url);
+    }
+}
+
 // Process a single URL
-void *process_url_thread(void *arg) {
+static void *process_task(void *arg) {
     url_task_t *task = (url_task_t *)arg;
     if (!task || !task->url) {
         LOG_ERROR("Invalid task or URL");
@@ -35,49 +225,71 @@ void *process_url_thread(void *arg) {
     redisContext *ctx = get_redis_context();
     if (!ctx) {
         LOG_ERROR("Failed to get Redis context");
-        free(task->url);
         free(task);
         return NULL;
     }
 
     LOG_INFO("Starting to process URL: %s", task->url);
 
-    // Check if URL has been visited
-    if (is_visited(task->url)) {
-        // Get scraper configuration to check force_rescrape flag
-        scraper_config_t *config = get_scraper_config();
-        if (config && config->force_rescrape) {
+    // Get scraper configuration to check force_rescrape flag
+    int force_rescrape = 0;
+    int skip_near_duplicates = 0;
+    int deprioritize_duplicate_links = 0;
+    int max_depth = -1;
+    scraper_config_t *config = get_scraper_config();
+    if (config) {
+        force_rescrape = config->force_rescrape;
+        max_depth = config->max_depth;
+        skip_near_duplicates = config->skip_near_duplicates;
+        deprioritize_duplicate_links = config->deprioritize_duplicate_links;
+        free(config->user_agent);
+        free(config);
+    }
+
+    // Claim the URL; this also tells us whether it has been visited
+    claim_result_t claim = claim_url(task->url);
+    if (claim == CLAIM_BUSY && !force_rescrape) {
+        LOG_INFO("URL is being processed by another worker: %s", task->url);
+        free(task);
+        return NULL;
+    }
+    if (claim == CLAIM_VISITED) {
+        if (force_rescrape) {
             LOG_INFO("Force re-scraping enabled, processing URL despite being visited: %s", task->url);
-            printf("\n\033[1;33m⚠️  INFO: URL '%s' has already been visited, but force re-scraping is enabled.\033[0m\n\n");
-            free(config->user_agent);
-            free(config);
+            printf("\n\033[1;33m⚠️  INFO: URL '%s' has already been visited, but force re-scraping is enabled.\033[0m\n\n", task->url);
         } else {
-            // Get analysis data if available
-            redisReply *reply = redisCommand(ctx, "HGETALL analysis:%s", task->url);
-            if (reply && reply->type == REDIS_REPLY_ARRAY) {
-                printf("\n\033[1;33m⚠️  ALERT: URL '%s' has already been visited!\033[0m\n", task->url);
-                printf("\033[1;36mPrevious Analysis Data:\033[0m\n");
-                for (size_t i = 0; i < reply->elements; i += 2) {
-                    if (i + 1 < reply->elements) {
-                        printf("  %s: %s\n", reply->element[i]->str, reply->element[i+1]->str);
-                    }
+            // Get analysis and cache data if available
+            content_analysis_t *analysis = get_analysis_results(ctx, task->url);
+            pthread_mutex_lock(&redis_mutex);
+            redisReply *reply = redisCommand(ctx, "HGET cache:%s type", task->url);
+            pthread_mutex_unlock(&redis_mutex);
+            const char *cache_type = reply && reply->type == REDIS_REPLY_STRING ? reply->str : NULL;
+
+            if (result_sink_is_open()) {
+                result_record_t record;
+                result_record_init(&record, "visited", task->url);
+                result_record_add(&record, "cache_type", cache_type);
+                result_record_add(&record, "title", analysis ? analysis->title : NULL);
+                result_record_add(&record, "language", analysis ? analysis->language : NULL);
+                if (analysis) {
+                    result_record_add_double(&record, "sentiment", analysis->sentiment_score);
                 }
-                freeReplyObject(reply);
+                result_sink_emit(&record);
             } else {
                 printf("\n\033[1;33m⚠️  ALERT: URL '%s' has already been visited!\033[0m\n", task->url);
-                if (reply) freeReplyObject(reply);
-            }
-            
-            // Get cache data if available
-            reply = redisCommand(ctx, "HGET cache:%s type", task->url);
-            if (reply && reply->type == REDIS_REPLY_STRING) {
-                printf("\033[1;36mCache Type:\033[0m %s\n", reply->str);
-                freeReplyObject(reply);
+                if (analysis) {
+                    printf("\033[1;36mPrevious Analysis Data:\033[0m\n");
+                    print_previous_analysis(analysis);
+                }
+                if (cache_type) {
+                    printf("\033[1;36mCache Type:\033[0m %s\n", cache_type);
+                }
+                printf("\033[1;32m✓ URL processing skipped\033[0m\n\n");
             }
+            free_content_analysis(analysis);
+            freeReplyObject(reply);
             
-            printf("\033[1;32m✓ URL processing skipped\033[0m\n\n");
             LOG_INFO("URL already visited: %s", task->url);
-            free(task->url);
             free(task);
             return NULL;
         }
@@ -87,7 +299,7 @@ void *process_url_thread(void *arg) {
     char *domain = extract_domain(task->url);
     if (!domain) {
         LOG_ERROR("Failed to extract domain from URL: %s", task->url);
-        free(task->url);
+        release_claim(task->url);
         free(task);
         return NULL;
     }
@@ -110,8 +322,8 @@ void *process_url_thread(void *arg) {
     // Check robots.txt
     if (!is_crawl_allowed(base_url, target_path, rate_limiter)) {
         LOG_INFO("URL not allowed by robots.txt: %s", task->url);
+        release_claim(task->url);
         free(domain);
-        free(task->url);
         free(task);
         return NULL;
     }
@@ -120,68 +332,230 @@ void *process_url_thread(void *arg) {
     // Fetch URL content
     LOG_INFO("Fetching content from URL: %s", task->url);
     struct Memory chunk = {0};
-    fetch_url(task->url, &chunk);
+    fetch_info_t fetch_info;
+    struct timespec fetch_start, fetch_end;
+    clock_gettime(CLOCK_MONOTONIC, &fetch_start);
+    fetch_url_tracked(task->url, &chunk, &fetch_info);
+    clock_gettime(CLOCK_MONOTONIC, &fetch_end);
+    double response_time = (fetch_end.tv_sec - fetch_start.tv_sec) +
+                           (fetch_end.tv_nsec - fetch_start.tv_nsec) / 1e9;
     if (!chunk.response) {
         LOG_ERROR("Failed to fetch URL: %s", task->url);
+        release_claim(task->url);
+        free_fetch_info(&fetch_info);
         free(domain);
-        free(task->url);
         free(task);
         return NULL;
     }
     LOG_INFO("Successfully fetched content from URL: %s (size: %zu bytes)", task->url, chunk.size);
 
-    // Store in cache
-    LOG_INFO("Storing content in cache for URL: %s", task->url);
-    if (cache_store_content(ctx, task->url, chunk.response, chunk.size, "text/html", 200) != 0) {
-        LOG_WARNING("Failed to cache content for URL: %s", task->url);
-    } else {
-        LOG_INFO("Successfully cached content for URL: %s", task->url);
+    // Archive the raw exchange; this only queues it for the writer thread
+    if (warc_writer_is_open() && fetch_info.response_headers.size > 0) {
+        warc_exchange_t exchange = {
+            .url = fetch_info.effective_url ? fetch_info.effective_url : task->url,
+            .remote_ip = fetch_info.remote_ip,
+            .content_type = fetch_info.content_type,
+            .status_code = (int)fetch_info.status_code,
+            .request_headers = fetch_info.request_headers.response,
+            .request_headers_len = fetch_info.request_headers.size,
+            .response_headers = fetch_info.response_headers.response,
+            .response_headers_len = fetch_info.response_headers.size,
+            .body = chunk.response,
+            .body_len = chunk.size
+        };
+        if (warc_write_exchange(&exchange) != 0) {
+            LOG_WARNING("Failed to archive URL: %s", task->url);
+        }
     }
 
-    // Analyze content using AI
-    LOG_INFO("Analyzing content from URL: %s", task->url);
-    content_analysis_t *analysis = analyze_content(chunk.response, task->url);
-    if (analysis) {
-        LOG_INFO("Content analysis completed for URL: %s", task->url);
-        
-        // Store analysis results
-        if (store_analysis_results(ctx, task->url, analysis) == 0) {
-            LOG_INFO("Stored analysis results for URL: %s", task->url);
+    // Collect every URL this document is known by
+    const char *page_url = fetch_info.effective_url ? fetch_info.effective_url : task->url;
+    char *canonical = extract_canonical(chunk.response, page_url);
+    if (canonical && !same_host(canonical, page_url)) {
+        LOG_DEBUG("Ignoring canonical URL %s on another host than %s", canonical, page_url);
+        free(canonical);
+        canonical = NULL;
+    }
+    const char *aliases[MAX_URL_ALIASES];
+    int alias_count = 0;
+    add_url_alias(aliases, &alias_count, task->url);
+    for (int i = 0; i < fetch_info.redirect_count; i++) {
+        add_url_alias(aliases, &alias_count, fetch_info.redirects[i]);
+    }
+    add_url_alias(aliases, &alias_count, page_url);
+    add_url_alias(aliases, &alias_count, canonical);
+
+    // Remember redirects so later links are rewritten before they are fetched
+    for (int i = 0; i < fetch_info.redirect_count; i++) {
+        record_redirect(fetch_info.redirects[i], page_url);
+    }
+
+    // Collapse duplicates: the document was already crawled under another alias
+    if (!force_rescrape && is_known_alias(aliases, alias_count, task->url)) {
+        LOG_INFO("URL %s is an alias of an already visited page (effective: %s, canonical: %s)",
+                 task->url, page_url, canonical ? canonical : "none");
+        complete_page(task->url, aliases, alias_count);
+        update_stats(chunk.size, 1, 0);
+        free(canonical);
+        free_fetch_info(&fetch_info);
+        free(chunk.response);
+        free(domain);
+        free(task);
+        return NULL;
+    }
+
+    // Near-duplicate detection on the visible text
+    int near_duplicate = 0;
+    int page_stored = 0;
+    int link_priority = DEFAULT_LINK_PRIORITY;
+    if (skip_near_duplicates) {
+        char *page_text = extract_text_content(chunk.response);
+        uint64_t fingerprint = simhash_compute(page_text);
+        free(page_text);
+
+        if (fingerprint) {
+            char *match_url = NULL;
+            // A forced re-scrape stores and analyzes the page whatever it resembles
+            if (force_rescrape) {
+                simhash_index(ctx, fingerprint, task->url);
+            } else if (simhash_find_or_index(ctx, fingerprint, task->url, &match_url) == 1) {
+                near_duplicate = 1;
+                LOG_INFO("URL %s is a near-duplicate of %s, skipping storage and analysis",
+                         task->url, match_url ? match_url : "an indexed page");
+                if (deprioritize_duplicate_links) {
+                    link_priority = DUPLICATE_LINK_PRIORITY;
+                }
+                free(match_url);
+            }
+        }
+    }
+
+    if (!near_duplicate) {
+        // Store in cache, keyed by the hash of the body
+        uint64_t body_hash = content_hash64(chunk.response, chunk.size, 0);
+        LOG_INFO("Storing content in cache for URL: %s", task->url);
+        if (!cache_store_content_hashed(ctx, task->url, body_hash, chunk.response, chunk.size,
+                                        fetch_info.content_type, (int)fetch_info.status_code)) {
+            LOG_WARNING("Failed to cache content for URL: %s", task->url);
         } else {
-            LOG_WARNING("Failed to store analysis results for URL: %s", task->url);
+            LOG_INFO("Successfully cached content for URL: %s", task->url);
         }
+
+        // Reuse the analysis of identical bytes seen under another URL
+        content_analysis_t *analysis = get_analysis_by_hash(ctx, body_hash);
+        if (analysis) {
+            LOG_INFO("Reusing memoized analysis for URL: %s", task->url);
+        } else {
+            // Analyze content using AI
+            LOG_INFO("Analyzing content from URL: %s", task->url);
+            analysis = analyze_content(chunk.response, task->url);
+            if (analysis) {
+                LOG_INFO("Content analysis completed for URL: %s", task->url);
+                store_analysis_by_hash(ctx, body_hash, analysis);
+            }
+        }
+
+        if (analysis) {
+            store_page_row(page_url, &chunk, &fetch_info, response_time, analysis);
+            page_stored = 1;
+
+            // Store analysis results
+            if (store_analysis_results(ctx, task->url, analysis) == 0) {
+                LOG_INFO("Stored analysis results for URL: %s", task->url);
+            } else {
+                LOG_WARNING("Failed to store analysis results for URL: %s", task->url);
+            }
         
-        // Free analysis results
-        free_content_analysis(analysis);
-    } else {
-        LOG_WARNING("Failed to analyze content for URL: %s", task->url);
+            // Free analysis results
+            free_content_analysis(analysis);
+        } else {
+            LOG_WARNING("Failed to analyze content for URL: %s", task->url);
+        }
+    }
+
+    if (!page_stored) {
+        store_page_row(page_url, &chunk, &fetch_info, response_time, NULL);
     }
 
     // Extract and process content
     LOG_INFO("Extracting content from URL: %s", task->url);
-    extract_title(chunk.response);
-    extract_meta(chunk.response);
-    extract_hrefs(chunk.response, task->url);
+    extract_title(chunk.response, page_url);
+    extract_meta(chunk.response, page_url);
+    extract_hrefs_at_depth(chunk.response, page_url, link_priority, task->depth, max_depth);
 
-    // Mark URL as visited
-    LOG_INFO("Marking URL as visited: %s", task->url);
-    const char *urls[] = {task->url};
-    mark_visited_bulk(urls, 1);
+    // Mark URL and all of its aliases as visited and release the claim
+    LOG_INFO("Marking URL as visited: %s (%d aliases)", task->url, alias_count);
+    complete_page(task->url, aliases, alias_count);
 
     // Update statistics
     LOG_INFO("Updating statistics for URL: %s", task->url);
-    update_stats(chunk.size, 0, 0);
+    update_stats(chunk.size, near_duplicate, 0);
 
     // Cleanup
     LOG_INFO("Cleaning up resources for URL: %s", task->url);
     free(chunk.response);
+    free(canonical);
+    free_fetch_info(&fetch_info);
     free(domain);
     LOG_INFO("Finished processing URL: %s", task->url);
-    free(task->url);
     free(task);
     return NULL;
 }
 
+// Create a task for a URL. The URL is interned when the link graph or a
+// dictionary file needs ids; otherwise it is copied into the task's own
+// allocation, so the dictionary does not grow with every URL crawled
+url_task_t *url_task_create(const char *url, int priority, int depth) {
+    if (!url) {
+        return NULL;
+    }
+    url_task_t *task;
+    if (link_graph_get_dir() || url_intern_get_file()) {
+        url_id_t url_id = url_intern(url);
+        task = url_id != URL_ID_NONE ? malloc(sizeof(url_task_t)) : NULL;
+        if (!task) {
+            return NULL;
+        }
+        task->url_id = url_id;
+        task->url = url_lookup(url_id);
+    } else {
+        size_t len = strlen(url) + 1;
+        task = malloc(sizeof(url_task_t) + len);
+        if (!task) {
+            return NULL;
+        }
+        char *copy = (char *)(task + 1);
+        memcpy(copy, url, len);
+        task->url_id = URL_ID_NONE;
+        task->url = copy;
+    }
+    task->priority = priority;
+    task->depth = depth;
+    task->parent_url = NULL;
+    return task;
+}
+
+// Process a URL in a thread, keeping it in the in-flight set meanwhile
+void *process_url_thread(void *arg) {
+    url_task_t *task = (url_task_t *)arg;
+    int slot = task && task->url ? inflight_add(task) : -1;
+    void *result = process_task(task);
+    inflight_remove(slot);
+    return result;
+}
+
+// Call visit for every task currently being processed
+void url_processor_for_each_inflight(void (*visit)(const url_task_t *task, void *ctx),
+                                     void *ctx) {
+    pthread_mutex_lock(&inflight_mutex);
+    for (int i = 0; i < inflight_capacity; i++) {
+        if (inflight[i].url) {
+            visit(&inflight[i], ctx);
+        }
+    }
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
 // Initialize URL processor components
 int init_url_processor(redisContext *ctx) {
     // Initialize rate limiter
@@ -198,6 +572,13 @@ int init_url_processor(redisContext *ctx) {
         return -1;
     }
     
+    // Start the WARC writer if archiving was requested
+    if (warc_writer_open() != 0) {
+        LOG_ERROR("Failed to start WARC writer");
+        rate_limiter_destroy(rate_limiter);
+        return -1;
+    }
+
     // Initialize content analyzer
     if (init_content_analyzer(ctx) != 0) {
         LOG_ERROR("Failed to initialize content analyzer");
@@ -224,4 +605,17 @@ void cleanup_url_processor(void) {
     
     // Cleanup content analyzer
     cleanup_content_analyzer();
+
+    // Close the local content store, if any
+    cache_cleanup();
+
+    // Write out any queued archive records
+    warc_writer_close();
+
+    // Workers have stopped, so no slot is in use
+    pthread_mutex_lock(&inflight_mutex);
+    free(inflight);
+    inflight = NULL;
+    inflight_capacity = 0;
+    pthread_mutex_unlock(&inflight_mutex);
 } 
\ No newline at end of file
@@ -7,9 +7,18 @@
 // Initialize URL processor
 int init_url_processor(redisContext *ctx);
 
+// Create a task for a URL at the given priority and depth
+// Returns a task to free with free(), or NULL on failure
+url_task_t *url_task_create(const char *url, int priority, int depth);
+
 // Process a URL in a thread
 void *process_url_thread(void *arg);
 
+// Call visit for every task currently being processed. The tasks are
+// copies and are only valid during the call.
+void url_processor_for_each_inflight(void (*visit)(const url_task_t *task, void *ctx),
+                                     void *ctx);
+
 // Cleanup URL processor
 void cleanup_url_processor(void);
 
@@ -0,0 +1,731 @@
+#include "visited_store.h"
+#include "content_hash.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include "write_behind.h"
+#include <hiredis/hiredis.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FP_EXTRA_SEED 0x9E3779B97F4A7C15ULL  // Seed for the extra 32 bits of a 96-bit fingerprint
+#define SCAN_BATCH "1000"
+#define SSCAN_BATCH "500"
+#define FP_ENTRY_OVERHEAD 4      // listpack bytes per field/value pair besides the field itself
+#define FP_BUCKET_OVERHEAD 64    // Approximate cost of one small hash key
+#define LAYOUT_BUCKETS 1024
+#define RESIZE_BATCH 500         // Fields copied per pipeline while resizing
+
+static int visited_mode = VISITED_MODE_URLS;
+
+// Bucket bits of hosts sized by visited_migrate(); others use the default
+typedef struct layout_entry {
+    char *tag;
+    int bits;
+    struct layout_entry *next;
+} layout_entry_t;
+
+static layout_entry_t *layout[LAYOUT_BUCKETS];
+
+// Select the representation
+int visited_set_mode(int mode) {
+    if (mode != VISITED_MODE_URLS && mode != VISITED_MODE_FP64 && mode != VISITED_MODE_FP96) {
+        return -1;
+    }
+    visited_mode = mode;
+    return 0;
+}
+
+int visited_get_mode(void) {
+    return visited_mode;
+}
+
+static size_t fingerprint_bytes(void) {
+    return visited_mode / 8;
+}
+
+static layout_entry_t **layout_slot(const char *tag) {
+    return &layout[content_hash64(tag, strlen(tag), 0) % LAYOUT_BUCKETS];
+}
+
+static int bucket_bits(const char *tag) {
+    for (layout_entry_t *entry = *layout_slot(tag); entry; entry = entry->next) {
+        if (strcmp(entry->tag, tag) == 0) {
+            return entry->bits;
+        }
+    }
+    return VISITED_FP_BUCKET_BITS;
+}
+
+static int set_bucket_bits(const char *tag, int bits) {
+    layout_entry_t **slot = layout_slot(tag);
+    for (layout_entry_t *entry = *slot; entry; entry = entry->next) {
+        if (strcmp(entry->tag, tag) == 0) {
+            entry->bits = bits;
+            return 0;
+        }
+    }
+    layout_entry_t *entry = malloc(sizeof(layout_entry_t));
+    if (!entry || !(entry->tag = strdup(tag))) {
+        free(entry);
+        return -1;
+    }
+    entry->bits = bits;
+    entry->next = *slot;
+    *slot = entry;
+    return 0;
+}
+
+// Key suffix of a bucket; hosts on the default layout keep the original
+// two-digit names
+static void bucket_suffix(char *buf, size_t size, int bits, uint64_t bucket) {
+    if (bits == VISITED_FP_BUCKET_BITS) {
+        snprintf(buf, size, ":%02x", (unsigned)bucket);
+    } else {
+        snprintf(buf, size, ":b%d:%x", bits, (unsigned)bucket);
+    }
+}
+
+// Bucket of a fingerprint: its top bits, read big-endian from the field
+static uint64_t fingerprint_bucket(const unsigned char *fp, int bits) {
+    uint64_t hash = 0;
+    for (int i = 0; i < 8; i++) {
+        hash = hash << 8 | fp[i];
+    }
+    return bits > 0 ? hash >> (64 - bits) : 0;
+}
+
+// Read the bucket count of every sized host
+long visited_load_layout(void) {
+    if (visited_mode == VISITED_MODE_URLS) {
+        return 0;
+    }
+    redisContext *ctx = shard_acquire(0);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *reply = redisCommand(ctx, "HGETALL %s", VISITED_LAYOUT_KEY);
+    shard_release(0);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        freeReplyObject(reply);
+        return -1;
+    }
+    long hosts = 0;
+    for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+        int bits = atoi(reply->element[i + 1]->str);
+        if (bits >= 0 && bits <= VISITED_FP_MAX_BUCKET_BITS &&
+            set_bucket_bits(reply->element[i]->str, bits) == 0) {
+            hosts++;
+        }
+    }
+    freeReplyObject(reply);
+    return hosts;
+}
+
+// Fill in where url is recorded
+int visited_ref(const char *url, visited_ref_t *ref) {
+    if (!url) {
+        return -1;
+    }
+    if (visited_mode == VISITED_MODE_URLS) {
+        ref->member = url;
+        ref->member_len = strlen(url);
+        return shard_url_key(ref->key, sizeof(ref->key), VISITED_KEY_PREFIX, url, NULL);
+    }
+
+    // Big-endian, so the bucket bits lead the field
+    size_t len = strlen(url);
+    uint64_t hash = content_hash64(url, len, 0);
+    for (int i = 0; i < 8; i++) {
+        ref->fp[i] = (unsigned char)(hash >> (56 - 8 * i));
+    }
+    if (visited_mode == VISITED_MODE_FP96) {
+        uint32_t extra = (uint32_t)content_hash64(url, len, FP_EXTRA_SEED);
+        for (int i = 0; i < 4; i++) {
+            ref->fp[8 + i] = (unsigned char)(extra >> (24 - 8 * i));
+        }
+    }
+    ref->member = (const char *)ref->fp;
+    ref->member_len = fingerprint_bytes();
+
+    char tag[SHARD_TAG_MAX], suffix[16];
+    if (shard_url_tag(url, tag, sizeof(tag)) != 0) {
+        strcpy(tag, "_");
+    }
+    int bits = bucket_bits(tag);
+    bucket_suffix(suffix, sizeof(suffix), bits, fingerprint_bucket(ref->fp, bits));
+    return shard_tag_key(ref->key, sizeof(ref->key), VISITED_KEY_PREFIX, tag, suffix);
+}
+
+// Command that tests a ref
+const char *visited_check_command(void) {
+    return visited_mode == VISITED_MODE_URLS ? "SISMEMBER" : "HEXISTS";
+}
+
+// Whether url has been recorded
+int visited_contains(const char *url) {
+    visited_ref_t ref;
+    if (visited_ref(url, &ref) != 0) {
+        return -1;
+    }
+
+    int node = shard_for_key(ref.key);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *reply = redisCommand(ctx, "%s %s %b", visited_check_command(), ref.key,
+                                     ref.member, ref.member_len);
+    shard_release(node);
+    if (!reply) {
+        return -1;
+    }
+    int result = reply->type == REDIS_REPLY_INTEGER ? reply->integer == 1 : -1;
+    freeReplyObject(reply);
+    return result;
+}
+
+typedef struct {
+    const visited_ref_t *ref;
+    int index;
+} ref_entry_t;
+
+static int compare_refs(const void *a, const void *b) {
+    const ref_entry_t *ra = a, *rb = b;
+    int cmp = strcmp(ra->ref->key, rb->ref->key);
+    return cmp ? cmp : ra->index - rb->index;
+}
+
+// Record URLs with one command per key
+int visited_mark_urls(const char **urls, int count) {
+    if (!urls || count <= 0) {
+        return 0;
+    }
+
+    // SADD key m... or HSET key f 1 f 1...
+    int per_entry = visited_mode == VISITED_MODE_URLS ? 1 : 2;
+    visited_ref_t *refs = malloc(count * sizeof(visited_ref_t));
+    ref_entry_t *entries = malloc(count * sizeof(ref_entry_t));
+    const char **argv = malloc((count * per_entry + 2) * sizeof(char *));
+    size_t *argvlen = malloc((count * per_entry + 2) * sizeof(size_t));
+    if (!refs || !entries || !argv || !argvlen) {
+        LOG_ERROR("Failed to allocate memory for visited update");
+        free(refs);
+        free(entries);
+        free(argv);
+        free(argvlen);
+        return -1;
+    }
+
+    int valid = 0;
+    for (int i = 0; i < count; i++) {
+        if (visited_ref(urls[i], &refs[valid]) == 0) {
+            entries[valid].ref = &refs[valid];
+            entries[valid].index = valid;
+            valid++;
+        }
+    }
+    qsort(entries, valid, sizeof(ref_entry_t), compare_refs);
+
+    int result = valid == count ? 0 : -1;
+    for (int start = 0; start < valid;) {
+        const char *key = entries[start].ref->key;
+        int argc = 2;
+        argv[0] = visited_mode == VISITED_MODE_URLS ? "SADD" : "HSET";
+        argvlen[0] = 4;
+        argv[1] = key;
+        argvlen[1] = strlen(key);
+
+        int end = start;
+        for (; end < valid && strcmp(entries[end].ref->key, key) == 0; end++) {
+            argv[argc] = entries[end].ref->member;
+            argvlen[argc++] = entries[end].ref->member_len;
+            if (per_entry == 2) {
+                argv[argc] = "1";
+                argvlen[argc++] = 1;
+            }
+        }
+        if (write_behind_command_argv_at(shard_for_key(key), argc, argv, argvlen) != 0) {
+            result = -1;
+        }
+        start = end;
+    }
+
+    free(refs);
+    free(entries);
+    free(argv);
+    free(argvlen);
+    return result;
+}
+
+// Copy one URL set into the current representation, then delete it
+static long migrate_set(int node, const char *key) {
+    long migrated = 0;
+    char cursor[32] = "0";
+    do {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            return -1;
+        }
+        redisReply *reply = redisCommand(ctx, "SSCAN %s %s COUNT %s", key, cursor, SSCAN_BATCH);
+        shard_release(node);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            LOG_ERROR("SSCAN failed on %s", key);
+            freeReplyObject(reply);
+            return -1;
+        }
+
+        redisReply *members = reply->element[1];
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        if (members->elements > 0) {
+            const char **urls = malloc(members->elements * sizeof(char *));
+            if (!urls) {
+                freeReplyObject(reply);
+                return -1;
+            }
+            for (size_t i = 0; i < members->elements; i++) {
+                urls[i] = members->element[i]->str;
+            }
+            int marked = visited_mark_urls(urls, (int)members->elements);
+            free(urls);
+            if (marked != 0) {
+                freeReplyObject(reply);
+                return -1;
+            }
+            migrated += members->elements;
+        }
+        freeReplyObject(reply);
+    } while (strcmp(cursor, "0") != 0);
+
+    // Only drop the source once every copy has been acknowledged
+    write_behind_flush();
+    redisContext *ctx = shard_acquire(node);
+    if (ctx) {
+        redisReply *reply = redisCommand(ctx, "DEL %s", key);
+        shard_release(node);
+        freeReplyObject(reply);
+    }
+    LOG_INFO("Migrated %ld URLs from %s", migrated, key);
+    return migrated;
+}
+
+// Whether a key is a per-host URL set, visited:{host}
+static int is_host_set_key(const char *key) {
+    size_t len = strlen(key);
+    size_t prefix_len = strlen(VISITED_KEY_PREFIX);
+    return len > prefix_len + 2 && strncmp(key, VISITED_KEY_PREFIX, prefix_len) == 0 &&
+           key[prefix_len] == '{' && key[len - 1] == '}';
+}
+
+// Collect the keys of a node matching a pattern
+static redisReply **scan_keys(int node, const char *pattern, size_t *batch_count) {
+    redisReply **batches = NULL;
+    size_t count = 0, cap = 0;
+    char cursor[32] = "0";
+    do {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            break;
+        }
+        redisReply *reply = redisCommand(ctx, "SCAN %s MATCH %s COUNT %s", cursor, pattern,
+                                         SCAN_BATCH);
+        shard_release(node);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            freeReplyObject(reply);
+            break;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            redisReply **grown = realloc(batches, cap * sizeof(redisReply *));
+            if (!grown) {
+                freeReplyObject(reply);
+                break;
+            }
+            batches = grown;
+        }
+        batches[count++] = reply;
+    } while (strcmp(cursor, "0") != 0);
+    *batch_count = count;
+    return batches;
+}
+
+static void free_batches(redisReply **batches, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        freeReplyObject(batches[i]);
+    }
+    free(batches);
+}
+
+// One fingerprint bucket found by a key scan
+typedef struct {
+    char tag[SHARD_TAG_MAX];
+    const char *key;
+    int layout;   // Bucket bits the key's name belongs to, -1 if unknown
+} bucket_key_t;
+
+// Split visited:{host}<suffix> into its host and the layout it belongs to
+static int parse_bucket_key(const char *key, bucket_key_t *bucket) {
+    size_t prefix_len = strlen(VISITED_KEY_PREFIX);
+    const char *open = key + prefix_len, *close = strchr(key, '}');
+    if (strncmp(key, VISITED_KEY_PREFIX, prefix_len) != 0 || *open != '{' || !close ||
+        (size_t)(close - open - 1) >= sizeof(bucket->tag) || close[1] != ':') {
+        return -1;
+    }
+    memcpy(bucket->tag, open + 1, close - open - 1);
+    bucket->tag[close - open - 1] = '\0';
+    bucket->key = key;
+    int bits;
+    char end;
+    if (sscanf(close + 1, ":b%d:%*x%c", &bits, &end) == 1) {
+        bucket->layout = bits;
+    } else {
+        bucket->layout = strlen(close + 1) == 3 ? VISITED_FP_BUCKET_BITS : -1;
+    }
+    return 0;
+}
+
+static int compare_bucket_keys(const void *a, const void *b) {
+    const bucket_key_t *ka = a, *kb = b;
+    int cmp = strcmp(ka->tag, kb->tag);
+    return cmp ? cmp : strcmp(ka->key, kb->key);
+}
+
+// Copy one bucket's fields into the buckets of another layout
+static int copy_bucket(int node, const char *tag, const char *key, int bits) {
+    char cursor[32] = "0";
+    do {
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            return -1;
+        }
+        redisReply *reply = redisCommand(ctx, "HSCAN %s %s COUNT %d", key, cursor,
+                                         RESIZE_BATCH);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            shard_release(node);
+            LOG_ERROR("HSCAN failed on %s", key);
+            freeReplyObject(reply);
+            return -1;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        redisReply *fields = reply->element[1];
+        size_t sent = 0;
+        for (size_t i = 0; i + 1 < fields->elements; i += 2) {
+            redisReply *field = fields->element[i];
+            char target[VISITED_KEY_MAX], suffix[16];
+            if (field->len < 8) {
+                continue;
+            }
+            bucket_suffix(suffix, sizeof(suffix), bits,
+                          fingerprint_bucket((const unsigned char *)field->str, bits));
+            if (shard_tag_key(target, sizeof(target), VISITED_KEY_PREFIX, tag, suffix) == 0) {
+                redisAppendCommand(ctx, "HSET %s %b 1", target, field->str, field->len);
+                sent++;
+            }
+        }
+        int ok = 1;
+        for (size_t i = 0; i < sent; i++) {
+            redisReply *written = NULL;
+            ok = ok && redisGetReply(ctx, (void **)&written) == REDIS_OK &&
+                 written->type == REDIS_REPLY_INTEGER;
+            freeReplyObject(written);
+        }
+        shard_release(node);
+        freeReplyObject(reply);
+        if (!ok) {
+            LOG_ERROR("Failed to copy fingerprints out of %s", key);
+            return -1;
+        }
+    } while (strcmp(cursor, "0") != 0);
+    return 0;
+}
+
+static void delete_key(int node, const char *key) {
+    redisContext *ctx = shard_acquire(node);
+    if (ctx) {
+        redisReply *reply = redisCommand(ctx, "DEL %s", key);
+        shard_release(node);
+        freeReplyObject(reply);
+    }
+}
+
+// Resize one host's buckets to its cardinality. Keys of other layouts are
+// leftovers of an interrupted resize and are dropped once the layout is
+// settled; the layout only changes after every fingerprint is copied
+// Returns 1 if resized, 0 if already sized, -1 on failure
+static int resize_host(int node, const bucket_key_t *buckets, size_t count) {
+    const char *tag = buckets[0].tag;
+    int bits = bucket_bits(tag);
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    size_t counted = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (buckets[i].layout == bits) {
+            redisAppendCommand(ctx, "HLEN %s", buckets[i].key);
+            counted++;
+        }
+    }
+    long long entries = 0;
+    int ok = 1;
+    for (size_t i = 0; i < counted; i++) {
+        redisReply *len = NULL;
+        ok = ok && redisGetReply(ctx, (void **)&len) == REDIS_OK &&
+             len->type == REDIS_REPLY_INTEGER;
+        entries += ok ? len->integer : 0;
+        freeReplyObject(len);
+    }
+    shard_release(node);
+    if (!ok) {
+        return -1;
+    }
+
+    int target = 0;
+    while (target < VISITED_FP_MAX_BUCKET_BITS &&
+           entries > (long long)VISITED_FP_BUCKET_FILL << target) {
+        target++;
+    }
+    if (target != bits) {
+        for (size_t i = 0; i < count; i++) {
+            if (buckets[i].layout == bits && copy_bucket(node, tag, buckets[i].key, target) != 0) {
+                return -1;
+            }
+        }
+        ctx = shard_acquire(0);
+        redisReply *reply = ctx ? redisCommand(ctx, "HSET %s %s %d", VISITED_LAYOUT_KEY, tag,
+                                               target) : NULL;
+        if (ctx) {
+            shard_release(0);
+        }
+        ok = reply && reply->type == REDIS_REPLY_INTEGER;
+        freeReplyObject(reply);
+        if (!ok || set_bucket_bits(tag, target) != 0) {
+            LOG_ERROR("Failed to record the visited layout of %s", tag);
+            return -1;
+        }
+        LOG_INFO("Resized visited buckets of %s from %d to %d (%lld URLs)", tag, 1 << bits,
+                 1 << target, entries);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (buckets[i].layout != target) {
+            delete_key(node, buckets[i].key);
+        }
+    }
+    return target != bits;
+}
+
+// Size every host's fingerprint buckets from its cardinality
+static long resize_buckets(void) {
+    long resized = 0;
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s{*}:*", VISITED_KEY_PREFIX);
+    for (int node = 0; node < shard_count(); node++) {
+        size_t batch_count = 0, key_count = 0, parsed = 0;
+        redisReply **batches = scan_keys(node, pattern, &batch_count);
+        for (size_t b = 0; b < batch_count; b++) {
+            key_count += batches[b]->element[1]->elements;
+        }
+        bucket_key_t *buckets = malloc((key_count ? key_count : 1) * sizeof(bucket_key_t));
+        if (!buckets) {
+            free_batches(batches, batch_count);
+            return -1;
+        }
+        for (size_t b = 0; b < batch_count; b++) {
+            redisReply *keys = batches[b]->element[1];
+            for (size_t i = 0; i < keys->elements; i++) {
+                parsed += parse_bucket_key(keys->element[i]->str, &buckets[parsed]) == 0;
+            }
+        }
+        qsort(buckets, parsed, sizeof(bucket_key_t), compare_bucket_keys);
+
+        int failed = 0;
+        for (size_t start = 0; start < parsed && !failed;) {
+            size_t end = start;
+            while (end < parsed && strcmp(buckets[end].tag, buckets[start].tag) == 0) {
+                end++;
+            }
+            int result = resize_host(node, buckets + start, end - start);
+            failed = result < 0;
+            resized += result > 0;
+            start = end;
+        }
+        free(buckets);
+        free_batches(batches, batch_count);
+        if (failed) {
+            return -1;
+        }
+    }
+    if (resized > 0) {
+        LOG_INFO("Resized the visited buckets of %ld hosts", resized);
+    }
+    return resized;
+}
+
+// Convert visited_urls and per-host URL sets into the current mode
+long visited_migrate(void) {
+    long total = 0;
+
+    // The single pre-sharding set always lives on the primary
+    redisContext *ctx = shard_acquire(0);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *exists = redisCommand(ctx, "EXISTS %s", LEGACY_VISITED_SET);
+    shard_release(0);
+    if (exists && exists->type == REDIS_REPLY_INTEGER && exists->integer > 0) {
+        long migrated = migrate_set(0, LEGACY_VISITED_SET);
+        if (migrated < 0) {
+            freeReplyObject(exists);
+            return -1;
+        }
+        total += migrated;
+    }
+    freeReplyObject(exists);
+
+    // Per-host sets are already in place unless fingerprints are enabled
+    if (visited_mode == VISITED_MODE_URLS) {
+        return total;
+    }
+
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s{*}", VISITED_KEY_PREFIX);
+    for (int node = 0; node < shard_count(); node++) {
+        size_t batch_count = 0;
+        redisReply **batches = scan_keys(node, pattern, &batch_count);
+        for (size_t b = 0; b < batch_count; b++) {
+            redisReply *keys = batches[b]->element[1];
+            for (size_t i = 0; i < keys->elements; i++) {
+                if (!is_host_set_key(keys->element[i]->str)) {
+                    continue;
+                }
+                long migrated = migrate_set(node, keys->element[i]->str);
+                if (migrated < 0) {
+                    free_batches(batches, batch_count);
+                    return -1;
+                }
+                total += migrated;
+            }
+        }
+        free_batches(batches, batch_count);
+    }
+    return resize_buckets() < 0 ? -1 : total;
+}
+
+// Add one key's type, size, encoding and memory to the totals
+static void measure_key(redisContext *ctx, const char *key, visited_usage_t *url_sets,
+                        visited_usage_t *fingerprints) {
+    redisAppendCommand(ctx, "TYPE %s", key);
+    redisAppendCommand(ctx, "OBJECT ENCODING %s", key);
+    redisAppendCommand(ctx, "MEMORY USAGE %s", key);
+    redisReply *type = NULL, *encoding = NULL, *memory = NULL;
+    redisGetReply(ctx, (void **)&type);
+    redisGetReply(ctx, (void **)&encoding);
+    redisGetReply(ctx, (void **)&memory);
+
+    visited_usage_t *usage = NULL;
+    const char *count_command = NULL;
+    if (type && type->type == REDIS_REPLY_STATUS) {
+        if (strcmp(type->str, "set") == 0) {
+            usage = url_sets;
+            count_command = "SCARD";
+        } else if (strcmp(type->str, "hash") == 0) {
+            usage = fingerprints;
+            count_command = "HLEN";
+        }
+    }
+    if (usage) {
+        redisReply *count = redisCommand(ctx, "%s %s", count_command, key);
+        usage->keys++;
+        if (count && count->type == REDIS_REPLY_INTEGER) {
+            usage->entries += count->integer;
+        }
+        if (memory && memory->type == REDIS_REPLY_INTEGER) {
+            usage->bytes += memory->integer;
+        }
+        if (encoding && encoding->type == REDIS_REPLY_STRING &&
+            (strcmp(encoding->str, "listpack") == 0 || strcmp(encoding->str, "ziplist") == 0 ||
+             strcmp(encoding->str, "intset") == 0)) {
+            usage->compact_keys++;
+        }
+        freeReplyObject(count);
+    }
+    freeReplyObject(type);
+    freeReplyObject(encoding);
+    freeReplyObject(memory);
+}
+
+// Measure both representations on every node
+int visited_measure(visited_usage_t *url_sets, visited_usage_t *fingerprints) {
+    memset(url_sets, 0, sizeof(*url_sets));
+    memset(fingerprints, 0, sizeof(*fingerprints));
+
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s*", VISITED_KEY_PREFIX);
+    for (int node = 0; node < shard_count(); node++) {
+        size_t batch_count = 0;
+        redisReply **batches = scan_keys(node, pattern, &batch_count);
+        redisContext *ctx = shard_acquire(node);
+        if (!ctx) {
+            free_batches(batches, batch_count);
+            return -1;
+        }
+        if (node == 0) {
+            measure_key(ctx, LEGACY_VISITED_SET, url_sets, fingerprints);
+        }
+        for (size_t b = 0; b < batch_count; b++) {
+            redisReply *keys = batches[b]->element[1];
+            for (size_t i = 0; i < keys->elements; i++) {
+                measure_key(ctx, keys->element[i]->str, url_sets, fingerprints);
+            }
+        }
+        shard_release(node);
+        free_batches(batches, batch_count);
+    }
+    return 0;
+}
+
+static void print_usage_line(const char *name, const visited_usage_t *usage) {
+    printf("%-14s %10lu keys %12lu URLs %14llu bytes", name, usage->keys, usage->entries,
+           usage->bytes);
+    if (usage->entries > 0) {
+        printf("  %6.1f bytes/URL", (double)usage->bytes / usage->entries);
+    }
+    if (usage->keys > 0) {
+        printf("  %lu%% compact", usage->compact_keys * 100 / usage->keys);
+    }
+    printf("\n");
+}
+
+// Print a comparison of the two representations
+void visited_print_report(void) {
+    visited_usage_t url_sets, fingerprints;
+    if (visited_measure(&url_sets, &fingerprints) != 0) {
+        fprintf(stderr, "Failed to measure the visited set\n");
+        return;
+    }
+
+    printf("\n=== Visited Set Memory ===\n");
+    if (visited_mode == VISITED_MODE_URLS) {
+        printf("Mode: URL sets\n");
+    } else {
+        printf("Mode: %d-bit fingerprints, buckets sized per host (%d until sized)\n",
+               visited_mode, 1 << VISITED_FP_BUCKET_BITS);
+    }
+    print_usage_line("URL sets:", &url_sets);
+    print_usage_line("Fingerprints:", &fingerprints);
+
+    // Project what the URL sets would cost as fingerprint buckets
+    if (url_sets.entries > 0) {
+        size_t fp_bytes = visited_mode == VISITED_MODE_URLS ? 8 : fingerprint_bytes();
+        unsigned long long buckets = (unsigned long long)url_sets.keys << VISITED_FP_BUCKET_BITS;
+        if (buckets > url_sets.entries) {
+            buckets = url_sets.entries;
+        }
+        unsigned long long estimate = url_sets.entries * (fp_bytes + FP_ENTRY_OVERHEAD) +
+                                      buckets * FP_BUCKET_OVERHEAD;
+        printf("URL sets as %zu-bit fingerprints: ~%llu bytes (%.1f%% of current)\n",
+               fp_bytes * 8, estimate, url_sets.bytes ? 100.0 * estimate / url_sets.bytes : 0.0);
+    }
+    printf("==========================\n\n");
+}
@@ -0,0 +1,94 @@
+#ifndef VISITED_STORE_H
+#define VISITED_STORE_H
+
+#include "shard_router.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Where a URL is recorded in the visited set
+//
+// By default every host has one set of full URL strings, visited:{host}.
+// In fingerprint mode a URL is reduced to a 64- or 96-bit fingerprint and
+// stored as a field of a small hash, visited:{host}:<bucket>, where the
+// bucket is the top bits of the fingerprint. Hashes that small stay in
+// Redis' compact listpack encoding, which costs a few bytes per entry
+// instead of a full string plus a hash table slot.
+//
+// A host uses 2^VISITED_FP_BUCKET_BITS buckets until visited_migrate()
+// sizes it from its cardinality, so that its buckets average at most
+// VISITED_FP_BUCKET_FILL entries. The chosen bit count is recorded in
+// VISITED_LAYOUT_KEY and the buckets are named visited:{host}:b<bits>:<n>.
+// The layout is read once by visited_load_layout(); resize with the
+// crawler stopped.
+//
+// Fingerprints are per host, so 64 bits keeps the chance of a false
+// "visited" negligible until a single host has billions of URLs; 96 bits
+// is available for the cautious. The mode has to match the stored data:
+// after switching, run visited_migrate() to convert existing sets.
+
+#define VISITED_MODE_URLS 0
+#define VISITED_MODE_FP64 64
+#define VISITED_MODE_FP96 96
+
+#define VISITED_FP_BUCKET_BITS 8     // 256 buckets for hosts not yet sized
+#define VISITED_FP_MAX_BUCKET_BITS 16
+#define VISITED_FP_BUCKET_FILL 64    // Half of Redis' default hash-max-listpack-entries
+#define VISITED_LAYOUT_KEY "visited_layout"  // Hash of host -> bucket bits, on node 0
+#define VISITED_FP_MAX_BYTES 12
+#define VISITED_KEY_MAX (SHARD_TAG_MAX + 32)
+#define LEGACY_VISITED_SET "visited_urls"  // Single set used before sharding
+
+typedef struct {
+    char key[VISITED_KEY_MAX];              // Set or bucket hash
+    unsigned char fp[VISITED_FP_MAX_BYTES]; // Fingerprint in fingerprint mode
+    const char *member;                     // URL or fp
+    size_t member_len;
+} visited_ref_t;
+
+// Memory used by one representation of the visited set
+typedef struct {
+    unsigned long keys;
+    unsigned long entries;
+    unsigned long compact_keys;   // Keys in listpack/intset encoding
+    unsigned long long bytes;     // As reported by MEMORY USAGE
+} visited_usage_t;
+
+// Select the representation; 0 (URL sets), 64 or 96
+// Returns 0 on success, -1 for an unsupported value
+int visited_set_mode(int mode);
+int visited_get_mode(void);
+
+// Fill in where url is recorded; ref->member points into ref or at url,
+// so ref must not be copied
+// Returns 0 on success, -1 if the key does not fit
+int visited_ref(const char *url, visited_ref_t *ref);
+
+// Read the bucket count of every sized host; call before workers start
+// Returns the number of sized hosts, or -1 on failure
+long visited_load_layout(void);
+
+// Command that tests a ref as "<command> key member": SISMEMBER or HEXISTS
+const char *visited_check_command(void);
+
+// Whether url has been recorded
+// Returns 1 if visited, 0 if not, -1 on failure
+int visited_contains(const char *url);
+
+// Record URLs with one command per key, sent by the write-behind flusher
+// Returns 0 on success, -1 on failure
+int visited_mark_urls(const char **urls, int count);
+
+// Convert visited_urls and per-host URL sets into the current mode.
+// Sets are deleted once their members have been written. In fingerprint
+// mode every host's buckets are then resized to its cardinality.
+// Returns the number of URLs migrated, or -1 on failure
+long visited_migrate(void);
+
+// Measure both representations on every node
+// Returns 0 on success, -1 on failure
+int visited_measure(visited_usage_t *url_sets, visited_usage_t *fingerprints);
+
+// Print a comparison of the two representations
+void visited_print_report(void);
+
+#endif // VISITED_STORE_H
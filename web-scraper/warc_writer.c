@@ -0,0 +1,607 @@
+#include "warc_writer.h"
+#include "content_hash.h"
+#include "logger.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define WARC_VERSION "WARC/1.1"
+#define SHA1_DIGEST_LEN 20
+#define SHA1_BASE32_LEN 33  // 32 characters plus terminator
+#define UUID_LEN 48         // "<urn:uuid:xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx>"
+#define MAX_PATH_LENGTH 1024
+#define CDX_HEADER " CDX N b a m s k r M S V g\n"
+
+// Growable byte buffer for building records
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} buffer_t;
+
+// A compressed exchange waiting for the writer thread
+typedef struct warc_job {
+    struct warc_job *next;
+    char *request_gz;       // NULL when no request headers were captured
+    size_t request_len;
+    char *response_gz;
+    size_t response_len;
+    char *cdx_fields;       // CDX line up to (not including) length, offset and file
+} warc_job_t;
+
+typedef struct {
+    uint32_t state[5];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} sha1_ctx_t;
+
+static char *output_dir = NULL;
+static size_t max_file_size = WARC_DEFAULT_MAX_FILE_SIZE;
+
+// Queue between workers and the writer thread
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static warc_job_t *queue_head = NULL;
+static warc_job_t *queue_tail = NULL;
+static size_t queue_bytes = 0;
+static int writer_running = 0;
+static pthread_t writer_thread;
+
+// Owned by the writer thread while it runs
+static FILE *warc_file = NULL;
+static FILE *cdx_file = NULL;
+static char warc_name[MAX_PATH_LENGTH];
+static size_t warc_size = 0;
+static int file_serial = 0;
+
+static uint64_t id_seed = 0;
+static uint64_t id_counter = 0;
+static unsigned long records_written = 0;
+static unsigned long records_dropped = 0;
+
+// SHA-1, used for the block and payload digests that WARC tools expect
+static uint32_t rol32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_transform(sha1_ctx_t *ctx, const unsigned char *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2];
+    uint32_t d = ctx->state[3], e = ctx->state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol32(b, 30);
+        b = a;
+        a = temp;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+}
+
+static void sha1_init(sha1_ctx_t *ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha1_update(sha1_ctx_t *ctx, const void *data, size_t len) {
+    const unsigned char *p = data;
+    ctx->length += len;
+    while (len > 0) {
+        size_t take = 64 - ctx->used;
+        if (take > len) take = len;
+        memcpy(ctx->block + ctx->used, p, take);
+        ctx->used += take;
+        p += take;
+        len -= take;
+        if (ctx->used == 64) {
+            sha1_transform(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha1_final(sha1_ctx_t *ctx, unsigned char digest[SHA1_DIGEST_LEN]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    sha1_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha1_update(ctx, &pad, 1);
+    }
+    unsigned char length_be[8];
+    for (int i = 0; i < 8; i++) {
+        length_be[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha1_update(ctx, length_be, 8);
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+// Digests are written in base32, as in CDX files
+static void base32_encode(const unsigned char digest[SHA1_DIGEST_LEN], char out[SHA1_BASE32_LEN]) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    uint32_t value = 0;
+    int bits = 0, pos = 0;
+    for (int i = 0; i < SHA1_DIGEST_LEN; i++) {
+        value = ((value << 8) | digest[i]) & 0xFFFF;
+        bits += 8;
+        while (bits >= 5) {
+            out[pos++] = alphabet[(value >> (bits - 5)) & 31];
+            bits -= 5;
+        }
+    }
+    out[pos] = '\0';
+}
+
+static void digest_parts(const char *a, size_t a_len, const char *b, size_t b_len,
+                         char out[SHA1_BASE32_LEN]) {
+    sha1_ctx_t ctx;
+    unsigned char digest[SHA1_DIGEST_LEN];
+    sha1_init(&ctx);
+    if (a_len) sha1_update(&ctx, a, a_len);
+    if (b_len) sha1_update(&ctx, b, b_len);
+    sha1_final(&ctx, digest);
+    base32_encode(digest, out);
+}
+
+static int buffer_append(buffer_t *buf, const void *data, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len + 1) cap *= 2;
+        char *grown = realloc(buf->data, cap);
+        if (!grown) {
+            return -1;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    if (len) {
+        memcpy(buf->data + buf->len, data, len);
+    }
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+static int buffer_printf(buffer_t *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static int buffer_printf(buffer_t *buf, const char *fmt, ...) {
+    char line[MAX_PATH_LENGTH * 4];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= sizeof(line)) {
+        return -1;
+    }
+    return buffer_append(buf, line, n);
+}
+
+// Random-looking version 4 record id
+static void make_record_id(char out[UUID_LEN]) {
+    uint64_t n = __atomic_fetch_add(&id_counter, 1, __ATOMIC_RELAXED);
+    uint64_t hi = content_hash64(&n, sizeof(n), id_seed);
+    uint64_t lo = content_hash64(&n, sizeof(n), ~id_seed);
+    hi = (hi & ~0xF000ULL) | 0x4000ULL;
+    lo = (lo & ~(0xC000ULL << 48)) | (0x8000ULL << 48);
+    snprintf(out, UUID_LEN, "<urn:uuid:%08x-%04x-%04x-%04x-%012llx>",
+             (unsigned)(hi >> 32), (unsigned)(hi >> 16) & 0xFFFF, (unsigned)hi & 0xFFFF,
+             (unsigned)(lo >> 48), (unsigned long long)(lo & 0xFFFFFFFFFFFFULL));
+}
+
+// Compress one record as a standalone gzip member
+static char *gzip_member(const buffer_t *record, size_t *out_len) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    size_t bound = deflateBound(&zs, record->len);
+    char *out = malloc(bound);
+    if (!out) {
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef *)record->data;
+    zs.avail_in = record->len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&zs);
+        free(out);
+        return NULL;
+    }
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+
+// Format a record: WARC headers, then the block, then two CRLFs
+static int build_record(buffer_t *record, const char *type, const char *record_id,
+                        const char *date, const char *url, const char *extra_headers,
+                        const char *content_type, const char *block, size_t block_len,
+                        const char *block_tail, size_t tail_len) {
+    char block_digest[SHA1_BASE32_LEN];
+    digest_parts(block, block_len, block_tail, tail_len, block_digest);
+
+    record->len = 0;
+    if (buffer_printf(record, WARC_VERSION "\r\nWARC-Type: %s\r\nWARC-Record-ID: %s\r\n"
+                      "WARC-Date: %s\r\n", type, record_id, date) != 0 ||
+        (url && buffer_printf(record, "WARC-Target-URI: %s\r\n", url) != 0) ||
+        buffer_append(record, extra_headers, strlen(extra_headers)) != 0 ||
+        buffer_printf(record, "WARC-Block-Digest: sha1:%s\r\nContent-Type: %s\r\n"
+                      "Content-Length: %zu\r\n\r\n", block_digest, content_type,
+                      block_len + tail_len) != 0 ||
+        buffer_append(record, block, block_len) != 0 ||
+        buffer_append(record, block_tail, tail_len) != 0 ||
+        buffer_append(record, "\r\n\r\n", 4) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// SURT-style sort key: host labels reversed, "www" dropped, lowercased
+static void make_url_key(const char *url, buffer_t *key) {
+    const char *host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    const char *host_end = host + strcspn(host, "/?#");
+    const char *port = memchr(host, ':', host_end - host);
+    const char *name_end = port ? port : host_end;
+    if (name_end - host > 4 && strncasecmp(host, "www.", 4) == 0) {
+        host += 4;
+    }
+
+    // Emit labels right to left
+    const char *end = name_end;
+    while (end > host) {
+        const char *start = end;
+        while (start > host && start[-1] != '.') start--;
+        for (const char *p = start; p < end; p++) {
+            char c = (char)tolower((unsigned char)*p);
+            buffer_append(key, &c, 1);
+        }
+        end = start > host ? start - 1 : host;
+        if (end > host) buffer_append(key, ",", 1);
+    }
+    buffer_append(key, ")", 1);
+    if (!*host_end) {
+        buffer_append(key, "/", 1);
+    }
+    for (const char *p = host_end; *p && *p != '#'; p++) {
+        char c = isspace((unsigned char)*p) ? '+' : (char)tolower((unsigned char)*p);
+        buffer_append(key, &c, 1);
+    }
+}
+
+// Open the next archive file and its index, starting with a warcinfo record
+static int open_next_file(void) {
+    if (warc_file) fclose(warc_file);
+    if (cdx_file) fclose(cdx_file);
+    warc_file = NULL;
+    cdx_file = NULL;
+
+    time_t now = time(NULL);
+    struct tm tm_now;
+    gmtime_r(&now, &tm_now);
+    char stamp[16];
+    strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", &tm_now);
+
+    snprintf(warc_name, sizeof(warc_name), "%s-%s-%05d.warc.gz", WARC_FILE_PREFIX, stamp, file_serial++);
+    char path[MAX_PATH_LENGTH * 2];
+    snprintf(path, sizeof(path), "%s/%s", output_dir, warc_name);
+    warc_file = fopen(path, "wb");
+    if (!warc_file) {
+        LOG_ERROR("Failed to open WARC file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    setvbuf(warc_file, NULL, _IOFBF, 1 << 20);
+
+    snprintf(path, sizeof(path), "%s/%.*s.cdx", output_dir,
+             (int)(strlen(warc_name) - strlen(".warc.gz")), warc_name);
+    cdx_file = fopen(path, "w");
+    if (!cdx_file) {
+        LOG_ERROR("Failed to open CDX file %s: %s", path, strerror(errno));
+        fclose(warc_file);
+        warc_file = NULL;
+        return -1;
+    }
+    fputs(CDX_HEADER, cdx_file);
+
+    char date[32], record_id[UUID_LEN], extra[MAX_PATH_LENGTH];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &tm_now);
+    make_record_id(record_id);
+    snprintf(extra, sizeof(extra), "WARC-Filename: %s\r\n", warc_name);
+    static const char info[] = "software: web-scraper\r\nformat: WARC File Format 1.1\r\n";
+
+    buffer_t record = {0};
+    size_t gz_len = 0;
+    char *gz = NULL;
+    if (build_record(&record, "warcinfo", record_id, date, NULL, extra, "application/warc-fields",
+                     info, sizeof(info) - 1, NULL, 0) == 0) {
+        gz = gzip_member(&record, &gz_len);
+    }
+    free(record.data);
+    warc_size = 0;
+    if (gz) {
+        warc_size = fwrite(gz, 1, gz_len, warc_file);
+        free(gz);
+    }
+
+    LOG_INFO("Writing WARC archive %s/%s", output_dir, warc_name);
+    return 0;
+}
+
+// Append one exchange to the current file, rotating first if it would not fit
+static void write_job(const warc_job_t *job) {
+    size_t job_size = job->request_len + job->response_len;
+    if (!warc_file || (warc_size > 0 && warc_size + job_size > max_file_size)) {
+        if (open_next_file() != 0) {
+            __atomic_fetch_add(&records_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    if (job->request_gz) {
+        warc_size += fwrite(job->request_gz, 1, job->request_len, warc_file);
+    }
+    size_t offset = warc_size;
+    size_t written = fwrite(job->response_gz, 1, job->response_len, warc_file);
+    warc_size += written;
+    if (written != job->response_len) {
+        LOG_ERROR("Short write to WARC file %s", warc_name);
+        __atomic_fetch_add(&records_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    fprintf(cdx_file, "%s %zu %zu %s\n", job->cdx_fields, job->response_len, offset, warc_name);
+    records_written++;
+}
+
+static void free_job(warc_job_t *job) {
+    free(job->request_gz);
+    free(job->response_gz);
+    free(job->cdx_fields);
+    free(job);
+}
+
+// Drain the queue in batches; flush once per batch
+static void *writer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_mutex);
+    for (;;) {
+        while (!queue_head && writer_running) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        }
+        if (!queue_head && !writer_running) {
+            break;
+        }
+
+        warc_job_t *batch = queue_head;
+        queue_head = queue_tail = NULL;
+        queue_bytes = 0;
+        pthread_mutex_unlock(&queue_mutex);
+
+        while (batch) {
+            warc_job_t *next = batch->next;
+            write_job(batch);
+            free_job(batch);
+            batch = next;
+        }
+        if (warc_file) fflush(warc_file);
+        if (cdx_file) fflush(cdx_file);
+
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+// Write archives into dir
+void warc_set_output_dir(const char *dir) {
+    free(output_dir);
+    output_dir = dir ? strdup(dir) : NULL;
+}
+
+// Directory archives are written to
+const char *warc_get_output_dir(void) {
+    return output_dir;
+}
+
+// Rotate to a new file once the current one reaches max_bytes
+void warc_set_max_file_size(size_t max_bytes) {
+    if (max_bytes > 0) {
+        max_file_size = max_bytes;
+    }
+}
+
+// Start the writer thread if an output directory is set
+int warc_writer_open(void) {
+    if (!output_dir || writer_running) {
+        return 0;
+    }
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create WARC directory %s: %s", output_dir, strerror(errno));
+        return -1;
+    }
+
+    // Seed record ids so separate runs do not collide
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, &id_seed, sizeof(id_seed)) != (ssize_t)sizeof(id_seed)) {
+        id_seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    if (fd >= 0) close(fd);
+
+    writer_running = 1;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        LOG_ERROR("Failed to start WARC writer thread");
+        writer_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Flush pending records, stop the writer thread and close the files
+void warc_writer_close(void) {
+    pthread_mutex_lock(&queue_mutex);
+    int was_running = writer_running;
+    writer_running = 0;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    if (!was_running) {
+        return;
+    }
+    pthread_join(writer_thread, NULL);
+
+    if (warc_file) fclose(warc_file);
+    if (cdx_file) fclose(cdx_file);
+    warc_file = NULL;
+    cdx_file = NULL;
+    LOG_INFO("WARC writer closed: %lu records written, %lu dropped",
+             records_written, records_dropped);
+}
+
+// Whether archiving is active
+int warc_writer_is_open(void) {
+    return writer_running;
+}
+
+// Queue an exchange for archiving without waiting for disk
+int warc_write_exchange(const warc_exchange_t *exchange) {
+    if (!writer_running || !exchange || !exchange->url || !exchange->response_headers) {
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    struct tm tm_now;
+    gmtime_r(&now, &tm_now);
+    char date[32], stamp[16];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &tm_now);
+    strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", &tm_now);
+
+    char response_id[UUID_LEN], request_id[UUID_LEN];
+    make_record_id(response_id);
+    make_record_id(request_id);
+
+    char payload_digest[SHA1_BASE32_LEN];
+    digest_parts(exchange->body, exchange->body_len, NULL, 0, payload_digest);
+
+    warc_job_t *job = calloc(1, sizeof(warc_job_t));
+    if (!job) {
+        return -1;
+    }
+
+    // Records are built and compressed here so the writer thread only does I/O
+    buffer_t record = {0};
+    char extra[MAX_PATH_LENGTH];
+    int ip_len = snprintf(extra, sizeof(extra), "%s%s%s",
+                          exchange->remote_ip ? "WARC-IP-Address: " : "",
+                          exchange->remote_ip ? exchange->remote_ip : "",
+                          exchange->remote_ip ? "\r\n" : "");
+    snprintf(extra + ip_len, sizeof(extra) - ip_len, "WARC-Payload-Digest: sha1:%s\r\n",
+             payload_digest);
+    if (build_record(&record, "response", response_id, date, exchange->url, extra,
+                     "application/http;msgtype=response",
+                     exchange->response_headers, exchange->response_headers_len,
+                     exchange->body, exchange->body_len) == 0) {
+        job->response_gz = gzip_member(&record, &job->response_len);
+    }
+
+    if (job->response_gz && exchange->request_headers && exchange->request_headers_len) {
+        snprintf(extra + ip_len, sizeof(extra) - ip_len, "WARC-Concurrent-To: %s\r\n", response_id);
+        if (build_record(&record, "request", request_id, date, exchange->url, extra,
+                         "application/http;msgtype=request",
+                         exchange->request_headers, exchange->request_headers_len, NULL, 0) == 0) {
+            job->request_gz = gzip_member(&record, &job->request_len);
+        }
+    }
+
+    // CDX: urlkey timestamp original mimetype status digest redirect robotflags
+    record.len = 0;
+    make_url_key(exchange->url, &record);
+    char mime[128] = "-";
+    if (exchange->content_type && *exchange->content_type) {
+        size_t n = strcspn(exchange->content_type, "; ");
+        if (n >= sizeof(mime)) n = sizeof(mime) - 1;
+        for (size_t i = 0; i < n; i++) {
+            mime[i] = (char)tolower((unsigned char)exchange->content_type[i]);
+        }
+        mime[n] = '\0';
+    }
+    buffer_printf(&record, " %s %s %s %d %s - -", stamp, exchange->url, mime,
+                  exchange->status_code, payload_digest);
+    job->cdx_fields = record.data;
+
+    if (!job->response_gz || !job->cdx_fields) {
+        LOG_WARNING("Failed to build WARC records for %s", exchange->url);
+        free_job(job);
+        return -1;
+    }
+
+    size_t job_size = job->request_len + job->response_len;
+    pthread_mutex_lock(&queue_mutex);
+    if (queue_bytes + job_size > WARC_QUEUE_MAX_BYTES) {
+        // Never make a worker wait on disk; drop and report instead
+        __atomic_fetch_add(&records_dropped, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&queue_mutex);
+        LOG_WARNING("WARC queue full, dropping record for %s", exchange->url);
+        free_job(job);
+        return -1;
+    }
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    queue_bytes += job_size;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
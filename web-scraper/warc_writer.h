@@ -0,0 +1,56 @@
+#ifndef WARC_WRITER_H
+#define WARC_WRITER_H
+
+#include <stddef.h>
+
+// WARC/1.1 archive of fetched responses
+//
+// Each fetch is written as a request and a response record, every record
+// compressed as its own gzip member so readers can seek straight to it.
+// Workers format and compress records, then hand them to a writer thread
+// that appends them to the current .warc.gz file in batches. The writer
+// rotates files at a size limit and keeps a CDX index next to each file.
+
+#define WARC_DEFAULT_MAX_FILE_SIZE (1024UL * 1024 * 1024)  // Rotate at 1GB
+#define WARC_QUEUE_MAX_BYTES (64UL * 1024 * 1024)          // Pending records before dropping
+#define WARC_FILE_PREFIX "crawl"
+
+// One HTTP exchange to archive
+typedef struct {
+    const char *url;
+    const char *remote_ip;          // May be NULL
+    const char *content_type;       // May be NULL
+    int status_code;
+    const char *request_headers;    // Raw request header block
+    size_t request_headers_len;
+    const char *response_headers;   // Raw status line and response headers
+    size_t response_headers_len;
+    const char *body;
+    size_t body_len;
+} warc_exchange_t;
+
+// Write archives into dir (NULL disables archiving)
+// Must be called before warc_writer_open()
+void warc_set_output_dir(const char *dir);
+
+// Directory archives are written to, or NULL when archiving is off
+const char *warc_get_output_dir(void);
+
+// Rotate to a new file once the current one reaches max_bytes
+void warc_set_max_file_size(size_t max_bytes);
+
+// Start the writer thread if an output directory is set
+// Returns 0 on success (or when archiving is off), -1 on failure
+int warc_writer_open(void);
+
+// Flush pending records, stop the writer thread and close the files
+void warc_writer_close(void);
+
+// Whether archiving is active
+int warc_writer_is_open(void);
+
+// Queue an exchange for archiving without waiting for disk
+// Returns 0 if queued, -1 if archiving is off or the queue is full
+int warc_write_exchange(const warc_exchange_t *exchange);
+
+#endif // WARC_WRITER_H
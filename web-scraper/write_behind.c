@@ -0,0 +1,528 @@
+#include "write_behind.h"
+#include "logger.h"
+#include "redis_helper.h"
+#include "shard_router.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Commands bound for one node
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int commands;
+} wb_chunk_t;
+
+// Per-thread command buffer, one chunk per node
+typedef struct wb_buffer {
+    pthread_mutex_t lock;
+    wb_chunk_t chunks[SHARD_MAX_NODES];
+    struct wb_buffer *next;
+} wb_buffer_t;
+
+// Batch taken from one buffer by the flusher
+typedef struct {
+    char *data;
+    size_t len;
+    int commands;
+} wb_batch_t;
+
+static __thread wb_buffer_t *thread_buffer = NULL;
+static __thread unsigned long thread_generation = 0;
+static unsigned long generation = 1;  // Bumped on stop so stale thread buffers are not reused
+
+// All buffers ever registered; they live until write_behind_stop()
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static wb_buffer_t *buffers = NULL;
+static int buffer_count = 0;
+
+// Flusher coordination
+static pthread_mutex_t flusher_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flusher_done = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher_thread;
+static int running = 0;
+static unsigned long flush_requested = 0;
+static unsigned long flush_completed = 0;
+
+static redisContext *flusher_ctx[SHARD_MAX_NODES];
+static char *flusher_host = NULL;
+static int flusher_port = 0;
+static int flusher_nodes = 1;
+
+static write_behind_stats_t stats;
+static size_t bytes_pending = 0;
+
+// Execute a formatted command on the node's shared connection
+static int execute_now(int node, const char *cmd, size_t len) {
+    redisContext *ctx = shard_acquire(node);
+    if (!ctx) {
+        return -1;
+    }
+    redisReply *reply = NULL;
+    int ok = redisAppendFormattedCommand(ctx, cmd, len) == REDIS_OK &&
+             redisGetReply(ctx, (void **)&reply) == REDIS_OK && reply &&
+             reply->type != REDIS_REPLY_ERROR;
+    shard_release(node);
+    if (reply && reply->type == REDIS_REPLY_ERROR) {
+        LOG_ERROR("Redis error reply: %s", reply->str);
+    }
+    freeReplyObject(reply);
+    return ok ? 0 : -1;
+}
+
+static wb_buffer_t *get_thread_buffer(void) {
+    if (thread_buffer && thread_generation == __atomic_load_n(&generation, __ATOMIC_ACQUIRE)) {
+        return thread_buffer;
+    }
+    wb_buffer_t *buffer = calloc(1, sizeof(wb_buffer_t));
+    if (!buffer) {
+        return NULL;
+    }
+    pthread_mutex_init(&buffer->lock, NULL);
+
+    pthread_mutex_lock(&registry_mutex);
+    buffer->next = buffers;
+    buffers = buffer;
+    buffer_count++;
+    pthread_mutex_unlock(&registry_mutex);
+
+    thread_buffer = buffer;
+    thread_generation = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    return buffer;
+}
+
+// Append a formatted command to this thread's buffer for the node
+static int enqueue(int node, const char *cmd, size_t len) {
+    if (node < 0 || node >= shard_count()) {
+        node = 0;
+    }
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return execute_now(node, cmd, len);
+    }
+
+    wb_buffer_t *buffer = get_thread_buffer();
+    if (!buffer) {
+        return execute_now(node, cmd, len);
+    }
+
+    // Bounded memory: wait for the flusher rather than growing without limit
+    if (__atomic_load_n(&bytes_pending, __ATOMIC_RELAXED) + len > WRITE_BEHIND_MAX_BYTES) {
+        pthread_mutex_lock(&flusher_mutex);
+        while (running && bytes_pending > 0 && bytes_pending + len > WRITE_BEHIND_MAX_BYTES) {
+            pthread_cond_signal(&flusher_wake);
+            pthread_cond_wait(&flusher_done, &flusher_mutex);
+        }
+        pthread_mutex_unlock(&flusher_mutex);
+    }
+
+    pthread_mutex_lock(&buffer->lock);
+    wb_chunk_t *chunk = &buffer->chunks[node];
+    if (chunk->len + len > chunk->cap) {
+        size_t cap = chunk->cap ? chunk->cap : 4096;
+        while (cap < chunk->len + len) cap *= 2;
+        char *grown = realloc(chunk->data, cap);
+        if (!grown) {
+            pthread_mutex_unlock(&buffer->lock);
+            return execute_now(node, cmd, len);
+        }
+        chunk->data = grown;
+        chunk->cap = cap;
+    }
+    memcpy(chunk->data + chunk->len, cmd, len);
+    chunk->len += len;
+    chunk->commands++;
+    size_t buffered = chunk->len;
+    pthread_mutex_unlock(&buffer->lock);
+
+    __atomic_add_fetch(&bytes_pending, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats.commands_queued, 1, __ATOMIC_RELAXED);
+
+    if (buffered >= WRITE_BEHIND_BATCH_BYTES) {
+        pthread_cond_signal(&flusher_wake);
+    }
+    return 0;
+}
+
+static int queue_formatted(int node, const char *format, va_list args) {
+    char *cmd = NULL;
+    int len = redisvFormatCommand(&cmd, format, args);
+    if (len < 0) {
+        LOG_ERROR("Failed to format Redis command");
+        return -1;
+    }
+    int result = enqueue(node, cmd, len);
+    redisFreeCommand(cmd);
+    return result;
+}
+
+// Queue a command (hiredis format string)
+int write_behind_command(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = queue_formatted(0, format, args);
+    va_end(args);
+    return result;
+}
+
+// Queue a command for a given node
+int write_behind_command_at(int node, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = queue_formatted(node, format, args);
+    va_end(args);
+    return result;
+}
+
+// Queue a command given as an argument vector for a given node
+int write_behind_command_argv_at(int node, int argc, const char **argv,
+                                 const size_t *argvlen) {
+    char *cmd = NULL;
+    long long len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+    if (len < 0) {
+        LOG_ERROR("Failed to format Redis command");
+        return -1;
+    }
+    int result = enqueue(node, cmd, (size_t)len);
+    redisFreeCommand(cmd);
+    return result;
+}
+
+// Queue a command given as an argument vector
+int write_behind_command_argv(int argc, const char **argv, const size_t *argvlen) {
+    return write_behind_command_argv_at(0, argc, argv, argvlen);
+}
+
+static int connect_flusher(int node) {
+    if (flusher_ctx[node]) {
+        redisFree(flusher_ctx[node]);
+    }
+    const char *host = node == 0 ? flusher_host : shard_node_host(node);
+    int port = node == 0 ? flusher_port : shard_node_port(node);
+    struct timeval timeout = {1, 500000};  // 1.5 seconds
+    flusher_ctx[node] = redisConnectWithTimeout(host, port, timeout);
+    if (!flusher_ctx[node] || flusher_ctx[node]->err) {
+        LOG_ERROR("Write-behind connection to %s:%d failed: %s", host, port,
+                  flusher_ctx[node] ? flusher_ctx[node]->errstr : "Unknown error");
+        if (flusher_ctx[node]) {
+            redisFree(flusher_ctx[node]);
+            flusher_ctx[node] = NULL;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Commands that leave the same state when applied twice; only these are
+// resent after a connection failure. A resent DEL could drop a claim
+// another worker has taken since, and a resent ZADD could queue a URL
+// that has been popped already, so neither is listed.
+static const char *IDEMPOTENT_COMMANDS[] = {"SET", "HSET", "HSETNX", "HDEL", "SADD", "EXPIRE"};
+
+// Parse a decimal length terminated by CRLF; returns the position after it
+static const char *parse_length(const char *pos, const char *end, size_t *value) {
+    *value = 0;
+    const char *start = pos;
+    while (pos < end && *pos >= '0' && *pos <= '9') {
+        *value = *value * 10 + (size_t)(*pos++ - '0');
+    }
+    if (pos == start || end - pos < 2 || pos[0] != '\r' || pos[1] != '\n') {
+        return NULL;
+    }
+    return pos + 2;
+}
+
+// Length of the formatted command at data; its name is returned through
+// name and name_len. Returns 0 if the command is malformed.
+static size_t command_length(const char *data, size_t len, const char **name,
+                             size_t *name_len) {
+    const char *pos = data, *end = data + len;
+    size_t argc;
+    if (len == 0 || *pos != '*' || !(pos = parse_length(pos + 1, end, &argc)) || argc == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < argc; i++) {
+        size_t arg_len;
+        if (pos >= end || *pos != '$' || !(pos = parse_length(pos + 1, end, &arg_len)) ||
+            (size_t)(end - pos) < arg_len + 2) {
+            return 0;
+        }
+        if (i == 0) {
+            *name = pos;
+            *name_len = arg_len;
+        }
+        pos += arg_len + 2;
+    }
+    return (size_t)(pos - data);
+}
+
+static int is_idempotent(const char *name, size_t name_len) {
+    for (size_t i = 0; i < sizeof(IDEMPOTENT_COMMANDS) / sizeof(IDEMPOTENT_COMMANDS[0]); i++) {
+        if (strlen(IDEMPOTENT_COMMANDS[i]) == name_len &&
+            strncasecmp(IDEMPOTENT_COMMANDS[i], name, name_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Send one node's batches as one pipeline
+// Returns the number of commands acknowledged before the connection failed,
+// or total_commands if every reply arrived
+static int send_batches(int node, wb_batch_t *batches, int count, int total_commands) {
+    if (!flusher_ctx[node] && connect_flusher(node) != 0) {
+        return 0;
+    }
+    redisContext *ctx = flusher_ctx[node];
+    for (int i = 0; i < count; i++) {
+        if (batches[i].len > 0) {
+            redisAppendFormattedCommand(ctx, batches[i].data, batches[i].len);
+        }
+    }
+
+    for (int i = 0; i < total_commands; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+            LOG_WARNING("Write-behind connection lost: %s", ctx->errstr);
+            redisFree(ctx);
+            flusher_ctx[node] = NULL;
+            return i;
+        }
+        if (reply && reply->type == REDIS_REPLY_ERROR) {
+            LOG_ERROR("Write-behind command failed: %s", reply->str);
+            __atomic_add_fetch(&stats.commands_failed, 1, __ATOMIC_RELAXED);
+        }
+        freeReplyObject(reply);
+    }
+    return total_commands;
+}
+
+// Collect the idempotent commands among those after the first skip ones
+// into retry, which must hold the batches' total length
+// Returns the number of commands that cannot be resent
+static int collect_retry(wb_batch_t *batches, int count, int skip, wb_batch_t *retry) {
+    int dropped = 0, index = 0;
+    for (int b = 0; b < count; b++) {
+        size_t offset = 0;
+        for (int c = 0; c < batches[b].commands; c++, index++) {
+            const char *name = NULL;
+            size_t name_len = 0;
+            size_t len = command_length(batches[b].data + offset, batches[b].len - offset,
+                                        &name, &name_len);
+            if (len == 0) {
+                // Cannot happen for hiredis-formatted commands; give up on the rest
+                return dropped + batches[b].commands - c;
+            }
+            if (index >= skip) {
+                if (is_idempotent(name, name_len)) {
+                    memcpy(retry->data + retry->len, batches[b].data + offset, len);
+                    retry->len += len;
+                    retry->commands++;
+                } else {
+                    dropped++;
+                }
+            }
+            offset += len;
+        }
+    }
+    return dropped;
+}
+
+// Take every buffer's contents and pipeline them, one pipeline per node
+static void drain_buffers(void) {
+    pthread_mutex_lock(&registry_mutex);
+    int count = buffer_count;
+    wb_batch_t *batches = count ? calloc((size_t)count * flusher_nodes, sizeof(wb_batch_t)) : NULL;
+    int taken[SHARD_MAX_NODES] = {0};
+    int total_commands[SHARD_MAX_NODES] = {0};
+    size_t node_bytes[SHARD_MAX_NODES] = {0};
+    size_t total_bytes = 0;
+    for (wb_buffer_t *buffer = buffers; buffer && batches; buffer = buffer->next) {
+        pthread_mutex_lock(&buffer->lock);
+        for (int node = 0; node < flusher_nodes; node++) {
+            wb_chunk_t *chunk = &buffer->chunks[node];
+            if (chunk->commands == 0) {
+                continue;
+            }
+            wb_batch_t *batch = &batches[node * count + taken[node]++];
+            batch->data = chunk->data;
+            batch->len = chunk->len;
+            batch->commands = chunk->commands;
+            total_commands[node] += chunk->commands;
+            node_bytes[node] += chunk->len;
+            total_bytes += chunk->len;
+            memset(chunk, 0, sizeof(*chunk));
+        }
+        pthread_mutex_unlock(&buffer->lock);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    int sent_any = 0;
+    for (int node = 0; node < flusher_nodes; node++) {
+        if (taken[node] == 0) {
+            continue;
+        }
+        wb_batch_t *node_batches = &batches[node * count];
+        int acked = send_batches(node, node_batches, taken[node], total_commands[node]);
+        int lost = total_commands[node] - acked;
+        if (lost > 0) {
+            // Commands after the last reply may or may not have run; resend
+            // the idempotent ones once on a fresh connection and drop the rest
+            wb_batch_t retry = {malloc(node_bytes[node]), 0, 0};
+            lost = retry.data ? collect_retry(node_batches, taken[node], acked, &retry) : lost;
+            if (retry.commands > 0) {
+                lost += retry.commands - send_batches(node, &retry, 1, retry.commands);
+            }
+            free(retry.data);
+        }
+        if (lost > 0) {
+            LOG_ERROR("Write-behind dropped %d Redis commands", lost);
+            __atomic_add_fetch(&stats.commands_failed, lost, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&stats.commands_flushed, total_commands[node] - lost, __ATOMIC_RELAXED);
+        for (int i = 0; i < taken[node]; i++) {
+            free(node_batches[i].data);
+        }
+        sent_any = 1;
+    }
+    if (sent_any) {
+        __atomic_add_fetch(&stats.batches, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&bytes_pending, total_bytes, __ATOMIC_RELAXED);
+    }
+    free(batches);
+}
+
+static void *flusher_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&flusher_mutex);
+    for (;;) {
+        if (running && flush_requested == flush_completed) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WRITE_BEHIND_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&flusher_wake, &flusher_mutex, &deadline);
+        }
+
+        // Everything queued before this point is covered by the drain below
+        unsigned long target = flush_requested;
+        int stopping = !running;
+        pthread_mutex_unlock(&flusher_mutex);
+
+        drain_buffers();
+
+        pthread_mutex_lock(&flusher_mutex);
+        flush_completed = target;
+        pthread_cond_broadcast(&flusher_done);
+        if (stopping) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&flusher_mutex);
+    return NULL;
+}
+
+// Start the flusher thread with its own connection
+int write_behind_start(const char *host, int port) {
+    if (running) {
+        return 0;
+    }
+    free(flusher_host);
+    flusher_host = strdup(host);
+    flusher_port = port;
+    flusher_nodes = shard_count();
+    if (!flusher_host) {
+        return -1;
+    }
+    for (int node = 0; node < flusher_nodes; node++) {
+        if (connect_flusher(node) != 0) {
+            return -1;
+        }
+    }
+
+    running = 1;
+    if (pthread_create(&flusher_thread, NULL, flusher_main, NULL) != 0) {
+        LOG_ERROR("Failed to start write-behind flusher: %s", strerror(errno));
+        running = 0;
+        return -1;
+    }
+    LOG_INFO("Write-behind flusher started");
+    return 0;
+}
+
+// Block until every command queued before the call has been sent
+void write_behind_flush(void) {
+    pthread_mutex_lock(&flusher_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&flusher_mutex);
+        return;
+    }
+    unsigned long target = ++flush_requested;
+    pthread_cond_signal(&flusher_wake);
+    while (running && flush_completed < target) {
+        pthread_cond_wait(&flusher_done, &flusher_mutex);
+    }
+    pthread_mutex_unlock(&flusher_mutex);
+}
+
+// Flush everything and stop the flusher thread
+// Worker threads must be finished before this is called
+void write_behind_stop(void) {
+    pthread_mutex_lock(&flusher_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&flusher_mutex);
+        return;
+    }
+    // The flusher drains once more after seeing running == 0
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&flusher_wake);
+    pthread_cond_broadcast(&flusher_done);
+    pthread_mutex_unlock(&flusher_mutex);
+    pthread_join(flusher_thread, NULL);
+
+    // Threads that raced with the shutdown may have left commands behind
+    drain_buffers();
+
+    pthread_mutex_lock(&registry_mutex);
+    while (buffers) {
+        wb_buffer_t *next = buffers->next;
+        pthread_mutex_destroy(&buffers->lock);
+        for (int node = 0; node < SHARD_MAX_NODES; node++) {
+            free(buffers->chunks[node].data);
+        }
+        free(buffers);
+        buffers = next;
+    }
+    buffer_count = 0;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&registry_mutex);
+
+    for (int node = 0; node < SHARD_MAX_NODES; node++) {
+        if (flusher_ctx[node]) {
+            redisFree(flusher_ctx[node]);
+            flusher_ctx[node] = NULL;
+        }
+    }
+
+    write_behind_stats_t final;
+    write_behind_get_stats(&final);
+    LOG_INFO("Write-behind stopped: %lu commands flushed in %lu batches, %lu failed",
+             final.commands_flushed, final.batches, final.commands_failed);
+}
+
+// Snapshot of the counters
+void write_behind_get_stats(write_behind_stats_t *out) {
+    out->commands_queued = __atomic_load_n(&stats.commands_queued, __ATOMIC_RELAXED);
+    out->commands_flushed = __atomic_load_n(&stats.commands_flushed, __ATOMIC_RELAXED);
+    out->commands_failed = __atomic_load_n(&stats.commands_failed, __ATOMIC_RELAXED);
+    out->batches = __atomic_load_n(&stats.batches, __ATOMIC_RELAXED);
+    out->bytes_pending = __atomic_load_n(&bytes_pending, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,61 @@
+#ifndef WRITE_BEHIND_H
+#define WRITE_BEHIND_H
+
+#include <stddef.h>
+
+// Write-behind buffering for Redis writes whose reply nobody waits for
+//
+// Each worker thread appends already-formatted commands to its own buffer.
+// A flusher thread with its own connection per shard node swaps the
+// buffers out and sends them as one pipeline per node, then reads the
+// replies. Workers only block when more than WRITE_BEHIND_MAX_BYTES are
+// pending. Writes become visible to other readers after the next flush,
+// which is normally a few milliseconds later.
+//
+// When a connection fails, commands without a reply may or may not have
+// run. Only idempotent ones (SET, HSET, HSETNX, HDEL, SADD, EXPIRE) are
+// resent, once, on a fresh connection; the rest are dropped and counted
+// as failed. Writes that must neither be replayed nor silently lost,
+// such as claim releases and queue inserts, are sent synchronously.
+//
+// Until write_behind_start() is called (and after write_behind_stop()),
+// commands are executed synchronously on the shared connection.
+
+#define WRITE_BEHIND_INTERVAL_MS 5                  // Flusher wakeup interval
+#define WRITE_BEHIND_BATCH_BYTES (64 * 1024)        // Wake the flusher early past this
+#define WRITE_BEHIND_MAX_BYTES (16 * 1024 * 1024)   // Pending bytes before workers wait
+
+typedef struct {
+    unsigned long commands_queued;
+    unsigned long commands_flushed;
+    unsigned long commands_failed;   // Error replies and commands lost to connection errors
+    unsigned long batches;
+    size_t bytes_pending;
+} write_behind_stats_t;
+
+// Start the flusher thread with its own connection
+// Returns 0 on success, -1 on failure
+int write_behind_start(const char *host, int port);
+
+// Flush everything and stop the flusher thread
+void write_behind_stop(void);
+
+// Queue a command (hiredis format string)
+// Returns 0 if queued (or executed, when not started), -1 on failure
+int write_behind_command(const char *format, ...);
+
+// Queue a command given as an argument vector; argvlen may be NULL
+int write_behind_command_argv(int argc, const char **argv, const size_t *argvlen);
+
+// Variants for a shard node (see shard_router.h); the plain calls use node 0
+int write_behind_command_at(int node, const char *format, ...);
+int write_behind_command_argv_at(int node, int argc, const char **argv,
+                                 const size_t *argvlen);
+
+// Block until every command queued before the call has been sent and acknowledged
+void write_behind_flush(void);
+
+// Snapshot of the counters
+void write_behind_get_stats(write_behind_stats_t *stats);
+
+#endif // WRITE_BEHIND_H